@@ -627,6 +627,13 @@ case "$TARGET_OS" in
         ;;
 esac
 
+# native AIO goes through raw system calls, libaio is not needed
+case "$TARGET_OS" in
+    linux-*)
+        echo "#define CONFIG_LINUX_AIO    1" >> $config_h
+        ;;
+esac
+
 case "$TARGET_OS" in
     linux-*|darwin-*)
         echo "#define CONFIG_MADVISE  1" >> $config_h
@@ -23,6 +23,8 @@
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/ioctl.h>
+#include <sys/select.h>
+#include <time.h>
 #include "android/camera/camera-capture.h"
 #include "android/camera/camera-format-converters.h"
 
@@ -75,6 +77,8 @@ typedef enum CameraIoType {
     CAMERA_IO_DIRECT
 } CameraIoType;
 
+typedef struct VirtualCamera VirtualCamera;
+
 typedef struct LinuxCameraDevice LinuxCameraDevice;
 /*
  * Describes a connection to an actual camera device.
@@ -104,6 +108,9 @@ struct LinuxCameraDevice {
     struct CameraFrameBuffer*   framebuffers;
     /* Actual number of allocated framebuffers. */
     int                         framebuffer_num;
+    /* Synthetic frame source. When set, this descriptor doesn't represent a
+     * V4L2 device, and 'handle' stays at -1. */
+    VirtualCamera*              virt;
 };
 
 /* Preferred pixel formats arranged from the most to the least desired.
@@ -235,6 +242,600 @@ _free_framebuffers(CameraFrameBuffer* fb, int num, CameraIoType io_type)
     }
 }
 
+/*******************************************************************************
+ *                     Virtual camera
+ ******************************************************************************/
+
+/*
+ * The virtual camera is a synthetic frame source that can be registered along
+ * with the V4L2 devices found on the host. It either renders an animated test
+ * pattern, or plays back a file containing raw frames, at a fixed frame rate
+ * paced by the host's monotonic clock. This makes it possible to measure frame
+ * delivery through the camera service without any camera hardware.
+ *
+ * The virtual camera is only registered when the ANDROID_VIRTUAL_CAMERA
+ * environment variable is set, so that it doesn't change the enumeration of
+ * the host's webcams otherwise. The variable has the following format:
+ *
+ *      on | <width>x<height>[@<fps>][,format=<fmt>][,file=<path>]
+ *
+ * where <fmt> is one of yv12 (default), yu12, nv12, nv21, or yuyv, and <path>
+ * is a file containing back-to-back frames of the given dimensions and format.
+ * "on" renders a 640x480 test pattern at 30 frames per second.
+ */
+
+/* Environment variable that configures the virtual camera. */
+#define VIRTUAL_CAMERA_ENV      "ANDROID_VIRTUAL_CAMERA"
+/* Device name for the virtual camera. */
+#define VIRTUAL_CAMERA_DEVICE   "virtual"
+/* Display name for the virtual camera. */
+#define VIRTUAL_CAMERA_NAME     "webcam-virtual"
+/* Maximum frame rate accepted for the virtual camera. */
+#define VIRTUAL_CAMERA_MAX_FPS  240
+
+/* Configuration of the virtual camera. */
+typedef struct VirtualCameraConfig {
+    /* Frame dimensions. */
+    int         width;
+    int         height;
+    /* Frame rate. */
+    int         fps;
+    /* Pixel format in V4L2_PIX_FMT_XXX form. */
+    uint32_t    pixel_format;
+    /* Raw frames file to play back, or NULL for the test pattern. */
+    char*       file;
+} VirtualCameraConfig;
+
+/* Describes the virtual camera. */
+struct VirtualCamera {
+    /* Configuration the camera has been opened with. */
+    VirtualCameraConfig config;
+
+    /*
+     * Set when capturing is started.
+     */
+
+    /* Dimensions of the delivered frames. */
+    int         width;
+    int         height;
+    /* Size of a frame in bytes. */
+    size_t      frame_size;
+    /* Frame rendered with the test pattern. */
+    uint8_t*    frame;
+    /* Test pattern color bars and luminance ramp: 'width' Y values, followed by
+     * 'width / 2' U, and 'width / 2' V values each. */
+    uint8_t*    bars;
+    uint8_t*    ramp;
+    /* Y, U, and V values for the line that is being rendered. */
+    uint8_t*    line;
+
+    /* Mapped raw frames file. */
+    uint8_t*    file_data;
+    size_t      file_size;
+    int         file_frames;
+
+    /* Frame period, and capture start time in nanoseconds. */
+    int64_t     period_ns;
+    int64_t     start_ns;
+    /* Index of the last delivered frame, or -1 if nothing was delivered. */
+    int64_t     last_index;
+    /* Delivery statistics. */
+    int64_t     delivered;
+    int64_t     skipped;
+};
+
+/* Pixel formats that can be used with the virtual camera. */
+static const struct {
+    const char* name;
+    uint32_t    format;
+} _virtual_camera_formats[] = {
+    { "yv12",   V4L2_PIX_FMT_YVU420 },
+    { "yu12",   V4L2_PIX_FMT_YUV420 },
+    { "i420",   V4L2_PIX_FMT_YUV420 },
+    { "nv12",   V4L2_PIX_FMT_NV12 },
+    { "nv21",   V4L2_PIX_FMT_NV21 },
+    { "yuyv",   V4L2_PIX_FMT_YUYV },
+};
+
+/* Frame dimensions reported for the test pattern in addition to the configured
+ * ones. */
+static const CameraFrameDim _virtual_camera_dims[] = {
+    { 1280, 720 }, { 640, 480 }, { 352, 288 }, { 320, 240 }, { 176, 144 },
+};
+
+/* SMPTE color bars: white, yellow, cyan, green, magenta, red, blue, black. */
+static const uint8_t _color_bars[8][3] = {
+    { 235, 128, 128 }, { 210,  16, 146 }, { 170, 166,  16 }, { 145,  54,  34 },
+    { 106, 202, 222 }, {  81,  90, 240 }, {  41, 240, 110 }, {  16, 128, 128 },
+};
+
+/* Returns monotonic host time in nanoseconds. */
+static int64_t
+_virtual_camera_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* Returns size of a frame in the given pixel format. */
+static size_t
+_virtual_camera_frame_size(uint32_t pixel_format, int width, int height)
+{
+    if (pixel_format == V4L2_PIX_FMT_YUYV) {
+        return (size_t)width * height * 2;
+    }
+    return (size_t)width * height + (size_t)width * height / 2;
+}
+
+/* Parses virtual camera configuration from the environment.
+ * Return:
+ *  0 on success, 1 if the virtual camera is not enabled, or -1 if
+ *  configuration string is invalid.
+ */
+static int
+_virtual_camera_get_config(VirtualCameraConfig* config)
+{
+    const char* env = getenv(VIRTUAL_CAMERA_ENV);
+    const char* comma;
+    const char* p;
+
+    config->width = 640;
+    config->height = 480;
+    config->fps = 30;
+    config->pixel_format = V4L2_PIX_FMT_YVU420;
+    config->file = NULL;
+
+    if (env == NULL || env[0] == '\0') {
+        return 1;
+    }
+    if (!strcmp(env, "on")) {
+        return 0;
+    }
+
+    if (sscanf(env, "%dx%d", &config->width, &config->height) != 2 ||
+        config->width <= 0 || config->height <= 0 ||
+        (config->width & 1) || (config->height & 1)) {
+        W("%s: Invalid frame dimensions in '%s'", VIRTUAL_CAMERA_ENV, env);
+        return -1;
+    }
+    comma = strchr(env, ',');
+    p = strchr(env, '@');
+    if (p != NULL && (comma == NULL || p < comma)) {
+        config->fps = atoi(p + 1);
+        if (config->fps <= 0 || config->fps > VIRTUAL_CAMERA_MAX_FPS) {
+            W("%s: Invalid frame rate in '%s'", VIRTUAL_CAMERA_ENV, env);
+            return -1;
+        }
+    }
+
+    for (p = comma; p != NULL; p = strchr(p, ',')) {
+        p++;
+        if (!strncmp(p, "format=", 7)) {
+            const char* name = p + 7;
+            const int len = strcspn(name, ",");
+            int n;
+            for (n = 0; n < (int)(sizeof(_virtual_camera_formats) /
+                                  sizeof(*_virtual_camera_formats)); n++) {
+                if (strlen(_virtual_camera_formats[n].name) == (size_t)len &&
+                    !strncasecmp(_virtual_camera_formats[n].name, name, len)) {
+                    break;
+                }
+            }
+            if (n == (int)(sizeof(_virtual_camera_formats) /
+                           sizeof(*_virtual_camera_formats))) {
+                W("%s: Unsupported pixel format '%.*s'",
+                  VIRTUAL_CAMERA_ENV, len, name);
+                free(config->file);
+                return -1;
+            }
+            config->pixel_format = _virtual_camera_formats[n].format;
+        } else if (!strncmp(p, "file=", 5)) {
+            /* File name runs to the end of the string, so it may contain
+             * commas. */
+            free(config->file);
+            config->file = ASTRDUP(p + 5);
+            break;
+        } else {
+            W("%s: Unknown parameter '%s'", VIRTUAL_CAMERA_ENV, p);
+            free(config->file);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/* Frees virtual camera descriptor. */
+static void
+_virtual_camera_free(VirtualCamera* vc)
+{
+    if (vc->file_data != NULL) {
+        munmap(vc->file_data, vc->file_size);
+    }
+    free(vc->frame);
+    free(vc->bars);
+    free(vc->config.file);
+    AFREE(vc);
+}
+
+/* Collects information about the virtual camera.
+ * Return:
+ *  0 on success, != 0 if the virtual camera is disabled or misconfigured.
+ */
+static int
+_virtual_camera_get_info(CameraInfo* cis)
+{
+    VirtualCameraConfig config;
+    int n;
+
+    if (_virtual_camera_get_config(&config)) {
+        return -1;
+    }
+
+    /* Raw frames can only be delivered with the dimensions they were recorded
+     * with, while the test pattern can be rendered with any size. */
+    cis->frame_sizes_num = 1;
+    cis->frame_sizes = (CameraFrameDim*)malloc(
+        sizeof(CameraFrameDim) *
+        (1 + sizeof(_virtual_camera_dims) / sizeof(*_virtual_camera_dims)));
+    if (cis->frame_sizes == NULL) {
+        E("%s: Not enough memory for frame sizes", __FUNCTION__);
+        free(config.file);
+        return -1;
+    }
+    cis->frame_sizes[0].width = config.width;
+    cis->frame_sizes[0].height = config.height;
+    if (config.file == NULL) {
+        for (n = 0; n < (int)(sizeof(_virtual_camera_dims) /
+                              sizeof(*_virtual_camera_dims)); n++) {
+            if (_virtual_camera_dims[n].width != config.width ||
+                _virtual_camera_dims[n].height != config.height) {
+                cis->frame_sizes[cis->frame_sizes_num++] =
+                    _virtual_camera_dims[n];
+            }
+        }
+    }
+
+    cis->display_name = ASTRDUP(VIRTUAL_CAMERA_NAME);
+    cis->device_name = ASTRDUP(VIRTUAL_CAMERA_DEVICE);
+    cis->inp_channel = 0;
+    cis->pixel_format = config.pixel_format;
+    cis->in_use = 0;
+    free(config.file);
+
+    return 0;
+}
+
+/* Renders test pattern line into vc->line.
+ * The pattern consists of color bars scrolling to the left on top, a luminance
+ * ramp scrolling to the right on the bottom, and a grey box bouncing over both.
+ */
+static void
+_virtual_camera_render_line(VirtualCamera* vc, int64_t index, int y)
+{
+    const int w = vc->width;
+    const int h = vc->height;
+    const int cw = w / 2;
+    const int box_w = (w / 8) & ~1;
+    const int box_h = (h / 8) & ~1;
+    uint8_t* Y = vc->line;
+    uint8_t* U = Y + w;
+    uint8_t* V = U + cw;
+    const uint8_t* src;
+    int shift;
+
+    if (y < h - h / 4) {
+        src = vc->bars;
+        shift = (int)((index * 4) % w) & ~1;
+    } else {
+        src = vc->ramp;
+        shift = (w - (int)((index * 4) % w)) & ~1;
+        if (shift == w) {
+            shift = 0;
+        }
+    }
+    memcpy(Y, src + shift, w - shift);
+    memcpy(Y + w - shift, src, shift);
+    memcpy(U, src + w + shift / 2, cw - shift / 2);
+    memcpy(U + cw - shift / 2, src + w, shift / 2);
+    memcpy(V, src + w + cw + shift / 2, cw - shift / 2);
+    memcpy(V + cw - shift / 2, src + w + cw, shift / 2);
+
+    if (box_w > 0 && box_h > 0) {
+        const int range = h - box_h;
+        const int t = range > 0 ? (int)((index * 4) % (2 * range)) : 0;
+        const int box_y = (t < range ? t : 2 * range - t) & ~1;
+        const int box_x = (int)((index * 8) % (w - box_w + 1)) & ~1;
+        if (y >= box_y && y < box_y + box_h) {
+            memset(Y + box_x, 128, box_w);
+            memset(U + box_x / 2, 128, box_w / 2);
+            memset(V + box_x / 2, 128, box_w / 2);
+        }
+    }
+}
+
+/* Renders the test pattern frame for the given frame index. */
+static void
+_virtual_camera_render(VirtualCamera* vc, int64_t index)
+{
+    const int w = vc->width;
+    const int h = vc->height;
+    const int cw = w / 2;
+    const uint8_t* Y = vc->line;
+    const uint8_t* U = Y + w;
+    const uint8_t* V = U + cw;
+    uint8_t* frame = vc->frame;
+    int y, x;
+
+    for (y = 0; y < h; y++) {
+        const int chroma_line = !(y & 1);
+        _virtual_camera_render_line(vc, index, y);
+
+        switch (vc->config.pixel_format) {
+            case V4L2_PIX_FMT_YUYV: {
+                uint8_t* dst = frame + (size_t)y * w * 2;
+                for (x = 0; x < cw; x++, dst += 4) {
+                    dst[0] = Y[x * 2];
+                    dst[1] = U[x];
+                    dst[2] = Y[x * 2 + 1];
+                    dst[3] = V[x];
+                }
+                break;
+            }
+
+            case V4L2_PIX_FMT_YVU420:
+            case V4L2_PIX_FMT_YUV420: {
+                uint8_t* chroma = frame + (size_t)w * h;
+                const size_t pane = (size_t)cw * (h / 2);
+                memcpy(frame + (size_t)y * w, Y, w);
+                if (chroma_line) {
+                    const size_t off = (size_t)(y / 2) * cw;
+                    const int yv12 =
+                        vc->config.pixel_format == V4L2_PIX_FMT_YVU420;
+                    memcpy(chroma + (yv12 ? pane : 0) + off, U, cw);
+                    memcpy(chroma + (yv12 ? 0 : pane) + off, V, cw);
+                }
+                break;
+            }
+
+            case V4L2_PIX_FMT_NV12:
+            case V4L2_PIX_FMT_NV21: {
+                memcpy(frame + (size_t)y * w, Y, w);
+                if (chroma_line) {
+                    uint8_t* dst = frame + (size_t)w * h + (size_t)(y / 2) * w;
+                    const uint8_t* first =
+                        vc->config.pixel_format == V4L2_PIX_FMT_NV12 ? U : V;
+                    const uint8_t* second = first == U ? V : U;
+                    for (x = 0; x < cw; x++, dst += 2) {
+                        dst[0] = first[x];
+                        dst[1] = second[x];
+                    }
+                }
+                break;
+            }
+        }
+    }
+}
+
+/* Opens the virtual camera.
+ * Return:
+ *  Virtual camera descriptor on success, or NULL on failure.
+ */
+static VirtualCamera*
+_virtual_camera_open(void)
+{
+    VirtualCamera* vc;
+
+    ANEW0(vc);
+    if (_virtual_camera_get_config(&vc->config)) {
+        AFREE(vc);
+        return NULL;
+    }
+
+    if (vc->config.file != NULL) {
+        struct stat st;
+        const size_t frame_size =
+            _virtual_camera_frame_size(vc->config.pixel_format,
+                                       vc->config.width, vc->config.height);
+        const int fd = open(vc->config.file, O_RDONLY);
+        if (fd < 0) {
+            E("%s: Unable to open '%s': %s",
+              __FUNCTION__, vc->config.file, strerror(errno));
+            _virtual_camera_free(vc);
+            return NULL;
+        }
+        if (fstat(fd, &st) || st.st_size < (off_t)frame_size) {
+            E("%s: File '%s' doesn't contain a %dx%d frame",
+              __FUNCTION__, vc->config.file, vc->config.width,
+              vc->config.height);
+            close(fd);
+            _virtual_camera_free(vc);
+            return NULL;
+        }
+        vc->file_size = st.st_size;
+        vc->file_frames = vc->file_size / frame_size;
+        vc->file_data = mmap(NULL, vc->file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (vc->file_data == MAP_FAILED) {
+            E("%s: Unable to map '%s': %s",
+              __FUNCTION__, vc->config.file, strerror(errno));
+            vc->file_data = NULL;
+            _virtual_camera_free(vc);
+            return NULL;
+        }
+        D("%s: Playing %d frames from '%s'",
+          __FUNCTION__, vc->file_frames, vc->config.file);
+    }
+
+    return vc;
+}
+
+/* Starts capturing frames from the virtual camera. */
+static int
+_virtual_camera_start(VirtualCamera* vc,
+                      uint32_t pixel_format,
+                      int width,
+                      int height)
+{
+    int x;
+
+    if (pixel_format != vc->config.pixel_format) {
+        E("%s: Virtual camera does not support pixel format '%.4s'",
+          __FUNCTION__, (const char*)&pixel_format);
+        return -1;
+    }
+    if ((width & 1) || (height & 1) || width <= 0 || height <= 0 ||
+        (vc->file_data != NULL &&
+         (width != vc->config.width || height != vc->config.height))) {
+        E("%s: Dimensions %dx%d are wrong for the virtual camera",
+          __FUNCTION__, width, height);
+        return -1;
+    }
+
+    vc->width = width;
+    vc->height = height;
+    vc->frame_size = _virtual_camera_frame_size(pixel_format, width, height);
+
+    if (vc->file_data == NULL) {
+        const int cw = width / 2;
+        uint8_t* bars_u;
+        uint8_t* bars_v;
+        uint8_t* ramp_u;
+        uint8_t* ramp_v;
+
+        vc->frame = malloc(vc->frame_size);
+        vc->bars = malloc(width * 2 * 3);
+        if (vc->frame == NULL || vc->bars == NULL) {
+            E("%s: Not enough memory for %dx%d frame",
+              __FUNCTION__, width, height);
+            free(vc->frame);
+            free(vc->bars);
+            vc->frame = vc->bars = NULL;
+            return -1;
+        }
+        vc->ramp = vc->bars + width * 2;
+        vc->line = vc->ramp + width * 2;
+        bars_u = vc->bars + width;
+        bars_v = bars_u + cw;
+        ramp_u = vc->ramp + width;
+        ramp_v = ramp_u + cw;
+        for (x = 0; x < width; x++) {
+            const int bar = x * 8 / width;
+            vc->bars[x] = _color_bars[bar][0];
+            vc->ramp[x] = 16 + x * 219 / width;
+            if (!(x & 1)) {
+                bars_u[x / 2] = _color_bars[bar][1];
+                bars_v[x / 2] = _color_bars[bar][2];
+                ramp_u[x / 2] = 128;
+                ramp_v[x / 2] = 128;
+            }
+        }
+    }
+
+    vc->period_ns = 1000000000LL / vc->config.fps;
+    vc->start_ns = _virtual_camera_now();
+    vc->last_index = -1;
+    vc->delivered = 0;
+    vc->skipped = 0;
+
+    return 0;
+}
+
+/* Stops capturing frames from the virtual camera. */
+static int
+_virtual_camera_stop(VirtualCamera* vc)
+{
+    const int64_t elapsed_ms = (_virtual_camera_now() - vc->start_ns) / 1000000;
+
+    D("%s: Delivered %lld frames in %lld ms (%d fps requested), %lld skipped",
+      __FUNCTION__, (long long)vc->delivered, (long long)elapsed_ms,
+      vc->config.fps, (long long)vc->skipped);
+
+    free(vc->frame);
+    free(vc->bars);
+    vc->frame = vc->bars = vc->ramp = vc->line = NULL;
+    vc->width = vc->height = 0;
+
+    return 0;
+}
+
+/* Reads a frame from the virtual camera.
+ * Frames become available at the configured rate relative to the moment the
+ * capturing has started. Frames that were due while nobody asked for them are
+ * skipped, just like a real device would drop them.
+ * Return:
+ *  0 on success, 1 if the next frame is not yet due, or -1 on failure.
+ */
+static int
+_virtual_camera_read_frame(VirtualCamera* vc,
+                           ClientFrameBuffer* framebuffers,
+                           int fbs_num,
+                           float r_scale,
+                           float g_scale,
+                           float b_scale,
+                           float exp_comp)
+{
+    const int64_t index = (_virtual_camera_now() - vc->start_ns) / vc->period_ns;
+    const uint8_t* frame;
+
+    if (vc->width == 0) {
+        E("%s: Virtual camera is not started", __FUNCTION__);
+        return -1;
+    }
+    if (index == vc->last_index) {
+        errno = EAGAIN;
+        return 1;
+    }
+    if (vc->last_index >= 0) {
+        vc->skipped += index - vc->last_index - 1;
+    }
+    vc->last_index = index;
+    vc->delivered++;
+
+    if (vc->file_data != NULL) {
+        frame = vc->file_data + (size_t)(index % vc->file_frames) * vc->frame_size;
+    } else {
+        _virtual_camera_render(vc, index);
+        frame = vc->frame;
+    }
+
+    return convert_frame(frame, vc->config.pixel_format, vc->frame_size,
+                         vc->width, vc->height, framebuffers, fbs_num,
+                         r_scale, g_scale, b_scale, exp_comp);
+}
+
+/* Waits until the next frame of the virtual camera is due.
+ * Return:
+ *  1 if the next frame is due, 0 if the timeout has expired, or -1 on failure.
+ */
+static int
+_virtual_camera_wait_frame(VirtualCamera* vc, int timeout_ms)
+{
+    struct timespec ts;
+    int64_t wait_ns;
+
+    if (vc->width == 0) {
+        E("%s: Virtual camera is not started", __FUNCTION__);
+        errno = EINVAL;
+        return -1;
+    }
+
+    wait_ns = vc->start_ns + (vc->last_index + 1) * vc->period_ns -
+              _virtual_camera_now();
+    if (wait_ns <= 0) {
+        return 1;
+    }
+    if (wait_ns > timeout_ms * 1000000LL) {
+        wait_ns = timeout_ms * 1000000LL;
+    }
+    ts.tv_sec = wait_ns / 1000000000LL;
+    ts.tv_nsec = wait_ns % 1000000000LL;
+    while (nanosleep(&ts, &ts) < 0 && errno == EINTR) {
+    }
+    return wait_ns < timeout_ms * 1000000LL ? 1 : 0;
+}
+
 /*******************************************************************************
  *                     CameraDevice routines
  ******************************************************************************/
@@ -276,6 +877,9 @@ _camera_device_free(LinuxCameraDevice* lcd)
                                lcd->io_type);
             free(lcd->framebuffers);
         }
+        if (lcd->virt != NULL) {
+            _virtual_camera_free(lcd->virt);
+        }
         AFREE(lcd);
     } else {
         E("%s: No descriptor", __FUNCTION__);
@@ -808,6 +1412,15 @@ camera_device_open(const char* name, int inp_channel)
     cd->device_name = name != NULL ? ASTRDUP(name) : ASTRDUP("/dev/video0");
     cd->input_channel = inp_channel;
 
+    if (!strcmp(cd->device_name, VIRTUAL_CAMERA_DEVICE)) {
+        cd->virt = _virtual_camera_open();
+        if (cd->virt == NULL) {
+            _camera_device_free(cd);
+            return NULL;
+        }
+        return &cd->header;
+    }
+
     /* Open the device. */
     if (_camera_device_open(cd)) {
         _camera_device_free(cd);
@@ -841,6 +1454,10 @@ camera_device_start_capturing(CameraDevice* ccd,
       return -1;
     }
     cd = (LinuxCameraDevice*)ccd->opaque;
+    if (cd->virt != NULL) {
+        return _virtual_camera_start(cd->virt, pixel_format, frame_width,
+                                     frame_height);
+    }
     if (cd->handle < 0) {
       E("%s: Camera device is not opened", __FUNCTION__);
       return -1;
@@ -934,6 +1551,9 @@ camera_device_stop_capturing(CameraDevice* ccd)
       return -1;
     }
     cd = (LinuxCameraDevice*)ccd->opaque;
+    if (cd->virt != NULL) {
+        return _virtual_camera_stop(cd->virt);
+    }
     if (cd->handle < 0) {
       E("%s: Camera device is not opened", __FUNCTION__);
       return -1;
@@ -983,6 +1603,10 @@ camera_device_read_frame(CameraDevice* ccd,
       return -1;
     }
     cd = (LinuxCameraDevice*)ccd->opaque;
+    if (cd->virt != NULL) {
+        return _virtual_camera_read_frame(cd->virt, framebuffers, fbs_num,
+                                          r_scale, g_scale, b_scale, exp_comp);
+    }
     if (cd->handle < 0) {
       E("%s: Camera device is not opened", __FUNCTION__);
       return -1;
@@ -1057,6 +1681,45 @@ camera_device_read_frame(CameraDevice* ccd,
     }
 }
 
+int
+camera_device_wait_frame(CameraDevice* ccd, int timeout_ms)
+{
+    LinuxCameraDevice* cd;
+    struct timeval tv;
+    fd_set fds;
+    int res;
+
+    /* Sanity checks. */
+    if (ccd == NULL || ccd->opaque == NULL) {
+      E("%s: Invalid camera device descriptor", __FUNCTION__);
+      return -1;
+    }
+    cd = (LinuxCameraDevice*)ccd->opaque;
+    if (cd->virt != NULL) {
+        return _virtual_camera_wait_frame(cd->virt, timeout_ms);
+    }
+    if (cd->handle < 0) {
+      E("%s: Camera device is not opened", __FUNCTION__);
+      return -1;
+    }
+
+    /* The device becomes readable when a frame can be read (or a buffer can be
+     * dequeued) from it. */
+    do {
+        FD_ZERO(&fds);
+        FD_SET(cd->handle, &fds);
+        tv.tv_sec = timeout_ms / 1000;
+        tv.tv_usec = (timeout_ms % 1000) * 1000;
+        res = select(cd->handle + 1, &fds, NULL, NULL, &tv);
+    } while (res < 0 && errno == EINTR);
+    if (res < 0) {
+        E("%s: Unable to wait for a frame from the camera '%s': %s",
+          __FUNCTION__, cd->device_name, strerror(errno));
+        return -1;
+    }
+    return res > 0 ? 1 : 0;
+}
+
 void
 camera_device_close(CameraDevice* ccd)
 {
@@ -1098,5 +1761,11 @@ enumerate_camera_devices(CameraInfo* cis, int max)
         }
     }
 
+    /* The virtual camera always comes after the real ones, so it doesn't
+     * change names assigned to them. */
+    if (found < max && !_virtual_camera_get_info(cis + found)) {
+        found++;
+    }
+
     return found;
 }
@@ -90,6 +90,19 @@ extern int camera_device_read_frame(CameraDevice* cd,
                                     float b_scale,
                                     float exp_comp);
 
+#ifdef __linux__
+/* Waits for the next frame to become available in the camera device.
+ * Param:
+ *  cd - Camera descriptor representing a camera device opened in
+ *    camera_device_open routine.
+ *  timeout_ms - Maximum time to wait (in milliseconds).
+ * Return:
+ *  1 if a frame may be read from the device, 0 if the timeout has expired, or
+ *  -1 on failure.
+ */
+extern int camera_device_wait_frame(CameraDevice* cd, int timeout_ms);
+#endif  /* __linux__ */
+
 /* Closes camera device, opened in camera_device_open routine.
  * Param:
  *  cd - Camera descriptor representing a camera device opened in
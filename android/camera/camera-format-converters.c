@@ -416,10 +416,9 @@ _change_white_balance_RGB_b(uint8_t* r,
  * calculated.
  *
  * Performance considerations:
- * Since converters implemented here are intended to work as part of the camera
- * emulation, making the code super performant is not a priority at all. There
- * will be enough loses in other parts of the emultion to overlook any slight
- * inefficiences in the conversion algorithm as neglectable.
+ * The generic converters are not meant to be fast. Conversions that are
+ * commonly used for webcam passthrough have specialized versions that produce
+ * the same output (see "Specialized converters" below).
  */
 
 typedef struct RGBDesc RGBDesc;
@@ -1594,6 +1593,479 @@ _get_pixel_format_descriptor(uint32_t pixel_format)
     return NULL;
 }
 
+/********************************************************************************
+ * Specialized converters
+ *******************************************************************************/
+
+/*
+ * The generic converters above go through the format descriptors, which costs
+ * several indirect calls and float operations per pixel. This is too slow for
+ * webcam passthrough of large frames, so the most common conversions have
+ * specialized versions below. They produce exactly the same output as the
+ * generic converters: white balance and exposure compensation are turned into
+ * lookup tables built once per frame with the same float expressions, and all
+ * per-pixel math is done in fixed point. When white balance and exposure are
+ * neutral, YUYV frames are converted with SSE2 where available.
+ */
+
+/* Parameters of a frame conversion. */
+typedef struct ConvertParams {
+    float   r_scale;
+    float   g_scale;
+    float   b_scale;
+    float   exp_comp;
+    /* Non-zero when the lookup tables below have been built. */
+    int     tables_ready;
+    /* White balance applied in YUV space (see _change_white_balance_YUV). */
+    int     wb_r[256];
+    int     wb_g[256];
+    int     wb_b[256];
+    /* White balance applied to RGB bytes (see _change_white_balance_RGB_b). */
+    uint8_t wb_rb[256];
+    uint8_t wb_gb[256];
+    uint8_t wb_bb[256];
+    /* Exposure compensation (see _change_exposure). */
+    uint8_t exp_y[256];
+    /* Non-zero if white balance in YUV space and exposure do nothing. */
+    int     neutral;
+} ConvertParams;
+
+/* Prototype for a frame converter. */
+typedef void (*frame_conv_func)(const PIXFormat* src_desc,
+                                const PIXFormat* dst_desc,
+                                const void* src,
+                                void* dst,
+                                int width,
+                                int height,
+                                ConvertParams* params);
+
+/* Builds lookup tables for the white balance and exposure compensation. */
+static const ConvertParams*
+_get_conv_tables(ConvertParams* p)
+{
+    int i;
+
+    if (p->tables_ready) {
+        return p;
+    }
+    p->neutral = 1;
+    for (i = 0; i < 256; i++) {
+        p->wb_r[i] = (float)i / p->r_scale;
+        p->wb_g[i] = (float)i / p->g_scale;
+        p->wb_b[i] = (float)i / p->b_scale;
+        p->wb_rb[i] = (float)i / p->r_scale;
+        p->wb_gb[i] = (float)i / p->g_scale;
+        p->wb_bb[i] = (float)i / p->b_scale;
+        p->exp_y[i] = _change_exposure(i, p->exp_comp);
+        if (p->wb_r[i] != i || p->wb_g[i] != i || p->wb_b[i] != i ||
+            p->exp_y[i] != i) {
+            p->neutral = 0;
+        }
+    }
+    p->tables_ready = 1;
+    return p;
+}
+
+/* Same as the _change_white_balance_RGB_b / _change_exposure_RGB pair. */
+static __inline__ void
+_adjust_RGB_fast(const ConvertParams* p, uint8_t* r, uint8_t* g, uint8_t* b)
+{
+    uint8_t y, u, v;
+    R8G8B8ToYUV(p->wb_rb[*r], p->wb_gb[*g], p->wb_bb[*b], &y, &u, &v);
+    YUVToRGBPix(p->exp_y[y], u, v, r, g, b);
+}
+
+/* Converts a line of YUYV pixel pairs to separate Y, U, and V values, with the
+ * same adjustments as YUVToYUV. U and V are stored with 'uv_inc' increment.
+ * Return:
+ *  Number of pixels converted.
+ */
+static void
+_YUYVLineToYUV_fast(const ConvertParams* p,
+                    const uint8_t* src,
+                    uint8_t* pY,
+                    uint8_t* pU,
+                    uint8_t* pV,
+                    int uv_inc,
+                    int store_uv,
+                    int x,
+                    int width)
+{
+    for (; x < width; x += 2, src += 4, pY += 2, pU += uv_inc, pV += uv_inc) {
+        const int Y = src[0], U = src[1], V = src[3];
+        const int r = p->wb_r[YUV2R(Y, U, V)];
+        const int g = p->wb_g[YUV2G(Y, U, V)];
+        const int b = p->wb_b[YUV2B(Y, U, V)];
+        pY[0] = p->exp_y[RGB2Y(r, g, b)];
+        pY[1] = p->exp_y[src[2]];
+        if (store_uv) {
+            *pU = RGB2U(r, g, b);
+            *pV = RGB2V(r, g, b);
+        }
+    }
+}
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+
+/* A 32-bit lane made of two 16-bit values, for _mm_madd_epi16 */
+#define PAIR16(lo, hi)  \
+    _mm_set1_epi32((int)(((uint32_t)(uint16_t)(hi) << 16) | (uint16_t)(lo)))
+
+/* Computes Y, U, and V values for the first pixels of 4 YUYV pixel pairs,
+ * going through RGB like _change_white_balance_YUV does with a neutral white
+ * balance. Results are in 32-bit lanes. */
+static __inline__ void
+_YUYV4ToRGB_sse2(__m128i s, __m128i* r, __m128i* g, __m128i* b)
+{
+    const __m128i mask = _mm_set1_epi32(0xff);
+    const __m128i c = _mm_sub_epi32(_mm_and_si128(s, mask), _mm_set1_epi32(16));
+    const __m128i d = _mm_sub_epi32(_mm_and_si128(_mm_srli_epi32(s, 8), mask),
+                                    _mm_set1_epi32(128));
+    const __m128i e = _mm_sub_epi32(_mm_srli_epi32(s, 24), _mm_set1_epi32(128));
+    /* 16-bit pairs for _mm_madd_epi16 */
+    const __m128i lo16 = _mm_set1_epi32(0xffff);
+    const __m128i ce = _mm_or_si128(_mm_and_si128(c, lo16), _mm_slli_epi32(e, 16));
+    const __m128i cd = _mm_or_si128(_mm_and_si128(c, lo16), _mm_slli_epi32(d, 16));
+    const __m128i e1 = _mm_or_si128(_mm_and_si128(e, lo16), _mm_set1_epi32(1 << 16));
+    const __m128i round = _mm_set1_epi32(128);
+
+    *r = _mm_srai_epi32(_mm_add_epi32(
+            _mm_madd_epi16(ce, PAIR16(298, 409)), round), 8);
+    *g = _mm_srai_epi32(_mm_add_epi32(
+            _mm_madd_epi16(cd, PAIR16(298, -100)),
+            _mm_madd_epi16(e1, PAIR16(-208, 128))), 8);
+    *b = _mm_srai_epi32(_mm_add_epi32(
+            _mm_madd_epi16(cd, PAIR16(298, 516)), round), 8);
+}
+
+/* Computes ((c0 * a + c1 * b + c2 * c + 128) >> 8) + bias for 8 16-bit lanes
+ * of a, b, and c, which must be in 0-255 range. */
+static __inline__ __m128i
+_RGB8ToComponent_sse2(__m128i a, __m128i b, __m128i c,
+                      int c0, int c1, int c2, int bias)
+{
+    const __m128i k01 = PAIR16(c0, c1);
+    const __m128i k2r = PAIR16(c2, 128);
+    const __m128i one = _mm_set1_epi16(1);
+    const __m128i lo = _mm_add_epi32(
+        _mm_madd_epi16(_mm_unpacklo_epi16(a, b), k01),
+        _mm_madd_epi16(_mm_unpacklo_epi16(c, one), k2r));
+    const __m128i hi = _mm_add_epi32(
+        _mm_madd_epi16(_mm_unpackhi_epi16(a, b), k01),
+        _mm_madd_epi16(_mm_unpackhi_epi16(c, one), k2r));
+    return _mm_add_epi16(_mm_packs_epi32(_mm_srai_epi32(lo, 8),
+                                         _mm_srai_epi32(hi, 8)),
+                         _mm_set1_epi16(bias));
+}
+
+/* Converts 8 YUYV pixel pairs with neutral white balance and exposure.
+ * Y values are returned interleaved as in a Y pane, U and V values in the low
+ * 8 bytes of 'u' and 'v'. */
+static __inline__ void
+_YUYV8ToYUV_sse2(const uint8_t* src, __m128i* y, __m128i* u, __m128i* v)
+{
+    const __m128i s0 = _mm_loadu_si128((const __m128i*)src);
+    const __m128i s1 = _mm_loadu_si128((const __m128i*)(src + 16));
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i max = _mm_set1_epi16(255);
+    __m128i r0, g0, b0, r1, g1, b1, r, g, b, y0, y1;
+
+    _YUYV4ToRGB_sse2(s0, &r0, &g0, &b0);
+    _YUYV4ToRGB_sse2(s1, &r1, &g1, &b1);
+    /* Clamp to 0-255 in 16-bit lanes. */
+    r = _mm_min_epi16(_mm_max_epi16(_mm_packs_epi32(r0, r1), zero), max);
+    g = _mm_min_epi16(_mm_max_epi16(_mm_packs_epi32(g0, g1), zero), max);
+    b = _mm_min_epi16(_mm_max_epi16(_mm_packs_epi32(b0, b1), zero), max);
+
+    y0 = _RGB8ToComponent_sse2(r, g, b, 66, 129, 25, 16);
+    *u = _mm_packus_epi16(_RGB8ToComponent_sse2(r, g, b, -38, -74, 112, 128), zero);
+    *v = _mm_packus_epi16(_RGB8ToComponent_sse2(r, g, b, 112, -94, -18, 128), zero);
+
+    /* Second Y of each pair is copied as is. */
+    y1 = _mm_packs_epi32(_mm_srli_epi32(_mm_slli_epi32(s0, 8), 24),
+                         _mm_srli_epi32(_mm_slli_epi32(s1, 8), 24));
+    *y = _mm_or_si128(y0, _mm_slli_epi16(y1, 8));
+}
+#endif  /* __SSE2__ */
+
+/* Converts YUYV frame to a 4:2:0 frame, either YV12 (separate V and U panes),
+ * or NV21 (interleaved VU pane). */
+static void
+_YUYVTo420_fast(const ConvertParams* p,
+                const uint8_t* src,
+                uint8_t* dst,
+                int width,
+                int height,
+                int nv21)
+{
+    uint8_t* const panes = dst + width * height;
+    const int uv_stride = nv21 ? width : width / 2;
+    const int uv_inc = nv21 ? 2 : 1;
+    int y;
+
+    for (y = 0; y < height; y++, src += width * 2, dst += width) {
+        uint8_t* const pV = panes + (y / 2) * uv_stride;
+        uint8_t* const pU = nv21 ? pV + 1 : pV + (width * height) / 4;
+        /* The generic converter writes U and V values for each line, so the
+         * values of odd lines overwrite the ones of even lines. */
+        const int store_uv = (y & 1) || y == height - 1;
+        int x = 0;
+#if defined(__SSE2__)
+        if (p->neutral) {
+            for (; x + 16 <= width; x += 16) {
+                __m128i vy, vu, vv;
+                _YUYV8ToYUV_sse2(src + x * 2, &vy, &vu, &vv);
+                _mm_storeu_si128((__m128i*)(dst + x), vy);
+                if (!store_uv) {
+                    continue;
+                }
+                if (nv21) {
+                    _mm_storeu_si128((__m128i*)(pV + x), _mm_unpacklo_epi8(vv, vu));
+                } else {
+                    _mm_storel_epi64((__m128i*)(pU + x / 2), vu);
+                    _mm_storel_epi64((__m128i*)(pV + x / 2), vv);
+                }
+            }
+        }
+#endif  /* __SSE2__ */
+        _YUYVLineToYUV_fast(p, src + x * 2, dst + x,
+                            pU + (x / 2) * uv_inc, pV + (x / 2) * uv_inc,
+                            uv_inc, store_uv, x, width);
+    }
+}
+
+/* YUYV -> NV21 */
+static void
+_YUYVToNV21(const PIXFormat* src_desc, const PIXFormat* dst_desc,
+            const void* src, void* dst, int width, int height,
+            ConvertParams* params)
+{
+    _YUYVTo420_fast(_get_conv_tables(params), src, dst, width, height, 1);
+}
+
+/* YUYV -> YV12 */
+static void
+_YUYVToYV12(const PIXFormat* src_desc, const PIXFormat* dst_desc,
+            const void* src, void* dst, int width, int height,
+            ConvertParams* params)
+{
+    _YUYVTo420_fast(_get_conv_tables(params), src, dst, width, height, 0);
+}
+
+/* YUYV -> RGB32 */
+static void
+_YUYVToRGB32(const PIXFormat* src_desc, const PIXFormat* dst_desc,
+             const void* src, void* dst, int width, int height,
+             ConvertParams* params)
+{
+    const ConvertParams* p = _get_conv_tables(params);
+    const uint8_t* s = (const uint8_t*)src;
+    const uint8_t* end = s + width * height * 2;
+    uint8_t* d = (uint8_t*)dst;
+
+    for (; s < end; s += 4, d += 8) {
+        YUVToRGBPix(s[0], s[1], s[3], &d[0], &d[1], &d[2]);
+        _adjust_RGB_fast(p, &d[0], &d[1], &d[2]);
+        YUVToRGBPix(s[2], s[1], s[3], &d[4], &d[5], &d[6]);
+        _adjust_RGB_fast(p, &d[4], &d[5], &d[6]);
+    }
+}
+
+/* RGB24 -> NV21 */
+static void
+_RGB24ToNV21(const PIXFormat* src_desc, const PIXFormat* dst_desc,
+             const void* src, void* dst, int width, int height,
+             ConvertParams* params)
+{
+    const ConvertParams* p = _get_conv_tables(params);
+    const uint8_t* s = (const uint8_t*)src;
+    uint8_t* pY = (uint8_t*)dst;
+    uint8_t* uv = pY + width * height;
+    int x, y;
+
+    for (y = 0; y < height; y++) {
+        uint8_t* pV = uv + (y / 2) * width;
+        /* See _YUYVTo420_fast about U/V values of even lines. */
+        const int store_uv = (y & 1) || y == height - 1;
+        for (x = 0; x < width; x += 2, s += 6, pY += 2, pV += 2) {
+            uint8_t r = s[0], g = s[1], b = s[2];
+            _adjust_RGB_fast(p, &r, &g, &b);
+            pY[0] = RGB2Y((int)r, (int)g, (int)b);
+            if (store_uv) {
+                pV[0] = RGB2V((int)r, (int)g, (int)b);
+                pV[1] = RGB2U((int)r, (int)g, (int)b);
+            }
+            r = s[3]; g = s[4]; b = s[5];
+            _adjust_RGB_fast(p, &r, &g, &b);
+            pY[1] = RGB2Y((int)r, (int)g, (int)b);
+        }
+        /* Same line alignment as RGBToYUV */
+        if (((uintptr_t)s & 1) != 0) s++;
+    }
+}
+
+/* Generic converter, dispatching on the pixel format types. */
+static void
+_convert_generic(const PIXFormat* src_desc, const PIXFormat* dst_desc,
+                 const void* src, void* dst, int width, int height,
+                 ConvertParams* p)
+{
+    switch (src_desc->format_sel) {
+        case PIX_FMT_RGB:
+            if (dst_desc->format_sel == PIX_FMT_RGB) {
+                RGBToRGB(src_desc->desc.rgb_desc, dst_desc->desc.rgb_desc,
+                         src, dst, width, height,
+                         p->r_scale, p->g_scale, p->b_scale, p->exp_comp);
+            } else {
+                RGBToYUV(src_desc->desc.rgb_desc, dst_desc->desc.yuv_desc,
+                         src, dst, width, height,
+                         p->r_scale, p->g_scale, p->b_scale, p->exp_comp);
+            }
+            break;
+        case PIX_FMT_YUV:
+            if (dst_desc->format_sel == PIX_FMT_RGB) {
+                YUVToRGB(src_desc->desc.yuv_desc, dst_desc->desc.rgb_desc,
+                         src, dst, width, height,
+                         p->r_scale, p->g_scale, p->b_scale, p->exp_comp);
+            } else {
+                YUVToYUV(src_desc->desc.yuv_desc, dst_desc->desc.yuv_desc,
+                         src, dst, width, height,
+                         p->r_scale, p->g_scale, p->b_scale, p->exp_comp);
+            }
+            break;
+        case PIX_FMT_BAYER:
+            if (dst_desc->format_sel == PIX_FMT_RGB) {
+                BAYERToRGB(src_desc->desc.bayer_desc, dst_desc->desc.rgb_desc,
+                           src, dst, width, height,
+                           p->r_scale, p->g_scale, p->b_scale, p->exp_comp);
+            } else {
+                BAYERToYUV(src_desc->desc.bayer_desc, dst_desc->desc.yuv_desc,
+                           src, dst, width, height,
+                           p->r_scale, p->g_scale, p->b_scale, p->exp_comp);
+            }
+            break;
+    }
+}
+
+/* List of specialized converters, keyed by format descriptors, so aliased
+ * pixel formats (e.g. YUY2 for YUYV) use them as well. */
+static const struct {
+    const void*     src;
+    const void*     dst;
+    frame_conv_func conv;
+} _fast_converters[] = {
+    { &_YUYV,  &_NV21,  _YUYVToNV21  },
+    { &_YUYV,  &_YV12,  _YUYVToYV12  },
+    { &_YUYV,  &_RGB32, _YUYVToRGB32 },
+    { &_RGB24, &_NV21,  _RGB24ToNV21 },
+};
+
+/* Returns the raw format descriptor referenced by a PIXFormat entry. */
+static const void*
+_get_format_desc(const PIXFormat* fmt)
+{
+    switch (fmt->format_sel) {
+        case PIX_FMT_RGB:   return fmt->desc.rgb_desc;
+        case PIX_FMT_YUV:   return fmt->desc.yuv_desc;
+        case PIX_FMT_BAYER: return fmt->desc.bayer_desc;
+    }
+    return NULL;
+}
+
+/* Entry in the cache of selected converters. */
+typedef struct ConverterCacheEntry {
+    uint32_t            from;
+    uint32_t            to;
+    const PIXFormat*    src_desc;
+    const PIXFormat*    dst_desc;
+    frame_conv_func     conv;
+} ConverterCacheEntry;
+
+/* Maximum number of (from, to) pairs that are cached. A camera uses at most
+ * two at any given time: one for video, and one for preview. Pairs that don't
+ * fit are simply looked up on every call.
+ *
+ * Frames may be converted concurrently by capture threads of different cameras,
+ * so the cache is append-only: an entry is written into a slot reserved by the
+ * writer, and becomes visible to the readers only after it has been completely
+ * written. */
+#define CONVERTER_CACHE_SIZE    16
+
+static ConverterCacheEntry  _converter_cache[CONVERTER_CACHE_SIZE];
+/* Number of entries visible to the readers. */
+static volatile int         _converter_cache_num;
+/* Number of slots reserved by the writers. */
+static int                  _converter_cache_reserved;
+
+/* Selects a converter for a pair of pixel formats. Selection is done once per
+ * pair, and then cached.
+ * Param:
+ *  entry - Upon success contains the selected converter.
+ * Return:
+ *  0 on success, or -1 if one of the formats is unknown.
+ */
+static int
+_get_converter(uint32_t from, uint32_t to, ConverterCacheEntry* entry)
+{
+    const int cached = _converter_cache_num;
+    const PIXFormat* src_desc;
+    const PIXFormat* dst_desc;
+    frame_conv_func conv = _convert_generic;
+    int n;
+
+    __sync_synchronize();
+    for (n = 0; n < cached; n++) {
+        if (_converter_cache[n].from == from && _converter_cache[n].to == to) {
+            *entry = _converter_cache[n];
+            return 0;
+        }
+    }
+
+    src_desc = _get_pixel_format_descriptor(from);
+    if (src_desc == NULL) {
+        E("%s: Source pixel format %.4s is unknown",
+          __FUNCTION__, (const char*)&from);
+        return -1;
+    }
+    dst_desc = _get_pixel_format_descriptor(to);
+    if (dst_desc == NULL) {
+        E("%s: Destination pixel format %.4s is unknown",
+          __FUNCTION__, (const char*)&to);
+        return -1;
+    }
+    if (dst_desc->format_sel == PIX_FMT_BAYER) {
+        E("%s: Unexpected destination pixel format %d",
+          __FUNCTION__, dst_desc->format_sel);
+        return -1;
+    }
+    for (n = 0; n < (int)(sizeof(_fast_converters) / sizeof(*_fast_converters)); n++) {
+        if (_fast_converters[n].src == _get_format_desc(src_desc) &&
+            _fast_converters[n].dst == _get_format_desc(dst_desc)) {
+            conv = _fast_converters[n].conv;
+            break;
+        }
+    }
+
+    entry->from = from;
+    entry->to = to;
+    entry->src_desc = src_desc;
+    entry->dst_desc = dst_desc;
+    entry->conv = conv;
+
+    /* Two threads may race to cache the same pair, which only wastes a slot. */
+    if (_converter_cache_reserved < CONVERTER_CACHE_SIZE) {
+        n = __sync_fetch_and_add(&_converter_cache_reserved, 1);
+        if (n < CONVERTER_CACHE_SIZE) {
+            _converter_cache[n] = *entry;
+            /* Entries are published in the order their slots were reserved. */
+            while (!__sync_bool_compare_and_swap(&_converter_cache_num, n, n + 1)) {
+            }
+        }
+    }
+    return 0;
+}
+
 /********************************************************************************
  * Public API
  *******************************************************************************/
@@ -1623,76 +2095,25 @@ convert_frame(const void* frame,
               float exp_comp)
 {
     int n;
-    const PIXFormat* src_desc = _get_pixel_format_descriptor(pixel_format);
-    if (src_desc == NULL) {
-        E("%s: Source pixel format %.4s is unknown",
-          __FUNCTION__, (const char*)&pixel_format);
-        return -1;
-    }
+    ConvertParams params;
+
+    params.r_scale = r_scale;
+    params.g_scale = g_scale;
+    params.b_scale = b_scale;
+    params.exp_comp = exp_comp;
+    params.tables_ready = 0;
 
     for (n = 0; n < fbs_num; n++) {
         /* Note that we need to apply white balance, exposure compensation, etc.
          * when we transfer the captured frame to the user framebuffer. So, even
          * if source and destination formats are the same, we will have to go
          * thrugh the converters to apply these things. */
-        const PIXFormat* dst_desc =
-            _get_pixel_format_descriptor(framebuffers[n].pixel_format);
-        if (dst_desc == NULL) {
-            E("%s: Destination pixel format %.4s is unknown",
-              __FUNCTION__, (const char*)&framebuffers[n].pixel_format);
+        ConverterCacheEntry conv;
+        if (_get_converter(pixel_format, framebuffers[n].pixel_format, &conv)) {
             return -1;
         }
-        switch (src_desc->format_sel) {
-            case PIX_FMT_RGB:
-                if (dst_desc->format_sel == PIX_FMT_RGB) {
-                    RGBToRGB(src_desc->desc.rgb_desc, dst_desc->desc.rgb_desc,
-                             frame, framebuffers[n].framebuffer, width, height,
-                             r_scale, g_scale, b_scale, exp_comp);
-                } else if (dst_desc->format_sel == PIX_FMT_YUV) {
-                    RGBToYUV(src_desc->desc.rgb_desc, dst_desc->desc.yuv_desc,
-                             frame, framebuffers[n].framebuffer, width, height,
-                             r_scale, g_scale, b_scale, exp_comp);
-                } else {
-                    E("%s: Unexpected destination pixel format %d",
-                      __FUNCTION__, dst_desc->format_sel);
-                    return -1;
-                }
-                break;
-            case PIX_FMT_YUV:
-                if (dst_desc->format_sel == PIX_FMT_RGB) {
-                    YUVToRGB(src_desc->desc.yuv_desc, dst_desc->desc.rgb_desc,
-                             frame, framebuffers[n].framebuffer, width, height,
-                             r_scale, g_scale, b_scale, exp_comp);
-                } else if (dst_desc->format_sel == PIX_FMT_YUV) {
-                    YUVToYUV(src_desc->desc.yuv_desc, dst_desc->desc.yuv_desc,
-                             frame, framebuffers[n].framebuffer, width, height,
-                             r_scale, g_scale, b_scale, exp_comp);
-                } else {
-                    E("%s: Unexpected destination pixel format %d",
-                      __FUNCTION__, dst_desc->format_sel);
-                    return -1;
-                }
-                break;
-            case PIX_FMT_BAYER:
-                if (dst_desc->format_sel == PIX_FMT_RGB) {
-                    BAYERToRGB(src_desc->desc.bayer_desc, dst_desc->desc.rgb_desc,
-                              frame, framebuffers[n].framebuffer, width, height,
-                              r_scale, g_scale, b_scale, exp_comp);
-                } else if (dst_desc->format_sel == PIX_FMT_YUV) {
-                    BAYERToYUV(src_desc->desc.bayer_desc, dst_desc->desc.yuv_desc,
-                               frame, framebuffers[n].framebuffer, width, height,
-                               r_scale, g_scale, b_scale, exp_comp);
-                } else {
-                    E("%s: Unexpected destination pixel format %d",
-                      __FUNCTION__, dst_desc->format_sel);
-                    return -1;
-                }
-                break;
-            default:
-                E("%s: Unexpected source pixel format %d",
-                  __FUNCTION__, dst_desc->format_sel);
-                return -1;
-        }
+        conv.conv(conv.src_desc, conv.dst_desc, frame,
+                  framebuffers[n].framebuffer, width, height, &params);
     }
 
     return 0;
@@ -27,6 +27,9 @@
 #include "android/camera/camera-capture.h"
 #include "android/camera/camera-format-converters.h"
 #include "android/camera/camera-service.h"
+#ifdef __linux__
+#include "qemu-thread.h"
+#endif
 
 #define  E(...)    derror(__VA_ARGS__)
 #define  W(...)    dwarning(__VA_ARGS__)
@@ -48,6 +51,15 @@
 /* Maximum number of supported emulated cameras. */
 #define MAX_CAMERA      8
 
+/* On Linux frames are captured on a dedicated thread, so that frame queries
+ * never wait for the camera device. On other hosts frames are captured when
+ * the guest queries them. */
+#ifdef __linux__
+#define CAMERA_CAPTURE_THREAD   1
+#else
+#define CAMERA_CAPTURE_THREAD   0
+#endif
+
 /* Camera sevice descriptor. */
 typedef struct CameraServiceDesc CameraServiceDesc;
 struct CameraServiceDesc {
@@ -573,6 +585,90 @@ _factory_client_close(void*  opaque)
  * Camera client API
  *******************************************************************************/
 
+/* Frame capturing statistics of an emulated camera client.
+ * With the capture thread, 'captured', 'dropped', 'errors', and latency
+ * counters are updated by the thread, under the CameraCapture.lock mutex. */
+typedef struct CameraStats {
+    /* Frames obtained from the camera device. */
+    uint64_t    captured;
+    /* Captured frames replaced by a newer one before the guest queried them. */
+    uint64_t    dropped;
+    /* Frames sent to the guest. */
+    uint64_t    delivered;
+    /* Frames sent to the guest that had already been sent before. */
+    uint64_t    repeated;
+    /* Failed reads from the camera device. */
+    uint64_t    errors;
+    /* Time spent reading and converting frames (microseconds). */
+    uint64_t    latency_total;
+    uint64_t    latency_max;
+    /* Time between capturing a frame and sending it to the guest
+     * (microseconds). */
+    uint64_t    age_total;
+} CameraStats;
+
+#if CAMERA_CAPTURE_THREAD
+
+/* Number of framebuffers in the capture ring: one is being filled by the
+ * capture thread, one holds the freshest captured frame, and one holds the
+ * frame last sent to the guest. */
+#define CAPTURE_RING_SIZE       3
+/* Flag in CameraCapture.ready, set when the frame hasn't been taken yet. */
+#define CAPTURE_FRESH           0x100
+/* Longest time the capture thread waits for a frame from the device before
+ * checking whether it's asked to stop (millisec). */
+#define CAPTURE_WAIT_MS         100
+/* Number of consecutive read failures that stops the capture thread. */
+#define CAPTURE_MAX_FAILURES    50
+
+/* Describes capture thread of an emulated camera client.
+ * Frames are handed off from the capture thread to the main loop by
+ * atomically exchanging ring indexes: the capture thread swaps its filled
+ * 'back' slot with the 'ready' one, and the main loop swaps its 'front' slot
+ * with the 'ready' one when it wants a fresh frame. The capture thread takes
+ * 'lock' briefly twice per frame: to read the conversion parameters, and to
+ * publish the frame. The main loop holds the same lock while it takes a frame,
+ * which may allocate a new framebuffer for a slot still queued for the guest,
+ * so publishing can wait for that long. The main loop only waits on
+ * 'frame_cond' when it has no suitable frame to send to the guest. */
+typedef struct CameraCapture {
+    /* Capture thread. */
+    QemuThread          thread;
+    /* Non-zero while the capture thread runs. */
+    int                 started;
+    /* Cleared to ask the capture thread to exit. */
+    volatile int        running;
+    /* Framebuffers. Each buffer contains video and preview frames. */
+    QemudBuffer*        slots[CAPTURE_RING_SIZE];
+    /* Capture time of the frame in each slot. */
+    uint64_t            stamps[CAPTURE_RING_SIZE];
+    /* Slot being filled by the capture thread. */
+    int                 back;
+    /* Slot with the freshest frame, possibly or-ed with CAPTURE_FRESH. */
+    volatile int        ready;
+    /* Slot owned by the main loop. */
+    int                 front;
+    /* Whether the frame in each slot contains a converted preview frame. */
+    int                 previews[CAPTURE_RING_SIZE];
+    /* Set once the guest has queried a preview frame. Until then the capture
+     * thread doesn't convert preview frames. */
+    volatile int        want_preview;
+    /* Protects conversion parameters below, and capturing statistics of the
+     * client. */
+    QemuMutex           lock;
+    /* Signaled when a frame is published in the 'ready' slot. */
+    QemuCond            frame_cond;
+    /* White balance, and exposure compensation requested by the guest. */
+    float               r_scale;
+    float               g_scale;
+    float               b_scale;
+    float               exp_comp;
+    /* errno value for the failure that stopped the capture thread. */
+    volatile int        error;
+} CameraCapture;
+
+#endif  /* CAMERA_CAPTURE_THREAD */
+
 /* Describes an emulated camera client.
  */
 typedef struct CameraClient CameraClient;
@@ -589,6 +685,9 @@ struct CameraClient
     const CameraInfo*   camera_info;
     /* Emulated camera device descriptor. */
     CameraDevice*       camera;
+    /* Reference-counted buffer containing video and preview frames. Pipe
+     * clients hold a reference to it until the guest has read a frame. */
+    QemudBuffer*        frame_buffer;
     /* Buffer allocated for video frames.
      * Note that memory allocated for this buffer
      * also contains preview framebuffer. */
@@ -610,26 +709,299 @@ struct CameraClient
     int                 pixel_num;
     /* Status of video and preview frame cache. */
     int                 frames_cached;
+    /* Capture time of the cached frames. */
+    uint64_t            frame_stamp;
+    /* Capturing statistics. */
+    CameraStats         stats;
+#if CAMERA_CAPTURE_THREAD
+    /* Capture thread, and its framebuffer ring. */
+    CameraCapture       capture;
+#endif
+    /* Next client in the list of created camera clients. */
+    CameraClient*       next;
 };
 
+/* List of created camera clients. */
+static CameraClient*    _camera_clients;
+
+/* Sets video and preview frame pointers to the given framebuffer. */
+static void
+_camera_client_set_frames(CameraClient* cc, QemudBuffer* fb)
+{
+    cc->frame_buffer = fb;
+    cc->video_frame = qemud_buffer_data(fb);
+    cc->preview_frame = (uint16_t*)(cc->video_frame + cc->video_frame_size);
+}
+
+/* Allocates video and preview framebuffers.
+ * Return:
+ *  0 on success, or -1 on allocation failure.
+ */
+static int
+_camera_client_alloc_frames(CameraClient* cc)
+{
+    const size_t size = cc->video_frame_size + cc->preview_frame_size;
+#if CAMERA_CAPTURE_THREAD
+    CameraCapture* cap = &cc->capture;
+    int n;
+
+    for (n = 0; n < CAPTURE_RING_SIZE; n++) {
+        cap->slots[n] = qemud_buffer_new(size);
+        if (cap->slots[n] == NULL) {
+            while (--n >= 0) {
+                qemud_buffer_unref(cap->slots[n]);
+                cap->slots[n] = NULL;
+            }
+            return -1;
+        }
+    }
+    cap->front = 0;
+    cap->back = 1;
+    cap->ready = 2;
+    _camera_client_set_frames(cc, cap->slots[cap->front]);
+#else
+    QemudBuffer* fb = qemud_buffer_new(size);
+    if (fb == NULL) {
+        return -1;
+    }
+    _camera_client_set_frames(cc, fb);
+#endif
+    return 0;
+}
+
+/* Releases video and preview framebuffers. */
+static void
+_camera_client_free_frames(CameraClient* cc)
+{
+#if CAMERA_CAPTURE_THREAD
+    int n;
+    for (n = 0; n < CAPTURE_RING_SIZE; n++) {
+        qemud_buffer_unref(cc->capture.slots[n]);
+        cc->capture.slots[n] = NULL;
+    }
+#else
+    qemud_buffer_unref(cc->frame_buffer);
+#endif
+    cc->frame_buffer = NULL;
+    cc->video_frame = NULL;
+    cc->preview_frame = NULL;
+}
+
+/* Accounts for a frame read from the camera device. */
+static void
+_camera_client_frame_captured(CameraClient* cc, uint64_t start, uint64_t end)
+{
+    const uint64_t latency = end - start;
+    cc->stats.captured++;
+    cc->stats.latency_total += latency;
+    if (latency > cc->stats.latency_max) {
+        cc->stats.latency_max = latency;
+    }
+}
+
+#if CAMERA_CAPTURE_THREAD
+
+/* Capture thread routine: keeps reading frames from the camera device into the
+ * ring, until it's asked to stop. */
+static void*
+_camera_capture_thread(void* opaque)
+{
+    CameraClient* cc = (CameraClient*)opaque;
+    CameraCapture* cap = &cc->capture;
+    int failures = 0;
+
+    while (cap->running) {
+        ClientFrameBuffer fbs[2];
+        float r_scale, g_scale, b_scale, exp_comp;
+        uint8_t* data = qemud_buffer_data(cap->slots[cap->back]);
+        const int preview = cap->want_preview;
+        uint64_t start, end;
+        int res, prev;
+
+        qemu_mutex_lock(&cap->lock);
+        r_scale = cap->r_scale;
+        g_scale = cap->g_scale;
+        b_scale = cap->b_scale;
+        exp_comp = cap->exp_comp;
+        qemu_mutex_unlock(&cap->lock);
+
+        /* Video frame is always converted, while RGB32 preview frame is
+         * converted only after the guest has asked for one. */
+        fbs[0].pixel_format = cc->pixel_format;
+        fbs[0].framebuffer = data;
+        fbs[1].pixel_format = V4L2_PIX_FMT_RGB32;
+        fbs[1].framebuffer = data + cc->video_frame_size;
+
+        start = _get_timestamp();
+        res = camera_device_read_frame(cc->camera, fbs, preview ? 2 : 1,
+                                       r_scale, g_scale, b_scale, exp_comp);
+        if (res == 1) {
+            /* No frame yet: sleep until the device has one. */
+            if (camera_device_wait_frame(cc->camera, CAPTURE_WAIT_MS) < 0) {
+                _camera_sleep(10);
+            }
+            continue;
+        } else if (res < 0) {
+            qemu_mutex_lock(&cap->lock);
+            cc->stats.errors++;
+            qemu_mutex_unlock(&cap->lock);
+            if (++failures >= CAPTURE_MAX_FAILURES) {
+                cap->error = errno ? errno : EIO;
+                break;
+            }
+            _camera_sleep(10);
+            continue;
+        }
+        failures = 0;
+        end = _get_timestamp();
+        cap->stamps[cap->back] = end;
+        cap->previews[cap->back] = preview;
+
+        /* Publish the frame, and take over the slot it replaces. */
+        qemu_mutex_lock(&cap->lock);
+        _camera_client_frame_captured(cc, start, end);
+        __sync_synchronize();
+        prev = __sync_lock_test_and_set(&cap->ready, cap->back | CAPTURE_FRESH);
+        if (prev & CAPTURE_FRESH) {
+            cc->stats.dropped++;
+        }
+        qemu_cond_broadcast(&cap->frame_cond);
+        qemu_mutex_unlock(&cap->lock);
+        cap->back = prev & ~CAPTURE_FRESH;
+    }
+
+    return NULL;
+}
+
+/* Starts capture thread for a camera client. */
+static void
+_camera_capture_start(CameraClient* cc)
+{
+    CameraCapture* cap = &cc->capture;
+
+    cap->r_scale = cap->g_scale = cap->b_scale = cap->exp_comp = 1.0f;
+    cap->error = 0;
+    cap->want_preview = 0;
+    memset(cap->previews, 0, sizeof(cap->previews));
+    cap->running = 1;
+    qemu_mutex_init(&cap->lock);
+    qemu_cond_init(&cap->frame_cond);
+    qemu_thread_create(&cap->thread, _camera_capture_thread, cc);
+    cap->started = 1;
+}
+
+/* Stops capture thread for a camera client (if it's running). */
+static void
+_camera_capture_stop(CameraClient* cc)
+{
+    CameraCapture* cap = &cc->capture;
+
+    if (cap->started) {
+        cap->running = 0;
+        qemu_thread_join(&cap->thread);
+        qemu_cond_destroy(&cap->frame_cond);
+        qemu_mutex_destroy(&cap->lock);
+        cap->started = 0;
+    }
+}
+
+/* Takes the freshest captured frame from the ring.
+ * Return:
+ *  1 if a new frame has been taken, 0 if there is no new frame since the
+ *  last call, or -1 on allocation failure.
+ */
+static int
+_camera_capture_take_frame(CameraClient* cc)
+{
+    CameraCapture* cap = &cc->capture;
+    int prev;
+
+    if (!(cap->ready & CAPTURE_FRESH)) {
+        return 0;
+    }
+
+    /* The front slot goes back to the capture thread, which must not overwrite
+     * a frame that is still queued for the guest. */
+    if (qemud_buffer_is_shared(cap->slots[cap->front])) {
+        QemudBuffer* fb =
+            qemud_buffer_new(cc->video_frame_size + cc->preview_frame_size);
+        if (fb == NULL) {
+            return -1;
+        }
+        qemud_buffer_unref(cap->slots[cap->front]);
+        cap->slots[cap->front] = fb;
+    }
+
+    __sync_synchronize();
+    prev = __sync_lock_test_and_set(&cap->ready, cap->front);
+    __sync_synchronize();
+    cap->front = prev & ~CAPTURE_FRESH;
+    cc->frame_stamp = cap->stamps[cap->front];
+    _camera_client_set_frames(cc, cap->slots[cap->front]);
+    return 1;
+}
+
+#else   /* CAMERA_CAPTURE_THREAD */
+
+/* Makes sure that the framebuffers are not referenced by frames that are
+ * still queued for the guest, before they get overwritten by a new frame.
+ * Return:
+ *  0 on success, or -1 on allocation failure.
+ */
+static int
+_camera_client_own_frames(CameraClient* cc)
+{
+    QemudBuffer* fb;
+    const size_t size = cc->video_frame_size + cc->preview_frame_size;
+
+    if (!qemud_buffer_is_shared(cc->frame_buffer)) {
+        return 0;
+    }
+
+    fb = qemud_buffer_new(size);
+    if (fb == NULL) {
+        return -1;
+    }
+    /* Keep the cached frames: they may be sent again if the device has
+     * no new frame ready. */
+    memcpy(qemud_buffer_data(fb), cc->video_frame, size);
+    qemud_buffer_unref(cc->frame_buffer);
+    _camera_client_set_frames(cc, fb);
+    return 0;
+}
+
+#endif  /* CAMERA_CAPTURE_THREAD */
+
 /* Frees emulated camera client descriptor. */
 static void
 _camera_client_free(CameraClient* cc)
 {
     /* The only exception to the "read only" rule: we have to mark the camera
      * as being not used when we destroy a service for it. */
+    CameraClient** pcc;
+
     if (cc->camera_info != NULL) {
         ((CameraInfo*)cc->camera_info)->in_use = 0;
     }
+#if CAMERA_CAPTURE_THREAD
+    /* Capture thread must be done with the device before it's closed. */
+    _camera_capture_stop(cc);
+#endif
     if (cc->camera != NULL) {
         camera_device_close(cc->camera);
     }
     if (cc->video_frame != NULL) {
-        free(cc->video_frame);
+        _camera_client_free_frames(cc);
     }
     if (cc->device_name != NULL) {
         free(cc->device_name);
     }
+    for (pcc = &_camera_clients; *pcc != NULL; pcc = &(*pcc)->next) {
+        if (*pcc == cc) {
+            *pcc = cc->next;
+            break;
+        }
+    }
 
     AFREE(cc);
 }
@@ -705,6 +1077,8 @@ _camera_client_create(CameraServiceDesc* csd, const char* param)
     /* We're done. Set camera in use, and succeed the connection. */
     ci->in_use = 1;
     cc->camera_info = ci;
+    cc->next = _camera_clients;
+    _camera_clients = cc;
 
     D("%s: Camera service is created for device '%s' using input channel %d",
       __FUNCTION__, cc->device_name, cc->inp_channel);
@@ -914,32 +1288,31 @@ _camera_client_query_start(CameraClient* cc, QemudClient* qc, const char* param)
      * changes (if changes). */
     cc->preview_frame_size = cc->pixel_num * 4;
 
-    /* Allocate buffer large enough to contain both, video and preview
+    /* Allocate buffers large enough to contain both, video and preview
      * framebuffers. */
-    cc->video_frame =
-        (uint8_t*)malloc(cc->video_frame_size + cc->preview_frame_size);
-    if (cc->video_frame == NULL) {
+    if (_camera_client_alloc_frames(cc)) {
         E("%s: Not enough memory for framebuffers %d + %d",
           __FUNCTION__, cc->video_frame_size, cc->preview_frame_size);
         _qemu_client_reply_ko(qc, "Out of memory");
         return;
     }
 
-    /* Set framebuffer pointers. */
-    cc->preview_frame = (uint16_t*)(cc->video_frame + cc->video_frame_size);
-
     /* Start the camera. */
     if (camera_device_start_capturing(cc->camera, cc->camera_info->pixel_format,
                                       cc->width, cc->height)) {
         E("%s: Cannot start camera '%s' for %.4s[%dx%d]: %s",
           __FUNCTION__, cc->device_name, (const char*)&cc->pixel_format,
           cc->width, cc->height, strerror(errno));
-        free(cc->video_frame);
-        cc->video_frame = NULL;
+        _camera_client_free_frames(cc);
         _qemu_client_reply_ko(qc, "Cannot start the camera");
         return;
     }
 
+    memset(&cc->stats, 0, sizeof(cc->stats));
+#if CAMERA_CAPTURE_THREAD
+    _camera_capture_start(cc);
+#endif
+
     D("%s: Camera '%s' is now started for %.4s[%dx%d]",
       __FUNCTION__, cc->device_name, (char*)&cc->pixel_format, cc->width,
       cc->height);
@@ -963,16 +1336,23 @@ _camera_client_query_stop(CameraClient* cc, QemudClient* qc, const char* param)
         return;
     }
 
+#if CAMERA_CAPTURE_THREAD
+    _camera_capture_stop(cc);
+#endif
+
     /* Stop the camera. */
     if (camera_device_stop_capturing(cc->camera)) {
         E("%s: Cannot stop camera device '%s': %s",
           __FUNCTION__, cc->device_name, strerror(errno));
+#if CAMERA_CAPTURE_THREAD
+        /* Camera is still started: keep capturing. */
+        _camera_capture_start(cc);
+#endif
         _qemu_client_reply_ko(qc, "Cannot stop camera device");
         return;
     }
 
-    free(cc->video_frame);
-    cc->video_frame = NULL;
+    _camera_client_free_frames(cc);
 
     D("%s: Camera device '%s' is now stopped.", __FUNCTION__, cc->device_name);
     _qemu_client_reply_ok(qc, NULL);
@@ -997,9 +1377,14 @@ _camera_client_query_frame(CameraClient* cc, QemudClient* qc, const char* param)
 {
     int video_size = 0;
     int preview_size = 0;
+#if CAMERA_CAPTURE_THREAD
+    CameraCapture* cap = &cc->capture;
+    int res, fresh, ready;
+#else
     int repeat;
     ClientFrameBuffer fbs[2];
     int fbs_num = 0;
+#endif
     size_t payload_size;
     uint64_t tick;
     float r_scale = 1.0f, g_scale = 1.0f, b_scale = 1.0f, exp_comp = 1.0f;
@@ -1051,6 +1436,75 @@ _camera_client_query_frame(CameraClient* cc, QemudClient* qc, const char* param)
         return;
     }
 
+#if CAMERA_CAPTURE_THREAD
+    qemu_mutex_lock(&cap->lock);
+
+    /* New conversion parameters are picked up by the capture thread with the
+     * next frame it reads from the device. */
+    cap->r_scale = r_scale;
+    cap->g_scale = g_scale;
+    cap->b_scale = b_scale;
+    cap->exp_comp = exp_comp;
+    if (preview_size) {
+        cap->want_preview = 1;
+    }
+
+    /* Take the freshest frame captured since the last query. If there is none,
+     * the cached frames are still good, unless there is nothing cached yet, or
+     * a preview frame is requested, and the cached one doesn't have it. In
+     * that case wait for a suitable frame for up to 2 seconds (see the comment
+     * for the synchronous version below). */
+    tick = _get_timestamp();
+    fresh = 0;
+    for (;;) {
+        uint64_t elapsed;
+
+        res = _camera_capture_take_frame(cc);
+        if (res < 0) {
+            break;
+        }
+        fresh |= res;
+        ready = (fresh || cc->frames_cached) &&
+                (preview_size == 0 || cap->previews[cap->front]);
+        elapsed = _get_timestamp() - tick;
+        if (ready || cap->error != 0 || elapsed >= 2000000LL) {
+            break;
+        }
+        qemu_cond_timedwait(&cap->frame_cond, &cap->lock,
+                            (2000000LL - elapsed) / 1000 + 1);
+    }
+    qemu_mutex_unlock(&cap->lock);
+
+    if (res < 0) {
+        E("%s: Not enough memory for framebuffers", __FUNCTION__);
+        _qemu_client_reply_ko(qc, "Out of memory");
+        return;
+    } else if (cap->error != 0 && !fresh) {
+        /* Capture thread has given up on the device. */
+        E("%s: Unable to obtain video frame from the camera '%s': %s.",
+          __FUNCTION__, cc->device_name, strerror(cap->error));
+        _qemu_client_reply_ko(qc, strerror(cap->error));
+        return;
+    } else if (!ready) {
+        /* Waited too long for the first frame, or for a preview frame. */
+        E("%s: Unable to obtain first video frame from the camera '%s' in %d milliseconds.",
+          __FUNCTION__, cc->device_name,
+          (uint32_t)(_get_timestamp() - tick) / 1000);
+        _qemu_client_reply_ko(qc, "Unable to obtain video frame from the camera");
+        return;
+    }
+    if (!fresh) {
+        cc->stats.repeated++;
+    }
+#else   /* CAMERA_CAPTURE_THREAD */
+    /* Frames sent in reply to the previous query may still be waiting to be
+     * read by the guest. Don't overwrite them. */
+    if (_camera_client_own_frames(cc)) {
+        E("%s: Not enough memory for framebuffers", __FUNCTION__);
+        _qemu_client_reply_ko(qc, "Out of memory");
+        return;
+    }
+
     /*
      * Initialize framebuffer array for frame read.
      */
@@ -1105,8 +1559,18 @@ _camera_client_query_frame(CameraClient* cc, QemudClient* qc, const char* param)
         return;
     }
 
+    if (repeat == 0) {
+        cc->frame_stamp = _get_timestamp();
+        _camera_client_frame_captured(cc, tick, cc->frame_stamp);
+    } else {
+        cc->stats.repeated++;
+    }
+#endif  /* CAMERA_CAPTURE_THREAD */
+
     /* We have cached something... */
     cc->frames_cached = 1;
+    cc->stats.delivered++;
+    cc->stats.age_total += _get_timestamp() - cc->frame_stamp;
 
     /*
      * Build the reply.
@@ -1129,12 +1593,13 @@ _camera_client_query_frame(CameraClient* cc, QemudClient* qc, const char* param)
 
     /* After that send video frame (if requested). */
     if (video_size) {
-        qemud_client_send(qc, cc->video_frame, video_size);
+        qemud_client_send_buffer(qc, cc->frame_buffer, 0, video_size);
     }
 
     /* After that send preview frame (if requested). */
     if (preview_size) {
-        qemud_client_send(qc, (const uint8_t*)cc->preview_frame, preview_size);
+        qemud_client_send_buffer(qc, cc->frame_buffer, cc->video_frame_size,
+                                 preview_size);
     }
 }
 
@@ -1306,3 +1771,49 @@ android_list_web_cameras(void)
     }
     printf("\n");
 }
+
+int
+android_camera_get_stats(AndroidCameraStats* stats, int max)
+{
+    CameraClient* cc;
+    int n = 0;
+
+    for (cc = _camera_clients; cc != NULL && n < max; cc = cc->next, n++) {
+        AndroidCameraStats* st = stats + n;
+        CameraStats cs;
+
+#if CAMERA_CAPTURE_THREAD
+        /* Capture thread updates the counters under the lock. */
+        if (cc->capture.started) {
+            qemu_mutex_lock(&cc->capture.lock);
+            cs = cc->stats;
+            qemu_mutex_unlock(&cc->capture.lock);
+        } else {
+            cs = cc->stats;
+        }
+#else
+        cs = cc->stats;
+#endif
+
+        memset(st, 0, sizeof(*st));
+        snprintf(st->device_name, sizeof(st->device_name), "%s",
+                 cc->device_name);
+        st->started = cc->video_frame != NULL;
+        st->width = cc->width;
+        st->height = cc->height;
+        st->captured = cs.captured;
+        st->dropped = cs.dropped;
+        st->delivered = cs.delivered;
+        st->repeated = cs.repeated;
+        st->errors = cs.errors;
+        st->latency_max = cs.latency_max;
+        if (cs.captured != 0) {
+            st->latency_avg = cs.latency_total / cs.captured;
+        }
+        if (cs.delivered != 0) {
+            st->age_avg = cs.age_total / cs.delivered;
+        }
+    }
+
+    return n;
+}
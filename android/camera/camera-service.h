@@ -21,10 +21,47 @@
  * Contains public camera service API.
  */
 
+#include <stdint.h>
+
 /* Initializes camera emulation service over qemu pipe. */
 extern void android_camera_service_init(void);
 
 /* Lists available web cameras. */
 extern void android_list_web_cameras(void);
 
+/* Frame capturing statistics of an emulated web camera. */
+typedef struct AndroidCameraStats {
+    /* Device name of the camera. */
+    char        device_name[64];
+    /* Non-zero if the camera is capturing, and frame dimensions. */
+    int         started;
+    int         width;
+    int         height;
+    /* Frames read from the camera device. */
+    uint64_t    captured;
+    /* Captured frames replaced by a newer one before the guest asked for them. */
+    uint64_t    dropped;
+    /* Frames sent to the guest, and how many of them were sent again because
+     * no new frame was captured in the meantime. */
+    uint64_t    delivered;
+    uint64_t    repeated;
+    /* Failed reads from the camera device. */
+    uint64_t    errors;
+    /* Average, and maximum time needed to read and convert a frame (usec). */
+    uint64_t    latency_avg;
+    uint64_t    latency_max;
+    /* Average age of the frames sent to the guest (usec). */
+    uint64_t    age_avg;
+} AndroidCameraStats;
+
+/* Collects frame capturing statistics of the emulated web cameras that the
+ * guest is connected to.
+ * Param:
+ *  stats - Array where to store the statistics.
+ *  max - Number of entries in the 'stats' array.
+ * Return:
+ *  Number of entries stored in the array.
+ */
+extern int android_camera_get_stats(AndroidCameraStats* stats, int max);
+
 #endif  /* ANDROID_CAMERA_CAMERA_SERVICE_H_ */
@@ -17,6 +17,7 @@
 #define CONFIG_SKINS    1
 #define CONFIG_TRACE    1
 #define CONFIG_FDATASYNC    1
+#define CONFIG_LINUX_AIO    1
 #define CONFIG_NAND_LIMITS  1
 #define QEMU_VERSION    "0.10.50"
 #define QEMU_PKGVERSION "Android"
@@ -38,8 +38,13 @@
 #include "android/utils/stralloc.h"
 #include "android/config/config.h"
 #include "tcpdump.h"
+#include "netstats.h"
 #include "net.h"
 #include "monitor.h"
+#include "block.h"
+#include "hw/goldfish_nand.h"
+#include "qemu-objects.h"
+#include "qjson.h"
 
 #include <stdlib.h>
 #include <stdio.h>
@@ -50,6 +55,8 @@
 #include "android/hw-events.h"
 #include "user-events.h"
 #include "android/hw-sensors.h"
+#include "android/camera/camera-service.h"
+#include "audio/audio.h"
 #include "android/keycode-array.h"
 #include "android/charmap.h"
 #include "android/display-core.h"
@@ -809,6 +816,13 @@ static const CommandDefRec  network_capture_commands[] =
       "into a specific <file>. This will stop any capture already in progress.\r\n"
       "the capture file can later be analyzed by tools like WireShark. It uses\r\n"
       "the libpcap file format.\r\n\r\n"
+      "options can be appended to <file>, separated by commas:\r\n\r\n"
+      "   snaplen=<bytes>   only save the first <bytes> of each packet\r\n"
+      "   rotate=<size>     switch to <file>.1, <file>.2, ... when a file would\r\n"
+      "                     exceed <size> bytes (k, m or g suffix allowed)\r\n"
+      "   files=<count>     keep at most <count> rotated files, then overwrite\r\n"
+      "                     the oldest one (default 10)\r\n"
+      "   filter=<expr>     only save packets matching <expr>, see 'emulator -help-tcpdump'\r\n\r\n"
       "you can stop the capture anytime with 'network capture stop'\r\n", NULL,
       do_network_capture_start, NULL },
 
@@ -820,6 +834,149 @@ static const CommandDefRec  network_capture_commands[] =
     { NULL, NULL, NULL, NULL, NULL, NULL }
 };
 
+static int
+do_network_dns_stats( ControlClient  client, char*  args )
+{
+    SlirpDnsCacheStats  stats;
+
+    slirp_dns_cache_stats( &stats );
+    control_write( client, "  entries:        %u\r\n", stats.entries );
+    control_write( client, "  hits:           %u\r\n", stats.hits );
+    control_write( client, "  negative hits:  %u\r\n", stats.negative_hits );
+    control_write( client, "  misses:         %u\r\n", stats.misses );
+    control_write( client, "  coalesced:      %u\r\n", stats.coalesced );
+    control_write( client, "  expired:        %u\r\n", stats.expired );
+    control_write( client, "  evicted:        %u\r\n", stats.evicted );
+    return 0;
+}
+
+static int
+do_network_dns_flush( ControlClient  client, char*  args )
+{
+    slirp_dns_cache_flush();
+    return 0;
+}
+
+static const CommandDefRec  network_dns_commands[] =
+{
+    { "stats", "dump DNS cache statistics",
+      "'network dns stats' reports how many guest DNS queries were answered from\r\n"
+      "the emulator's DNS cache, merged with an identical query in flight, or\r\n"
+      "forwarded to the host resolvers.\r\n", NULL,
+      do_network_dns_stats, NULL },
+
+    { "flush", "clear the DNS cache",
+      "'network dns flush' drops all cached DNS answers, including negative ones.\r\n", NULL,
+      do_network_dns_flush, NULL },
+
+    { NULL, NULL, NULL, NULL, NULL, NULL }
+};
+
+static void
+dump_network_counters( ControlClient  client, const char*  label, const NetStatsCounters*  c )
+{
+    control_write( client, "    %s %llu packets, %llu bytes, %u retransmits",
+                   label,
+                   (unsigned long long)c->packets,
+                   (unsigned long long)c->bytes,
+                   c->retransmits );
+    if (c->delay_count > 0)
+        control_write( client, ", delay avg %llu ms max %u ms",
+                       (unsigned long long)(c->delay_total_ms / c->delay_count),
+                       c->delay_max_ms );
+    control_write( client, "\r\n" );
+}
+
+static void
+dump_network_histogram( ControlClient  client, const char*  label, const NetStatsCounters*  c )
+{
+    int  nn;
+
+    control_write( client, "  %s delay histogram (ms):", label );
+    for (nn = 0; nn < NETSTATS_DELAY_BUCKETS; nn++) {
+        if (c->delay_hist[nn] == 0)
+            continue;
+        if (nn == NETSTATS_DELAY_BUCKETS-1)
+            control_write( client, " >=%d:%u", netstats_bucket_min_ms(nn), c->delay_hist[nn] );
+        else
+            control_write( client, " %d-%d:%u", netstats_bucket_min_ms(nn),
+                           netstats_bucket_min_ms(nn+1)-1, c->delay_hist[nn] );
+    }
+    control_write( client, "\r\n" );
+}
+
+static int
+do_network_stats( ControlClient  client, char*  args )
+{
+    NetFlowStats*   flows;
+    NetStatsTotals  totals;
+    int             count, nn;
+
+    if (args != NULL && !strcmp(args, "reset")) {
+        netstats_reset();
+        return 0;
+    }
+
+    if (args != NULL && !strncmp(args, "json", 4) && (args[4] == 0 || args[4] == ' ')) {
+        STRALLOC_DEFINE(out);
+        char*  path = args + 4;
+
+        while (*path == ' ')
+            path++;
+
+        netstats_dump_json(out);
+        if (*path) {
+            FILE*  f = fopen(path, "w");
+            if (f == NULL) {
+                control_write( client, "KO: could not create '%s': %s\r\n", path, strerror(errno) );
+                stralloc_reset(out);
+                return -1;
+            }
+            fwrite(out->s, 1, out->n, f);
+            fclose(f);
+        } else {
+            control_control_write( client, out->s, out->n );
+        }
+        stralloc_reset(out);
+        return 0;
+    }
+
+    if (args != NULL) {
+        control_write( client, "KO: invalid argument, see 'help network stats'\r\n" );
+        return -1;
+    }
+
+    netstats_get_totals(&totals);
+    control_write( client, "%u active flows, %u evicted\r\n",
+                   totals.active_flows, totals.evicted_flows );
+    dump_network_counters( client, "total tx:", &totals.dir[NETSTATS_TX] );
+    dump_network_counters( client, "total rx:", &totals.dir[NETSTATS_RX] );
+    dump_network_histogram( client, "tx", &totals.dir[NETSTATS_TX] );
+    dump_network_histogram( client, "rx", &totals.dir[NETSTATS_RX] );
+
+    flows = malloc(NETSTATS_MAX_FLOWS * sizeof(NetFlowStats));
+    if (flows == NULL)
+        return 0;
+
+    count = netstats_get_flows(flows, NETSTATS_MAX_FLOWS);
+    for (nn = 0; nn < count; nn++) {
+        const NetFlowStats*  f = &flows[nn];
+        const char*          proto = (f->proto == 6)  ? "tcp"  :
+                                     (f->proto == 17) ? "udp"  :
+                                     (f->proto == 1)  ? "icmp" : "ip";
+
+        control_write( client, "  %-4s %u.%u.%u.%u:%d <-> %u.%u.%u.%u:%d\r\n", proto,
+                       (f->guest_ip >> 24) & 255, (f->guest_ip >> 16) & 255,
+                       (f->guest_ip >> 8) & 255, f->guest_ip & 255, f->guest_port,
+                       (f->remote_ip >> 24) & 255, (f->remote_ip >> 16) & 255,
+                       (f->remote_ip >> 8) & 255, f->remote_ip & 255, f->remote_port );
+        dump_network_counters( client, "tx:", &f->dir[NETSTATS_TX] );
+        dump_network_counters( client, "rx:", &f->dir[NETSTATS_RX] );
+    }
+    free(flows);
+    return 0;
+}
+
 static const CommandDefRec  network_commands[] =
 {
     { "status", "dump network status", NULL, NULL,
@@ -831,10 +988,23 @@ static const CommandDefRec  network_commands[] =
     { "delay", "change network latency", NULL, describe_network_delay,
        do_network_delay, NULL },
 
+    { "stats", "dump per-flow network statistics",
+      "'network stats' lists the network flows of the emulated device, busiest first,\r\n"
+      "with packet and byte counts, TCP retransmits and the queueing delay added by\r\n"
+      "the 'network speed' and 'network delay' settings, in each direction.\r\n\r\n"
+      "'network stats json [<file>]' dumps the same data, including the delay\r\n"
+      "histograms, as JSON to the console or to <file>.\r\n\r\n"
+      "'network stats reset' clears all statistics.\r\n", NULL,
+      do_network_stats, NULL },
+
     { "capture", "dump network packets to file",
       "allows to start/stop capture of network packets to a file for later analysis\r\n", NULL,
       NULL, network_capture_commands },
 
+    { "dns", "manage the DNS cache",
+      "allows to inspect or clear the cache of DNS answers sent to the emulated device\r\n", NULL,
+      NULL, network_dns_commands },
+
     { NULL, NULL, NULL, NULL, NULL, NULL }
 };
 
@@ -2931,6 +3101,55 @@ do_sensors_status( ControlClient client, char* args )
     return 0;
 }
 
+/* replay a sensor trace file */
+static int
+do_sensors_playback_start( ControlClient client, char* args )
+{
+    char*  loop;
+    int    do_loop = 0;
+
+    if (!args) {
+        control_write( client, "KO: missing <file> argument, see 'help sensor playback start'\r\n" );
+        return -1;
+    }
+    loop = strrchr( args, ' ' );
+    if (loop != NULL && !strcmp( loop + 1, "loop" )) {
+        *loop = 0;
+        do_loop = 1;
+    }
+    if (android_sensors_playback_start( args, do_loop ) < 0) {
+        control_write( client, "KO: could not replay '%s': %s\r\n", args, strerror(errno) );
+        return -1;
+    }
+    return 0;
+}
+
+static int
+do_sensors_playback_stop( ControlClient client, char* args )
+{
+    android_sensors_playback_stop();
+    return 0;
+}
+
+static const CommandDefRec sensor_playback_commands[] =
+{
+    { "start", "replay a sensor trace file",
+      "'sensor playback start <file> [loop]' replays the sensor value changes recorded in\r\n"
+      "<file> at their original rate, replacing any replay in progress. each line of\r\n"
+      "<file> has the following format:\r\n\r\n"
+      "   <time_us> <sensorname> <value-a>[:<value-b>[:<value-c>]]\r\n\r\n"
+      "where times are in micro-seconds and must not decrease. lines starting with\r\n"
+      "'#' are ignored. with 'loop', the replay restarts when the trace ends.\r\n", NULL,
+      do_sensors_playback_start, NULL },
+
+    { "stop", "stop replaying a sensor trace file",
+      "'sensor playback stop' stops the current sensor trace replay, if any.\r\n"
+      "sensors keep their last replayed values.\r\n", NULL,
+      do_sensors_playback_stop, NULL },
+
+    { NULL, NULL, NULL, NULL, NULL, NULL }
+};
+
 /* Sensor commands for get/set sensor values and get available sensor names. */
 static const CommandDefRec sensor_commands[] =
 {
@@ -2946,6 +3165,10 @@ static const CommandDefRec sensor_commands[] =
       "'set <sensorname> <value-a>[:<value-b>[:<value-c>]]' set the values of a given sensor.\r\n",
       NULL, do_sensors_set, NULL },
 
+    { "playback", "replay sensor traces",
+      "allows you to replay recorded sensor values at their original rate\r\n",
+      NULL, NULL, sensor_playback_commands },
+
     { NULL, NULL, NULL, NULL, NULL, NULL }
 };
 
@@ -3795,6 +4018,92 @@ static const CommandDefRec bt_commands[] =
     { NULL, NULL, NULL, NULL, NULL, NULL }
 };
 
+/********************************************************************************************/
+/********************************************************************************************/
+/*****                                                                                 ******/
+/*****                          D I S K   C O M M A N D S                              ******/
+/*****                                                                                 ******/
+/********************************************************************************************/
+/********************************************************************************************/
+
+static int
+do_disk_stats( ControlClient  client, char*  args )
+{
+    QObject*  block;
+    QObject*  nand;
+
+    if (args != NULL && !strcmp(args, "reset")) {
+        bdrv_reset_stats();
+        nand_dev_reset_stats();
+        return 0;
+    }
+
+    if (args != NULL && !strncmp(args, "json", 4) && (args[4] == 0 || args[4] == ' ')) {
+        QDict*     all = qdict_new();
+        QString*   json;
+        char*      path = args + 4;
+        int        ret = 0;
+
+        while (*path == ' ')
+            path++;
+
+        bdrv_info_stats(NULL, &block);
+        nand_dev_info_stats(NULL, &nand);
+        qdict_put_obj(all, "block", block);
+        qdict_put_obj(all, "nand", nand);
+        json = qobject_to_json(QOBJECT(all));
+
+        if (*path) {
+            FILE*  f = fopen(path, "w");
+            if (f == NULL) {
+                control_write( client, "KO: could not create '%s': %s\r\n", path, strerror(errno) );
+                ret = -1;
+            } else {
+                fprintf(f, "%s\n", qstring_get_str(json));
+                fclose(f);
+            }
+        } else {
+            control_control_write( client, qstring_get_str(json), -1 );
+            control_write( client, "\r\n" );
+        }
+        QDECREF(json);
+        QDECREF(all);
+        return ret;
+    }
+
+    if (args != NULL) {
+        control_write( client, "KO: invalid argument, see 'help disk stats'\r\n" );
+        return -1;
+    }
+
+    Monitor *out = monitor_fake_new(client, control_write_out_cb);
+    bdrv_info_stats(out, &block);
+    bdrv_stats_print(out, block);
+    qobject_decref(block);
+    nand_dev_info_stats(out, &nand);
+    nand_dev_stats_print(out, nand);
+    qobject_decref(nand);
+    monitor_fake_free(out);
+    return 0;
+}
+
+static const CommandDefRec  disk_commands[] =
+{
+    { "stats", "dump disk I/O statistics",
+      "'disk stats' reports, for every block device and NAND partition, the bytes and\r\n"
+      "requests transferred and the latency of the read, write, flush and erase\r\n"
+      "requests: count, average, maximum and the non-empty buckets of a log2\r\n"
+      "histogram in microseconds. Failed block requests are counted separately, and\r\n"
+      "are left out of the other figures.\r\n\r\n"
+      "'disk stats json [<file>]' dumps the same data, including the complete\r\n"
+      "histograms, as JSON to the console or to <file>.\r\n\r\n"
+      "'disk stats reset' clears all statistics.\r\n", NULL,
+      do_disk_stats, NULL },
+
+    { NULL, NULL, NULL, NULL, NULL, NULL }
+};
+
+
 /********************************************************************************************/
 /********************************************************************************************/
 /*****                                                                                 ******/
@@ -4100,6 +4409,121 @@ static const CommandDefRec  qemu_commands[] =
 };
 
 
+/********************************************************************************************/
+/********************************************************************************************/
+/*****                                                                                 ******/
+/*****                         C A M E R A   C O M M A N D S                           ******/
+/*****                                                                                 ******/
+/********************************************************************************************/
+/********************************************************************************************/
+
+#define  MAX_CAMERA_STATS  8
+
+static int
+do_camera_stats( ControlClient  client, char*  args )
+{
+    AndroidCameraStats  stats[MAX_CAMERA_STATS];
+    int                 count = android_camera_get_stats( stats, MAX_CAMERA_STATS );
+    int                 nn;
+
+    if (count == 0) {
+        control_write( client, "  no camera is connected\r\n" );
+        return 0;
+    }
+    for (nn = 0; nn < count; nn++) {
+        AndroidCameraStats*  st = &stats[nn];
+
+        if (st->started)
+            control_write( client, "  %s: capturing %dx%d\r\n",
+                           st->device_name, st->width, st->height );
+        else
+            control_write( client, "  %s: stopped\r\n", st->device_name );
+        control_write( client, "    captured:  %llu frames, %llu dropped, %llu errors\r\n",
+                       (unsigned long long)st->captured,
+                       (unsigned long long)st->dropped,
+                       (unsigned long long)st->errors );
+        control_write( client, "    delivered: %llu frames, %llu repeated\r\n",
+                       (unsigned long long)st->delivered,
+                       (unsigned long long)st->repeated );
+        control_write( client, "    capture latency avg %llu us max %llu us, frame age avg %llu us\r\n",
+                       (unsigned long long)st->latency_avg,
+                       (unsigned long long)st->latency_max,
+                       (unsigned long long)st->age_avg );
+    }
+    return 0;
+}
+
+static const CommandDefRec  camera_commands[] =
+{
+    { "stats", "dump web camera capture statistics",
+      "'camera stats' reports, for each web camera the guest is connected to, how many\r\n"
+      "frames were captured from the host device, dropped before the guest asked for\r\n"
+      "them, and delivered to the guest, along with capture latency and the average\r\n"
+      "age of the delivered frames. Counters are reset when capturing starts.\r\n", NULL,
+      do_camera_stats, NULL },
+
+    { NULL, NULL, NULL, NULL, NULL, NULL }
+};
+
+
+/********************************************************************************************/
+/********************************************************************************************/
+/*****                                                                                 ******/
+/*****                            A U D I O   C O M M A N D S                          ******/
+/*****                                                                                 ******/
+/********************************************************************************************/
+/********************************************************************************************/
+
+static int
+do_audio_stats( ControlClient  client, char*  args )
+{
+    AudioStats  st;
+
+    if (args && !strcmp(args, "reset")) {
+        AUD_reset_stats();
+        return 0;
+    }
+    if (args && args[0]) {
+        control_write( client, "KO: bad argument, use 'audio stats [reset]'\r\n" );
+        return -1;
+    }
+
+    AUD_get_stats( &st );
+    if (st.period)
+        control_write( client, "  timer: period %lld us\r\n",
+                       (long long)(st.period / 1000) );
+    else
+        control_write( client, "  timer: idle\r\n" );
+    control_write( client, "  wakeups: %llu, kicks: %llu, idle periods: %llu\r\n",
+                   (unsigned long long)st.wakeups,
+                   (unsigned long long)st.kicks,
+                   (unsigned long long)st.idle_entries );
+    control_write( client, "  output latency avg %lld us max %lld us\r\n",
+                   (long long)(st.latency_avg / 1000),
+                   (long long)(st.latency_max / 1000) );
+    control_write( client, "  timer lateness avg %lld us max %lld us\r\n",
+                   (long long)(st.lateness_avg / 1000),
+                   (long long)(st.lateness_max / 1000) );
+    control_write( client, "  mixing time avg %lld us max %lld us\r\n",
+                   (long long)(st.run_avg / 1000),
+                   (long long)(st.run_max / 1000) );
+    return 0;
+}
+
+static const CommandDefRec  audio_commands[] =
+{
+    { "stats", "dump audio scheduling statistics",
+      "'audio stats' reports how many times the audio timer ran, how many times cards\r\n"
+      "asked for an early run because new data was queued, and how often the timer\r\n"
+      "stopped because all voices were idle. It also reports the output latency added\r\n"
+      "by the mixer, how late the timer fired and the host time spent mixing.\r\n"
+      "'audio stats reset' clears them.\r\n", NULL,
+      do_audio_stats, NULL },
+
+    { NULL, NULL, NULL, NULL, NULL, NULL }
+};
+
+
 /********************************************************************************************/
 /********************************************************************************************/
 /*****                                                                                 ******/
@@ -4204,6 +4628,18 @@ static const CommandDefRec   main_commands[] =
       "allows you to retrieve BT status or add/remove remote devices\r\n", NULL,
       NULL, bt_commands },
 
+    { "audio", "audio related commands",
+      "allows you to inspect the audio scheduling\r\n", NULL,
+      NULL, audio_commands },
+
+    { "disk", "disk related commands",
+      "allows you to inspect the I/O statistics of the block devices and NAND partitions\r\n", NULL,
+      NULL, disk_commands },
+
+    { "camera", "web camera related commands",
+      "allows you to monitor emulated web cameras\r\n", NULL,
+      NULL, camera_commands },
+
     { NULL, NULL, NULL, NULL, NULL, NULL }
 };
 
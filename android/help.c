@@ -274,6 +274,15 @@ help_environment(stralloc_t*  out)
     "  If ANDROID_SDK_ROOT is defined, it indicates the path of the SDK\n"
     "  installation directory.\n\n"
 
+    "  If ANDROID_VIRTUAL_CAMERA is defined, it enables the 'webcam-virtual'\n"
+    "  camera on Linux hosts, using the following format:\n\n"
+
+    "      on | <width>x<height>[@<fps>][,format=<fmt>][,file=<path>]\n\n"
+
+    "  where <fmt> is one of yv12, yu12, nv12, nv21 or yuyv, and <path> is a file\n"
+    "  of raw frames to play back in a loop instead of the animated test pattern.\n"
+    "  'on' is equivalent to 640x480@30,format=yv12.\n\n"
+
     );
 }
 
@@ -1388,6 +1397,21 @@ help_tcpdump(stralloc_t  *out)
     "  note that this captures all Ethernet packets, and is not limited to TCP\n"
     "  connections.\n\n"
 
+    "  the capture can be tuned by appending comma-separated options to <file>:\n\n"
+    "    -tcpdump <file>,snaplen=<bytes>     only save the first <bytes> of each packet\n"
+    "    -tcpdump <file>,rotate=<size>       switch to <file>.1, <file>.2, ... whenever\n"
+    "                                        the current file would exceed <size>\n"
+    "                                        (a suffix of k, m or g can be used)\n"
+    "    -tcpdump <file>,rotate=<size>,files=<count>\n"
+    "                                        keep at most <count> files, then\n"
+    "                                        overwrite the oldest (default 10)\n"
+    "    -tcpdump \"<file>,filter=<expr>\"   only save packets matching <expr>\n\n"
+
+    "  filter expressions support 'ip', 'arp', 'tcp', 'udp', 'icmp',\n"
+    "  '[src|dst] host <a.b.c.d>' and '[src|dst] port <number>', combined with\n"
+    "  'and', 'or', 'not' and parentheses, e.g.:\n\n"
+    "    -tcpdump \"/tmp/http.pcap,snaplen=128,filter=tcp and port 80\"\n\n"
+
     "  you can also start/stop the packet capture dynamically through the console;\n"
     "  see the 'network capture start' and 'network capture stop' commands for\n"
     "  details.\n\n"
@@ -1476,6 +1500,8 @@ help_camera_back(stralloc_t* out)
 
     "     emulated  -> camera will be emulated using software ('fake') camera emulation\n"
     "     webcam<N> -> camera will be emulated using a webcamera connected to the host\n"
+    "     webcam-virtual -> camera will be emulated using a synthetic frame source\n"
+    "                  (Linux only, see 'ANDROID_VIRTUAL_CAMERA' in -help-environment)\n"
     "     none      -> camera emulation will be disabled\n\n"
     );
 }
@@ -1489,6 +1515,8 @@ help_camera_front(stralloc_t* out)
 
     "     emulated  -> camera will be emulated using software ('fake') camera emulation\n"
     "     webcam<N> -> camera will be emulated using a webcamera connected to the host\n"
+    "     webcam-virtual -> camera will be emulated using a synthetic frame source\n"
+    "                  (Linux only, see 'ANDROID_VIRTUAL_CAMERA' in -help-environment)\n"
     "     none      -> camera emulation will be disabled\n\n"
     );
 }
@@ -217,6 +217,11 @@ typedef enum {
 
 #define  BUFFER_SIZE    MAX_SERIAL_PAYLOAD
 
+/* outgoing packets are batched into bursts of up to this many bytes,
+ * see qemud_serial_send()
+ */
+#define  OUT_BUFFER_SIZE  (4*(HEADER_SIZE + MAX_SERIAL_PAYLOAD))
+
 /* out of convenience, the incoming message is zero-terminated
  * and can be modified by the receiver (e.g. for tokenization).
  */
@@ -237,6 +242,11 @@ typedef struct QemudSerial {
     QemudSink     payload[1];
     uint8_t       data0[MAX_SERIAL_PAYLOAD+1];
 
+    /* outgoing packets not yet written to the serial port */
+    int           out_len;
+    QEMUBH*       out_bh;
+    uint8_t       out[OUT_BUFFER_SIZE];
+
     /* receiver */
     QemudSerialReceive  recv_func;    /* receiver callback */
     void*               recv_opaque;  /* receiver user-specific data */
@@ -315,12 +325,63 @@ qemud_serial_can_read( void*  opaque )
         return s->overflow;
     }
 
-    /* if in_size is 0, we're reading the header */
-    if (s->need_header)
-        return qemud_sink_needed(s->header);
+    /* qemud_serial_read() buffers partial headers and payloads in the
+     * sinks, so accept a whole packet at once: this lets it parse all
+     * the packets of a burst in a single call.
+     */
+    return HEADER_SIZE + MAX_SERIAL_PAYLOAD;
+}
+
+/* extract the payload length and channel id from a packet header,
+ * detecting the daemon version with the first one.
+ */
+static void
+qemud_serial_parse_header( QemudSerial*  s, const uint8_t*  header )
+{
+#if SUPPORT_LEGACY_QEMUD
+    if (s->version == QEMUD_VERSION_UNKNOWN) {
+        /* if we receive "001200" as the first header, then we
+         * detected a legacy qemud daemon. See the comments
+         * in qemud_serial_send_legacy_probe() for details.
+         */
+        if ( !memcmp(header, "001200", 6) ) {
+            D("%s: legacy qemud detected.", __FUNCTION__);
+            s->version = QEMUD_VERSION_LEGACY;
+            /* tell the modem to use legacy emulation mode */
+            int i;
+            AModem modem;
+            for (i = 0; i < amodem_num_devices; i++) {
+                if ((modem = amodem_get_instance(i)) != NULL) {
+                    amodem_set_legacy(modem);
+                }
+            }
+        } else {
+            D("%s: normal qemud detected.", __FUNCTION__);
+            s->version = QEMUD_VERSION_NORMAL;
+        }
+    }
 
-    /* otherwise, we're reading the payload */
-    return qemud_sink_needed(s->payload);
+    if (s->version == QEMUD_VERSION_LEGACY) {
+        s->in_size     = hex2int( header + LEGACY_LENGTH_OFFSET,  LENGTH_SIZE );
+        s->in_channel  = hex2int( header + LEGACY_CHANNEL_OFFSET, CHANNEL_SIZE );
+        return;
+    }
+#endif
+    /* extract payload length + channel id */
+    s->in_size     = hex2int( header + LENGTH_OFFSET,  LENGTH_SIZE );
+    s->in_channel  = hex2int( header + CHANNEL_OFFSET, CHANNEL_SIZE );
+}
+
+/* zero-terminate the payload in data0, then send it to the receiver */
+static void
+qemud_serial_dispatch( QemudSerial*  s )
+{
+    s->data0[s->in_size] = 0;
+    D("%s: channel=%2d len=%3d '%s'", __FUNCTION__,
+      s->in_channel, s->in_size,
+      quote_bytes((const void*)s->data0, s->in_size));
+
+    s->recv_func( s->recv_opaque, s->in_channel, s->data0, s->in_size );
 }
 
 /* called by the charpipe to read data from the serial
@@ -345,53 +406,30 @@ qemud_serial_read( void*  opaque, const uint8_t*  from, int  len )
 
             from += avail;
             len  -= avail;
+            s->overflow -= avail;
             continue;
         }
 
         /* read header if needed */
         if (s->need_header) {
-            if (!qemud_sink_fill(s->header, (const uint8_t**)&from, &len))
-                break;
+            const uint8_t*  header;
 
-#if SUPPORT_LEGACY_QEMUD
-            if (s->version == QEMUD_VERSION_UNKNOWN) {
-                /* if we receive "001200" as the first header, then we
-                 * detected a legacy qemud daemon. See the comments
-                 * in qemud_serial_send_legacy_probe() for details.
-                 */
-                if ( !memcmp(s->data0, "001200", 6) ) {
-                    D("%s: legacy qemud detected.", __FUNCTION__);
-                    s->version = QEMUD_VERSION_LEGACY;
-                    /* tell the modem to use legacy emulation mode */
-                    int i;
-                    AModem modem;
-                    for (i = 0; i < amodem_num_devices; i++) {
-                        if ((modem = amodem_get_instance(i)) != NULL) {
-                            amodem_set_legacy(modem);
-                        }
-                    }
-                } else {
-                    D("%s: normal qemud detected.", __FUNCTION__);
-                    s->version = QEMUD_VERSION_NORMAL;
-                }
-            }
-
-            if (s->version == QEMUD_VERSION_LEGACY) {
-                s->in_size     = hex2int( s->data0 + LEGACY_LENGTH_OFFSET,  LENGTH_SIZE );
-                s->in_channel  = hex2int( s->data0 + LEGACY_CHANNEL_OFFSET, CHANNEL_SIZE );
+            if (s->header->used == 0 && len >= HEADER_SIZE) {
+                /* fast path: the whole header is in the input */
+                header = from;
+                from  += HEADER_SIZE;
+                len   -= HEADER_SIZE;
             } else {
-                s->in_size     = hex2int( s->data0 + LENGTH_OFFSET,  LENGTH_SIZE );
-                s->in_channel  = hex2int( s->data0 + CHANNEL_OFFSET, CHANNEL_SIZE );
+                if (!qemud_sink_fill(s->header, (const uint8_t**)&from, &len))
+                    break;
+                header = s->data0;
+                s->header->used = 0;
             }
-#else
-            /* extract payload length + channel id */
-            s->in_size     = hex2int( s->data0 + LENGTH_OFFSET,  LENGTH_SIZE );
-            s->in_channel  = hex2int( s->data0 + CHANNEL_OFFSET, CHANNEL_SIZE );
-#endif
-            s->header->used = 0;
+
+            qemud_serial_parse_header(s, header);
 
             if (s->in_size <= 0 || s->in_channel < 0) {
-                D("%s: bad header: '%.*s'", __FUNCTION__, HEADER_SIZE, s->data0);
+                D("%s: bad header: '%.*s'", __FUNCTION__, HEADER_SIZE, header);
                 continue;
             }
 
@@ -402,6 +440,15 @@ qemud_serial_read( void*  opaque, const uint8_t*  from, int  len )
                 continue;
             }
 
+            /* fast path: the whole payload is in the input too */
+            if (len >= s->in_size) {
+                memcpy(s->data0, from, s->in_size);
+                from += s->in_size;
+                len  -= s->in_size;
+                qemud_serial_dispatch(s);
+                continue;
+            }
+
             /* prepare 'in_data' for payload */
             s->need_header = 0;
             qemud_sink_reset(s->payload, s->in_size, s->data0);
@@ -411,13 +458,7 @@ qemud_serial_read( void*  opaque, const uint8_t*  from, int  len )
         if (!qemud_sink_fill(s->payload, &from, &len))
             break;
 
-        /* zero-terminate payload, then send it to receiver */
-        s->payload->buff[s->payload->size] = 0;
-        D("%s: channel=%2d len=%3d '%s'", __FUNCTION__,
-          s->in_channel, s->payload->size,
-          quote_bytes((const void*)s->payload->buff, s->payload->size));
-
-        s->recv_func( s->recv_opaque, s->in_channel, s->payload->buff, s->payload->size );
+        qemud_serial_dispatch(s);
 
         /* prepare for new header */
         s->need_header = 1;
@@ -486,6 +527,23 @@ qemud_serial_send_legacy_probe( QemudSerial*  s )
 }
 #endif /* SUPPORT_LEGACY_QEMUD */
 
+/* write the pending outgoing packets to the serial port in one burst */
+static void
+qemud_serial_flush( QemudSerial*  s )
+{
+    if (s->out_len > 0) {
+        T("%s: %d bytes", __FUNCTION__, s->out_len);
+        qemu_chr_write(s->cs, s->out, s->out_len);
+        s->out_len = 0;
+    }
+}
+
+static void
+qemud_serial_flush_bh( void*  opaque )
+{
+    qemud_serial_flush(opaque);
+}
+
 /* intialize a QemudSerial object with a charpipe endpoint
  * and a receiver.
  */
@@ -505,6 +563,9 @@ qemud_serial_init( QemudSerial*        s,
     s->in_size      = 0;
     s->in_channel   = -1;
 
+    s->out_len      = 0;
+    s->out_bh       = qemu_bh_new( qemud_serial_flush_bh, s );
+
 #if SUPPORT_LEGACY_QEMUD
     s->version = QEMUD_VERSION_UNKNOWN;
     qemud_serial_send_legacy_probe(s);
@@ -519,6 +580,14 @@ qemud_serial_init( QemudSerial*        s,
 
 /* send a message to the serial port. This will add the necessary
  * header.
+ *
+ * Packets are not written right away: they are appended to the 'out'
+ * buffer, which is flushed from a bottom half once the current event
+ * has been processed, or sooner if it fills up. All the messages sent
+ * while handling one event (e.g. the replies and unsolicited messages
+ * of several clients) thus reach the guest in a single serial write,
+ * instead of up to three writes per packet. The packets themselves are
+ * unchanged, so this works with any version of the daemon.
  */
 static void
 qemud_serial_send( QemudSerial*    s,
@@ -527,8 +596,7 @@ qemud_serial_send( QemudSerial*    s,
                    const uint8_t*  msg,
                    int             msglen )
 {
-    uint8_t   header[HEADER_SIZE];
-    uint8_t   frame[FRAME_HEADER_SIZE];
+    uint8_t*  header;
     int       avail, len = msglen;
 
     if (msglen <= 0 || channel < 0)
@@ -549,7 +617,11 @@ qemud_serial_send( QemudSerial*    s,
         if (avail > MAX_SERIAL_PAYLOAD)
             avail = MAX_SERIAL_PAYLOAD;
 
+        if (s->out_len + HEADER_SIZE + avail > OUT_BUFFER_SIZE)
+            qemud_serial_flush(s);
+
         /* write this packet's header */
+        header = s->out + s->out_len;
 #if SUPPORT_LEGACY_QEMUD
         if (s->version == QEMUD_VERSION_LEGACY) {
             int2hex(header + LEGACY_LENGTH_OFFSET,  LENGTH_SIZE,  avail);
@@ -563,24 +635,26 @@ qemud_serial_send( QemudSerial*    s,
         int2hex(header + CHANNEL_OFFSET, CHANNEL_SIZE, channel);
 #endif
         T("%s: '%.*s'", __FUNCTION__, HEADER_SIZE, header);
-        qemu_chr_write(s->cs, header, HEADER_SIZE);
+        s->out_len += HEADER_SIZE;
+        len        -= avail;
 
         /* insert frame header when needed */
         if (framing) {
-            int2hex(frame, FRAME_HEADER_SIZE, msglen);
-            T("%s: '%.*s'", __FUNCTION__, FRAME_HEADER_SIZE, frame);
-            qemu_chr_write(s->cs, frame, FRAME_HEADER_SIZE);
-            avail  -= FRAME_HEADER_SIZE;
-            len    -= FRAME_HEADER_SIZE;
-            framing = 0;
+            int2hex(s->out + s->out_len, FRAME_HEADER_SIZE, msglen);
+            T("%s: '%.*s'", __FUNCTION__, FRAME_HEADER_SIZE, s->out + s->out_len);
+            s->out_len += FRAME_HEADER_SIZE;
+            avail      -= FRAME_HEADER_SIZE;
+            framing     = 0;
         }
 
         /* write message content */
         T("%s: '%.*s'", __FUNCTION__, avail, msg);
-        qemu_chr_write(s->cs, msg, avail);
-        msg += avail;
-        len -= avail;
+        memcpy(s->out + s->out_len, msg, avail);
+        s->out_len += avail;
+        msg        += avail;
     }
+
+    qemu_bh_schedule(s->out_bh);
 }
 
 /** CLIENTS
@@ -593,11 +667,23 @@ qemud_serial_send( QemudSerial*    s,
  * available to write service's data to, So, we need to cache that data into the
  * client descriptor, and "send" them over to the client in _qemudPipe_recvBuffers
  * callback. Pending service data is stored in the client descriptor as a list
- * of QemudPipeMessage instances.
- */
+ * of QemudPipeMessage instances, each one referencing a QemudBuffer. Pipes
+ * have no MTU, so a message is never split, whatever its size.
+ */
+struct QemudBuffer {
+    /* Number of references to this buffer. */
+    int                 ref_count;
+    /* Buffer size. */
+    int                 size;
+    /* Buffer data, allocated right after this descriptor. */
+    uint8_t*            data;
+};
+
 typedef struct QemudPipeMessage QemudPipeMessage;
 struct QemudPipeMessage {
-    /* Message to send. */
+    /* Buffer containing the message. */
+    QemudBuffer*        buffer;
+    /* Message to send, inside the buffer. */
     uint8_t*            message;
     /* Message size. */
     size_t              size;
@@ -608,6 +694,54 @@ struct QemudPipeMessage {
     QemudPipeMessage*   next;
 };
 
+QemudBuffer*
+qemud_buffer_new( int  size )
+{
+    QemudBuffer*  buffer = malloc(sizeof(QemudBuffer) + size);
+
+    if (buffer != NULL) {
+        buffer->ref_count = 1;
+        buffer->size      = size;
+        buffer->data      = (uint8_t*)buffer + sizeof(QemudBuffer);
+    }
+    return buffer;
+}
+
+uint8_t*
+qemud_buffer_data( QemudBuffer*  buffer )
+{
+    return buffer->data;
+}
+
+QemudBuffer*
+qemud_buffer_ref( QemudBuffer*  buffer )
+{
+    buffer->ref_count += 1;
+    return buffer;
+}
+
+void
+qemud_buffer_unref( QemudBuffer*  buffer )
+{
+    if (buffer != NULL && --buffer->ref_count == 0) {
+        free(buffer);
+    }
+}
+
+int
+qemud_buffer_is_shared( QemudBuffer*  buffer )
+{
+    return buffer->ref_count > 1;
+}
+
+/* Frees a pipe message, and drops its buffer reference. */
+static void
+_qemud_pipe_message_free( QemudPipeMessage*  msg )
+{
+    qemud_buffer_unref(msg->buffer);
+    AFREE(msg);
+}
+
 
 /* A QemudClient models a single client as seen by the emulator.
  * Each client has its own channel id (for the serial qemud), or pipe descriptor
@@ -680,6 +814,8 @@ struct QemudClient {
         struct {
             QemudPipe*          qemud_pipe;
             QemudPipeMessage*   messages;
+            /* Last message in the list, or NULL if the list is empty. */
+            QemudPipeMessage*   messages_last;
         } Pipe;
     } ProtocolSelector;
 };
@@ -817,8 +953,9 @@ _qemud_client_free(QemudClient* c)
             while (*msg_list != NULL) {
                 QemudPipeMessage* to_free = *msg_list;
                 *msg_list = to_free->next;
-                free(to_free);
+                _qemud_pipe_message_free(to_free);
             }
+            c->ProtocolSelector.Pipe.messages_last = NULL;
         }
         if (c->param != NULL) {
             free(c->param);
@@ -915,8 +1052,9 @@ qemud_client_alloc( int               channel_id,
     if (channel_id < 0) {
         /* Allocating a pipe client. */
         c->protocol = QEMUD_PROTOCOL_PIPE;
-        c->ProtocolSelector.Pipe.messages   = NULL;
-        c->ProtocolSelector.Pipe.qemud_pipe = NULL;
+        c->ProtocolSelector.Pipe.messages      = NULL;
+        c->ProtocolSelector.Pipe.messages_last = NULL;
+        c->ProtocolSelector.Pipe.qemud_pipe    = NULL;
     } else {
         /* Allocating a serial client. */
         c->protocol = QEMUD_PROTOCOL_SERIAL;
@@ -1607,43 +1745,46 @@ qemud_client_new( QemudService*     service,
     return c;
 }
 
-/* Caches a service message into the client's descriptor.
+/* Queues a reference to a service message into the client's descriptor.
  *
  * See comments on QemudPipeMessage structure for more info.
  */
 static void
-_qemud_pipe_cache_buffer(QemudClient* client, const uint8_t*  msg, int  msglen)
+_qemud_pipe_queue_buffer(QemudClient* client, QemudBuffer* buffer,
+                         uint8_t* msg, int msglen)
 {
     QemudPipeMessage* buf;
-    QemudPipeMessage** ins_at = &client->ProtocolSelector.Pipe.messages;
-
-    /* Allocate descriptor big enough to contain message as well. */
-    buf = (QemudPipeMessage*)malloc(msglen + sizeof(QemudPipeMessage));
-    if (buf != NULL) {
-        /* Message starts right after the descriptor. */
-        buf->message = (uint8_t*)buf + sizeof(QemudPipeMessage);
-        buf->size = msglen;
-        memcpy(buf->message, msg, msglen);
-        buf->offset = 0;
-        buf->next = NULL;
-        while (*ins_at != NULL) {
-            ins_at = &(*ins_at)->next;
-        }
-        *ins_at = buf;
-        /* Notify the pipe that there is data to read. */
-        goldfish_pipe_wake(client->ProtocolSelector.Pipe.qemud_pipe->hwpipe,
-                           PIPE_WAKE_READ);
+
+    ANEW0(buf);
+    buf->buffer  = qemud_buffer_ref(buffer);
+    buf->message = msg;
+    buf->size    = msglen;
+    buf->offset  = 0;
+    buf->next    = NULL;
+
+    /* Append to the tail of the message list. */
+    if (client->ProtocolSelector.Pipe.messages_last != NULL) {
+        client->ProtocolSelector.Pipe.messages_last->next = buf;
+    } else {
+        client->ProtocolSelector.Pipe.messages = buf;
     }
+    client->ProtocolSelector.Pipe.messages_last = buf;
+
+    /* Notify the pipe that there is data to read. */
+    goldfish_pipe_wake(client->ProtocolSelector.Pipe.qemud_pipe->hwpipe,
+                       PIPE_WAKE_READ);
 }
 
 /* Sends service message to the client.
+ * The message, preceded by its frame header if needed, is copied into a
+ * single buffer: there is no MTU to honor on a pipe.
  */
 static void
 _qemud_pipe_send(QemudClient*  client, const uint8_t*  msg, int  msglen)
 {
-    uint8_t   frame[FRAME_HEADER_SIZE];
-    int       avail, len = msglen;
-    int framing = client->framing;
+    QemudBuffer*  buffer;
+    uint8_t*      data;
+    int           len = msglen;
 
     if (msglen <= 0)
         return;
@@ -1651,33 +1792,29 @@ _qemud_pipe_send(QemudClient*  client, const uint8_t*  msg, int  msglen)
     D("%s: len=%3d '%s'",
       __FUNCTION__, msglen, quote_bytes((const void*)msg, msglen));
 
-    if (framing) {
+    if (client->framing) {
         len += FRAME_HEADER_SIZE;
     }
 
-    /* packetize the payload for the serial MTU */
-    while (len > 0)
-    {
-        avail = len;
-        if (avail > MAX_SERIAL_PAYLOAD)
-            avail = MAX_SERIAL_PAYLOAD;
+    buffer = qemud_buffer_new(len);
+    if (buffer == NULL)
+        return;
 
-        /* insert frame header when needed */
-        if (framing) {
-            int2hex(frame, FRAME_HEADER_SIZE, msglen);
-            T("%s: '%.*s'", __FUNCTION__, FRAME_HEADER_SIZE, frame);
-            _qemud_pipe_cache_buffer(client, frame, FRAME_HEADER_SIZE);
-            avail  -= FRAME_HEADER_SIZE;
-            len    -= FRAME_HEADER_SIZE;
-            framing = 0;
-        }
+    data = qemud_buffer_data(buffer);
 
-        /* write message content */
-        T("%s: '%.*s'", __FUNCTION__, avail, msg);
-        _qemud_pipe_cache_buffer(client, msg, avail);
-        msg += avail;
-        len -= avail;
+    /* insert frame header when needed */
+    if (client->framing) {
+        int2hex(data, FRAME_HEADER_SIZE, msglen);
+        T("%s: '%.*s'", __FUNCTION__, FRAME_HEADER_SIZE, data);
+        data += FRAME_HEADER_SIZE;
     }
+
+    /* write message content */
+    T("%s: '%.*s'", __FUNCTION__, msglen, msg);
+    memcpy(data, msg, msglen);
+
+    _qemud_pipe_queue_buffer(client, buffer, qemud_buffer_data(buffer), len);
+    qemud_buffer_unref(buffer);
 }
 
 /* this can be used by a service implementation to send an answer
@@ -1695,6 +1832,39 @@ qemud_client_send ( QemudClient*  client, const uint8_t*  msg, int  msglen )
     }
 }
 
+/* same as qemud_client_send(), but pipe clients queue a reference to
+ * the buffer instead of copying its content.
+ */
+void
+qemud_client_send_buffer( QemudClient*  client,
+                          QemudBuffer*  buffer,
+                          int           offset,
+                          int           msglen )
+{
+    uint8_t*  msg = qemud_buffer_data(buffer) + offset;
+
+    if (msglen <= 0)
+        return;
+
+    if (!_is_pipe_client(client)) {
+        qemud_client_send(client, msg, msglen);
+        return;
+    }
+
+    D("%s: len=%3d", __FUNCTION__, msglen);
+
+    if (client->framing) {
+        QemudBuffer*  header = qemud_buffer_new(FRAME_HEADER_SIZE);
+        if (header == NULL)
+            return;
+        int2hex(qemud_buffer_data(header), FRAME_HEADER_SIZE, msglen);
+        _qemud_pipe_queue_buffer(client, header, qemud_buffer_data(header),
+                                 FRAME_HEADER_SIZE);
+        qemud_buffer_unref(header);
+    }
+    _qemud_pipe_queue_buffer(client, buffer, msg, msglen);
+}
+
 /* enable framing for this client. When TRUE, this will
  * use internally a simple 4-hexchar header before each
  * message exchanged through the serial port.
@@ -1764,6 +1934,8 @@ qemud_save(QEMUFile* f, void* opaque)
 {
     QemudMultiplexer *m = opaque;
 
+    /* pending output is not part of the saved state */
+    qemud_serial_flush(m->serial);
     qemud_serial_save(f, m->serial);
 
     /* save service states */
@@ -1839,6 +2011,8 @@ qemud_load(QEMUFile *f, void* opaque, int version)
 
     int ret;
 
+    /* drop output queued before the snapshot was restored */
+    m->serial->out_len = 0;
     if ((ret = qemud_serial_load(f, m->serial)))
         return ret;
     if ((ret = qemud_load_services(f, m->services)))
@@ -1865,16 +2039,20 @@ _save_pipe_message(QEMUFile* f, QemudPipeMessage* msg)
 }
 
 /* Loads pending pipe messages from the snapshot file.
+ * Param:
+ *  plast - Receives the last message in the returned list, or NULL.
  * Return:
  *  List of pending pipe messages loaded from snapshot, or NULL if snapshot didn't
  *  contain saved messages.
  */
 static QemudPipeMessage*
-_load_pipe_message(QEMUFile* f)
+_load_pipe_message(QEMUFile* f, QemudPipeMessage** plast)
 {
     QemudPipeMessage* ret = NULL;
     QemudPipeMessage** next = &ret;
 
+    *plast = NULL;
+
     uint32_t size = qemu_get_be32(f);
     while (size != 0) {
         QemudPipeMessage* wrk;
@@ -1882,11 +2060,13 @@ _load_pipe_message(QEMUFile* f)
         *next = wrk;
         wrk->size = size;
         wrk->offset = qemu_get_be32(f);
-        wrk->message = malloc(wrk->size);
-        if (wrk->message == NULL) {
+        wrk->buffer = qemud_buffer_new(wrk->size);
+        if (wrk->buffer == NULL) {
             APANIC("Unable to allocate buffer for pipe's pending message.");
         }
+        wrk->message = qemud_buffer_data(wrk->buffer);
         qemu_get_buffer(f, wrk->message, wrk->size);
+        *plast = wrk;
         next = &wrk->next;
         *next = NULL;
         size = qemu_get_be32(f);
@@ -2056,7 +2236,10 @@ _qemudPipe_recvBuffers(void* opaque, GoldfishPipeBuffer* buffers, int numBuffers
         if (msg->size == msg->offset) {
             /* We're done with the current message. Go to the next one. */
             *msg_list = msg->next;
-            free(msg);
+            if (*msg_list == NULL) {
+                client->ProtocolSelector.Pipe.messages_last = NULL;
+            }
+            _qemud_pipe_message_free(msg);
         }
         if (off_in_buff == buff->size) {
             /* Current pipe buffer is full. Continue with the next one. */
@@ -2156,7 +2339,8 @@ _qemudPipe_load(void* hwpipe, void* pipeOpaque, const char* args, QEMUFile* f)
         return NULL;
 
     /* Load pending messages. */
-    c->ProtocolSelector.Pipe.messages = _load_pipe_message(f);
+    c->ProtocolSelector.Pipe.messages =
+        _load_pipe_message(f, &c->ProtocolSelector.Pipe.messages_last);
 
     /* load client-specific state */
     if (c->clie_load && c->clie_load(f, c, c->clie_opaque)) {
@@ -2333,9 +2517,23 @@ qemud_service_broadcast( QemudService*  sv,
                          int             msglen )
 {
     QemudClient*  c;
+    QemudBuffer*  buffer = NULL;
 
-    for (c = sv->clients; c; c = c->next_serv)
-        qemud_client_send(c, msg, msglen);
+    for (c = sv->clients; c; c = c->next_serv) {
+        if (!_is_pipe_client(c)) {
+            qemud_client_send(c, msg, msglen);
+            continue;
+        }
+        /* pipe clients all share a single copy of the message */
+        if (buffer == NULL) {
+            buffer = qemud_buffer_new(msglen);
+            if (buffer == NULL)
+                return;
+            memcpy(qemud_buffer_data(buffer), msg, msglen);
+        }
+        qemud_client_send_buffer(c, buffer, 0, msglen);
+    }
+    qemud_buffer_unref(buffer);
 }
 
 
@@ -106,6 +106,40 @@ extern void           qemud_client_set_framing( QemudClient*  client, int  enabl
  */
 extern void   qemud_client_send ( QemudClient*  client, const uint8_t*  msg, int  msglen );
 
+/* A reference-counted data buffer that can be queued on qemud clients
+ * without being copied. This is useful for services that produce large
+ * messages (e.g. camera frames): pipe clients keep a reference to the
+ * buffer until the guest has read the data.
+ *
+ * A service that wants to modify a buffer after sending it must first
+ * check with qemud_buffer_is_shared() that no client still holds it.
+ */
+typedef struct QemudBuffer  QemudBuffer;
+
+/* Allocates a new buffer of 'size' bytes, with a reference count of 1.
+ * Returns NULL on allocation failure. */
+extern QemudBuffer*  qemud_buffer_new( int  size );
+
+/* Returns the data of a given buffer. */
+extern uint8_t*      qemud_buffer_data( QemudBuffer*  buffer );
+
+/* Adds, or drops a reference to a given buffer. The buffer is freed
+ * when its last reference is dropped. */
+extern QemudBuffer*  qemud_buffer_ref( QemudBuffer*  buffer );
+extern void          qemud_buffer_unref( QemudBuffer*  buffer );
+
+/* Returns non-zero if a buffer is referenced by anything else than
+ * its owner, e.g. is still waiting to be read by a pipe client. */
+extern int           qemud_buffer_is_shared( QemudBuffer*  buffer );
+
+/* Sends 'msglen' bytes of a buffer, starting at 'offset', to a given
+ * qemud client. Pipe clients queue a reference to the buffer, serial
+ * clients copy the data immediately. */
+extern void   qemud_client_send_buffer( QemudClient*  client,
+                                        QemudBuffer*  buffer,
+                                        int           offset,
+                                        int           msglen );
+
 /* Force-close the connection to a given qemud client.
  */
 extern void   qemud_client_close( QemudClient*  client );
@@ -162,10 +162,66 @@ typedef struct {
  *   was "taken" by this code. This is adjusted by the HAL module to
  *   emulated system time (using the first sync: to compute an adjustment
  *   offset).
+ *
+ * - the HAL module can send "set-format:binary" to receive each report
+ *   as a single binary frame instead of the text lines above. This code
+ *   replies with "format:binary" (an older emulator doesn't reply at all).
+ *   "set-format:text" switches back to text reports, and is acknowledged
+ *   with "format:text". A binary frame is laid out as follows, with all
+ *   values in little-endian order:
+ *
+ *      offset  size
+ *        0      4    "sfr:"
+ *        4      4    bitmap of the sensors in the frame (1 << sensor id)
+ *        8      8    VM time in micro-seconds (same as <time_us> above)
+ *       16     12*n  three 32-bit floats for each sensor in the bitmap,
+ *                    in sensor id order. Single-value sensors (temperature,
+ *                    proximity) only use the first one.
+ *
+ *   Binary reports can be sent with a delay as low as 5 ms (200 Hz),
+ *   while text reports are limited to one every 20 ms.
  */
 #define  HEADER_SIZE  4
 #define  BUFFER_SIZE  512
 
+/* minimum delay between reports, in milliseconds */
+#define  SENSORS_MIN_DELAY_MS         20
+#define  SENSORS_MIN_DELAY_BINARY_MS  5
+
+/* binary sensor frame layout, see above */
+#define  SENSOR_FRAME_TAG     "sfr:"
+#define  SENSOR_FRAME_HEADER  16
+#define  SENSOR_FRAME_MAX     (SENSOR_FRAME_HEADER + 12*MAX_SENSORS)
+
+/* the client's enabledMask is saved to snapshots with this bit set when
+ * the client receives binary frames. Sensor ids never use it. */
+#define  SENSORS_SAVED_BINARY  0x80000000U
+
+/* A sensor trace is a text file where each line describes a change of a
+ * sensor's values:
+ *
+ *    <time_us> <sensor-name> <value-a>[:<value-b>[:<value-c>]]
+ *
+ * where <time_us> is a time in micro-seconds, relative to any origin, and
+ * must not decrease from one line to the next. Empty lines and lines
+ * starting with '#' are ignored. The trace is replayed against the VM
+ * clock, so paused VMs also pause the replay.
+ */
+typedef struct {
+    int64_t  time_us;
+    int      sensor;
+    float    a, b, c;
+} SensorTraceEvent;
+
+typedef struct {
+    SensorTraceEvent*  events;
+    int                count;
+    int                next;     /* index of next event to apply */
+    int                loop;
+    int64_t            start_ns; /* VM time of the first event */
+    QEMUTimer*         timer;
+} SensorTrace;
+
 typedef struct HwSensorClient   HwSensorClient;
 
 typedef struct {
@@ -173,6 +229,7 @@ typedef struct {
     Sensor              sensors[MAX_SENSORS];
     HwSensorClient*     clients;
     AndroidSensorsPort* sensors_port;
+    SensorTrace         trace;
 } HwSensors;
 
 struct HwSensorClient {
@@ -182,6 +239,8 @@ struct HwSensorClient {
     QEMUTimer*       timer;
     uint32_t         enabledMask;
     int32_t          delay_ms;
+    char             binary;      /* send binary frames */
+    int64_t          deadline_ns; /* VM time of the last scheduled report */
 };
 
 static void
@@ -281,17 +340,57 @@ _hwSensorClient_enabled( HwSensorClient*  cl, int  sensorId )
     return (cl->enabledMask & (1 << sensorId)) != 0;
 }
 
-/* this function is called periodically to send sensor reports
- * to the HAL module, and re-arm the timer if necessary
- */
 static void
-_hwSensorClient_tick( void*  opaque )
+_putLe32( uint8_t*  p, uint32_t  v )
+{
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+}
+
+static void
+_putLeFloat( uint8_t*  p, float  f )
+{
+    union { float f; uint32_t u; } v;
+    v.f = f;
+    _putLe32(p, v.u);
+}
+
+/* send all enabled sensors as a single binary frame */
+static void
+_hwSensorClient_sendFrame( HwSensorClient*  cl, int64_t  now_ns )
+{
+    HwSensors*  hw   = cl->sensors;
+    uint32_t    mask = cl->enabledMask;
+    uint64_t    time_us = (uint64_t)(now_ns / 1000);
+    uint8_t     frame[SENSOR_FRAME_MAX];
+    uint8_t*    p = frame + SENSOR_FRAME_HEADER;
+    int         nn;
+
+    memcpy(frame, SENSOR_FRAME_TAG, 4);
+    _putLe32(frame + 4, mask);
+    _putLe32(frame + 8, (uint32_t)time_us);
+    _putLe32(frame + 12, (uint32_t)(time_us >> 32));
+
+    for (nn = 0; nn < MAX_SENSORS; nn++) {
+        const SensorValues*  v = &hw->sensors[nn].u.value;
+        if (!(mask & (1U << nn)))
+            continue;
+        _putLeFloat(p,     v->a);
+        _putLeFloat(p + 4, v->b);
+        _putLeFloat(p + 8, v->c);
+        p += 12;
+    }
+    T("%s: %d bytes", __FUNCTION__, (int)(p - frame));
+    qemud_client_send(cl->client, frame, p - frame);
+}
+
+/* send all enabled sensors as text lines, followed by a sync line */
+static void
+_hwSensorClient_sendText( HwSensorClient*  cl, int64_t  now_ns )
 {
-    HwSensorClient*  cl = opaque;
     HwSensors*       hw  = cl->sensors;
-    int64_t          delay = cl->delay_ms;
-    int64_t          now_ns;
-    uint32_t         mask  = cl->enabledMask;
     Sensor*          sensor;
     char             buffer[128];
 
@@ -337,22 +436,50 @@ _hwSensorClient_tick( void*  opaque )
         _hwSensorClient_send(cl, (uint8_t*) buffer, strlen(buffer));
     }
 
-    now_ns = qemu_get_clock_ns(vm_clock);
-
     snprintf(buffer, sizeof buffer, "sync:%" PRId64, now_ns/1000);
     _hwSensorClient_send(cl, (uint8_t*)buffer, strlen(buffer));
+}
+
+/* this function is called periodically to send sensor reports
+ * to the HAL module, and re-arm the timer if necessary
+ */
+static void
+_hwSensorClient_tick( void*  opaque )
+{
+    HwSensorClient*  cl = opaque;
+    int64_t          delay = cl->delay_ms;
+    int64_t          now_ns = qemu_get_clock_ns(vm_clock);
+    uint32_t         mask  = cl->enabledMask;
 
-    /* rearm timer, use a minimum delay of 20 ms, just to
-     * be safe.
+    if (cl->binary)
+        _hwSensorClient_sendFrame(cl, now_ns);
+    else
+        _hwSensorClient_sendText(cl, now_ns);
+
+    /* rearm timer, use a minimum delay of 20 ms (5 ms for binary
+     * frames), just to be safe.
      */
     if (mask == 0)
         return;
 
-    if (delay < 20)
-        delay = 20;
+    if (cl->binary) {
+        if (delay < SENSORS_MIN_DELAY_BINARY_MS)
+            delay = SENSORS_MIN_DELAY_BINARY_MS;
+    } else {
+        if (delay < SENSORS_MIN_DELAY_MS)
+            delay = SENSORS_MIN_DELAY_MS;
+    }
 
     delay *= 1000000LL;  /* convert to nanoseconds */
-    qemu_mod_timer(cl->timer, now_ns + delay);
+
+    /* schedule relative to the previous deadline, not to the current
+     * time, so that the timer's own latency doesn't lower the report
+     * rate. Resynchronize if we fell behind by more than one period.
+     */
+    cl->deadline_ns += delay;
+    if (cl->deadline_ns <= now_ns)
+        cl->deadline_ns = now_ns + delay;
+    qemu_mod_timer(cl->timer, cl->deadline_ns);
 }
 
 /* handle incoming messages from the HAL module */
@@ -395,12 +522,32 @@ _hwSensorClient_receive( HwSensorClient*  cl, uint8_t*  msg, int  msglen )
      */
     if (msglen > 10 && !memcmp(msg, "set-delay:", 10)) {
         cl->delay_ms = atoi((const char*)msg+10);
-        if (cl->enabledMask != 0)
+        if (cl->enabledMask != 0) {
+            cl->deadline_ns = 0;
             _hwSensorClient_tick(cl);
+        }
 
         return;
     }
 
+    /* "set-format:<format>" selects text or binary sensor reports,
+     * and is acknowledged with "format:<format>"
+     */
+    if (msglen > 11 && !memcmp(msg, "set-format:", 11)) {
+        const char*  format = (const char*)msg + 11;
+
+        if (!strcmp(format, "binary"))
+            cl->binary = 1;
+        else if (!strcmp(format, "text"))
+            cl->binary = 0;
+        else {
+            D("%s: ignore unknown format '%s'", __FUNCTION__, format);
+            return;
+        }
+        _hwSensorClient_send(cl, msg + 4, msglen - 4);
+        return;
+    }
+
     /* "set:<name>:<state>" is used to enable/disable a given
      * sensor. <state> must be 0 or 1
      */
@@ -446,6 +593,7 @@ _hwSensorClient_receive( HwSensorClient*  cl, uint8_t*  msg, int  msglen )
             }
         }
 
+        cl->deadline_ns = 0;
         _hwSensorClient_tick(cl);
         return;
     }
@@ -460,7 +608,7 @@ _hwSensorClient_save( QEMUFile*  f, QemudClient*  client, void*  opaque  )
     HwSensorClient* sc = opaque;
 
     qemu_put_be32(f, sc->delay_ms);
-    qemu_put_be32(f, sc->enabledMask);
+    qemu_put_be32(f, sc->enabledMask | (sc->binary ? SENSORS_SAVED_BINARY : 0));
     qemu_put_timer(f, sc->timer);
 }
 
@@ -472,6 +620,9 @@ _hwSensorClient_load( QEMUFile*  f, QemudClient*  client, void*  opaque  )
 
     sc->delay_ms = qemu_get_be32(f);
     sc->enabledMask = qemu_get_be32(f);
+    sc->binary = (sc->enabledMask & SENSORS_SAVED_BINARY) != 0;
+    sc->enabledMask &= ~SENSORS_SAVED_BINARY;
+    sc->deadline_ns = 0;
     qemu_get_timer(f, sc->timer);
 
     return 0;
@@ -657,6 +808,153 @@ _hwSensors_setCoarseOrientation( HwSensors*  h, AndroidCoarseOrientation  orient
 }
 
 
+/* free the sensor trace being replayed, if any */
+static void
+_hwSensors_traceStop( HwSensors*  h )
+{
+    SensorTrace*  t = &h->trace;
+
+    if (t->timer) {
+        qemu_del_timer(t->timer);
+        qemu_free_timer(t->timer);
+        t->timer = NULL;
+    }
+    AFREE(t->events);
+    t->events = NULL;
+    t->count  = 0;
+    t->next   = 0;
+}
+
+/* apply all trace events that are due, and re-arm the timer for the next one */
+static void
+_hwSensors_traceTick( void*  opaque )
+{
+    HwSensors*    h = opaque;
+    SensorTrace*  t = &h->trace;
+    int64_t       now_ns = qemu_get_clock_ns(vm_clock);
+
+    for (;;) {
+        int64_t  pos_us = (now_ns - t->start_ns) / 1000;
+
+        while (t->next < t->count && t->events[t->next].time_us <= pos_us) {
+            const SensorTraceEvent*  ev = &t->events[t->next++];
+            _hwSensors_setSensorValue(h, ev->sensor, ev->a, ev->b, ev->c);
+        }
+        if (t->next < t->count)
+            break;
+
+        if (!t->loop) {
+            D("%s: sensor trace replay complete", __FUNCTION__);
+            _hwSensors_traceStop(h);
+            return;
+        }
+
+        /* restart from the beginning, one average event period after
+         * the last event */
+        {
+            int64_t  last_us = t->events[t->count-1].time_us;
+            int64_t  gap_us  = (t->count > 1) ? last_us / (t->count - 1) : 0;
+
+            if (gap_us < 1000)
+                gap_us = 1000;
+            t->start_ns += (last_us + gap_us) * 1000;
+            t->next = 0;
+        }
+    }
+
+    qemu_mod_timer(t->timer, t->start_ns + t->events[t->next].time_us * 1000);
+}
+
+/* parse '<value-a>[:<value-b>[:<value-c>]]', return 0 on success */
+static int
+_parseSensorValues( const char*  str, float  values[3] )
+{
+    int  nn;
+
+    values[0] = values[1] = values[2] = 0.;
+    for (nn = 0; nn < 3; nn++) {
+        char*  end;
+
+        values[nn] = (float)strtod(str, &end);
+        if (end == str)
+            return -1;
+        if (*end != ':')
+            return (*end == '\0' || *end == '\n' || *end == '\r' ||
+                    *end == ' ' || *end == '\t') ? 0 : -1;
+        str = end + 1;
+    }
+    return -1;
+}
+
+/* load a sensor trace file, return 0 on success, or -1 with errno set */
+static int
+_hwSensors_traceLoad( SensorTrace*  t, const char*  path )
+{
+    FILE*              f = fopen(path, "r");
+    SensorTraceEvent*  events = NULL;
+    int                count = 0, capacity = 0, lineno = 0;
+    char               line[256];
+
+    if (f == NULL)
+        return -1;
+
+    while (fgets(line, sizeof line, f) != NULL) {
+        SensorTraceEvent  ev;
+        long long         time_us;
+        char              name[32];
+        float             values[3];
+        int               pos = 0;
+
+        lineno++;
+        if (line[0] == '#' || line[strspn(line, " \t\r\n")] == '\0')
+            continue;
+
+        if (sscanf(line, "%lld %31s %n", &time_us, name, &pos) < 2 || pos == 0 ||
+            (ev.sensor = _sensorIdFromName(name)) < 0 ||
+            _parseSensorValues(line + pos, values) < 0 ||
+            (count > 0 && time_us < events[count-1].time_us))
+        {
+            W("%s:%d: invalid sensor trace event", path, lineno);
+            AFREE(events);
+            fclose(f);
+            errno = EINVAL;
+            return -1;
+        }
+        ev.time_us = time_us;
+        ev.a = values[0];
+        ev.b = values[1];
+        ev.c = values[2];
+
+        if (count == capacity) {
+            capacity += capacity/2 + 64;
+            AARRAY_RENEW(events, capacity);
+        }
+        events[count++] = ev;
+    }
+    fclose(f);
+
+    if (count == 0) {
+        W("%s: sensor trace is empty", path);
+        AFREE(events);
+        errno = EINVAL;
+        return -1;
+    }
+
+    /* make times relative to the first event */
+    {
+        int64_t  origin = events[0].time_us;
+        int      nn;
+
+        for (nn = 0; nn < count; nn++)
+            events[nn].time_us -= origin;
+    }
+
+    t->events = events;
+    t->count  = count;
+    t->next   = 0;
+    return 0;
+}
+
 /* initialize the sensors state */
 static void
 _hwSensors_init( HwSensors*  h )
@@ -811,3 +1109,34 @@ android_sensors_get_sensor_status( int sensor_id )
 
     return hw->sensors[sensor_id].enabled;
 }
+
+/* Start replaying a sensor trace file */
+extern int
+android_sensors_playback_start( const char*  path, int  loop )
+{
+    HwSensors*    hw = _sensorsState;
+    SensorTrace*  t  = &hw->trace;
+
+    if (hw->service == NULL) {
+        errno = ENODEV;
+        return -1;
+    }
+
+    _hwSensors_traceStop(hw);
+    if (_hwSensors_traceLoad(t, path) < 0)
+        return -1;
+
+    D("%s: replaying %d events from %s", __FUNCTION__, t->count, path);
+    t->loop     = loop;
+    t->start_ns = qemu_get_clock_ns(vm_clock);
+    t->timer    = qemu_new_timer_ns(vm_clock, _hwSensors_traceTick, hw);
+    _hwSensors_traceTick(hw);
+    return 0;
+}
+
+/* Stop replaying a sensor trace file */
+extern void
+android_sensors_playback_stop( void )
+{
+    _hwSensors_traceStop(_sensorsState);
+}
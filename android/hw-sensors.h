@@ -78,4 +78,13 @@ extern const char* android_sensors_get_name_from_id( int sensor_id );
 /* Get sensor from sensor id */
 extern uint8_t android_sensors_get_sensor_status( int sensor_id );
 
+/* Start replaying the sensor trace file at 'path' (see android/hw-sensors.c
+ * for its format), replacing any replay in progress. If 'loop' is not 0,
+ * the trace restarts from its beginning when it ends.
+ * Returns 0 on success, or -1 with errno set on failure. */
+extern int android_sensors_playback_start( const char* path, int loop );
+
+/* Stop replaying a sensor trace file, if any */
+extern void android_sensors_playback_stop( void );
+
 #endif /* _android_gps_h */
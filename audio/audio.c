@@ -67,6 +67,7 @@ static struct audio_driver *drvtab[] = {
     &oss_audio_driver,
 #endif
     &no_audio_driver,
+    &bench_audio_driver,
 #if 0  /* disabled WAV audio for now - until we find a user-friendly way to use it */
     &wav_audio_driver
 #endif
@@ -160,6 +161,8 @@ static struct {
     int log_to_monitor;
     int try_poll_in;
     int try_poll_out;
+    int mixeng_simd;
+    int adaptive;
 } conf = {
     .fixed_out = { /* DAC fixed settings */
         .enabled = 1,
@@ -190,6 +193,8 @@ static struct {
     .log_to_monitor = 0,
     .try_poll_in = 1,
     .try_poll_out = 1,
+    .mixeng_simd = 1,
+    .adaptive = 1,
 };
 
 static AudioState glob_audio_state;
@@ -1192,21 +1197,134 @@ static void audio_pcm_print_info (const char *cap, struct audio_pcm_info *info)
 
 /*
  * Timer
+ *
+ * With TIMER_ADAPTIVE (the default), the timer is armed after each run from
+ * the state of the voices instead of at a fixed period. Output voices that
+ * still have samples queued in the mixer, and enabled input voices, want a
+ * run four times per hardware buffer so that the backend never starves.
+ * Output voices with nothing queued are idle: their cards call
+ * AUD_kick_out () when they have new data. When every voice is idle the
+ * timer is stopped altogether.
  */
+#define AUDIO_MIN_PERIOD_NS  1000000LL
+#define AUDIO_MAX_PERIOD_NS  50000000LL
+
+static int64_t audio_samples_to_ns (struct audio_pcm_info *info, int samples)
+{
+    return muldiv64 (samples, get_ticks_per_sec (), info->freq);
+}
+
+static int64_t audio_buffer_period (struct audio_pcm_info *info, int samples)
+{
+    int64_t period = audio_samples_to_ns (info, samples) / 4;
+
+    if (period < AUDIO_MIN_PERIOD_NS) {
+        return AUDIO_MIN_PERIOD_NS;
+    }
+    if (period > AUDIO_MAX_PERIOD_NS) {
+        return AUDIO_MAX_PERIOD_NS;
+    }
+    return period;
+}
+
+/* Returns the time until the next run is needed, or 0 if all voices are
+ * idle. Also accounts the output latency of the voices. */
+static int64_t audio_next_period (AudioState *s)
+{
+    HWVoiceOut *hwo = NULL;
+    HWVoiceIn *hwi = NULL;
+    int64_t period = 0;
+
+    while ((hwo = audio_pcm_hw_find_any_enabled_out (hwo))) {
+        int nb_live, live;
+        int64_t latency;
+
+        if (hwo->poll_mode) {
+            continue;
+        }
+        live = audio_pcm_hw_get_live_out (hwo, &nb_live);
+        if (!nb_live) {
+            live = 0;
+        }
+        if (!live && !hwo->pending_disable) {
+            continue;
+        }
+
+        latency = audio_samples_to_ns (&hwo->info, live);
+        s->latency_count++;
+        s->latency_total += latency;
+        if (latency > s->latency_max) {
+            s->latency_max = latency;
+        }
+
+        if (!period || audio_buffer_period (&hwo->info, hwo->samples) < period) {
+            period = audio_buffer_period (&hwo->info, hwo->samples);
+        }
+    }
+
+    while ((hwi = audio_pcm_hw_find_any_enabled_in (hwi))) {
+        if (hwi->poll_mode) {
+            continue;
+        }
+        if (!period || audio_buffer_period (&hwi->info, hwi->samples) < period) {
+            period = audio_buffer_period (&hwi->info, hwi->samples);
+        }
+    }
+    return period;
+}
+
+static void audio_arm_timer (AudioState *s, int64_t deadline)
+{
+    s->timer_deadline = deadline;
+    qemu_mod_timer (s->ts, deadline);
+}
+
+static void audio_stop_timer (AudioState *s)
+{
+    if (s->timer_deadline) {
+        s->idle_entries++;
+    }
+    s->timer_deadline = 0;
+    s->timer_period = 0;
+    qemu_del_timer (s->ts);
+}
+
+static void audio_schedule (AudioState *s, int64_t now)
+{
+    int64_t period;
+
+    if (!conf.adaptive) {
+        s->timer_period = conf.period.ticks;
+        audio_arm_timer (s, now + conf.period.ticks);
+        return;
+    }
+
+    period = audio_next_period (s);
+    if (!period) {
+        audio_stop_timer (s);
+        return;
+    }
+    s->timer_period = period;
+    audio_arm_timer (s, now + period);
+}
+
 static void audio_timer (void *opaque)
 {
     AudioState *s = opaque;
+    int64_t now = qemu_get_clock_ns (vm_clock);
+    int64_t lateness = now - s->timer_deadline;
+
 #if 0
 #define  MAX_DIFFS  100
-    int64_t         now  = qemu_get_clock_ms(vm_clock);
+    int64_t         now_ms = qemu_get_clock_ms(vm_clock);
     static int64_t  last = 0;
     static float    diffs[MAX_DIFFS];
     static int      num_diffs;
 
     if (last == 0)
-        last = now;
+        last = now_ms;
     else {
-        diffs[num_diffs] = (float)((now-last)/1e6);  /* last diff in ms */
+        diffs[num_diffs] = (float)((now_ms-last)/1e6);  /* last diff in ms */
         if (++num_diffs == MAX_DIFFS) {
             double  min_diff = 1e6, max_diff = -1e6;
             double  all_diff = 0.;
@@ -1223,11 +1341,19 @@ static void audio_timer (void *opaque)
             num_diffs = 0;
         }
     }
-    last = now;
+    last = now_ms;
 #endif
 
+    s->wakeups++;
+    if (s->timer_deadline && lateness > 0) {
+        s->lateness_total += lateness;
+        if (lateness > s->lateness_max) {
+            s->lateness_max = lateness;
+        }
+    }
+
     audio_run ("timer");
-    qemu_mod_timer (s->ts, qemu_get_clock_ns (vm_clock) + conf.period.ticks);
+    audio_schedule (s, now);
 }
 
 
@@ -1250,11 +1376,67 @@ static void audio_reset_timer (void)
     AudioState *s = &glob_audio_state;
 
     if (audio_is_timer_needed ()) {
-        qemu_mod_timer (s->ts, qemu_get_clock_ns (vm_clock) + 1);
+        audio_arm_timer (s, qemu_get_clock_ns (vm_clock) + 1);
     }
     else {
-        qemu_del_timer (s->ts);
+        audio_stop_timer (s);
+    }
+}
+
+void AUD_kick_out (SWVoiceOut *sw)
+{
+    AudioState *s = &glob_audio_state;
+    int64_t now;
+
+    if (!sw || !sw->active || !sw->hw->enabled || sw->hw->poll_mode
+        || !s->vm_running || !s->ts) {
+        return;
+    }
+    s->kicks++;
+    now = qemu_get_clock_ns (vm_clock);
+    if (!s->timer_deadline || s->timer_deadline > now) {
+        audio_arm_timer (s, now);
+    }
+}
+
+void AUD_get_stats (AudioStats *stats)
+{
+    AudioState *s = &glob_audio_state;
+
+    memset (stats, 0, sizeof (*stats));
+    stats->wakeups = s->wakeups;
+    stats->kicks = s->kicks;
+    stats->idle_entries = s->idle_entries;
+    stats->period = s->timer_deadline ? s->timer_period : 0;
+    if (s->latency_count) {
+        stats->latency_avg = s->latency_total / s->latency_count;
+    }
+    stats->latency_max = s->latency_max;
+    if (s->wakeups) {
+        stats->lateness_avg = s->lateness_total / s->wakeups;
     }
+    stats->lateness_max = s->lateness_max;
+    if (s->run_count) {
+        stats->run_avg = s->run_total / s->run_count;
+    }
+    stats->run_max = s->run_max;
+}
+
+void AUD_reset_stats (void)
+{
+    AudioState *s = &glob_audio_state;
+
+    s->wakeups = 0;
+    s->kicks = 0;
+    s->idle_entries = 0;
+    s->latency_count = 0;
+    s->latency_total = 0;
+    s->latency_max = 0;
+    s->lateness_total = 0;
+    s->lateness_max = 0;
+    s->run_count = 0;
+    s->run_total = 0;
+    s->run_max = 0;
 }
 
 /*
@@ -1335,6 +1517,10 @@ void AUD_set_active_out (SWVoiceOut *sw, int on)
                 }
 
                 hw->pending_disable = nb_active == 1;
+                /* the voice is disabled by the next run */
+                if (hw->pending_disable && s->vm_running) {
+                    audio_reset_timer ();
+                }
             }
         }
 
@@ -1662,10 +1848,19 @@ static void audio_run_capture (AudioState *s)
 void audio_run (const char *msg)
 {
     AudioState *s = &glob_audio_state;
+    int64_t start = get_clock ();
+    int64_t spent;
 
     audio_run_out (s);
     audio_run_in (s);
     audio_run_capture (s);
+
+    spent = get_clock () - start;
+    s->run_count++;
+    s->run_total += spent;
+    if (spent > s->run_max) {
+        s->run_max = spent;
+    }
 #ifdef DEBUG_POLL
     {
         static double prevtime;
@@ -1766,6 +1961,12 @@ static struct audio_option audio_options[] = {
         .valp  = &conf.period.hertz,
         .descr = "Timer period in HZ (0 - use lowest possible)"
     },
+    {
+        .name  = "TIMER_ADAPTIVE",
+        .tag   = AUD_OPT_BOOL,
+        .valp  = &conf.adaptive,
+        .descr = "Arm the timer from the voices fill level, stop it when idle"
+    },
     {
         .name  = "PLIVE",
         .tag   = AUD_OPT_BOOL,
@@ -1778,6 +1979,12 @@ static struct audio_option audio_options[] = {
         .valp  = &conf.log_to_monitor,
         .descr = "Print logging messages to monitor instead of stderr"
     },
+    {
+        .name  = "MIXENG_SIMD",
+        .tag   = AUD_OPT_BOOL,
+        .valp  = &conf.mixeng_simd,
+        .descr = "Use vectorized mixing engine kernels when available"
+    },
     { /* End of list */ }
 };
 
@@ -1971,6 +2178,7 @@ static void audio_init (void)
     }
 
     audio_process_options ("AUDIO", audio_options);
+    mixeng_init (conf.mixeng_simd);
 
     s->nb_hw_voices_out = conf.fixed_out.nb_voices;
     s->nb_hw_voices_in = conf.fixed_in.nb_voices;
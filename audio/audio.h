@@ -118,6 +118,9 @@ int  AUD_write (SWVoiceOut *sw, void *pcm_buf, int size);
 int  AUD_get_buffer_size_out (SWVoiceOut *sw);
 void AUD_set_active_out (SWVoiceOut *sw, int on);
 int  AUD_is_active_out (SWVoiceOut *sw);
+/* Tells the audio layer that the card has new data for sw, so that its
+ * callback runs as soon as possible even if the timer went idle. */
+void AUD_kick_out (SWVoiceOut *sw);
 
 void     AUD_init_time_stamp_out (SWVoiceOut *sw, QEMUAudioTimeStamp *ts);
 uint64_t AUD_get_elapsed_usec_out (SWVoiceOut *sw, QEMUAudioTimeStamp *ts);
@@ -142,6 +145,24 @@ int  AUD_is_active_in (SWVoiceIn *sw);
 void     AUD_init_time_stamp_in (SWVoiceIn *sw, QEMUAudioTimeStamp *ts);
 uint64_t AUD_get_elapsed_usec_in (SWVoiceIn *sw, QEMUAudioTimeStamp *ts);
 
+/* Audio timer scheduling statistics, times are in nanoseconds of vm_clock,
+ * except for the mixer run time which is measured on the host clock */
+typedef struct AudioStats {
+    uint64_t wakeups;         /* timer runs */
+    uint64_t kicks;           /* AUD_kick_out () requests */
+    uint64_t idle_entries;    /* times the timer stopped for lack of work */
+    int64_t  period;          /* current timer period, 0 when stopped */
+    int64_t  latency_avg;     /* output queued in the mixer after a run */
+    int64_t  latency_max;
+    int64_t  lateness_avg;    /* timer expiry after its deadline */
+    int64_t  lateness_max;
+    int64_t  run_avg;         /* host time spent mixing in one run */
+    int64_t  run_max;
+} AudioStats;
+
+void AUD_get_stats (AudioStats *stats);
+void AUD_reset_stats (void);
+
 static inline void *advance (void *p, int incr)
 {
     uint8_t *d = p;
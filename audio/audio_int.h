@@ -199,9 +199,25 @@ struct AudioState {
     int nb_hw_voices_out;
     int nb_hw_voices_in;
     int vm_running;
+
+    /* timer scheduling, see audio_schedule () */
+    int64_t timer_deadline;     /* 0 when the timer is stopped */
+    int64_t timer_period;
+    uint64_t wakeups;
+    uint64_t kicks;
+    uint64_t idle_entries;
+    uint64_t latency_count;
+    int64_t latency_total;
+    int64_t latency_max;
+    int64_t lateness_total;
+    int64_t lateness_max;
+    uint64_t run_count;         /* host time spent in audio_run () */
+    int64_t run_total;
+    int64_t run_max;
 };
 
 extern struct audio_driver no_audio_driver;
+extern struct audio_driver bench_audio_driver;
 extern struct audio_driver oss_audio_driver;
 extern struct audio_driver sdl_audio_driver;
 extern struct audio_driver win_audio_driver;
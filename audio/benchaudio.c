@@ -0,0 +1,447 @@
+/*
+ * QEMU benchmark audio backend
+ *
+ * Copyright (c) 2012 The Android Open Source Project
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * A backend for headless audio testing. Like "none" it discards the output
+ * and captures silence, but it does so at exactly the configured rate of
+ * the host monotonic clock, the way a sound card would, and reports:
+ *
+ *  - output underruns: runs where fewer samples were queued than the card
+ *    would have played since the previous run,
+ *  - input overruns: captured samples dropped because the guest did not
+ *    drain the capture buffer in time,
+ *  - the host time spent in each run of the mixer and of the backend.
+ *
+ * The played stream can also be saved to a .wav file for verification.
+ * Statistics are logged, and optionally written to a file, on exit.
+ */
+#include "qemu-common.h"
+#include "audio.h"
+#include "qemu-timer.h"
+#include "qemu_file.h"
+
+#define AUDIO_CAP "bench"
+#include "audio_int.h"
+
+typedef struct BenchVoiceOut {
+    HWVoiceOut hw;
+    int running;
+    int64_t start;          /* host clock when the stream (re)started */
+    uint64_t elapsed;       /* samples the card played since start */
+    void *pcm_buf;
+    QEMUFile *wav;
+    uint32_t wav_samples;
+} BenchVoiceOut;
+
+typedef struct BenchVoiceIn {
+    HWVoiceIn hw;
+    int running;
+    int64_t start;
+    uint64_t elapsed;
+} BenchVoiceIn;
+
+static struct {
+    int samples;
+    const char *wav_path;
+    const char *report_path;
+} conf = {
+    .samples = 1024,
+    .wav_path = NULL,
+    .report_path = NULL,
+};
+
+static struct {
+    int64_t start;              /* host clock of the first voice start */
+    uint64_t out_periods;
+    uint64_t played;            /* samples taken from the mixer */
+    uint64_t due;               /* samples the card asked for */
+    uint64_t underruns;
+    uint64_t underrun_samples;
+    uint64_t in_periods;
+    uint64_t captured;
+    uint64_t overruns;
+    uint64_t overrun_samples;
+    int64_t run_total;          /* host time spent in run_out/run_in */
+    int64_t run_max;
+} stats;
+
+static BenchVoiceOut *bench_out;
+
+/* Samples due since the stream started, from the host monotonic clock.
+ * Computing it from the start time rather than adding up intervals keeps
+ * rounding errors from accumulating. */
+static uint64_t bench_elapsed (int64_t start, int64_t now, int freq)
+{
+    return muldiv64 (now - start, freq, get_ticks_per_sec ());
+}
+
+static void bench_account_run (int64_t t0)
+{
+    int64_t t = get_clock () - t0;
+
+    stats.run_total += t;
+    if (t > stats.run_max) {
+        stats.run_max = t;
+    }
+}
+
+static void bench_start (int *running, int64_t *start, uint64_t *elapsed)
+{
+    *running = 1;
+    *start = get_clock ();
+    *elapsed = 0;
+    if (!stats.start) {
+        stats.start = *start;
+    }
+}
+
+/* VICE code: Store number as little endian. */
+static void le_store (uint8_t *buf, uint32_t val, int len)
+{
+    int i;
+    for (i = 0; i < len; i++) {
+        buf[i] = (uint8_t) (val & 0xff);
+        val >>= 8;
+    }
+}
+
+static void bench_wav_open (BenchVoiceOut *bench)
+{
+    HWVoiceOut *hw = &bench->hw;
+    uint8_t hdr[] = {
+        0x52, 0x49, 0x46, 0x46, 0x00, 0x00, 0x00, 0x00, 0x57, 0x41, 0x56,
+        0x45, 0x66, 0x6d, 0x74, 0x20, 0x10, 0x00, 0x00, 0x00, 0x01, 0x00,
+        0x02, 0x00, 0x44, 0xac, 0x00, 0x00, 0x10, 0xb1, 0x02, 0x00, 0x04,
+        0x00, 0x10, 0x00, 0x64, 0x61, 0x74, 0x61, 0x00, 0x00, 0x00, 0x00
+    };
+
+    if (hw->info.bits == 32) {
+        dolog ("WAVE files can not handle 32bit formats\n");
+        return;
+    }
+    if (hw->info.swap_endianness) {
+        dolog ("WAVE files can not handle big endian samples\n");
+        return;
+    }
+
+    le_store (hdr + 22, hw->info.nchannels, 2);
+    le_store (hdr + 24, hw->info.freq, 4);
+    le_store (hdr + 28, hw->info.bytes_per_second, 4);
+    le_store (hdr + 32, 1 << hw->info.shift, 2);
+    le_store (hdr + 34, hw->info.bits, 2);
+
+    bench->wav = qemu_fopen (conf.wav_path, "wb");
+    if (!bench->wav) {
+        dolog ("Failed to open wave file `%s'\nReason: %s\n",
+               conf.wav_path, strerror (errno));
+        return;
+    }
+    qemu_put_buffer (bench->wav, hdr, sizeof (hdr));
+}
+
+static void bench_wav_close (BenchVoiceOut *bench)
+{
+    uint8_t rlen[4];
+    uint8_t dlen[4];
+    uint32_t datalen = bench->wav_samples << bench->hw.info.shift;
+
+    if (!bench->wav) {
+        return;
+    }
+
+    le_store (rlen, datalen + 36, 4);
+    le_store (dlen, datalen, 4);
+
+    qemu_fseek (bench->wav, 4, SEEK_SET);
+    qemu_put_buffer (bench->wav, rlen, 4);
+
+    qemu_fseek (bench->wav, 32, SEEK_CUR);
+    qemu_put_buffer (bench->wav, dlen, 4);
+
+    qemu_fclose (bench->wav);
+    bench->wav = NULL;
+}
+
+static int bench_run_out (HWVoiceOut *hw, int live)
+{
+    BenchVoiceOut *bench = (BenchVoiceOut *) hw;
+    int64_t now = get_clock ();
+    uint64_t elapsed, due;
+    int rpos, decr, samples;
+
+    if (!bench->running) {
+        /* the card starts playing from now on */
+        bench_start (&bench->running, &bench->start, &bench->elapsed);
+        return 0;
+    }
+
+    elapsed = bench_elapsed (bench->start, now, hw->info.freq);
+    due = elapsed - bench->elapsed;
+    bench->elapsed = elapsed;
+
+    decr = audio_MIN (due, (uint64_t) live);
+    if (due > (uint64_t) live) {
+        stats.underruns++;
+        stats.underrun_samples += due - live;
+    }
+
+    /* clip even without a .wav file, a real backend has to */
+    rpos = hw->rpos;
+    samples = decr;
+    while (samples) {
+        int convert_samples = audio_MIN (samples, hw->samples - rpos);
+        void *dst = advance (bench->pcm_buf, rpos << hw->info.shift);
+
+        hw->clip (dst, hw->mix_buf + rpos, convert_samples);
+        if (bench->wav) {
+            qemu_put_buffer (bench->wav, dst,
+                             convert_samples << hw->info.shift);
+            bench->wav_samples += convert_samples;
+        }
+        rpos = (rpos + convert_samples) % hw->samples;
+        samples -= convert_samples;
+    }
+    hw->rpos = rpos;
+
+    stats.out_periods++;
+    stats.played += decr;
+    stats.due += due;
+    bench_account_run (now);
+    return decr;
+}
+
+static int bench_write (SWVoiceOut *sw, void *buf, int len)
+{
+    return audio_pcm_sw_write (sw, buf, len);
+}
+
+static int bench_init_out (HWVoiceOut *hw, struct audsettings *as)
+{
+    BenchVoiceOut *bench = (BenchVoiceOut *) hw;
+
+    audio_pcm_init_info (&hw->info, as);
+    hw->samples = conf.samples;
+    bench->pcm_buf = audio_calloc (AUDIO_FUNC, hw->samples,
+                                   1 << hw->info.shift);
+    if (!bench->pcm_buf) {
+        dolog ("Could not allocate buffer (%d bytes)\n",
+               hw->samples << hw->info.shift);
+        return -1;
+    }
+    if (conf.wav_path) {
+        bench_wav_open (bench);
+    }
+    bench_out = bench;
+    return 0;
+}
+
+static void bench_fini_out (HWVoiceOut *hw)
+{
+    BenchVoiceOut *bench = (BenchVoiceOut *) hw;
+
+    bench_wav_close (bench);
+    qemu_free (bench->pcm_buf);
+    bench->pcm_buf = NULL;
+    if (bench_out == bench) {
+        bench_out = NULL;
+    }
+}
+
+static int bench_ctl_out (HWVoiceOut *hw, int cmd, ...)
+{
+    BenchVoiceOut *bench = (BenchVoiceOut *) hw;
+
+    /* the stream restarts with the first run after enabling */
+    bench->running = 0;
+    (void) cmd;
+    return 0;
+}
+
+static int bench_init_in (HWVoiceIn *hw, struct audsettings *as)
+{
+    audio_pcm_init_info (&hw->info, as);
+    hw->samples = conf.samples;
+    return 0;
+}
+
+static void bench_fini_in (HWVoiceIn *hw)
+{
+    (void) hw;
+}
+
+static int bench_run_in (HWVoiceIn *hw)
+{
+    BenchVoiceIn *bench = (BenchVoiceIn *) hw;
+    int64_t now = get_clock ();
+    int dead = hw->samples - audio_pcm_hw_get_live_in (hw);
+    uint64_t elapsed, due;
+    int samples;
+
+    if (!bench->running) {
+        bench_start (&bench->running, &bench->start, &bench->elapsed);
+        return 0;
+    }
+
+    elapsed = bench_elapsed (bench->start, now, hw->info.freq);
+    due = elapsed - bench->elapsed;
+    bench->elapsed = elapsed;
+
+    samples = audio_MIN (due, (uint64_t) dead);
+    if (due > (uint64_t) dead) {
+        stats.overruns++;
+        stats.overrun_samples += due - dead;
+    }
+
+    stats.in_periods++;
+    stats.captured += samples;
+    bench_account_run (now);
+    return samples;
+}
+
+static int bench_read (SWVoiceIn *sw, void *buf, int size)
+{
+    int samples = size >> sw->info.shift;
+    int total = sw->hw->total_samples_captured - sw->total_hw_samples_acquired;
+    int to_clear = audio_MIN (samples, total);
+    audio_pcm_info_clear_buf (&sw->info, buf, to_clear);
+    return to_clear;
+}
+
+static int bench_ctl_in (HWVoiceIn *hw, int cmd, ...)
+{
+    BenchVoiceIn *bench = (BenchVoiceIn *) hw;
+
+    bench->running = 0;
+    (void) cmd;
+    return 0;
+}
+
+static void *bench_audio_init (void)
+{
+    memset (&stats, 0, sizeof (stats));
+    return &conf;
+}
+
+static void bench_report (FILE *f)
+{
+    AudioStats st;
+    int64_t duration = stats.start ? get_clock () - stats.start : 0;
+    uint64_t periods = stats.out_periods + stats.in_periods;
+
+    AUD_get_stats (&st);
+    fprintf (f, "duration_us=%" PRId64 "\n", duration / 1000);
+    fprintf (f, "out_periods=%" PRIu64 "\n", stats.out_periods);
+    fprintf (f, "out_samples_played=%" PRIu64 "\n", stats.played);
+    fprintf (f, "out_samples_due=%" PRIu64 "\n", stats.due);
+    fprintf (f, "out_underruns=%" PRIu64 "\n", stats.underruns);
+    fprintf (f, "out_underrun_samples=%" PRIu64 "\n", stats.underrun_samples);
+    fprintf (f, "in_periods=%" PRIu64 "\n", stats.in_periods);
+    fprintf (f, "in_samples_captured=%" PRIu64 "\n", stats.captured);
+    fprintf (f, "in_overruns=%" PRIu64 "\n", stats.overruns);
+    fprintf (f, "in_overrun_samples=%" PRIu64 "\n", stats.overrun_samples);
+    fprintf (f, "backend_run_avg_us=%" PRId64 "\n",
+             periods ? stats.run_total / (int64_t) periods / 1000 : 0);
+    fprintf (f, "backend_run_max_us=%" PRId64 "\n", stats.run_max / 1000);
+    fprintf (f, "mixer_run_avg_us=%" PRId64 "\n", st.run_avg / 1000);
+    fprintf (f, "mixer_run_max_us=%" PRId64 "\n", st.run_max / 1000);
+    fprintf (f, "timer_wakeups=%" PRIu64 "\n", st.wakeups);
+}
+
+static void bench_audio_fini (void *opaque)
+{
+    (void) opaque;
+
+    /* disabled voices are not finalized by the audio layer on exit */
+    if (bench_out) {
+        bench_wav_close (bench_out);
+    }
+
+    dolog ("played %" PRIu64 " of %" PRIu64 " samples due, "
+           "%" PRIu64 " underruns (%" PRIu64 " samples), "
+           "%" PRIu64 " capture overruns (%" PRIu64 " samples)\n",
+           stats.played, stats.due, stats.underruns, stats.underrun_samples,
+           stats.overruns, stats.overrun_samples);
+
+    if (conf.report_path) {
+        FILE *f = fopen (conf.report_path, "w");
+
+        if (!f) {
+            dolog ("Could not create report `%s': %s\n",
+                   conf.report_path, strerror (errno));
+            return;
+        }
+        bench_report (f);
+        fclose (f);
+    }
+}
+
+static struct audio_option bench_options[] = {
+    {
+        .name  = "SAMPLES",
+        .tag   = AUD_OPT_INT,
+        .valp  = &conf.samples,
+        .descr = "Buffer size in samples, sets the mixing period"
+    },
+    {
+        .name  = "WAV_PATH",
+        .tag   = AUD_OPT_STR,
+        .valp  = &conf.wav_path,
+        .descr = "Path of a .wav file receiving the played stream"
+    },
+    {
+        .name  = "REPORT_PATH",
+        .tag   = AUD_OPT_STR,
+        .valp  = &conf.report_path,
+        .descr = "Path of a file receiving the statistics on exit"
+    },
+    { /* End of list */ }
+};
+
+static struct audio_pcm_ops bench_pcm_ops = {
+    .init_out = bench_init_out,
+    .fini_out = bench_fini_out,
+    .run_out  = bench_run_out,
+    .write    = bench_write,
+    .ctl_out  = bench_ctl_out,
+
+    .init_in  = bench_init_in,
+    .fini_in  = bench_fini_in,
+    .run_in   = bench_run_in,
+    .read     = bench_read,
+    .ctl_in   = bench_ctl_in
+};
+
+struct audio_driver bench_audio_driver = {
+    .name           = "bench",
+    .descr          = "Host clocked null audio with statistics, for benchmarks",
+    .options        = bench_options,
+    .init           = bench_audio_init,
+    .fini           = bench_audio_fini,
+    .pcm_ops        = &bench_pcm_ops,
+    .can_be_default = 0,
+    .max_voices_out = 1,
+    .max_voices_in  = 1,
+    .voice_size_out = sizeof (BenchVoiceOut),
+    .voice_size_in  = sizeof (BenchVoiceIn)
+};
@@ -28,6 +28,11 @@
 #define AUDIO_CAP "mixeng"
 #include "audio_int.h"
 
+#if defined(__SSE2__) && !defined(FLOAT_MIXENG)
+#define MIXENG_SSE2
+#include <emmintrin.h>
+#endif
+
 /* 8 bit */
 #define ENDIAN_CONVERSION natural
 #define ENDIAN_CONVERT(v) (v)
@@ -253,6 +258,78 @@ f_sample *mixeng_clip[2][2][2][3] = {
     }
 };
 
+#ifdef MIXENG_SSE2
+/*
+ * SSE2 versions of the signed 16 bit, native endian, stereo converters,
+ * the format used by virtually every guest and host. They produce exactly
+ * the same samples as the generic ones above, and must keep doing so:
+ * mixeng_init(0) switches back to the generic code, so both can be run on
+ * the same input and compared. The mixer time reported by the "bench"
+ * backend with QEMU_AUDIO_MIXENG_SIMD=0 and 1 compares their throughput.
+ */
+#ifndef CONFIG_MIXEMU
+static void conv_natural_int16_t_to_stereo_sse2
+    (struct st_sample *dst, const void *src, int samples, struct mixeng_volume *vol)
+{
+    const int16_t *in = src;
+    __m128i *out = (__m128i *) dst;
+    const __m128i zero = _mm_setzero_si128 ();
+
+    for (; samples >= 4; samples -= 4, in += 8, out += 4) {
+        __m128i v = _mm_loadu_si128 ((const __m128i *) in);
+        /* v << 16 in 32 bit lanes, then sign extended to 64 bits */
+        __m128i lo = _mm_unpacklo_epi16 (zero, v);
+        __m128i hi = _mm_unpackhi_epi16 (zero, v);
+        __m128i slo = _mm_srai_epi32 (lo, 31);
+        __m128i shi = _mm_srai_epi32 (hi, 31);
+
+        _mm_storeu_si128 (out + 0, _mm_unpacklo_epi32 (lo, slo));
+        _mm_storeu_si128 (out + 1, _mm_unpackhi_epi32 (lo, slo));
+        _mm_storeu_si128 (out + 2, _mm_unpacklo_epi32 (hi, shi));
+        _mm_storeu_si128 (out + 3, _mm_unpackhi_epi32 (hi, shi));
+    }
+    conv_natural_int16_t_to_stereo ((struct st_sample *) out, in, samples, vol);
+}
+#endif
+
+/* Same as clip_natural_int16_t() on the four 64 bit values of a and b */
+static inline __m128i sse2_clip_s16 (__m128i a, __m128i b)
+{
+    __m128i ta = _mm_shuffle_epi32 (a, _MM_SHUFFLE (3, 1, 2, 0));
+    __m128i tb = _mm_shuffle_epi32 (b, _MM_SHUFFLE (3, 1, 2, 0));
+    __m128i lo = _mm_unpacklo_epi64 (ta, tb);
+    __m128i hi = _mm_unpackhi_epi64 (ta, tb);
+    /* saturate to 32 bits: INT_MAX or INT_MIN when the value does not fit */
+    __m128i fits = _mm_cmpeq_epi32 (hi, _mm_srai_epi32 (lo, 31));
+    __m128i sat = _mm_xor_si128 (_mm_srai_epi32 (hi, 31), _mm_set1_epi32 (INT_MAX));
+
+    lo = _mm_or_si128 (_mm_and_si128 (fits, lo), _mm_andnot_si128 (fits, sat));
+    return _mm_srai_epi32 (lo, 16);
+}
+
+static void clip_natural_int16_t_from_stereo_sse2
+    (void *dst, const struct st_sample *src, int samples)
+{
+    const __m128i *in = (const __m128i *) src;
+    int16_t *out = dst;
+    /* values from 0x7f000000 up map to SHRT_MAX */
+    const __m128i knee = _mm_set1_epi16 (0x7eff);
+
+    for (; samples >= 4; samples -= 4, in += 4, out += 8) {
+        __m128i v01 = sse2_clip_s16 (_mm_loadu_si128 (in + 0),
+                                     _mm_loadu_si128 (in + 1));
+        __m128i v23 = sse2_clip_s16 (_mm_loadu_si128 (in + 2),
+                                     _mm_loadu_si128 (in + 3));
+        __m128i v = _mm_packs_epi32 (v01, v23);
+
+        v = _mm_or_si128 (v, _mm_and_si128 (_mm_cmpgt_epi16 (v, knee),
+                                            _mm_set1_epi16 (0xff)));
+        _mm_storeu_si128 ((__m128i *) out, v);
+    }
+    clip_natural_int16_t_from_stereo (out, (const struct st_sample *) in, samples);
+}
+#endif
+
 /*
  * August 21, 1998
  * Copyright 1998 Fabrice Bellard.
@@ -316,14 +393,153 @@ void *st_rate_start (int inrate, int outrate)
     return rate;
 }
 
-#define NAME st_rate_flow_mix
+typedef void (rate_flow_fn) (void *opaque, struct st_sample *ibuf,
+                             struct st_sample *obuf, int *isamp, int *osamp);
+
+#define NAME st_rate_flow_mix_c
 #define OP(a, b) a += b
 #include "rate_template.h"
 
-#define NAME st_rate_flow
+#define NAME st_rate_flow_c
 #define OP(a, b) a = b
 #include "rate_template.h"
 
+#ifdef MIXENG_SSE2
+/* Whether all the values of n samples fit in 32 bits, which is always the
+ * case except with unsigned 32 bit sources */
+static int sse2_fits_s32 (const struct st_sample *buf, int n)
+{
+    const __m128i bias = _mm_set_epi32 (0, INT_MIN, 0, INT_MIN);
+    const __m128i *in = (const __m128i *) buf;
+    __m128i acc0 = _mm_setzero_si128 ();
+    __m128i acc1 = _mm_setzero_si128 ();
+    int i;
+
+    for (i = 0; i + 4 <= n; i += 4) {
+        acc0 = _mm_or_si128 (acc0, _mm_add_epi64 (_mm_loadu_si128 (in + i), bias));
+        acc1 = _mm_or_si128 (acc1, _mm_add_epi64 (_mm_loadu_si128 (in + i + 1), bias));
+        acc0 = _mm_or_si128 (acc0, _mm_add_epi64 (_mm_loadu_si128 (in + i + 2), bias));
+        acc1 = _mm_or_si128 (acc1, _mm_add_epi64 (_mm_loadu_si128 (in + i + 3), bias));
+    }
+    for (; i < n; i++) {
+        acc0 = _mm_or_si128 (acc0, _mm_add_epi64 (_mm_loadu_si128 (in + i), bias));
+    }
+    acc0 = _mm_srli_epi64 (_mm_or_si128 (acc0, acc1), 32);
+    return _mm_movemask_epi8 (_mm_cmpeq_epi32 (acc0, _mm_setzero_si128 ())) == 0xffff;
+}
+
+/*
+ * (a * (UINT_MAX - t) + b * t) >> 32 for both channels, exact as long as
+ * the samples fit in 32 bits. They are biased by 2^31 to use unsigned
+ * multiplies, which adds 2^31 * UINT_MAX to the sum.
+ */
+static inline __m128i sse2_interp (__m128i a, __m128i b, uint32_t t)
+{
+    const __m128i bias = _mm_set_epi32 (0, INT_MIN, 0, INT_MIN);
+    const __m128i sum_bias = _mm_set_epi32 (INT_MAX, INT_MIN, INT_MAX, INT_MIN);
+    __m128i v = _mm_add_epi64 (
+        _mm_mul_epu32 (_mm_xor_si128 (a, bias),
+                       _mm_set1_epi32 (UINT_MAX - t)),
+        _mm_mul_epu32 (_mm_xor_si128 (b, bias), _mm_set1_epi32 (t)));
+
+    v = _mm_sub_epi64 (v, sum_bias);
+    /* the result fits in 32 bits, sign extend it back to 64 */
+    v = _mm_shuffle_epi32 (v, _MM_SHUFFLE (3, 1, 3, 1));
+    return _mm_unpacklo_epi32 (v, _mm_srai_epi32 (v, 31));
+}
+
+/*
+ * Same results as rate_template.h, but the input position of each output
+ * sample is computed from opos instead of walking ibuf one sample at a
+ * time. Output sample at position p interpolates input samples p and p + 1,
+ * the first of which is rate->ilast when p is just before ibuf.
+ */
+static inline void sse2_rate_flow (struct rate *rate, struct st_sample *ibuf,
+                                   struct st_sample *obuf, int *isamp,
+                                   int *osamp, int mix)
+{
+    const uint64_t n = *isamp;
+    const uint64_t opos_inc = rate->opos_inc;
+    const uint32_t base = rate->ipos;
+    uint64_t opos = rate->opos;
+    uint64_t used = 0;
+    __m128i ilast = _mm_loadu_si128 ((__m128i *) &rate->ilast);
+    int i;
+
+    for (i = 0; i < *osamp; i++, opos += opos_inc) {
+        /* index of the second input sample, ipos <= p + 1 always holds */
+        uint64_t j = (opos >> 32) + 1 - base;
+        __m128i out;
+
+        if (j >= n) {
+            /* not enough input: consume it all, like the generic code */
+            if (n) {
+                ilast = _mm_loadu_si128 ((__m128i *) &ibuf[n - 1]);
+            }
+            used = n;
+            break;
+        }
+        if (j) {
+            ilast = _mm_loadu_si128 ((__m128i *) &ibuf[j - 1]);
+        }
+        out = sse2_interp (ilast, _mm_loadu_si128 ((__m128i *) &ibuf[j]),
+                           opos & 0xffffffff);
+        if (mix) {
+            out = _mm_add_epi64 (out, _mm_loadu_si128 ((__m128i *) &obuf[i]));
+        }
+        _mm_storeu_si128 ((__m128i *) &obuf[i], out);
+        used = j;
+    }
+
+    *isamp = used;
+    *osamp = i;
+    _mm_storeu_si128 ((__m128i *) &rate->ilast, ilast);
+    rate->opos = opos;
+    rate->ipos = base + used;
+}
+
+static void st_rate_flow_sse2 (void *opaque, struct st_sample *ibuf,
+                               struct st_sample *obuf, int *isamp, int *osamp)
+{
+    struct rate *rate = opaque;
+
+    if (rate->opos_inc == (1ULL + UINT_MAX)
+        || !sse2_fits_s32 (&rate->ilast, 1) || !sse2_fits_s32 (ibuf, *isamp)) {
+        st_rate_flow_c (opaque, ibuf, obuf, isamp, osamp);
+        return;
+    }
+    sse2_rate_flow (rate, ibuf, obuf, isamp, osamp, 0);
+}
+
+static void st_rate_flow_mix_sse2 (void *opaque, struct st_sample *ibuf,
+                                   struct st_sample *obuf, int *isamp, int *osamp)
+{
+    struct rate *rate = opaque;
+
+    if (rate->opos_inc == (1ULL + UINT_MAX)
+        || !sse2_fits_s32 (&rate->ilast, 1) || !sse2_fits_s32 (ibuf, *isamp)) {
+        st_rate_flow_mix_c (opaque, ibuf, obuf, isamp, osamp);
+        return;
+    }
+    sse2_rate_flow (rate, ibuf, obuf, isamp, osamp, 1);
+}
+#endif
+
+static rate_flow_fn *rate_flow = st_rate_flow_c;
+static rate_flow_fn *rate_flow_mix = st_rate_flow_mix_c;
+
+void st_rate_flow (void *opaque, struct st_sample *ibuf, struct st_sample *obuf,
+                   int *isamp, int *osamp)
+{
+    rate_flow (opaque, ibuf, obuf, isamp, osamp);
+}
+
+void st_rate_flow_mix (void *opaque, struct st_sample *ibuf, struct st_sample *obuf,
+                       int *isamp, int *osamp)
+{
+    rate_flow_mix (opaque, ibuf, obuf, isamp, osamp);
+}
+
 void st_rate_stop (void *opaque)
 {
     qemu_free (opaque);
@@ -333,3 +549,21 @@ void mixeng_clear (struct st_sample *buf, int len)
 {
     memset (buf, 0, len * sizeof (struct st_sample));
 }
+
+void mixeng_init (int simd)
+{
+#ifdef MIXENG_SSE2
+#ifndef CONFIG_MIXEMU
+    mixeng_conv[1][1][0][1] = simd
+        ? conv_natural_int16_t_to_stereo_sse2
+        : conv_natural_int16_t_to_stereo;
+#endif
+    mixeng_clip[1][1][0][1] = simd
+        ? clip_natural_int16_t_from_stereo_sse2
+        : clip_natural_int16_t_from_stereo;
+    rate_flow = simd ? st_rate_flow_sse2 : st_rate_flow_c;
+    rate_flow_mix = simd ? st_rate_flow_mix_sse2 : st_rate_flow_mix_c;
+#else
+    (void) simd;
+#endif
+}
@@ -48,4 +48,8 @@ void st_rate_flow_mix (void *opaque, struct st_sample *ibuf, struct st_sample *o
 void st_rate_stop (void *opaque);
 void mixeng_clear (struct st_sample *buf, int len);
 
+/* Selects the mixing kernels, simd != 0 enables the vectorized ones where
+ * the host has them. Must be called before any voice is created. */
+void mixeng_init (int simd);
+
 #endif  /* mixeng.h */
@@ -27,6 +27,7 @@
 #include "block_int.h"
 #include "module.h"
 #include "qemu-objects.h"
+#include "qemu-timer.h"
 
 #ifdef CONFIG_BSD
 #include <sys/types.h>
@@ -900,18 +901,86 @@ static int bdrv_check_request(BlockDriverState *bs, int64_t sector_num,
                                    nb_sectors * BDRV_SECTOR_SIZE);
 }
 
+static int bdrv_latency_bucket(int64_t ns)
+{
+    int64_t us = ns / 1000;
+    int bucket = 0;
+
+    while (us > 0 && bucket < BDRV_LATENCY_BUCKETS - 1) {
+        us >>= 1;
+        bucket++;
+    }
+    return bucket;
+}
+
+void bdrv_latency_add(BlockLatencyStats *stats, int64_t ns)
+{
+    if (ns < 0) {
+        ns = 0;
+    }
+    stats->count++;
+    stats->total_ns += ns;
+    if ((uint64_t)ns > stats->max_ns) {
+        stats->max_ns = ns;
+    }
+    stats->hist[bdrv_latency_bucket(ns)]++;
+}
+
+/* Returns the lower bound, in us, of a latency histogram bucket */
+int64_t bdrv_latency_bucket_min_us(int bucket)
+{
+    return (bucket == 0) ? 0 : (1LL << (bucket - 1));
+}
+
+/*
+ * Accounts a completed request in the I/O statistics of a device. Each
+ * request is accounted once, on the layer that actually performs it: the
+ * sync and AIO emulation wrappers don't count the requests they forward.
+ * Failed requests (ret < 0) are only counted in failed_ops.
+ */
+static void bdrv_acct_done(BlockDriverState *bs, int type, int nb_sectors,
+                           int64_t start, int ret)
+{
+    if (ret < 0) {
+        bs->failed_ops[type]++;
+        return;
+    }
+
+    switch (type) {
+    case BDRV_ACCT_READ:
+        bs->rd_bytes += (unsigned) nb_sectors * BDRV_SECTOR_SIZE;
+        bs->rd_ops++;
+        break;
+    case BDRV_ACCT_WRITE:
+        bs->wr_bytes += (unsigned) nb_sectors * BDRV_SECTOR_SIZE;
+        bs->wr_ops++;
+        break;
+    }
+    bdrv_latency_add(&bs->latency[type], get_clock() - start);
+}
+
 /* return < 0 if error. See bdrv_write() for the return codes */
 int bdrv_read(BlockDriverState *bs, int64_t sector_num,
               uint8_t *buf, int nb_sectors)
 {
     BlockDriver *drv = bs->drv;
+    int64_t start;
+    int ret;
 
     if (!drv)
         return -ENOMEDIUM;
     if (bdrv_check_request(bs, sector_num, nb_sectors))
         return -EIO;
 
-    return drv->bdrv_read(bs, sector_num, buf, nb_sectors);
+    if (drv->bdrv_read == bdrv_read_em) {
+        /* accounted by bdrv_aio_readv() */
+        return bdrv_read_em(bs, sector_num, buf, nb_sectors);
+    }
+
+    start = get_clock();
+    ret = drv->bdrv_read(bs, sector_num, buf, nb_sectors);
+    bdrv_acct_done(bs, BDRV_ACCT_READ, nb_sectors, start, ret);
+    return ret;
 }
 
 static void set_dirty_bitmap(BlockDriverState *bs, int64_t sector_num,
@@ -952,6 +1021,9 @@ int bdrv_write(BlockDriverState *bs, int64_t sector_num,
                const uint8_t *buf, int nb_sectors)
 {
     BlockDriver *drv = bs->drv;
+    int64_t start;
+    int ret;
+
     if (!bs->drv)
         return -ENOMEDIUM;
     if (bs->read_only)
@@ -967,7 +1039,15 @@ int bdrv_write(BlockDriverState *bs, int64_t sector_num,
         bs->wr_highest_sector = sector_num + nb_sectors - 1;
     }
 
-    return drv->bdrv_write(bs, sector_num, buf, nb_sectors);
+    if (drv->bdrv_write == bdrv_write_em) {
+        /* accounted by bdrv_aio_writev() */
+        return bdrv_write_em(bs, sector_num, buf, nb_sectors);
+    }
+
+    start = get_clock();
+    ret = drv->bdrv_write(bs, sector_num, buf, nb_sectors);
+    bdrv_acct_done(bs, BDRV_ACCT_WRITE, nb_sectors, start, ret);
+    return ret;
 }
 
 int bdrv_pread(BlockDriverState *bs, int64_t offset,
@@ -1457,8 +1537,11 @@ void bdrv_flush(BlockDriverState *bs)
         return;
     }
 
-    if (bs->drv && bs->drv->bdrv_flush)
+    if (bs->drv && bs->drv->bdrv_flush) {
+        int64_t start = get_clock();
         bs->drv->bdrv_flush(bs);
+        bdrv_acct_done(bs, BDRV_ACCT_FLUSH, 0, start, 0);
+    }
 }
 
 void bdrv_flush_all(void)
@@ -1632,6 +1715,65 @@ void bdrv_info(Monitor *mon, QObject **ret_data)
     *ret_data = QOBJECT(bs_list);
 }
 
+QObject *bdrv_latency_to_qobject(const BlockLatencyStats *stats)
+{
+    QDict *dict;
+    QList *hist;
+    int i;
+
+    dict = qdict_new();
+    qdict_put(dict, "count", qint_from_int(stats->count));
+    qdict_put(dict, "total_ns", qint_from_int(stats->total_ns));
+    qdict_put(dict, "max_ns", qint_from_int(stats->max_ns));
+
+    hist = qlist_new();
+    for (i = 0; i < BDRV_LATENCY_BUCKETS; i++) {
+        qlist_append(hist, qint_from_int(stats->hist[i]));
+    }
+    qdict_put(dict, "histogram", hist);
+
+    return QOBJECT(dict);
+}
+
+/*
+ * Prints a latency dict built by bdrv_latency_to_qobject() on one line,
+ * followed by the non-empty histogram buckets.
+ */
+void bdrv_latency_print(Monitor *mon, const char *name, const QObject *data)
+{
+    QDict *qdict = qobject_to_qdict(data);
+    QListEntry *entry;
+    int64_t count;
+    int bucket = 0;
+
+    count = qdict_get_int(qdict, "count");
+    if (count == 0) {
+        return;
+    }
+
+    monitor_printf(mon, "    %s: count=%" PRId64
+                        " avg=%" PRId64 "us"
+                        " max=%" PRId64 "us",
+                        name, count,
+                        qdict_get_int(qdict, "total_ns") / count / 1000,
+                        qdict_get_int(qdict, "max_ns") / 1000);
+
+    QLIST_FOREACH_ENTRY(qdict_get_qlist(qdict, "histogram"), entry) {
+        int64_t n = qint_get_int(qobject_to_qint(qlist_entry_obj(entry)));
+
+        if (n != 0 && bucket == BDRV_LATENCY_BUCKETS - 1) {
+            monitor_printf(mon, " >=%" PRId64 "us:%" PRId64,
+                           bdrv_latency_bucket_min_us(bucket), n);
+        } else if (n != 0) {
+            monitor_printf(mon, " %" PRId64 "-%" PRId64 "us:%" PRId64,
+                           bdrv_latency_bucket_min_us(bucket),
+                           bdrv_latency_bucket_min_us(bucket + 1) - 1, n);
+        }
+        bucket++;
+    }
+    monitor_printf(mon, "\n");
+}
+
 static void bdrv_stats_iter(QObject *data, void *opaque)
 {
     QDict *qdict;
@@ -1650,6 +1792,58 @@ static void bdrv_stats_iter(QObject *data, void *opaque)
                         qdict_get_int(qdict, "wr_bytes"),
                         qdict_get_int(qdict, "rd_operations"),
                         qdict_get_int(qdict, "wr_operations"));
+
+    if (qdict_get_int(qdict, "rd_failed") ||
+        qdict_get_int(qdict, "wr_failed") ||
+        qdict_get_int(qdict, "flush_failed")) {
+        monitor_printf(mon, "    rd_failed=%" PRId64
+                            " wr_failed=%" PRId64
+                            " flush_failed=%" PRId64
+                            "\n",
+                            qdict_get_int(qdict, "rd_failed"),
+                            qdict_get_int(qdict, "wr_failed"),
+                            qdict_get_int(qdict, "flush_failed"));
+    }
+
+    if (qdict_haskey(qdict, "l2_cache_hits")) {
+        int64_t l2_hits = qdict_get_int(qdict, "l2_cache_hits");
+        int64_t l2_misses = qdict_get_int(qdict, "l2_cache_misses");
+        int64_t rc_hits = qdict_get_int(qdict, "refcount_cache_hits");
+        int64_t rc_misses = qdict_get_int(qdict, "refcount_cache_misses");
+
+        monitor_printf(mon, "    l2_cache_hits=%" PRId64
+                            " l2_cache_misses=%" PRId64
+                            " (%.1f%%)"
+                            " refcount_cache_hits=%" PRId64
+                            " refcount_cache_misses=%" PRId64
+                            " (%.1f%%)"
+                            " refcount_cache_writes=%" PRId64
+                            "\n",
+                            l2_hits, l2_misses,
+                            l2_hits + l2_misses ?
+                            100.0 * l2_hits / (l2_hits + l2_misses) : 0.0,
+                            rc_hits, rc_misses,
+                            rc_hits + rc_misses ?
+                            100.0 * rc_hits / (rc_hits + rc_misses) : 0.0,
+                            qdict_get_int(qdict, "refcount_cache_writes"));
+    }
+
+    bdrv_latency_print(mon, "rd_latency", qdict_get(qdict, "rd_latency"));
+    bdrv_latency_print(mon, "wr_latency", qdict_get(qdict, "wr_latency"));
+    bdrv_latency_print(mon, "flush_latency",
+                       qdict_get(qdict, "flush_latency"));
+
+    if (qdict_haskey(qdict, "decompress_cache_hits")) {
+        int64_t hits = qdict_get_int(qdict, "decompress_cache_hits");
+        int64_t misses = qdict_get_int(qdict, "decompress_cache_misses");
+
+        monitor_printf(mon, "    decompress_cache_hits=%" PRId64
+                            " decompress_cache_misses=%" PRId64
+                            " (%.1f%%)\n",
+                            hits, misses,
+                            hits + misses ? 100.0 * hits / (hits + misses)
+                                          : 0.0);
+    }
 }
 
 void bdrv_stats_print(Monitor *mon, const QObject *data)
@@ -1660,7 +1854,7 @@ void bdrv_stats_print(Monitor *mon, const QObject *data)
 static QObject* bdrv_info_stats_bs(BlockDriverState *bs)
 {
     QObject *res;
-    QDict *dict;
+    QDict *dict, *stats;
 
     res = qobject_from_jsonf("{ 'stats': {"
                              "'rd_bytes': %" PRId64 ","
@@ -1674,6 +1868,24 @@ static QObject* bdrv_info_stats_bs(BlockDriverState *bs)
                              bs->wr_highest_sector *
                              (uint64_t)BDRV_SECTOR_SIZE);
     dict  = qobject_to_qdict(res);
+    stats = qobject_to_qdict(qdict_get(dict, "stats"));
+
+    qdict_put(stats, "rd_failed",
+              qint_from_int(bs->failed_ops[BDRV_ACCT_READ]));
+    qdict_put(stats, "wr_failed",
+              qint_from_int(bs->failed_ops[BDRV_ACCT_WRITE]));
+    qdict_put(stats, "flush_failed",
+              qint_from_int(bs->failed_ops[BDRV_ACCT_FLUSH]));
+    qdict_put_obj(stats, "rd_latency",
+                  bdrv_latency_to_qobject(&bs->latency[BDRV_ACCT_READ]));
+    qdict_put_obj(stats, "wr_latency",
+                  bdrv_latency_to_qobject(&bs->latency[BDRV_ACCT_WRITE]));
+    qdict_put_obj(stats, "flush_latency",
+                  bdrv_latency_to_qobject(&bs->latency[BDRV_ACCT_FLUSH]));
+
+    if (bs->drv && bs->drv->bdrv_info_stats) {
+        bs->drv->bdrv_info_stats(bs, stats);
+    }
 
     if (*bs->device_name) {
         qdict_put(dict, "device", qstring_from_str(bs->device_name));
@@ -1703,6 +1915,28 @@ void bdrv_info_stats(Monitor *mon, QObject **ret_data)
     *ret_data = QOBJECT(devices);
 }
 
+static void bdrv_reset_stats_bs(BlockDriverState *bs)
+{
+    bs->rd_bytes = bs->wr_bytes = 0;
+    bs->rd_ops = bs->wr_ops = 0;
+    memset(bs->latency, 0, sizeof(bs->latency));
+    memset(bs->failed_ops, 0, sizeof(bs->failed_ops));
+
+    if (bs->file) {
+        bdrv_reset_stats_bs(bs->file);
+    }
+}
+
+/* Clears the I/O counters and latency histograms of all devices */
+void bdrv_reset_stats(void)
+{
+    BlockDriverState *bs;
+
+    QTAILQ_FOREACH(bs, &bdrv_states, list) {
+        bdrv_reset_stats_bs(bs);
+    }
+}
+
 const char *bdrv_get_encrypted_filename(BlockDriverState *bs)
 {
     if (bs->backing_hd && bs->backing_hd->encrypted)
@@ -1974,28 +2208,82 @@ char *bdrv_snapshot_dump(char *buf, int buf_size, QEMUSnapshotInfo *sn)
 /**************************************************************/
 /* async I/Os */
 
+/*
+ * AIO requests are wrapped so that their latency can be accounted when the
+ * driver completes them.
+ */
+typedef struct BlockAcctAIOCB {
+    BlockDriverAIOCB common;
+    BlockDriverAIOCB *acb;      /* the request of the driver */
+    int type;
+    int nb_sectors;
+    int64_t start;
+} BlockAcctAIOCB;
+
+static void bdrv_acct_cancel(BlockDriverAIOCB *blockacb)
+{
+    BlockAcctAIOCB *acct = container_of(blockacb, BlockAcctAIOCB, common);
+
+    bdrv_aio_cancel(acct->acb);
+    qemu_aio_release(acct);
+}
+
+static AIOPool bdrv_acct_aio_pool = {
+    .aiocb_size         = sizeof(BlockAcctAIOCB),
+    .cancel             = bdrv_acct_cancel,
+};
+
+static BlockAcctAIOCB *bdrv_acct_get(BlockDriverState *bs, int type,
+                                     int nb_sectors,
+                                     BlockDriverCompletionFunc *cb,
+                                     void *opaque)
+{
+    BlockAcctAIOCB *acct;
+
+    acct = qemu_aio_get(&bdrv_acct_aio_pool, bs, cb, opaque);
+    acct->type = type;
+    acct->nb_sectors = nb_sectors;
+    acct->start = get_clock();
+    return acct;
+}
+
+static void bdrv_acct_cb(void *opaque, int ret)
+{
+    BlockAcctAIOCB *acct = opaque;
+
+    bdrv_acct_done(acct->common.bs, acct->type, acct->nb_sectors,
+                   acct->start, ret);
+    acct->common.cb(acct->common.opaque, ret);
+    qemu_aio_release(acct);
+}
+
 BlockDriverAIOCB *bdrv_aio_readv(BlockDriverState *bs, int64_t sector_num,
                                  QEMUIOVector *qiov, int nb_sectors,
                                  BlockDriverCompletionFunc *cb, void *opaque)
 {
     BlockDriver *drv = bs->drv;
-    BlockDriverAIOCB *ret;
+    BlockAcctAIOCB *acct;
 
     if (!drv)
         return NULL;
     if (bdrv_check_request(bs, sector_num, nb_sectors))
         return NULL;
 
-    ret = drv->bdrv_aio_readv(bs, sector_num, qiov, nb_sectors,
-                              cb, opaque);
+    if (drv->bdrv_aio_readv == bdrv_aio_readv_em) {
+        /* accounted by bdrv_read() */
+        return bdrv_aio_readv_em(bs, sector_num, qiov, nb_sectors,
+                                 cb, opaque);
+    }
 
-    if (ret) {
-	/* Update stats even though technically transfer has not happened. */
-	bs->rd_bytes += (unsigned) nb_sectors * BDRV_SECTOR_SIZE;
-	bs->rd_ops ++;
+    acct = bdrv_acct_get(bs, BDRV_ACCT_READ, nb_sectors, cb, opaque);
+    acct->acb = drv->bdrv_aio_readv(bs, sector_num, qiov, nb_sectors,
+                                    bdrv_acct_cb, acct);
+    if (!acct->acb) {
+        qemu_aio_release(acct);
+        return NULL;
     }
 
-    return ret;
+    return &acct->common;
 }
 
 BlockDriverAIOCB *bdrv_aio_writev(BlockDriverState *bs, int64_t sector_num,
@@ -2003,7 +2291,7 @@ BlockDriverAIOCB *bdrv_aio_writev(BlockDriverState *bs, int64_t sector_num,
                                   BlockDriverCompletionFunc *cb, void *opaque)
 {
     BlockDriver *drv = bs->drv;
-    BlockDriverAIOCB *ret;
+    BlockAcctAIOCB *acct;
 
     if (!drv)
         return NULL;
@@ -2016,19 +2304,25 @@ BlockDriverAIOCB *bdrv_aio_writev(BlockDriverState *bs, int64_t sector_num,
         set_dirty_bitmap(bs, sector_num, nb_sectors, 1);
     }
 
-    ret = drv->bdrv_aio_writev(bs, sector_num, qiov, nb_sectors,
-                               cb, opaque);
+    if (drv->bdrv_aio_writev == bdrv_aio_writev_em) {
+        /* accounted by bdrv_write() */
+        return bdrv_aio_writev_em(bs, sector_num, qiov, nb_sectors,
+                                  cb, opaque);
+    }
+
+    acct = bdrv_acct_get(bs, BDRV_ACCT_WRITE, nb_sectors, cb, opaque);
+    acct->acb = drv->bdrv_aio_writev(bs, sector_num, qiov, nb_sectors,
+                                     bdrv_acct_cb, acct);
+    if (!acct->acb) {
+        qemu_aio_release(acct);
+        return NULL;
+    }
 
-    if (ret) {
-        /* Update stats even though technically transfer has not happened. */
-        bs->wr_bytes += (unsigned) nb_sectors * BDRV_SECTOR_SIZE;
-        bs->wr_ops ++;
-        if (bs->wr_highest_sector < sector_num + nb_sectors - 1) {
-            bs->wr_highest_sector = sector_num + nb_sectors - 1;
-        }
+    if (bs->wr_highest_sector < sector_num + nb_sectors - 1) {
+        bs->wr_highest_sector = sector_num + nb_sectors - 1;
     }
 
-    return ret;
+    return &acct->common;
 }
 
 
@@ -2258,6 +2552,7 @@ BlockDriverAIOCB *bdrv_aio_flush(BlockDriverState *bs,
         BlockDriverCompletionFunc *cb, void *opaque)
 {
     BlockDriver *drv = bs->drv;
+    BlockAcctAIOCB *acct;
 
     if (bs->open_flags & BDRV_O_NO_FLUSH) {
         return bdrv_aio_noop_em(bs, cb, opaque);
@@ -2265,7 +2560,20 @@ BlockDriverAIOCB *bdrv_aio_flush(BlockDriverState *bs,
 
     if (!drv)
         return NULL;
-    return drv->bdrv_aio_flush(bs, cb, opaque);
+
+    if (drv->bdrv_aio_flush == bdrv_aio_flush_em) {
+        /* accounted by bdrv_flush() */
+        return bdrv_aio_flush_em(bs, cb, opaque);
+    }
+
+    acct = bdrv_acct_get(bs, BDRV_ACCT_FLUSH, 0, cb, opaque);
+    acct->acb = drv->bdrv_aio_flush(bs, bdrv_acct_cb, acct);
+    if (!acct->acb) {
+        qemu_aio_release(acct);
+        return NULL;
+    }
+
+    return &acct->common;
 }
 
 void bdrv_aio_cancel(BlockDriverAIOCB *acb)
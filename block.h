@@ -50,15 +50,45 @@ typedef enum {
     BDRV_ACTION_REPORT, BDRV_ACTION_IGNORE, BDRV_ACTION_STOP
 } BlockMonEventAction;
 
+/* Request types of the I/O latency statistics */
+enum {
+    BDRV_ACCT_READ,
+    BDRV_ACCT_WRITE,
+    BDRV_ACCT_FLUSH,
+    BDRV_MAX_IOTYPE,
+};
+
+/*
+ * Request latencies are recorded in a log2 histogram of microseconds:
+ * bucket 0 is < 1us, bucket n is [2^(n-1) .. 2^n - 1] us, and the last
+ * bucket is everything above (about 4 seconds).
+ */
+#define BDRV_LATENCY_BUCKETS 24
+
+typedef struct BlockLatencyStats {
+    uint64_t count;
+    uint64_t total_ns;
+    uint64_t max_ns;
+    uint64_t hist[BDRV_LATENCY_BUCKETS];
+} BlockLatencyStats;
+
+void bdrv_latency_add(BlockLatencyStats *stats, int64_t ns);
+int64_t bdrv_latency_bucket_min_us(int bucket);
+QObject *bdrv_latency_to_qobject(const BlockLatencyStats *stats);
+void bdrv_latency_print(Monitor *mon, const char *name, const QObject *data);
+
 void bdrv_mon_event(const BlockDriverState *bdrv,
                     BlockMonEventAction action, int is_read);
 void bdrv_info_print(Monitor *mon, const QObject *data);
 void bdrv_info(Monitor *mon, QObject **ret_data);
 void bdrv_stats_print(Monitor *mon, const QObject *data);
 void bdrv_info_stats(Monitor *mon, QObject **ret_data);
+void bdrv_reset_stats(void);
 
 void bdrv_init(void);
 void bdrv_init_with_whitelist(void);
+void qcow2_set_cache_options(int l2_tables, int refcount_tables,
+                             int writethrough);
 BlockDriver *bdrv_find_protocol(const char *filename);
 BlockDriver *bdrv_find_format(const char *format_name);
 BlockDriver *bdrv_find_whitelisted_format(const char *format_name);
@@ -0,0 +1,345 @@
+/*
+ * L2/refcount table cache for the QCOW2 format
+ *
+ * Copyright (c) 2012 The Android Open Source Project
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "qemu-common.h"
+#include "block_int.h"
+#include "block/qcow2.h"
+
+typedef struct Qcow2CachedTable {
+    uint64_t offset;        /* offset of the table in the image, 0 if unused */
+    uint64_t lru_stamp;     /* value of the cache clock at the last use */
+    int dirty_start;        /* dirty byte range, empty if clean */
+    int dirty_end;
+    int next;               /* next entry in the same hash bucket, or -1 */
+} Qcow2CachedTable;
+
+struct Qcow2Cache {
+    Qcow2CachedTable *entries;
+    uint8_t *tables;
+    int *buckets;
+    int num_tables;
+    int table_size;
+    int bucket_mask;
+    uint64_t clock;
+    int flush_needed;       /* tables were written since the last flush */
+    Qcow2CacheStats stats;
+};
+
+static inline void *cache_table(Qcow2Cache *c, int i)
+{
+    return c->tables + (size_t)i * c->table_size;
+}
+
+static inline int cache_index(Qcow2Cache *c, void *table)
+{
+    int i = ((uint8_t *)table - c->tables) / c->table_size;
+    assert(i >= 0 && i < c->num_tables);
+    return i;
+}
+
+static inline int cache_bucket(Qcow2Cache *c, uint64_t offset)
+{
+    return (offset / c->table_size) & c->bucket_mask;
+}
+
+Qcow2Cache *qcow2_cache_create(int num_tables, int table_size)
+{
+    Qcow2Cache *c;
+    int num_buckets, i;
+
+    c = qemu_mallocz(sizeof(*c));
+    c->num_tables = num_tables;
+    c->table_size = table_size;
+    c->entries = qemu_mallocz(num_tables * sizeof(Qcow2CachedTable));
+    c->tables = qemu_malloc((size_t)num_tables * table_size);
+
+    num_buckets = 1;
+    while (num_buckets < 2 * num_tables) {
+        num_buckets <<= 1;
+    }
+    c->bucket_mask = num_buckets - 1;
+    c->buckets = qemu_malloc(num_buckets * sizeof(int));
+    for (i = 0; i < num_buckets; i++) {
+        c->buckets[i] = -1;
+    }
+    for (i = 0; i < num_tables; i++) {
+        c->entries[i].next = -1;
+    }
+
+    return c;
+}
+
+void qcow2_cache_destroy(Qcow2Cache *c)
+{
+    if (c == NULL) {
+        return;
+    }
+    qemu_free(c->buckets);
+    qemu_free(c->tables);
+    qemu_free(c->entries);
+    qemu_free(c);
+}
+
+static void cache_unlink(Qcow2Cache *c, int i)
+{
+    int *link = &c->buckets[cache_bucket(c, c->entries[i].offset)];
+
+    while (*link != i) {
+        assert(*link >= 0);
+        link = &c->entries[*link].next;
+    }
+    *link = c->entries[i].next;
+    c->entries[i].next = -1;
+    c->entries[i].offset = 0;
+    c->entries[i].dirty_start = c->entries[i].dirty_end = 0;
+}
+
+static int cache_find(Qcow2Cache *c, uint64_t offset)
+{
+    int i;
+
+    for (i = c->buckets[cache_bucket(c, offset)]; i >= 0;
+         i = c->entries[i].next) {
+        if (c->entries[i].offset == offset) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static int cache_entry_write_back(BlockDriverState *bs, Qcow2Cache *c, int i)
+{
+    Qcow2CachedTable *entry = &c->entries[i];
+    int start, end;
+    int ret;
+
+    if (entry->dirty_start >= entry->dirty_end) {
+        return 0;
+    }
+
+    /* Write whole sectors, bdrv_pwrite would read-modify-write otherwise */
+    start = entry->dirty_start & ~(BDRV_SECTOR_SIZE - 1);
+    end = (entry->dirty_end + BDRV_SECTOR_SIZE - 1) & ~(BDRV_SECTOR_SIZE - 1);
+    if (end > c->table_size) {
+        end = c->table_size;
+    }
+
+    ret = bdrv_pwrite(bs->file, entry->offset + start,
+                      (uint8_t *)cache_table(c, i) + start, end - start);
+    if (ret < 0) {
+        return ret;
+    }
+
+    entry->dirty_start = entry->dirty_end = 0;
+    c->flush_needed = 1;
+    c->stats.writes++;
+    return 0;
+}
+
+/*
+ * Returns an entry for a table that isn't in the cache yet, writing back the
+ * least recently used entry if needed. Returns the index of the entry, or
+ * -errno if writing back the evicted table failed.
+ */
+static int cache_new_entry(BlockDriverState *bs, Qcow2Cache *c,
+    uint64_t offset)
+{
+    uint64_t min_stamp = UINT64_MAX;
+    int min_index = 0;
+    int i, ret;
+
+    for (i = 0; i < c->num_tables; i++) {
+        if (c->entries[i].offset == 0) {
+            min_index = i;
+            break;
+        }
+        if (c->entries[i].lru_stamp < min_stamp) {
+            min_stamp = c->entries[i].lru_stamp;
+            min_index = i;
+        }
+    }
+
+    if (c->entries[min_index].offset != 0) {
+        ret = cache_entry_write_back(bs, c, min_index);
+        if (ret < 0) {
+            return ret;
+        }
+        cache_unlink(c, min_index);
+        c->stats.evictions++;
+    }
+
+    c->entries[min_index].offset = offset;
+    c->entries[min_index].lru_stamp = ++c->clock;
+    c->entries[min_index].next = c->buckets[cache_bucket(c, offset)];
+    c->buckets[cache_bucket(c, offset)] = min_index;
+
+    return min_index;
+}
+
+void *qcow2_cache_lookup(Qcow2Cache *c, uint64_t offset)
+{
+    int i = cache_find(c, offset);
+
+    if (i < 0) {
+        c->stats.misses++;
+        return NULL;
+    }
+
+    c->stats.hits++;
+    c->entries[i].lru_stamp = ++c->clock;
+    return cache_table(c, i);
+}
+
+/* Like qcow2_cache_lookup, but doesn't count as a use of the table */
+int qcow2_cache_contains(Qcow2Cache *c, uint64_t offset)
+{
+    return cache_find(c, offset) >= 0;
+}
+
+int qcow2_cache_get_empty(BlockDriverState *bs, Qcow2Cache *c,
+    uint64_t offset, void **table)
+{
+    int i;
+
+    assert(offset != 0);
+    i = cache_find(c, offset);
+    if (i < 0) {
+        i = cache_new_entry(bs, c, offset);
+        if (i < 0) {
+            return i;
+        }
+    } else {
+        c->entries[i].lru_stamp = ++c->clock;
+    }
+
+    *table = cache_table(c, i);
+    return 0;
+}
+
+int qcow2_cache_get(BlockDriverState *bs, Qcow2Cache *c, uint64_t offset,
+    void **table)
+{
+    int ret;
+
+    *table = qcow2_cache_lookup(c, offset);
+    if (*table != NULL) {
+        return 0;
+    }
+
+    ret = qcow2_cache_get_empty(bs, c, offset, table);
+    if (ret < 0) {
+        return ret;
+    }
+
+    ret = bdrv_pread(bs->file, offset, *table, c->table_size);
+    if (ret < 0) {
+        qcow2_cache_discard(c, *table);
+        *table = NULL;
+        return ret;
+    }
+
+    return 0;
+}
+
+void qcow2_cache_mark_dirty(Qcow2Cache *c, void *table, int start, int end)
+{
+    Qcow2CachedTable *entry = &c->entries[cache_index(c, table)];
+
+    if (entry->dirty_start >= entry->dirty_end) {
+        entry->dirty_start = start;
+        entry->dirty_end = end;
+    } else {
+        entry->dirty_start = MIN(entry->dirty_start, start);
+        entry->dirty_end = MAX(entry->dirty_end, end);
+    }
+}
+
+void qcow2_cache_mark_clean(Qcow2Cache *c, void *table)
+{
+    Qcow2CachedTable *entry = &c->entries[cache_index(c, table)];
+
+    entry->dirty_start = entry->dirty_end = 0;
+}
+
+void qcow2_cache_discard(Qcow2Cache *c, void *table)
+{
+    int i = cache_index(c, table);
+
+    if (c->entries[i].offset != 0) {
+        cache_unlink(c, i);
+    }
+}
+
+/* Drops the tables at offsets in [start, end) without writing them back */
+void qcow2_cache_discard_range(Qcow2Cache *c, uint64_t start, uint64_t end)
+{
+    int i;
+
+    for (i = 0; i < c->num_tables; i++) {
+        if (c->entries[i].offset >= start && c->entries[i].offset < end &&
+            c->entries[i].offset != 0) {
+            cache_unlink(c, i);
+        }
+    }
+}
+
+void qcow2_cache_reset(Qcow2Cache *c)
+{
+    int i;
+
+    for (i = 0; i < c->num_tables; i++) {
+        if (c->entries[i].offset != 0) {
+            cache_unlink(c, i);
+        }
+    }
+}
+
+int qcow2_cache_flush(BlockDriverState *bs, Qcow2Cache *c)
+{
+    int i, ret;
+
+    for (i = 0; i < c->num_tables; i++) {
+        ret = cache_entry_write_back(bs, c, i);
+        if (ret < 0) {
+            return ret;
+        }
+    }
+
+    /*
+     * Make sure the tables hit the disk before anything that refers to them.
+     * This includes tables written back earlier when they were evicted.
+     */
+    if (c->flush_needed) {
+        bdrv_flush(bs->file);
+        c->flush_needed = 0;
+        c->stats.flushes++;
+    }
+
+    return 0;
+}
+
+void qcow2_cache_get_stats(Qcow2Cache *c, Qcow2CacheStats *stats)
+{
+    *stats = c->stats;
+}
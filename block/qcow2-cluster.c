@@ -27,6 +27,9 @@
 #include "qemu-common.h"
 #include "block_int.h"
 #include "block/qcow2.h"
+#ifndef _WIN32
+#include "block/raw-posix-aio.h"
+#endif
 
 int qcow2_grow_l1_table(BlockDriverState *bs, int min_size)
 {
@@ -70,6 +73,13 @@ int qcow2_grow_l1_table(BlockDriverState *bs, int min_size)
     for(i = 0; i < s->l1_size; i++)
         new_l1_table[i] = be64_to_cpu(new_l1_table[i]);
 
+    /* the refcount of the new table must be on disk before the header
+     * points to it */
+    ret = qcow2_refcount_flush(bs);
+    if (ret < 0) {
+        goto fail;
+    }
+
     /* set new table */
     BLKDBG_EVENT(bs->file, BLKDBG_L1_GROW_ACTIVATE_TABLE);
     cpu_to_be32w((uint32_t*)data, new_l1_size);
@@ -94,57 +104,7 @@ void qcow2_l2_cache_reset(BlockDriverState *bs)
 {
     BDRVQcowState *s = bs->opaque;
 
-    memset(s->l2_cache, 0, s->l2_size * L2_CACHE_SIZE * sizeof(uint64_t));
-    memset(s->l2_cache_offsets, 0, L2_CACHE_SIZE * sizeof(uint64_t));
-    memset(s->l2_cache_counts, 0, L2_CACHE_SIZE * sizeof(uint32_t));
-}
-
-static inline int l2_cache_new_entry(BlockDriverState *bs)
-{
-    BDRVQcowState *s = bs->opaque;
-    uint32_t min_count;
-    int min_index, i;
-
-    /* find a new entry in the least used one */
-    min_index = 0;
-    min_count = 0xffffffff;
-    for(i = 0; i < L2_CACHE_SIZE; i++) {
-        if (s->l2_cache_counts[i] < min_count) {
-            min_count = s->l2_cache_counts[i];
-            min_index = i;
-        }
-    }
-    return min_index;
-}
-
-/*
- * seek_l2_table
- *
- * seek l2_offset in the l2_cache table
- * if not found, return NULL,
- * if found,
- *   increments the l2 cache hit count of the entry,
- *   if counter overflow, divide by two all counters
- *   return the pointer to the l2 cache entry
- *
- */
-
-static uint64_t *seek_l2_table(BDRVQcowState *s, uint64_t l2_offset)
-{
-    int i, j;
-
-    for(i = 0; i < L2_CACHE_SIZE; i++) {
-        if (l2_offset == s->l2_cache_offsets[i]) {
-            /* increment the hit count */
-            if (++s->l2_cache_counts[i] == 0xffffffff) {
-                for(j = 0; j < L2_CACHE_SIZE; j++) {
-                    s->l2_cache_counts[j] >>= 1;
-                }
-            }
-            return s->l2_cache + (i << s->l2_bits);
-        }
-    }
-    return NULL;
+    qcow2_cache_reset(s->l2_cache);
 }
 
 /*
@@ -161,31 +121,31 @@ static int l2_load(BlockDriverState *bs, uint64_t l2_offset,
     uint64_t **l2_table)
 {
     BDRVQcowState *s = bs->opaque;
-    int min_index;
     int ret;
 
     /* seek if the table for the given offset is in the cache */
 
-    *l2_table = seek_l2_table(s, l2_offset);
+    *l2_table = qcow2_cache_lookup(s->l2_cache, l2_offset);
     if (*l2_table != NULL) {
         return 0;
     }
 
-    /* not found: load a new entry in the least used one */
+    /* not found: load it in place of the least recently used one */
 
-    min_index = l2_cache_new_entry(bs);
-    *l2_table = s->l2_cache + (min_index << s->l2_bits);
+    ret = qcow2_cache_get_empty(bs, s->l2_cache, l2_offset,
+        (void **) l2_table);
+    if (ret < 0) {
+        return ret;
+    }
 
     BLKDBG_EVENT(bs->file, BLKDBG_L2_LOAD);
     ret = bdrv_pread(bs->file, l2_offset, *l2_table,
         s->l2_size * sizeof(uint64_t));
     if (ret < 0) {
+        qcow2_cache_discard(s->l2_cache, *l2_table);
         return ret;
     }
 
-    s->l2_cache_offsets[min_index] = l2_offset;
-    s->l2_cache_counts[min_index] = 1;
-
     return 0;
 }
 
@@ -201,6 +161,12 @@ static int write_l1_entry(BlockDriverState *bs, int l1_index)
     int l1_start_index;
     int i, ret;
 
+    /* the refcounts of the tables L1 points to must be on disk first */
+    ret = qcow2_refcount_flush(bs);
+    if (ret < 0) {
+        return ret;
+    }
+
     l1_start_index = l1_index & ~(L1_ENTRIES_PER_SECTOR - 1);
     for (i = 0; i < L1_ENTRIES_PER_SECTOR; i++) {
         buf[i] = cpu_to_be64(s->l1_table[l1_start_index + i]);
@@ -229,7 +195,6 @@ static int write_l1_entry(BlockDriverState *bs, int l1_index)
 static int l2_allocate(BlockDriverState *bs, int l1_index, uint64_t **table)
 {
     BDRVQcowState *s = bs->opaque;
-    int min_index;
     uint64_t old_l2_offset;
     uint64_t *l2_table;
     int64_t l2_offset;
@@ -246,8 +211,11 @@ static int l2_allocate(BlockDriverState *bs, int l1_index, uint64_t **table)
 
     /* allocate a new entry in the l2 cache */
 
-    min_index = l2_cache_new_entry(bs);
-    l2_table = s->l2_cache + (min_index << s->l2_bits);
+    ret = qcow2_cache_get_empty(bs, s->l2_cache, l2_offset,
+        (void **) &l2_table);
+    if (ret < 0) {
+        goto fail;
+    }
 
     if (old_l2_offset == 0) {
         /* if there was no old l2 table, clear the new table */
@@ -276,11 +244,6 @@ static int l2_allocate(BlockDriverState *bs, int l1_index, uint64_t **table)
         goto fail;
     }
 
-    /* update the l2 cache entry */
-
-    s->l2_cache_offsets[min_index] = l2_offset;
-    s->l2_cache_counts[min_index] = 1;
-
     *table = l2_table;
     return 0;
 
@@ -373,9 +336,10 @@ static int qcow_read(BlockDriverState *bs, int64_t sector_num,
                 memset(buf, 0, 512 * n);
             }
         } else if (cluster_offset & QCOW_OFLAG_COMPRESSED) {
-            if (qcow2_decompress_cluster(bs, cluster_offset) < 0)
+            const uint8_t *data;
+            if (qcow2_decompress_cluster(bs, cluster_offset, &data) < 0)
                 return -1;
-            memcpy(buf, s->cluster_cache + index_in_cluster * 512, 512 * n);
+            memcpy(buf, data + index_in_cluster * 512, 512 * n);
         } else {
             BLKDBG_EVENT(bs->file, BLKDBG_READ);
             ret = bdrv_pread(bs->file, cluster_offset + index_in_cluster * 512, buf, n * 512);
@@ -629,6 +593,10 @@ uint64_t qcow2_alloc_compressed_cluster_offset(BlockDriverState *bs,
 
     /* compressed clusters never have the copied flag */
 
+    if (qcow2_refcount_flush(bs) < 0) {
+        return 0;
+    }
+
     BLKDBG_EVENT(bs->file, BLKDBG_L2_UPDATE_COMPRESSED);
     l2_table[l2_index] = cpu_to_be64(cluster_offset);
     if (bdrv_pwrite_sync(bs->file,
@@ -654,6 +622,13 @@ static int write_l2_entries(BlockDriverState *bs, uint64_t *l2_table,
     size_t len = end_offset - start_offset;
     int ret;
 
+    /* the refcounts of newly allocated clusters must be on disk before L2
+     * points to them */
+    ret = qcow2_refcount_flush(bs);
+    if (ret < 0) {
+        return ret;
+    }
+
     BLKDBG_EVENT(bs->file, BLKDBG_L2_UPDATE);
     ret = bdrv_pwrite_sync(bs->file, l2_offset + start_offset,
         &l2_table[l2_start_index], len);
@@ -897,27 +872,333 @@ static int decompress_buffer(uint8_t *out_buf, int out_buf_size,
     return 0;
 }
 
-int qcow2_decompress_cluster(BlockDriverState *bs, uint64_t cluster_offset)
+/*
+ * Decompressed clusters are kept in an LRU cache indexed by the offset of
+ * their compressed data. That data never changes while it is allocated, so
+ * a cached cluster only needs to be dropped when a host cluster its
+ * compressed data lies in is freed, and the space may then be reused.
+ *
+ * Reads of compressed clusters go through inflate jobs: the compressed data
+ * is read with bdrv_aio_readv, inflated on the posix-aio-compat worker
+ * threads, and the decompressed cluster is added to the cache. Requests for
+ * a cluster whose job is still running wait for it, and each job started by
+ * a request also starts jobs for the following compressed clusters of the
+ * same L2 table, so that sequential reads find them ready.
+ */
+
+typedef struct Qcow2InflateWaiter {
+    Qcow2InflateFunc *cb;
+    void *opaque;
+    QLIST_ENTRY(Qcow2InflateWaiter) next;
+} Qcow2InflateWaiter;
+
+typedef struct Qcow2InflateJob {
+    BlockDriverState *bs;
+    uint64_t coffset;
+    int invalidated; /* compressed data freed, don't cache the result */
+    int nb_csectors;
+    int sector_offset;
+    int cluster_size;
+    uint8_t *compressed;
+    uint8_t *data;
+    struct iovec iov;
+    QEMUIOVector qiov;
+    QLIST_HEAD(, Qcow2InflateWaiter) waiters;
+    QLIST_ENTRY(Qcow2InflateJob) next;
+} Qcow2InflateJob;
+
+void qcow2_decompress_init(BlockDriverState *bs)
 {
     BDRVQcowState *s = bs->opaque;
-    int ret, csize, nb_csectors, sector_offset;
+
+    s->decompress_cache = qcow2_cache_create(QCOW2_DECOMPRESS_CACHE_SIZE,
+                                             s->cluster_size);
+    QLIST_INIT(&s->inflate_jobs);
+    s->nb_inflate_jobs = 0;
+#ifndef _WIN32
+    s->inflate_async = (paio_init() == 0);
+#else
+    s->inflate_async = 0;
+#endif
+}
+
+void qcow2_decompress_close(BlockDriverState *bs)
+{
+    BDRVQcowState *s = bs->opaque;
+
+    /* Read-ahead jobs may still be running */
+    while (!QLIST_EMPTY(&s->inflate_jobs)) {
+        qemu_aio_wait();
+    }
+    qcow2_cache_destroy(s->decompress_cache);
+    s->decompress_cache = NULL;
+}
+
+/*
+ * Drops the decompressed clusters whose compressed data may lie in the host
+ * cluster at cluster_offset, which has been freed. Compressed data is always
+ * shorter than a cluster, so it starts either in that cluster or less than a
+ * cluster before it.
+ */
+void qcow2_decompress_cache_invalidate(BlockDriverState *bs,
+    uint64_t cluster_offset)
+{
+    BDRVQcowState *s = bs->opaque;
+    Qcow2InflateJob *job;
+    uint64_t start, end;
+
+    start = cluster_offset > s->cluster_size ?
+            cluster_offset - s->cluster_size + 1 : 0;
+    end = cluster_offset + s->cluster_size;
+
+    if (s->decompress_cache) {
+        qcow2_cache_discard_range(s->decompress_cache, start, end);
+    }
+    /* Keep the jobs in flight from adding stale clusters */
+    QLIST_FOREACH(job, &s->inflate_jobs, next) {
+        if (job->coffset >= start && job->coffset < end) {
+            job->invalidated = 1;
+        }
+    }
+}
+
+static void inflate_job_complete(Qcow2InflateJob *job, int ret)
+{
+    BlockDriverState *bs = job->bs;
+    BDRVQcowState *s = bs->opaque;
+    Qcow2InflateWaiter *waiter;
+    void *table;
+
+    QLIST_REMOVE(job, next);
+    s->nb_inflate_jobs--;
+
+    if (ret >= 0 && !job->invalidated &&
+        qcow2_cache_get_empty(bs, s->decompress_cache, job->coffset,
+                              &table) == 0) {
+        memcpy(table, job->data, s->cluster_size);
+    }
+
+    while ((waiter = QLIST_FIRST(&job->waiters)) != NULL) {
+        QLIST_REMOVE(waiter, next);
+        waiter->cb(waiter->opaque, ret < 0 ? NULL : job->data,
+                   ret < 0 ? ret : 0);
+        qemu_free(waiter);
+    }
+
+    qemu_vfree(job->compressed);
+    qemu_free(job->data);
+    qemu_free(job);
+}
+
+/* Runs on a worker thread, must only touch the job */
+static int inflate_job_run(void *opaque)
+{
+    Qcow2InflateJob *job = opaque;
+    int csize = job->nb_csectors * 512 - job->sector_offset;
+
+    if (decompress_buffer(job->data, job->cluster_size,
+                          job->compressed + job->sector_offset, csize) < 0) {
+        return -EIO;
+    }
+    return 0;
+}
+
+static void inflate_job_done(void *opaque, int ret)
+{
+    inflate_job_complete(opaque, ret);
+}
+
+static void inflate_job_read_cb(void *opaque, int ret)
+{
+    Qcow2InflateJob *job = opaque;
+    BDRVQcowState *s = job->bs->opaque;
+
+    if (ret < 0) {
+        inflate_job_complete(job, ret);
+        return;
+    }
+
+#ifndef _WIN32
+    if (s->inflate_async &&
+        paio_call(job->bs, inflate_job_run, job, inflate_job_done, job)) {
+        return;
+    }
+#endif
+    inflate_job_complete(job, inflate_job_run(job));
+}
+
+static Qcow2InflateJob *find_inflate_job(BDRVQcowState *s, uint64_t coffset)
+{
+    Qcow2InflateJob *job;
+
+    QLIST_FOREACH(job, &s->inflate_jobs, next) {
+        if (job->coffset == coffset && !job->invalidated) {
+            return job;
+        }
+    }
+    return NULL;
+}
+
+static Qcow2InflateJob *start_inflate_job(BlockDriverState *bs,
+                                          uint64_t cluster_offset)
+{
+    BDRVQcowState *s = bs->opaque;
+    Qcow2InflateJob *job;
+
+    job = qemu_mallocz(sizeof(*job));
+    job->bs = bs;
+    job->coffset = cluster_offset & s->cluster_offset_mask;
+    job->nb_csectors =
+        ((cluster_offset >> s->csize_shift) & s->csize_mask) + 1;
+    job->sector_offset = job->coffset & 511;
+    job->cluster_size = s->cluster_size;
+    job->compressed = qemu_blockalign(bs->file, job->nb_csectors * 512);
+    job->data = qemu_malloc(s->cluster_size);
+    QLIST_INIT(&job->waiters);
+
+    QLIST_INSERT_HEAD(&s->inflate_jobs, job, next);
+    s->nb_inflate_jobs++;
+
+    job->iov.iov_base = job->compressed;
+    job->iov.iov_len = job->nb_csectors * 512;
+    qemu_iovec_init_external(&job->qiov, &job->iov, 1);
+    BLKDBG_EVENT(bs->file, BLKDBG_READ_COMPRESSED);
+    if (bdrv_aio_readv(bs->file, job->coffset >> 9, &job->qiov,
+                       job->nb_csectors, inflate_job_read_cb, job) == NULL) {
+        QLIST_REMOVE(job, next);
+        s->nb_inflate_jobs--;
+        qemu_vfree(job->compressed);
+        qemu_free(job->data);
+        qemu_free(job);
+        return NULL;
+    }
+    return job;
+}
+
+/* Starts inflating the compressed clusters that follow the given offset */
+static void inflate_readahead(BlockDriverState *bs, uint64_t offset)
+{
+    BDRVQcowState *s = bs->opaque;
+    uint64_t cluster_offset, coffset;
+    int i, n;
+
+    offset &= ~(uint64_t)(s->cluster_size - 1);
+    for (i = 0; i < QCOW2_INFLATE_READAHEAD; i++) {
+        offset += s->cluster_size;
+        /* Don't load other L2 tables just for read-ahead */
+        if (((offset >> s->cluster_bits) & (s->l2_size - 1)) == 0 ||
+            offset >= bs->total_sectors * BDRV_SECTOR_SIZE ||
+            s->nb_inflate_jobs >= QCOW2_INFLATE_MAX_JOBS) {
+            break;
+        }
+
+        n = s->cluster_sectors;
+        if (qcow2_get_cluster_offset(bs, offset, &n, &cluster_offset) < 0 ||
+            !(cluster_offset & QCOW_OFLAG_COMPRESSED)) {
+            break;
+        }
+
+        coffset = cluster_offset & s->cluster_offset_mask;
+        if (!qcow2_cache_contains(s->decompress_cache, coffset) &&
+            !find_inflate_job(s, coffset)) {
+            start_inflate_job(bs, cluster_offset);
+        }
+    }
+}
+
+/*
+ * Gets the decompressed data of the compressed cluster at cluster_offset,
+ * which maps the guest offset 'offset'. Returns 0 and sets *data if the
+ * cluster is cached. Returns 1 if the cluster is being inflated, cb is then
+ * called once it is ready, unless qcow2_decompress_cancel is called first.
+ * Returns -errno on error.
+ */
+int qcow2_decompress_cluster_async(BlockDriverState *bs, uint64_t offset,
+    uint64_t cluster_offset, const uint8_t **data,
+    Qcow2InflateFunc *cb, void *opaque)
+{
+    BDRVQcowState *s = bs->opaque;
+    Qcow2InflateJob *job;
+    Qcow2InflateWaiter *waiter;
     uint64_t coffset;
 
     coffset = cluster_offset & s->cluster_offset_mask;
-    if (s->cluster_cache_offset != coffset) {
-        nb_csectors = ((cluster_offset >> s->csize_shift) & s->csize_mask) + 1;
-        sector_offset = coffset & 511;
-        csize = nb_csectors * 512 - sector_offset;
-        BLKDBG_EVENT(bs->file, BLKDBG_READ_COMPRESSED);
-        ret = bdrv_read(bs->file, coffset >> 9, s->cluster_data, nb_csectors);
-        if (ret < 0) {
-            return -1;
+    *data = qcow2_cache_lookup(s->decompress_cache, coffset);
+    if (*data) {
+        return 0;
+    }
+
+    job = find_inflate_job(s, coffset);
+    if (job == NULL) {
+        job = start_inflate_job(bs, cluster_offset);
+        if (job == NULL) {
+            return -EIO;
         }
-        if (decompress_buffer(s->cluster_cache, s->cluster_size,
-                              s->cluster_data + sector_offset, csize) < 0) {
-            return -1;
+        inflate_readahead(bs, offset);
+    }
+
+    waiter = qemu_malloc(sizeof(*waiter));
+    waiter->cb = cb;
+    waiter->opaque = opaque;
+    QLIST_INSERT_HEAD(&job->waiters, waiter, next);
+    return 1;
+}
+
+/* Drops the pending callback of a qcow2_decompress_cluster_async request */
+void qcow2_decompress_cancel(BlockDriverState *bs, void *opaque)
+{
+    BDRVQcowState *s = bs->opaque;
+    Qcow2InflateJob *job;
+    Qcow2InflateWaiter *waiter;
+
+    QLIST_FOREACH(job, &s->inflate_jobs, next) {
+        QLIST_FOREACH(waiter, &job->waiters, next) {
+            if (waiter->opaque == opaque) {
+                QLIST_REMOVE(waiter, next);
+                qemu_free(waiter);
+                return;
+            }
         }
-        s->cluster_cache_offset = coffset;
     }
+}
+
+/*
+ * Synchronous version of qcow2_decompress_cluster_async. *data points into
+ * the cache and is only valid until the next use of the cache.
+ */
+int qcow2_decompress_cluster(BlockDriverState *bs, uint64_t cluster_offset,
+    const uint8_t **data)
+{
+    BDRVQcowState *s = bs->opaque;
+    int ret, csize, nb_csectors, sector_offset;
+    uint64_t coffset;
+    void *table;
+
+    coffset = cluster_offset & s->cluster_offset_mask;
+    *data = qcow2_cache_lookup(s->decompress_cache, coffset);
+    if (*data) {
+        return 0;
+    }
+
+    nb_csectors = ((cluster_offset >> s->csize_shift) & s->csize_mask) + 1;
+    sector_offset = coffset & 511;
+    csize = nb_csectors * 512 - sector_offset;
+    BLKDBG_EVENT(bs->file, BLKDBG_READ_COMPRESSED);
+    ret = bdrv_read(bs->file, coffset >> 9, s->cluster_data, nb_csectors);
+    if (ret < 0) {
+        return -1;
+    }
+
+    ret = qcow2_cache_get_empty(bs, s->decompress_cache, coffset, &table);
+    if (ret < 0) {
+        return -1;
+    }
+    if (decompress_buffer(table, s->cluster_size,
+                          s->cluster_data + sector_offset, csize) < 0) {
+        qcow2_cache_discard(s->decompress_cache, table);
+        return -1;
+    }
+
+    *data = table;
     return 0;
 }
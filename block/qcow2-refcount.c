@@ -32,27 +32,10 @@ static int QEMU_WARN_UNUSED_RESULT update_refcount(BlockDriverState *bs,
                             int addend);
 
 
+/* Set while a series of updates is made in write-through mode, to write the
+ * refcount blocks out once at the end of the series */
 static int cache_refcount_updates = 0;
 
-static int write_refcount_block(BlockDriverState *bs)
-{
-    BDRVQcowState *s = bs->opaque;
-    size_t size = s->cluster_size;
-
-    if (s->refcount_block_cache_offset == 0) {
-        return 0;
-    }
-
-    BLKDBG_EVENT(bs->file, BLKDBG_REFBLOCK_UPDATE);
-    if (bdrv_pwrite_sync(bs->file, s->refcount_block_cache_offset,
-            s->refcount_block_cache, size) < 0)
-    {
-        return -EIO;
-    }
-
-    return 0;
-}
-
 /*********************************************************/
 /* refcount handling */
 
@@ -61,7 +44,8 @@ int qcow2_refcount_init(BlockDriverState *bs)
     BDRVQcowState *s = bs->opaque;
     int ret, refcount_table_size2, i;
 
-    s->refcount_block_cache = qemu_malloc(s->cluster_size);
+    s->refcount_block_cache = NULL;
+    s->refcount_block_cache_offset = 0;
     refcount_table_size2 = s->refcount_table_size * sizeof(uint64_t);
     s->refcount_table = qemu_malloc(refcount_table_size2);
     if (s->refcount_table_size > 0) {
@@ -81,31 +65,89 @@ int qcow2_refcount_init(BlockDriverState *bs)
 void qcow2_refcount_close(BlockDriverState *bs)
 {
     BDRVQcowState *s = bs->opaque;
-    qemu_free(s->refcount_block_cache);
+    if (s->refcount_cache) {
+        qcow2_refcount_flush(bs);
+        qcow2_cache_destroy(s->refcount_cache);
+        s->refcount_cache = NULL;
+    }
     qemu_free(s->refcount_table);
 }
 
+/*
+ * Writes all the modified refcount blocks to disk. Refcount updates are
+ * written back lazily, so this must be called before writing any metadata
+ * that points to newly allocated clusters.
+ *
+ * Returns 0 on success, -errno in error case.
+ */
+int qcow2_refcount_flush(BlockDriverState *bs)
+{
+    BDRVQcowState *s = bs->opaque;
+
+    BLKDBG_EVENT(bs->file, BLKDBG_REFBLOCK_UPDATE);
+    return qcow2_cache_flush(bs, s->refcount_cache);
+}
 
+/*
+ * Makes the refcount block at the given offset the current one, loading it
+ * from disk if it isn't cached.
+ */
 static int load_refcount_block(BlockDriverState *bs,
                                int64_t refcount_block_offset)
 {
     BDRVQcowState *s = bs->opaque;
+    void *table;
     int ret;
 
-    if (cache_refcount_updates) {
-        ret = write_refcount_block(bs);
+    table = qcow2_cache_lookup(s->refcount_cache, refcount_block_offset);
+    if (table == NULL) {
+        ret = qcow2_cache_get_empty(bs, s->refcount_cache,
+                                    refcount_block_offset, &table);
         if (ret < 0) {
-            return ret;
+            goto fail;
+        }
+
+        BLKDBG_EVENT(bs->file, BLKDBG_REFBLOCK_LOAD);
+        ret = bdrv_pread(bs->file, refcount_block_offset, table,
+                         s->cluster_size);
+        if (ret < 0) {
+            qcow2_cache_discard(s->refcount_cache, table);
+            goto fail;
         }
     }
 
-    BLKDBG_EVENT(bs->file, BLKDBG_REFBLOCK_LOAD);
-    ret = bdrv_pread(bs->file, refcount_block_offset, s->refcount_block_cache,
-                     s->cluster_size);
+    s->refcount_block_cache = table;
+    s->refcount_block_cache_offset = refcount_block_offset;
+    return 0;
+
+fail:
+    s->refcount_block_cache = NULL;
+    s->refcount_block_cache_offset = 0;
+    return ret;
+}
+
+/*
+ * Makes a new, zeroed refcount block at the given offset the current one,
+ * without reading it from disk.
+ */
+static int new_refcount_block(BlockDriverState *bs,
+                              int64_t refcount_block_offset)
+{
+    BDRVQcowState *s = bs->opaque;
+    void *table;
+    int ret;
+
+    ret = qcow2_cache_get_empty(bs, s->refcount_cache, refcount_block_offset,
+                                &table);
     if (ret < 0) {
+        s->refcount_block_cache = NULL;
+        s->refcount_block_cache_offset = 0;
         return ret;
     }
 
+    memset(table, 0, s->cluster_size);
+    qcow2_cache_mark_clean(s->refcount_cache, table);
+    s->refcount_block_cache = table;
     s->refcount_block_cache_offset = refcount_block_offset;
     return 0;
 }
@@ -128,12 +170,9 @@ static int get_refcount(BlockDriverState *bs, int64_t cluster_index)
     refcount_block_offset = s->refcount_table[refcount_table_index];
     if (!refcount_block_offset)
         return 0;
-    if (refcount_block_offset != s->refcount_block_cache_offset) {
-        /* better than nothing: return allocated if read error */
-        ret = load_refcount_block(bs, refcount_block_offset);
-        if (ret < 0) {
-            return ret;
-        }
+    ret = load_refcount_block(bs, refcount_block_offset);
+    if (ret < 0) {
+        return ret;
     }
     block_index = cluster_index &
         ((1 << (s->cluster_bits - REFCOUNT_SHIFT)) - 1);
@@ -193,11 +232,9 @@ static int64_t alloc_refcount_block(BlockDriverState *bs, int64_t cluster_index)
 
         /* If it's already there, we're done */
         if (refcount_block_offset) {
-            if (refcount_block_offset != s->refcount_block_cache_offset) {
-                ret = load_refcount_block(bs, refcount_block_offset);
-                if (ret < 0) {
-                    return ret;
-                }
+            ret = load_refcount_block(bs, refcount_block_offset);
+            if (ret < 0) {
+                return ret;
             }
             return refcount_block_offset;
         }
@@ -225,13 +262,6 @@ static int64_t alloc_refcount_block(BlockDriverState *bs, int64_t cluster_index)
      *   refcount block into the cache
      */
 
-    if (cache_refcount_updates) {
-        ret = write_refcount_block(bs);
-        if (ret < 0) {
-            return ret;
-        }
-    }
-
     /* Allocate the refcount block itself and mark it as used */
     int64_t new_block = alloc_clusters_noref(bs, s->cluster_size);
     if (new_block < 0) {
@@ -246,8 +276,10 @@ static int64_t alloc_refcount_block(BlockDriverState *bs, int64_t cluster_index)
 
     if (in_same_refcount_block(s, new_block, cluster_index << s->cluster_bits)) {
         /* Zero the new refcount block before updating it */
-        memset(s->refcount_block_cache, 0, s->cluster_size);
-        s->refcount_block_cache_offset = new_block;
+        ret = new_refcount_block(bs, new_block);
+        if (ret < 0) {
+            goto fail_block;
+        }
 
         /* The block describes itself, need to update the cache */
         int block_index = (new_block >> s->cluster_bits) &
@@ -263,8 +295,16 @@ static int64_t alloc_refcount_block(BlockDriverState *bs, int64_t cluster_index)
 
         /* Initialize the new refcount block only after updating its refcount,
          * update_refcount uses the refcount cache itself */
-        memset(s->refcount_block_cache, 0, s->cluster_size);
-        s->refcount_block_cache_offset = new_block;
+        ret = new_refcount_block(bs, new_block);
+        if (ret < 0) {
+            goto fail_block;
+        }
+    }
+
+    /* The refcount of the new block must be on disk before it's hooked up */
+    ret = qcow2_refcount_flush(bs);
+    if (ret < 0) {
+        goto fail_block;
     }
 
     /* Now the new refcount block needs to be written to disk */
@@ -417,52 +457,26 @@ static int64_t alloc_refcount_block(BlockDriverState *bs, int64_t cluster_index)
 fail_table:
     qemu_free(new_table);
 fail_block:
+    /* Drop the new block, it may be only partially initialized */
+    if (s->refcount_block_cache_offset == new_block) {
+        qcow2_cache_discard(s->refcount_cache, s->refcount_block_cache);
+    }
+    s->refcount_block_cache = NULL;
     s->refcount_block_cache_offset = 0;
     return ret;
 }
 
-#define REFCOUNTS_PER_SECTOR (512 >> REFCOUNT_SHIFT)
-static int write_refcount_block_entries(BlockDriverState *bs,
-    int64_t refcount_block_offset, int first_index, int last_index)
-{
-    BDRVQcowState *s = bs->opaque;
-    size_t size;
-    int ret;
-
-    if (cache_refcount_updates) {
-        return 0;
-    }
-
-    if (first_index < 0) {
-        return 0;
-    }
-
-    first_index &= ~(REFCOUNTS_PER_SECTOR - 1);
-    last_index = (last_index + REFCOUNTS_PER_SECTOR)
-        & ~(REFCOUNTS_PER_SECTOR - 1);
-
-    size = (last_index - first_index) << REFCOUNT_SHIFT;
-
-    BLKDBG_EVENT(bs->file, BLKDBG_REFBLOCK_UPDATE_PART);
-    ret = bdrv_pwrite_sync(bs->file,
-        refcount_block_offset + (first_index << REFCOUNT_SHIFT),
-        &s->refcount_block_cache[first_index], size);
-    if (ret < 0) {
-        return ret;
-    }
-
-    return 0;
-}
-
-/* XXX: cache several refcount block clusters ? */
+/*
+ * Refcount updates only modify the cached refcount blocks. Modified blocks are
+ * written back when they are evicted from the cache, or when the cache is
+ * flushed: before any metadata that points to newly allocated clusters is
+ * written, and at the end of each update in write-through mode.
+ */
 static int QEMU_WARN_UNUSED_RESULT update_refcount(BlockDriverState *bs,
     int64_t offset, int64_t length, int addend)
 {
     BDRVQcowState *s = bs->opaque;
     int64_t start, last, cluster_offset;
-    int64_t refcount_block_offset = 0;
-    int64_t table_index = -1, old_table_index;
-    int first_index = -1, last_index = -1;
     int ret;
 
 #ifdef DEBUG_ALLOC2
@@ -484,38 +498,16 @@ static int QEMU_WARN_UNUSED_RESULT update_refcount(BlockDriverState *bs,
         int64_t cluster_index = cluster_offset >> s->cluster_bits;
         int64_t new_block;
 
-        /* Only write refcount block to disk when we are done with it */
-        old_table_index = table_index;
-        table_index = cluster_index >> (s->cluster_bits - REFCOUNT_SHIFT);
-        if ((old_table_index >= 0) && (table_index != old_table_index)) {
-
-            ret = write_refcount_block_entries(bs, refcount_block_offset,
-                first_index, last_index);
-            if (ret < 0) {
-                return ret;
-            }
-
-            first_index = -1;
-            last_index = -1;
-        }
-
         /* Load the refcount block and allocate it if needed */
         new_block = alloc_refcount_block(bs, cluster_index);
         if (new_block < 0) {
             ret = new_block;
             goto fail;
         }
-        refcount_block_offset = new_block;
 
         /* we can update the count and save it */
         block_index = cluster_index &
             ((1 << (s->cluster_bits - REFCOUNT_SHIFT)) - 1);
-        if (first_index == -1 || block_index < first_index) {
-            first_index = block_index;
-        }
-        if (block_index > last_index) {
-            last_index = block_index;
-        }
 
         refcount = be16_to_cpu(s->refcount_block_cache[block_index]);
         refcount += addend;
@@ -523,20 +515,25 @@ static int QEMU_WARN_UNUSED_RESULT update_refcount(BlockDriverState *bs,
             ret = -EINVAL;
             goto fail;
         }
-        if (refcount == 0 && cluster_index < s->free_cluster_index) {
-            s->free_cluster_index = cluster_index;
+        if (refcount == 0) {
+            /* The cluster may be reused, drop any decompressed data of it */
+            qcow2_decompress_cache_invalidate(bs, cluster_offset);
+            if (cluster_index < s->free_cluster_index) {
+                s->free_cluster_index = cluster_index;
+            }
         }
         s->refcount_block_cache[block_index] = cpu_to_be16(refcount);
+        qcow2_cache_mark_dirty(s->refcount_cache, s->refcount_block_cache,
+            block_index << REFCOUNT_SHIFT, (block_index + 1) << REFCOUNT_SHIFT);
     }
 
     ret = 0;
 fail:
 
-    /* Write last changed block to disk */
-    if (refcount_block_offset != 0) {
+    /* Write the changed blocks to disk now in write-through mode */
+    if (s->refcount_writethrough && !cache_refcount_updates) {
         int wret;
-        wret = write_refcount_block_entries(bs, refcount_block_offset,
-            first_index, last_index);
+        wret = qcow2_refcount_flush(bs);
         if (wret < 0) {
             return ret < 0 ? ret : wret;
         }
@@ -860,14 +857,16 @@ int qcow2_update_snapshot_refcount(BlockDriverState *bs,
         qemu_free(l1_table);
     qemu_free(l2_table);
     cache_refcount_updates = 0;
-    write_refcount_block(bs);
+    if (qcow2_refcount_flush(bs) < 0) {
+        return -EIO;
+    }
     return 0;
  fail:
     if (l1_allocated)
         qemu_free(l1_table);
     qemu_free(l2_table);
     cache_refcount_updates = 0;
-    write_refcount_block(bs);
+    qcow2_refcount_flush(bs);
     return -EIO;
 }
 
@@ -169,6 +169,10 @@ static int qcow_write_snapshots(BlockDriverState *bs)
         offset += name_size;
     }
 
+    /* the new snapshot table must be accounted for before it is referenced */
+    if (qcow2_refcount_flush(bs) < 0)
+        goto fail;
+
     /* update the various header fields */
     data64 = cpu_to_be64(snapshots_offset);
     if (bdrv_pwrite_sync(bs->file, offsetof(QCowHeader, snapshots_offset),
@@ -284,6 +288,8 @@ int qcow2_snapshot_create(BlockDriverState *bs, QEMUSnapshotInfo *sn_info)
     for(i = 0; i < s->l1_size; i++) {
         l1_table[i] = cpu_to_be64(s->l1_table[i]);
     }
+    if (qcow2_refcount_flush(bs) < 0)
+        goto fail;
     if (bdrv_pwrite_sync(bs->file, sn->l1_table_offset,
                     l1_table, s->l1_size * sizeof(uint64_t)) < 0)
         goto fail;
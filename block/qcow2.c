@@ -26,6 +26,7 @@
 #include "module.h"
 #include <zlib.h>
 #include "aes.h"
+#include "qint.h"
 #include "block/qcow2.h"
 
 /*
@@ -52,6 +53,25 @@ typedef struct {
 #define  QCOW_EXT_MAGIC_END 0
 #define  QCOW_EXT_MAGIC_BACKING_FORMAT 0xE2792ACA
 
+/* Metadata cache settings for the images opened from now on */
+static int qcow2_l2_cache_tables = QCOW2_L2_CACHE_SIZE_DEFAULT;
+static int qcow2_refcount_cache_tables = QCOW2_REFCOUNT_CACHE_SIZE_DEFAULT;
+static int qcow2_refcount_writethrough = 0;
+
+/* A table count of 0 keeps the default size */
+void qcow2_set_cache_options(int l2_tables, int refcount_tables,
+                             int writethrough)
+{
+    if (l2_tables > 0) {
+        qcow2_l2_cache_tables = MAX(l2_tables, QCOW2_CACHE_SIZE_MIN);
+    }
+    if (refcount_tables > 0) {
+        qcow2_refcount_cache_tables = MAX(refcount_tables,
+                                          QCOW2_CACHE_SIZE_MIN);
+    }
+    qcow2_refcount_writethrough = writethrough;
+}
+
 static int qcow_probe(const uint8_t *buf, int buf_size, const char *filename)
 {
     const QCowHeader *cow_header = (const void *)buf;
@@ -203,13 +223,15 @@ static int qcow_open(BlockDriverState *bs, int flags)
             be64_to_cpus(&s->l1_table[i]);
         }
     }
-    /* alloc L2 cache */
-    s->l2_cache = qemu_malloc(s->l2_size * L2_CACHE_SIZE * sizeof(uint64_t));
-    s->cluster_cache = qemu_malloc(s->cluster_size);
+    /* alloc L2 and refcount block caches */
+    s->l2_cache = qcow2_cache_create(qcow2_l2_cache_tables, s->cluster_size);
+    s->refcount_cache = qcow2_cache_create(qcow2_refcount_cache_tables,
+                                           s->cluster_size);
+    s->refcount_writethrough = qcow2_refcount_writethrough;
     /* one more sector for decompressed data alignment */
     s->cluster_data = qemu_malloc(QCOW_MAX_CRYPT_CLUSTERS * s->cluster_size
                                   + 512);
-    s->cluster_cache_offset = -1;
+    qcow2_decompress_init(bs);
 
     if (qcow2_refcount_init(bs) < 0)
         goto fail;
@@ -245,8 +267,8 @@ static int qcow_open(BlockDriverState *bs, int flags)
     qcow2_free_snapshots(bs);
     qcow2_refcount_close(bs);
     qemu_free(s->l1_table);
-    qemu_free(s->l2_cache);
-    qemu_free(s->cluster_cache);
+    qcow2_cache_destroy(s->l2_cache);
+    qcow2_cache_destroy(s->decompress_cache);
     qemu_free(s->cluster_data);
     return -1;
 }
@@ -348,6 +370,11 @@ static void qcow_aio_cancel(BlockDriverAIOCB *blockacb)
     QCowAIOCB *acb = container_of(blockacb, QCowAIOCB, common);
     if (acb->hd_aiocb)
         bdrv_aio_cancel(acb->hd_aiocb);
+    if (acb->bh) {
+        qemu_bh_delete(acb->bh);
+        acb->bh = NULL;
+    }
+    qcow2_decompress_cancel(acb->common.bs, acb);
     qemu_aio_release(acb);
 }
 
@@ -379,6 +406,21 @@ static int qcow_schedule_bh(QEMUBHFunc *cb, QCowAIOCB *acb)
     return 0;
 }
 
+/* Called when a compressed cluster read by qcow_aio_read_cb is inflated */
+static void qcow_aio_read_inflated(void *opaque, const uint8_t *data, int ret)
+{
+    QCowAIOCB *acb = opaque;
+    BDRVQcowState *s = acb->common.bs->opaque;
+    int index_in_cluster;
+
+    if (ret >= 0) {
+        index_in_cluster = acb->sector_num & (s->cluster_sectors - 1);
+        memcpy(acb->buf, data + index_in_cluster * 512,
+               512 * acb->cur_nr_sectors);
+    }
+    qcow_aio_read_cb(acb, ret);
+}
+
 static void qcow_aio_read_cb(void *opaque, int ret)
 {
     QCowAIOCB *acb = opaque;
@@ -451,14 +493,21 @@ static void qcow_aio_read_cb(void *opaque, int ret)
                 goto done;
         }
     } else if (acb->cluster_offset & QCOW_OFLAG_COMPRESSED) {
-        /* add AIO support for compressed blocks ? */
-        if (qcow2_decompress_cluster(bs, acb->cluster_offset) < 0)
-            goto done;
-        memcpy(acb->buf, s->cluster_cache + index_in_cluster * 512,
-               512 * acb->cur_nr_sectors);
-        ret = qcow_schedule_bh(qcow_aio_read_bh, acb);
+        const uint8_t *data;
+
+        ret = qcow2_decompress_cluster_async(bs, acb->sector_num << 9,
+                                             acb->cluster_offset, &data,
+                                             qcow_aio_read_inflated, acb);
         if (ret < 0)
             goto done;
+        if (ret == 0) {
+            /* cache hit */
+            memcpy(acb->buf, data + index_in_cluster * 512,
+                   512 * acb->cur_nr_sectors);
+            ret = qcow_schedule_bh(qcow_aio_read_bh, acb);
+            if (ret < 0)
+                goto done;
+        }
     } else {
         if ((acb->cluster_offset & 511) != 0) {
             ret = -EIO;
@@ -645,11 +694,8 @@ static BlockDriverAIOCB *qcow_aio_writev(BlockDriverState *bs,
         int64_t sector_num, QEMUIOVector *qiov, int nb_sectors,
         BlockDriverCompletionFunc *cb, void *opaque)
 {
-    BDRVQcowState *s = bs->opaque;
     QCowAIOCB *acb;
 
-    s->cluster_cache_offset = -1; /* disable compressed cache */
-
     acb = qcow_aio_setup(bs, sector_num, qiov, nb_sectors, cb, opaque, 1);
     if (!acb)
         return NULL;
@@ -661,9 +707,9 @@ static BlockDriverAIOCB *qcow_aio_writev(BlockDriverState *bs,
 static void qcow_close(BlockDriverState *bs)
 {
     BDRVQcowState *s = bs->opaque;
+    qcow2_decompress_close(bs);
     qemu_free(s->l1_table);
-    qemu_free(s->l2_cache);
-    qemu_free(s->cluster_cache);
+    qcow2_cache_destroy(s->l2_cache);
     qemu_free(s->cluster_data);
     qcow2_refcount_close(bs);
 }
@@ -1216,12 +1262,16 @@ static int qcow_write_compressed(BlockDriverState *bs, int64_t sector_num,
 
 static void qcow_flush(BlockDriverState *bs)
 {
+    qcow2_refcount_flush(bs);
     bdrv_flush(bs->file);
 }
 
 static BlockDriverAIOCB *qcow_aio_flush(BlockDriverState *bs,
          BlockDriverCompletionFunc *cb, void *opaque)
 {
+    if (qcow2_refcount_flush(bs) < 0) {
+        return NULL;
+    }
     return bdrv_aio_flush(bs->file, cb, opaque);
 }
 
@@ -1238,6 +1288,25 @@ static int qcow_get_info(BlockDriverState *bs, BlockDriverInfo *bdi)
     return 0;
 }
 
+static void qcow_info_stats(BlockDriverState *bs, QDict *stats)
+{
+    BDRVQcowState *s = bs->opaque;
+    Qcow2CacheStats l2, refcount, decompress;
+
+    qcow2_cache_get_stats(s->l2_cache, &l2);
+    qcow2_cache_get_stats(s->refcount_cache, &refcount);
+    qcow2_cache_get_stats(s->decompress_cache, &decompress);
+
+    qdict_put(stats, "l2_cache_hits", qint_from_int(l2.hits));
+    qdict_put(stats, "l2_cache_misses", qint_from_int(l2.misses));
+    qdict_put(stats, "refcount_cache_hits", qint_from_int(refcount.hits));
+    qdict_put(stats, "refcount_cache_misses", qint_from_int(refcount.misses));
+    qdict_put(stats, "refcount_cache_writes", qint_from_int(refcount.writes));
+    qdict_put(stats, "decompress_cache_hits", qint_from_int(decompress.hits));
+    qdict_put(stats, "decompress_cache_misses",
+              qint_from_int(decompress.misses));
+}
+
 
 static int qcow_check(BlockDriverState *bs, BdrvCheckResult *result)
 {
@@ -1353,6 +1422,7 @@ static BlockDriver bdrv_qcow2 = {
     .bdrv_snapshot_delete   = qcow2_snapshot_delete,
     .bdrv_snapshot_list     = qcow2_snapshot_list,
     .bdrv_get_info	= qcow_get_info,
+    .bdrv_info_stats	= qcow_info_stats,
 
     .bdrv_save_vmstate    = qcow_save_vmstate,
     .bdrv_load_vmstate    = qcow_load_vmstate,
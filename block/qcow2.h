@@ -49,7 +49,17 @@
 #define MIN_CLUSTER_BITS 9
 #define MAX_CLUSTER_BITS 21
 
-#define L2_CACHE_SIZE 16
+/* Default number of L2 tables and refcount blocks cached per image */
+#define QCOW2_L2_CACHE_SIZE_DEFAULT         64
+#define QCOW2_REFCOUNT_CACHE_SIZE_DEFAULT   16
+#define QCOW2_CACHE_SIZE_MIN                4
+
+/* Number of decompressed clusters cached per image */
+#define QCOW2_DECOMPRESS_CACHE_SIZE         16
+/* Compressed clusters following a compressed read that are inflated ahead */
+#define QCOW2_INFLATE_READAHEAD             4
+/* Maximum number of compressed clusters being read or inflated at once */
+#define QCOW2_INFLATE_MAX_JOBS              16
 
 typedef struct QCowHeader {
     uint32_t magic;
@@ -78,6 +88,23 @@ typedef struct QCowSnapshot {
     uint64_t vm_clock_nsec;
 } QCowSnapshot;
 
+typedef struct Qcow2Cache Qcow2Cache;
+
+typedef struct Qcow2CacheStats {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    uint64_t writes;    /* dirty tables written back */
+    uint64_t flushes;   /* flushes that had something to write */
+} Qcow2CacheStats;
+
+/*
+ * Called when a compressed cluster has been inflated. data points to the
+ * decompressed cluster and is only valid during the call, or is NULL if ret
+ * is a negative errno.
+ */
+typedef void Qcow2InflateFunc(void *opaque, const uint8_t *data, int ret);
+
 typedef struct BDRVQcowState {
     BlockDriverState *hd;
     int cluster_bits;
@@ -92,17 +119,20 @@ typedef struct BDRVQcowState {
     uint64_t cluster_offset_mask;
     uint64_t l1_table_offset;
     uint64_t *l1_table;
-    uint64_t *l2_cache;
-    uint64_t l2_cache_offsets[L2_CACHE_SIZE];
-    uint32_t l2_cache_counts[L2_CACHE_SIZE];
-    uint8_t *cluster_cache;
+    Qcow2Cache *l2_cache;
     uint8_t *cluster_data;
-    uint64_t cluster_cache_offset;
+    Qcow2Cache *decompress_cache;
+    QLIST_HEAD(Qcow2InflateJobs, Qcow2InflateJob) inflate_jobs;
+    int nb_inflate_jobs;
+    int inflate_async; /* inflate on the posix-aio-compat worker threads */
     QLIST_HEAD(QCowClusterAlloc, QCowL2Meta) cluster_allocs;
 
     uint64_t *refcount_table;
     uint64_t refcount_table_offset;
     uint32_t refcount_table_size;
+    Qcow2Cache *refcount_cache;
+    int refcount_writethrough;
+    /* the refcount block last loaded from refcount_cache */
     uint64_t refcount_block_cache_offset;
     uint16_t *refcount_block_cache;
     int64_t free_cluster_index;
@@ -186,11 +216,21 @@ int qcow2_update_snapshot_refcount(BlockDriverState *bs,
     int64_t l1_table_offset, int l1_size, int addend);
 
 int qcow2_check_refcounts(BlockDriverState *bs, BdrvCheckResult *res);
+int qcow2_refcount_flush(BlockDriverState *bs);
 
 /* qcow2-cluster.c functions */
 int qcow2_grow_l1_table(BlockDriverState *bs, int min_size);
 void qcow2_l2_cache_reset(BlockDriverState *bs);
-int qcow2_decompress_cluster(BlockDriverState *bs, uint64_t cluster_offset);
+void qcow2_decompress_init(BlockDriverState *bs);
+void qcow2_decompress_close(BlockDriverState *bs);
+void qcow2_decompress_cache_invalidate(BlockDriverState *bs,
+    uint64_t cluster_offset);
+int qcow2_decompress_cluster(BlockDriverState *bs, uint64_t cluster_offset,
+    const uint8_t **data);
+int qcow2_decompress_cluster_async(BlockDriverState *bs, uint64_t offset,
+    uint64_t cluster_offset, const uint8_t **data,
+    Qcow2InflateFunc *cb, void *opaque);
+void qcow2_decompress_cancel(BlockDriverState *bs, void *opaque);
 void qcow2_encrypt_sectors(BDRVQcowState *s, int64_t sector_num,
                      uint8_t *out_buf, const uint8_t *in_buf,
                      int nb_sectors, int enc,
@@ -206,6 +246,23 @@ uint64_t qcow2_alloc_compressed_cluster_offset(BlockDriverState *bs,
 
 int qcow2_alloc_cluster_link_l2(BlockDriverState *bs, QCowL2Meta *m);
 
+/* qcow2-cache.c functions */
+Qcow2Cache *qcow2_cache_create(int num_tables, int table_size);
+void qcow2_cache_destroy(Qcow2Cache *c);
+void *qcow2_cache_lookup(Qcow2Cache *c, uint64_t offset);
+int qcow2_cache_contains(Qcow2Cache *c, uint64_t offset);
+int qcow2_cache_get(BlockDriverState *bs, Qcow2Cache *c, uint64_t offset,
+    void **table);
+int qcow2_cache_get_empty(BlockDriverState *bs, Qcow2Cache *c,
+    uint64_t offset, void **table);
+void qcow2_cache_mark_dirty(Qcow2Cache *c, void *table, int start, int end);
+void qcow2_cache_mark_clean(Qcow2Cache *c, void *table);
+void qcow2_cache_discard(Qcow2Cache *c, void *table);
+void qcow2_cache_discard_range(Qcow2Cache *c, uint64_t start, uint64_t end);
+void qcow2_cache_reset(Qcow2Cache *c);
+int qcow2_cache_flush(BlockDriverState *bs, Qcow2Cache *c);
+void qcow2_cache_get_stats(Qcow2Cache *c, Qcow2CacheStats *stats);
+
 /* qcow2-snapshot.c functions */
 int qcow2_snapshot_create(BlockDriverState *bs, QEMUSnapshotInfo *sn_info);
 int qcow2_snapshot_goto(BlockDriverState *bs, const char *snapshot_id);
@@ -18,8 +18,10 @@
 #define QEMU_AIO_WRITE        0x0002
 #define QEMU_AIO_IOCTL        0x0004
 #define QEMU_AIO_FLUSH        0x0008
+#define QEMU_AIO_CALL         0x0010
 #define QEMU_AIO_TYPE_MASK \
-	(QEMU_AIO_READ|QEMU_AIO_WRITE|QEMU_AIO_IOCTL|QEMU_AIO_FLUSH)
+	(QEMU_AIO_READ|QEMU_AIO_WRITE|QEMU_AIO_IOCTL|QEMU_AIO_FLUSH| \
+	 QEMU_AIO_CALL)
 
 /* AIO flags */
 #define QEMU_AIO_MISALIGNED   0x1000
@@ -33,6 +35,9 @@ BlockDriverAIOCB *paio_submit(BlockDriverState *bs, int fd,
 BlockDriverAIOCB *paio_ioctl(BlockDriverState *bs, int fd,
         unsigned long int req, void *buf,
         BlockDriverCompletionFunc *cb, void *opaque);
+BlockDriverAIOCB *paio_call(BlockDriverState *bs,
+        int (*func)(void *arg), void *arg,
+        BlockDriverCompletionFunc *cb, void *opaque);
 
 /* linux-aio.c - Linux native implementation */
 void *laio_init(void);
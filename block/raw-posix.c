@@ -171,13 +171,17 @@ static int raw_open_common(BlockDriverState *bs, const char *filename,
                       (BDRV_O_NOCACHE|BDRV_O_NATIVE_AIO)) {
 
         /* We're falling back to POSIX AIO in some cases */
-        paio_init();
+        if (paio_init() < 0) {
+            goto out_free_buf;
+        }
 
+        /* Use the thread pool if the kernel doesn't support native AIO */
         s->aio_ctx = laio_init();
         if (!s->aio_ctx) {
-            goto out_free_buf;
+            fprintf(stderr, "%s: native AIO unavailable, using threads\n",
+                    filename);
         }
-        s->use_aio = 1;
+        s->use_aio = (s->aio_ctx != NULL);
     } else
 #endif
     {
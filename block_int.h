@@ -27,6 +27,7 @@
 #include "block.h"
 #include "qemu-option.h"
 #include "qemu-queue.h"
+#include "qdict.h"
 
 #define BLOCK_FLAG_ENCRYPT	1
 #define BLOCK_FLAG_COMPRESS	2
@@ -94,6 +95,8 @@ struct BlockDriver {
     int (*bdrv_snapshot_list)(BlockDriverState *bs,
                               QEMUSnapshotInfo **psn_info);
     int (*bdrv_get_info)(BlockDriverState *bs, BlockDriverInfo *bdi);
+    /* Adds driver specific counters to the 'info blockstats' output */
+    void (*bdrv_info_stats)(BlockDriverState *bs, QDict *stats);
 
     int (*bdrv_save_vmstate)(BlockDriverState *bs, const uint8_t *buf,
                              int64_t pos, int size);
@@ -178,6 +181,8 @@ struct BlockDriverState {
     uint64_t rd_ops;
     uint64_t wr_ops;
     uint64_t wr_highest_sector;
+    BlockLatencyStats latency[BDRV_MAX_IOTYPE];
+    uint64_t failed_ops[BDRV_MAX_IOTYPE]; /* not counted in the stats above */
 
     /* Whether the disk can expand beyond total_sectors */
     int growable;
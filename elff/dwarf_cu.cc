@@ -21,8 +21,9 @@
 #include "dwarf_cu.h"
 #include "dwarf_utils.h"
 
-DwarfCU::DwarfCU(ElfFile* elf)
+DwarfCU::DwarfCU(ElfFile* elf, ElfAllocator* allocator)
     : elf_file_(elf),
+      allocator_(allocator),
       cu_die_(NULL),
       prev_cu_(NULL) {
 }
@@ -34,16 +35,18 @@ DwarfCU::~DwarfCU() {
   abbrs_.empty();
 }
 
-DwarfCU* DwarfCU::create_instance(ElfFile* elf, const void* hdr) {
+DwarfCU* DwarfCU::create_instance(ElfFile* elf,
+                                  const void* hdr,
+                                  ElfAllocator* allocator) {
   DwarfCU* ret;
 
   /* 64-bit DWARF CU has first 4 bytes in its header set to 0xFFFFFFFF. */
   if (*reinterpret_cast<const Elf_Word*>(hdr) == 0xFFFFFFFF) {
-    ret = new(elf) DwarfCUImpl<Dwarf64_CUHdr, Dwarf64_Off>
-                      (elf, reinterpret_cast<const Dwarf64_CUHdr*>(hdr));
+    ret = new(allocator) DwarfCUImpl<Dwarf64_CUHdr, Dwarf64_Off>
+             (elf, reinterpret_cast<const Dwarf64_CUHdr*>(hdr), allocator);
   } else {
-    ret = new(elf) DwarfCUImpl<Dwarf32_CUHdr, Dwarf32_Off>
-                      (elf, reinterpret_cast<const Dwarf32_CUHdr*>(hdr));
+    ret = new(allocator) DwarfCUImpl<Dwarf32_CUHdr, Dwarf32_Off>
+             (elf, reinterpret_cast<const Dwarf32_CUHdr*>(hdr), allocator);
   }
   assert(ret != NULL);
   if (ret == NULL) {
@@ -52,6 +55,32 @@ DwarfCU* DwarfCU::create_instance(ElfFile* elf, const void* hdr) {
   return ret;
 }
 
+DIEObject* DwarfCU::get_leaf_die_for_address(Elf_Xword address) {
+  if (!routine_index_.is_finalized()) {
+    /* Index top level routines in the order the children list is walked by
+     * DIEObject::get_leaf_for_address(), so both find the same DIEs. */
+    int order = 0;
+    for (DIEObject* die = cu_die_->last_child(); die != NULL;
+         die = die->prev_sibling()) {
+      if (!die->index_address_ranges(&routine_index_, die, order++)) {
+        routine_index_.reset();
+        return cu_die_->get_leaf_for_address(address);
+      }
+    }
+    routine_index_.finalize();
+  }
+
+  const ElfAddressRange* range = routine_index_.find(address);
+  if (range != NULL) {
+    DIEObject* die =
+        const_cast<DIEObject*>(reinterpret_cast<const DIEObject*>(range->data));
+    return die->get_leaf_for_address(address);
+  }
+
+  /* No routine contains the address, but the CU DIE itself still may. */
+  return cu_die_->get_leaf_for_address(address);
+}
+
 const Elf_Byte* DwarfCU::process_attrib(const Elf_Byte* prop,
                                         Dwarf_Form form,
                                         Dwarf_Value* attr_value) const {
@@ -295,8 +324,9 @@ void DwarfCU::dump() const {
 
 template <typename Dwarf_CUHdr, typename Dwarf_Off>
 DwarfCUImpl<Dwarf_CUHdr, Dwarf_Off>::DwarfCUImpl(ElfFile* elf,
-                                                 const Dwarf_CUHdr* hdr)
-    : DwarfCU(elf),
+                                                 const Dwarf_CUHdr* hdr,
+                                                 ElfAllocator* allocator)
+    : DwarfCU(elf, allocator),
       cu_header_(hdr) {
   /* Cache CU's DIE abbreviation descriptor in the array. This MUST be done
    * BEFORE first call to array's cache_to() method. */
@@ -329,6 +359,29 @@ bool DwarfCUImpl<Dwarf_CUHdr, Dwarf_Off>::parse(
   return true;
 }
 
+template <typename Dwarf_CUHdr, typename Dwarf_Off>
+bool DwarfCUImpl<Dwarf_CUHdr, Dwarf_Off>::parse_cu_die(
+    const void** next_cu_die) {
+  /* Make sure abbreviation for the CU DIE is cached. */
+  Dwarf_AbbrNum abbr_num;
+  get_DIE()->process(&abbr_num);
+  if (abbrs_.cache_to(abbr_num) == NULL) {
+    return false;
+  }
+
+  cu_die_ = new(allocator_) DIEObject(get_DIE(), this, NULL);
+  assert(cu_die_ != NULL);
+  if (cu_die_ == NULL) {
+    _set_errno(ENOMEM);
+    return false;
+  }
+
+  *next_cu_die =
+      INC_CPTR(cu_header_, cu_size_ + ELFF_FIELD_OFFSET(Dwarf_CUHdr, version));
+
+  return true;
+}
+
 template <typename Dwarf_CUHdr, typename Dwarf_Off>
 const Elf_Byte* DwarfCUImpl<Dwarf_CUHdr, Dwarf_Off>::process_DIE(
     const DwarfParseContext* parse_context,
@@ -423,7 +476,7 @@ DIEObject* DwarfCUImpl<Dwarf_CUHdr, Dwarf_Off>::create_die_object(
 
   /* We will always create a DIE object for CU DIE. */
   if (tag == DW_TAG_compile_unit || collect_die(parse_context, tag)) {
-    ret = new(elf_file_) DIEObject(die, this, parent);
+    ret = new(allocator_) DIEObject(die, this, parent);
     assert(ret != NULL);
     if (ret == NULL) {
       _set_errno(ENOMEM);
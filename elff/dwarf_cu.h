@@ -20,6 +20,7 @@
 
 #include "dwarf_defs.h"
 #include "dwarf_die.h"
+#include "elf_addr_index.h"
 
 /* Address information descriptor. */
 typedef struct Dwarf_AddressInfo {
@@ -105,8 +106,9 @@ friend class ElfFile;
   /* Constructs DwarfCU instance.
    * Param:
    *  elf - Instance of ElfFile containing this compilation unit.
+   *  allocator - Allocator for DIE objects of this compilation unit.
    */
-  explicit DwarfCU(ElfFile* elf);
+  DwarfCU(ElfFile* elf, ElfAllocator* allocator);
 
   /* Destructs DwarfCU instance. */
   virtual ~DwarfCU();
@@ -118,11 +120,14 @@ friend class ElfFile;
    *    section of the ELF file. Actual data addressed by this pointer
    *    must be Dwarf32_CUHdr for 32 bit DWARFs, or Dwarf64_CUHdr for
    *    64 bit DWARFs.
+   *  allocator - Allocator for the instance, and its DIE objects.
    * Return:
    *  Created DwarfCUImpl instance (typecasted back to DwarfCU) on success,
    *  or NULL on failure.
    */
-  static DwarfCU* create_instance(ElfFile* elf, const void* hdr);
+  static DwarfCU* create_instance(ElfFile* elf,
+                                  const void* hdr,
+                                  ElfAllocator* allocator);
 
   /* Process a DIE attribute.
    * Param:
@@ -152,6 +157,11 @@ friend class ElfFile;
     return cu_die_;
   }
 
+  /* Gets allocator for DIE objects of this CU. */
+  ElfAllocator* allocator() const {
+    return allocator_;
+  }
+
   /* Gets byte size of the pointer type for this compilation unit. */
   Elf_Byte addr_sizeof() const {
     return addr_sizeof_;
@@ -214,9 +224,7 @@ friend class ElfFile;
    *  Leaf DIE containing given address, or NULL if this CU doesn't contain
    *  the given address.
    */
-  DIEObject* get_leaf_die_for_address(Elf_Xword address) const {
-    return cu_die_->get_leaf_for_address(address);
-  }
+  DIEObject* get_leaf_die_for_address(Elf_Xword address);
 
   /* Checks if this CU contains 64, or 32-bit addresses. */
   bool is_CU_address_64() const {
@@ -246,6 +254,21 @@ friend class ElfFile;
   virtual bool parse(const DwarfParseContext* parse_context,
                      const void** next_cu_die) = 0;
 
+  /* Collects only the DIE of this compilation unit, skipping all its
+   * children. This is enough to get CU attributes, such as its address
+   * ranges.
+   * Param:
+   *  next_cu_die - Upon successful return contains pointer to the next
+   *    compilation unit descriptor inside mapped .debug_info section of
+   *    the ELF file.
+   * Return:
+   *  true on success, false on failure.
+   */
+  virtual bool parse_cu_die(const void** next_cu_die) = 0;
+
+  /* Gets this compilation unit header in the mapped .debug_info section. */
+  virtual const void* header() const = 0;
+
   /* Gets a DIE object referenced by an offset from the beginning of
    * this CU in the mapped .debug_info section.
    */
@@ -298,6 +321,13 @@ friend class ElfFile;
   /* Instance of an ELF file that contains this compilation unit. */
   ElfFile*            elf_file_;
 
+  /* Allocator for DIE objects of this compilation unit. */
+  ElfAllocator*       allocator_;
+
+  /* Sorted index of address ranges covered by top level routines of this
+   * compilation unit. Built on the first address lookup. */
+  ElfAddressIndex     routine_index_;
+
   /* DIE object for this CU. */
   DIEObject*          cu_die_;
 
@@ -332,7 +362,7 @@ class DwarfCUImpl : public DwarfCU {
    *  hdr - Pointer to compilation unit header inside mapped .debug_info
    *    section of the ELF file.
    */
-  DwarfCUImpl(ElfFile* elf, const Dwarf_CUHdr* hdr);
+  DwarfCUImpl(ElfFile* elf, const Dwarf_CUHdr* hdr, ElfAllocator* allocator);
 
   /* Destructs DwarfCU instance. */
   ~DwarfCUImpl() {
@@ -346,6 +376,19 @@ class DwarfCUImpl : public DwarfCU {
   bool parse(const DwarfParseContext* parse_context,
              const void** next_cu_die);
 
+  /* Collects only the DIE of this compilation unit.
+   * This is an implementation of DwarfCU's abstract metod.
+   * See DwarfCU::parse_cu_die().
+   */
+  bool parse_cu_die(const void** next_cu_die);
+
+  /* Gets this compilation unit header in the mapped .debug_info section.
+   * This is an implementation of DwarfCU's abstract metod.
+   */
+  const void* header() const {
+    return cu_header_;
+  }
+
   /* Gets PC address information.
    * This is an implementation of DwarfCU's abstract metod.
    * See DwarfCU::get_pc_address_file_info().
@@ -19,6 +19,7 @@
 #include "dwarf_cu.h"
 #include "dwarf_utils.h"
 #include "elf_file.h"
+#include "elf_addr_index.h"
 
 DIEObject::~DIEObject() {
   /* Delete all children of this object. */
@@ -160,6 +161,43 @@ bool DIEObject::contains_address(Elf_Xword address) {
   }
 }
 
+bool DIEObject::index_address_ranges(ElfAddressIndex* index,
+                                     const void* data,
+                                     int order) {
+  return parent_cu()->is_CU_address_64() ?
+             add_address_ranges<Elf_Xword>(index, data, order) :
+             add_address_ranges<Elf_Word>(index, data, order);
+}
+
+template <typename AddrType>
+bool DIEObject::add_address_ranges(ElfAddressIndex* index,
+                                   const void* data,
+                                   int order) {
+  /* Ranges must be collected exactly as contains_address() checks them. */
+  DIEAttrib die_ranges;
+  if (get_attrib(DW_AT_ranges, &die_ranges)) {
+    AddrType low;
+    AddrType high;
+    Elf_Word range_off = die_ranges.value()->u32;
+    while (elf_file()->get_range(range_off, &low, &high) &&
+           (low != 0 || high != 0)) {
+      if (!index->add(low, high, data, order)) {
+        return false;
+      }
+      range_off += sizeof(AddrType) * 2;
+    }
+    return true;
+  }
+
+  DIEAttrib low_pc;
+  DIEAttrib high_pc;
+  if (!get_attrib(DW_AT_low_pc, &low_pc) ||
+      !get_attrib(DW_AT_high_pc, &high_pc)) {
+    return true;
+  }
+  return index->add(low_pc.value()->u64, high_pc.value()->u64, data, order);
+}
+
 DIEObject* DIEObject::find_die_object(const Dwarf_DIE* die_to_find) {
   if (die_to_find == die()) {
     return this;
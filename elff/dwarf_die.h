@@ -22,6 +22,7 @@
 
 class ElfFile;
 class DwarfCU;
+class ElfAddressIndex;
 
 /* Encapsulates an object that wraps up a DIE, cached during
  * ELF file parsing.
@@ -79,6 +80,19 @@ class DIEObject : public DwarfAllocBase {
    */
   DIEObject* get_leaf_for_address(Elf_Xword address);
 
+  /* Adds address ranges covered by this DIE to an address index.
+   * Param:
+   *  index - Address index to add this DIE's ranges to.
+   *  data - DWARF object to associate with the ranges in the index.
+   *  order - Lookup priority for the ranges. See ElfAddressRange.
+   * Return:
+   *  true on success (including DIEs that don't cover any address), or false
+   *  on memory allocation failure.
+   */
+  bool index_address_ranges(ElfAddressIndex* index,
+                            const void* data,
+                            int order);
+
   /* Finds a DIE object for the given die in the branch starting with
    * this DIE object.
    */
@@ -107,6 +121,14 @@ class DIEObject : public DwarfAllocBase {
   template <typename AddrType>
   bool contains_address(Elf_Xword address);
 
+  /* Adds address ranges covered by this DIE to an address index.
+   * Template param:
+   *  AddrType - Type of compilation unit address. See contains_address().
+   * See index_address_ranges() for parameters and return value.
+   */
+  template <typename AddrType>
+  bool add_address_ranges(ElfAddressIndex* index, const void* data, int order);
+
   /* Advances to the DIE's property list.
    * Param:
    *  at_abbr - Upon successful return contains a pointer to the beginning of
@@ -0,0 +1,126 @@
+/* Copyright (C) 2012 The Android Open Source Project
+**
+** This software is licensed under the terms of the GNU General Public
+** License version 2, as published by the Free Software Foundation, and
+** may be copied, distributed, and modified under those terms.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+*/
+
+/*
+ * Contains implementation of class ElfAddressIndex, that implements a sorted
+ * index of address ranges covered by DWARF objects of an ELF file.
+ */
+
+#include "elf_addr_index.h"
+
+/* Initial number of ranges allocated for an index. */
+#define ELF_ADDR_INDEX_INITIAL_CAPACITY 256
+
+/* Compares two ranges for qsort(). */
+static int compare_ranges(const void* first, const void* second) {
+  const ElfAddressRange* r1 = reinterpret_cast<const ElfAddressRange*>(first);
+  const ElfAddressRange* r2 = reinterpret_cast<const ElfAddressRange*>(second);
+  if (r1->low != r2->low) {
+    return r1->low < r2->low ? -1 : 1;
+  }
+  return r1->order - r2->order;
+}
+
+ElfAddressIndex::ElfAddressIndex()
+    : ranges_(NULL),
+      count_(0),
+      capacity_(0),
+      is_finalized_(false) {
+}
+
+ElfAddressIndex::~ElfAddressIndex() {
+  reset();
+}
+
+bool ElfAddressIndex::add(Elf_Xword low,
+                          Elf_Xword high,
+                          const void* data,
+                          int order) {
+  if (low >= high) {
+    /* Empty range can't contain anything. */
+    return true;
+  }
+
+  if (count_ == capacity_) {
+    const int new_capacity = capacity_ != 0 ? capacity_ * 2 :
+                                              ELF_ADDR_INDEX_INITIAL_CAPACITY;
+    ElfAddressRange* new_ranges = reinterpret_cast<ElfAddressRange*>
+        (realloc(ranges_, new_capacity * sizeof(ElfAddressRange)));
+    assert(new_ranges != NULL);
+    if (new_ranges == NULL) {
+      _set_errno(ENOMEM);
+      return false;
+    }
+    ranges_ = new_ranges;
+    capacity_ = new_capacity;
+  }
+
+  ElfAddressRange* range = ranges_ + count_;
+  range->low = low;
+  range->high = high;
+  range->max_high = high;
+  range->data = data;
+  range->order = order;
+  count_++;
+  is_finalized_ = false;
+
+  return true;
+}
+
+void ElfAddressIndex::finalize() {
+  qsort(ranges_, count_, sizeof(ElfAddressRange), compare_ranges);
+  for (int n = 1; n < count_; n++) {
+    if (ranges_[n].max_high < ranges_[n - 1].max_high) {
+      ranges_[n].max_high = ranges_[n - 1].max_high;
+    }
+  }
+  is_finalized_ = true;
+}
+
+void ElfAddressIndex::reset() {
+  if (ranges_ != NULL) {
+    free(ranges_);
+    ranges_ = NULL;
+  }
+  count_ = 0;
+  capacity_ = 0;
+  is_finalized_ = false;
+}
+
+const ElfAddressRange* ElfAddressIndex::find(Elf_Xword address) const {
+  assert(is_finalized_);
+
+  /* Find the last range that starts at, or below the address. */
+  int lo = 0;
+  int hi = count_;
+  while (lo < hi) {
+    const int mid = lo + (hi - lo) / 2;
+    if (ranges_[mid].low <= address) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+
+  /* Walk back through the ranges that may still cover the address. Since
+   * max_high never decreases along the array, we can stop at the first range
+   * where it doesn't reach the address. */
+  const ElfAddressRange* found = NULL;
+  for (int n = lo - 1; n >= 0 && ranges_[n].max_high > address; n--) {
+    if (ranges_[n].high > address &&
+        (found == NULL || ranges_[n].order < found->order)) {
+      found = ranges_ + n;
+    }
+  }
+
+  return found;
+}
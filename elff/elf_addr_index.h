@@ -0,0 +1,106 @@
+/* Copyright (C) 2012 The Android Open Source Project
+**
+** This software is licensed under the terms of the GNU General Public
+** License version 2, as published by the Free Software Foundation, and
+** may be copied, distributed, and modified under those terms.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+*/
+
+/*
+ * Contains declaration of class ElfAddressIndex, that implements a sorted
+ * index of address ranges covered by DWARF objects of an ELF file.
+ */
+
+#ifndef ELFF_ELF_ADDR_INDEX_H_
+#define ELFF_ELF_ADDR_INDEX_H_
+
+#include "elf_defs.h"
+
+/* Describes an address range covered by a DWARF object. */
+typedef struct ElfAddressRange {
+  /* First address in the range. */
+  Elf_Xword   low;
+
+  /* First address past the range. */
+  Elf_Xword   high;
+
+  /* The highest 'high' value among this and all preceding entries in the
+   * sorted index. Bounds the backward scan when ranges overlap. */
+  Elf_Xword   max_high;
+
+  /* DWARF object covering this range. Depending on the index, this is a
+   * DIE object, or a compilation unit header in the mapped .debug_info
+   * section. */
+  const void* data;
+
+  /* Lookup priority of the range. When several ranges contain an address, the
+   * range with the lowest order wins. */
+  int         order;
+} ElfAddressRange;
+
+/* Encapsulates a sorted index of address ranges.
+ * Ranges are collected with add(), and then sorted once with finalize(). After
+ * that, looking up a range that contains an address takes O(log n) for ranges
+ * that don't overlap, which is the case for the vast majority of routines in
+ * a compilation unit.
+ */
+class ElfAddressIndex {
+ public:
+  /* Constructs ElfAddressIndex instance. */
+  ElfAddressIndex();
+
+  /* Destructs ElfAddressIndex instance. */
+  ~ElfAddressIndex();
+
+  /* Adds a range to the index.
+   * Param:
+   *  low, high - Range boundaries (high is not included in the range).
+   *  data - DWARF object covering the range.
+   *  order - Lookup priority of the range. See ElfAddressRange.
+   * Return:
+   *  true on success, or false on memory allocation failure.
+   */
+  bool add(Elf_Xword low, Elf_Xword high, const void* data, int order);
+
+  /* Sorts the index, making it ready for lookups. */
+  void finalize();
+
+  /* Empties the index. */
+  void reset();
+
+  /* Finds a range that contains the given address.
+   * Return:
+   *  A range with the lowest order among the ranges that contain the address,
+   *  or NULL if no range contains it.
+   */
+  const ElfAddressRange* find(Elf_Xword address) const;
+
+  /* Checks if the index has been finalized. */
+  bool is_finalized() const {
+    return is_finalized_;
+  }
+
+  /* Gets number of ranges in the index. */
+  int count() const {
+    return count_;
+  }
+
+ protected:
+  /* Array of ranges in the index. */
+  ElfAddressRange*  ranges_;
+
+  /* Number of ranges in the array. */
+  int               count_;
+
+  /* Number of ranges that fit in the allocated array. */
+  int               capacity_;
+
+  /* Set once the index is sorted. */
+  bool              is_finalized_;
+};
+
+#endif  // ELFF_ELF_ADDR_INDEX_H_
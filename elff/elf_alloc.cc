@@ -19,7 +19,8 @@
 #include "elf_file.h"
 
 ElfAllocator::ElfAllocator()
-    : current_chunk_(NULL) {
+    : current_chunk_(NULL),
+      allocated_(0) {
 }
 
 ElfAllocator::~ElfAllocator() {
@@ -49,6 +50,7 @@ void* ElfAllocator::alloc(size_t size) {
     new_chunk->remains = new_chunk->size - sizeof(ElfAllocatorChunk);
     new_chunk->prev = current_chunk_;
     current_chunk_ = new_chunk;
+    allocated_ += ELF_ALLOC_CHUNK_SIZE;
   }
 
   void* ret = current_chunk_->avail;
@@ -60,3 +62,7 @@ void* ElfAllocator::alloc(size_t size) {
 void* DwarfAllocBase::operator new(size_t size, const ElfFile* elf) {
   return elf->allocator()->alloc(size);
 }
+
+void* DwarfAllocBase::operator new(size_t size, ElfAllocator* allocator) {
+  return allocator->alloc(size);
+}
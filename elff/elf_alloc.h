@@ -72,8 +72,9 @@ typedef struct ElfAllocatorChunk {
  * for DWARF object allocation implementation. See DwarfAllocBase for more
  * details.
  *
- * Instance (always one) of this class is created by ElfFile object when it is
- * initializing.
+ * One instance of this class is created by ElfFile object when it is
+ * initializing. Compilation units parsed on demand get an instance of their
+ * own, so all memory they use is released when they are evicted.
  */
 class ElfAllocator {
  public:
@@ -94,11 +95,19 @@ class ElfAllocator {
    */
   void* alloc(size_t size);
 
+  /* Gets number of bytes allocated from the heap by this allocator. */
+  size_t allocated() const {
+    return allocated_;
+  }
+
  protected:
   /* Current chunk to allocate memory from. NOTE: chunks are listed here
    * in reverse order (relatively to the chunk allocation sequence).
    */
   ElfAllocatorChunk*  current_chunk_;
+
+  /* Number of bytes allocated from the heap for the chunks. */
+  size_t              allocated_;
 };
 
 /* Base class for all WDARF objects that will use ElfAllocator class for
@@ -128,6 +137,15 @@ class DwarfAllocBase {
    */
   void* operator new(size_t size, const ElfFile* elf);
 
+  /* Operator new allocating objects from the given allocator.
+   * Param:
+   *  size - Number of bytes to allocate for an instance of the derived class.
+   *  allocator - Allocator to allocate the instance from.
+   * Return:
+   *  Pointer to the allocated memory on success, or NULL on failure.
+   */
+  void* operator new(size_t size, ElfAllocator* allocator);
+
   /* Overwitten operator delete.
    * Since deleting for chunk-allocated objects is a "no-op", we don't do
    * anything in this operator. We, however, are obliged to implement this
@@ -49,6 +49,9 @@ ElfFile::ElfFile()
       sec_entry_size_(0),
       last_cu_(NULL),
       cu_count_(0),
+      cu_index_from_aranges_(false),
+      loaded_cu_(NULL),
+      loaded_cu_bytes_(0),
       is_exec_(0) {
 }
 
@@ -60,6 +63,13 @@ ElfFile::~ElfFile() {
     cu_to_del = next_cu_to_del;
   }
 
+  cu_to_del = loaded_cu_;
+  while (cu_to_del != NULL) {
+    DwarfCU* next_cu_to_del = cu_to_del->prev_cu_;
+    release_loaded_cu(cu_to_del);
+    cu_to_del = next_cu_to_del;
+  }
+
   if (mapfile_is_valid(elf_handle_)) {
     mapfile_close(elf_handle_);
   }
@@ -181,134 +191,316 @@ bool ElfFile::get_pc_address_info(Elf_Xword address,
     return false;
   }
 
-  /* Collect routine information for all CUs in this file. */
-  if (parse_compilation_units(&parse_rt_context) == -1) {
+  /* Find a leaf DIE object that contains the address. Only the CU that
+   * contains the address gets parsed. */
+  address_info->inline_stack = NULL;
+  DwarfCU* cu = NULL;
+  Dwarf_AddressInfo info;
+  info.die_obj = get_leaf_die_for_address(address, &cu);
+  if (info.die_obj == NULL) {
     return false;
   }
 
-  /* Iterate through the collected CUs looking for the one that
-   * contains the given address. */
-  address_info->inline_stack = NULL;
-  DwarfCU* cu = last_cu();
-  while (cu != NULL) {
-    /* Find a leaf DIE object in the current CU that contains the address. */
-    Dwarf_AddressInfo info;
-    info.die_obj = cu->get_leaf_die_for_address(address);
-    if (info.die_obj != NULL) {
-      /* Convert the address to a location inside source file. */
-      if (cu->get_pc_address_file_info(address, &info)) {
-          /* Copy location information to the returning structure. */
-          address_info->file_name = info.file_name;
-          address_info->dir_name = info.dir_name;
-          address_info->line_number = info.line_number;
-      } else {
-          address_info->file_name = NULL;
-          address_info->dir_name = NULL;
-          address_info->line_number = 0;
+  /* Convert the address to a location inside source file. */
+  if (cu->get_pc_address_file_info(address, &info)) {
+      /* Copy location information to the returning structure. */
+      address_info->file_name = info.file_name;
+      address_info->dir_name = info.dir_name;
+      address_info->line_number = info.line_number;
+  } else {
+      address_info->file_name = NULL;
+      address_info->dir_name = NULL;
+      address_info->line_number = 0;
+  }
+
+  /* Lets see if the DIE represents a routine (rather than
+   * a lexical block, for instance). */
+  Dwarf_Tag tag = info.die_obj->get_tag();
+  while (!dwarf_tag_is_routine(tag)) {
+    /* This is not a routine DIE. Lets loop trhough the parents of that
+     * DIE looking for the first routine DIE. */
+    info.die_obj = info.die_obj->parent_die();
+    if (info.die_obj == NULL) {
+      /* Reached compilation unit DIE. Can't go any further. */
+      address_info->routine_name = "<unknown>";
+      return true;
+    }
+    tag = info.die_obj->get_tag();
+  }
+
+  /* Save name of the routine that contains the address. */
+  address_info->routine_name = info.die_obj->get_name();
+  if (address_info->routine_name == NULL) {
+    /* In some cases (minimum debugging info in the file) routine
+     * name may be not avaible. We, however, are obliged by API
+     * considerations to return something in this field. */
+      address_info->routine_name = "<unknown>";
+  }
+
+  /* Lets see if address belongs to an inlined routine. */
+  if (tag != DW_TAG_inlined_subroutine) {
+    address_info->inline_stack = NULL;
+    return true;
+  }
+
+  /*
+   * Address belongs to an inlined routine. Create inline stack.
+   */
+
+  /* Allocate inline stack array big enough to fit all parent entries. */
+  address_info->inline_stack =
+    new Elf_InlineInfo[info.die_obj->get_level() + 1];
+  assert(address_info->inline_stack != NULL);
+  if (address_info->inline_stack == NULL) {
+    _set_errno(ENOMEM);
+    return false;
+  }
+  memset(address_info->inline_stack, 0,
+         sizeof(Elf_InlineInfo) * (info.die_obj->get_level() + 1));
+
+  /* Reverse DIEs filling in inline stack entries for inline
+   * routine tags. */
+  int inl_index = 0;
+  do {
+    /* Save source file information. */
+    DIEAttrib file_desc;
+    if (info.die_obj->get_attrib(DW_AT_call_file, &file_desc)) {
+      const Dwarf_STMTL_FileDesc* desc =
+          cu->get_stmt_file_info(file_desc.value()->u32);
+      if (desc != NULL) {
+        address_info->inline_stack[inl_index].inlined_in_file =
+            desc->file_name;
+        address_info->inline_stack[inl_index].inlined_in_file_dir =
+            cu->get_stmt_dir_name(desc->get_dir_index());
       }
+    }
+    if (address_info->inline_stack[inl_index].inlined_in_file == NULL) {
+      address_info->inline_stack[inl_index].inlined_in_file = "<unknown>";
+      address_info->inline_stack[inl_index].inlined_in_file_dir = NULL;
+    }
+
+    /* Save source line information. */
+    if (info.die_obj->get_attrib(DW_AT_call_line, &file_desc)) {
+      address_info->inline_stack[inl_index].inlined_at_line = file_desc.value()->u32;
+    }
 
-      /* Lets see if the DIE represents a routine (rather than
-       * a lexical block, for instance). */
-      Dwarf_Tag tag = info.die_obj->get_tag();
+    /* Advance DIE to the parent routine, and save its name. */
+    info.die_obj = info.die_obj->parent_die();
+    assert(info.die_obj != NULL);
+    if (info.die_obj != NULL) {
+      tag = info.die_obj->get_tag();
       while (!dwarf_tag_is_routine(tag)) {
-        /* This is not a routine DIE. Lets loop trhough the parents of that
-         * DIE looking for the first routine DIE. */
         info.die_obj = info.die_obj->parent_die();
         if (info.die_obj == NULL) {
-          /* Reached compilation unit DIE. Can't go any further. */
-          address_info->routine_name = "<unknown>";
-          return true;
+          break;
         }
         tag = info.die_obj->get_tag();
       }
-
-      /* Save name of the routine that contains the address. */
-      address_info->routine_name = info.die_obj->get_name();
-      if (address_info->routine_name == NULL) {
-        /* In some cases (minimum debugging info in the file) routine
-         * name may be not avaible. We, however, are obliged by API
-         * considerations to return something in this field. */
-          address_info->routine_name = "<unknown>";
+      if (info.die_obj != NULL) {
+        address_info->inline_stack[inl_index].routine_name =
+            info.die_obj->get_name();
       }
+    }
+    if (address_info->inline_stack[inl_index].routine_name == NULL) {
+      address_info->inline_stack[inl_index].routine_name = "<unknown>";
+    }
 
-      /* Lets see if address belongs to an inlined routine. */
-      if (tag != DW_TAG_inlined_subroutine) {
-        address_info->inline_stack = NULL;
-        return true;
-      }
+    /* Continue with the parent DIE. */
+    inl_index++;
+  } while (info.die_obj != NULL && tag == DW_TAG_inlined_subroutine);
 
-      /*
-       * Address belongs to an inlined routine. Create inline stack.
-       */
+  return true;
+}
 
-      /* Allocate inline stack array big enough to fit all parent entries. */
-      address_info->inline_stack =
-        new Elf_InlineInfo[info.die_obj->get_level() + 1];
-      assert(address_info->inline_stack != NULL);
-      if (address_info->inline_stack == NULL) {
-        _set_errno(ENOMEM);
+bool ElfFile::index_aranges() {
+  const Elf_Byte* ptr = reinterpret_cast<const Elf_Byte*>(debug_aranges_.data());
+  const Elf_Byte* const end = INC_CPTR_T(Elf_Byte, ptr, debug_aranges_.size());
+
+  /* Section contains a set of ranges for each CU. */
+  while (diff_ptr(ptr, end) >= sizeof(Elf_Word)) {
+    const Elf_Byte* const set = ptr;
+    bool is_64 = false;
+    Elf_Xword set_size = pull_val(reinterpret_cast<const Elf_Word*>(ptr));
+    ptr += sizeof(Elf_Word);
+    if (set_size == 0xFFFFFFFF) {
+      /* 64-bit DWARF set. */
+      if (diff_ptr(ptr, end) < sizeof(Elf_Xword)) {
+        break;
+      }
+      set_size = pull_val(reinterpret_cast<const Elf_Xword*>(ptr));
+      ptr += sizeof(Elf_Xword);
+      is_64 = true;
+    }
+    const Elf_Xword hdr_rest =
+        sizeof(Elf_Half) + (is_64 ? sizeof(Elf_Xword) : sizeof(Elf_Word)) + 2;
+    if (set_size < hdr_rest || diff_ptr(ptr, end) < set_size) {
+      _set_errno(EINVAL);
+      return false;
+    }
+    const Elf_Byte* const set_end = ptr + set_size;
+
+    /* Skip version, and get CU offset, and address size. */
+    ptr += sizeof(Elf_Half);
+    Elf_Xword cu_offset;
+    if (is_64) {
+      cu_offset = pull_val(reinterpret_cast<const Elf_Xword*>(ptr));
+      ptr += sizeof(Elf_Xword);
+    } else {
+      cu_offset = pull_val(reinterpret_cast<const Elf_Word*>(ptr));
+      ptr += sizeof(Elf_Word);
+    }
+    const Elf_Byte addr_size = *ptr++;
+    const Elf_Byte seg_size = *ptr++;
+    const void* cu_header = INC_CPTR(debug_info_.data(), cu_offset);
+    if ((addr_size != 4 && addr_size != 8) || seg_size != 0 ||
+        cu_offset >= debug_info_.size() || !is_valid_cu(cu_header)) {
+      _set_errno(EINVAL);
+      return false;
+    }
+
+    /* Address / length pairs are aligned at their size from the set start. */
+    const size_t tuple_size = addr_size * 2;
+    ptr = set + (diff_ptr(set, ptr) + tuple_size - 1) / tuple_size * tuple_size;
+    const int order = get_cu_order(cu_header);
+    while (ptr < set_end && diff_ptr(ptr, set_end) >= tuple_size) {
+      Elf_Xword low;
+      Elf_Xword size;
+      if (addr_size == 8) {
+        low = pull_val(reinterpret_cast<const Elf_Xword*>(ptr));
+        size = pull_val(reinterpret_cast<const Elf_Xword*>(ptr) + 1);
+      } else {
+        low = pull_val(reinterpret_cast<const Elf_Word*>(ptr));
+        size = pull_val(reinterpret_cast<const Elf_Word*>(ptr) + 1);
+      }
+      ptr += tuple_size;
+      if (low == 0 && size == 0) {
+        break;
+      }
+      if (!cu_index_.add(low, low + size, cu_header, order)) {
         return false;
       }
-      memset(address_info->inline_stack, 0,
-             sizeof(Elf_InlineInfo) * (info.die_obj->get_level() + 1));
-
-      /* Reverse DIEs filling in inline stack entries for inline
-       * routine tags. */
-      int inl_index = 0;
-      do {
-        /* Save source file information. */
-        DIEAttrib file_desc;
-        if (info.die_obj->get_attrib(DW_AT_call_file, &file_desc)) {
-          const Dwarf_STMTL_FileDesc* desc =
-              cu->get_stmt_file_info(file_desc.value()->u32);
-          if (desc != NULL) {
-            address_info->inline_stack[inl_index].inlined_in_file =
-                desc->file_name;
-            address_info->inline_stack[inl_index].inlined_in_file_dir =
-                cu->get_stmt_dir_name(desc->get_dir_index());
-          }
-        }
-        if (address_info->inline_stack[inl_index].inlined_in_file == NULL) {
-          address_info->inline_stack[inl_index].inlined_in_file = "<unknown>";
-          address_info->inline_stack[inl_index].inlined_in_file_dir = NULL;
-        }
+    }
+    ptr = set_end;
+  }
 
-        /* Save source line information. */
-        if (info.die_obj->get_attrib(DW_AT_call_line, &file_desc)) {
-          address_info->inline_stack[inl_index].inlined_at_line = file_desc.value()->u32;
-        }
+  return true;
+}
 
-        /* Advance DIE to the parent routine, and save its name. */
-        info.die_obj = info.die_obj->parent_die();
-        assert(info.die_obj != NULL);
-        if (info.die_obj != NULL) {
-          tag = info.die_obj->get_tag();
-          while (!dwarf_tag_is_routine(tag)) {
-            info.die_obj = info.die_obj->parent_die();
-            if (info.die_obj == NULL) {
-              break;
-            }
-            tag = info.die_obj->get_tag();
-          }
-          if (info.die_obj != NULL) {
-            address_info->inline_stack[inl_index].routine_name =
-                info.die_obj->get_name();
-          }
-        }
-        if (address_info->inline_stack[inl_index].routine_name == NULL) {
-          address_info->inline_stack[inl_index].routine_name = "<unknown>";
-        }
+bool ElfFile::index_cu_dies(ElfAddressIndex* index) {
+  /* Parse just the CU DIEs, using one allocator for all of them. */
+  ElfAllocator allocator;
+  const void* next_cu = debug_info_.data();
+  while (is_valid_cu(next_cu)) {
+    const void* cu_header = next_cu;
+    DwarfCU* cu = DwarfCU::create_instance(this, cu_header, &allocator);
+    if (cu == NULL) {
+      _set_errno(ENOMEM);
+      return false;
+    }
+    const bool res =
+        cu->parse_cu_die(&next_cu) &&
+        cu->cu_die()->index_address_ranges(index, cu_header,
+                                           get_cu_order(cu_header));
+    delete cu;
+    if (!res) {
+      return false;
+    }
+  }
+  return true;
+}
 
-        /* Continue with the parent DIE. */
-        inl_index++;
-      } while (info.die_obj != NULL && tag == DW_TAG_inlined_subroutine);
+DwarfCU* ElfFile::get_loaded_cu(const void* cu_header) {
+  /* Lets see if this CU has been loaded already. */
+  DwarfCU* prev = NULL;
+  for (DwarfCU* cu = loaded_cu_; cu != NULL; cu = cu->prev_cu()) {
+    if (cu->header() == cu_header) {
+      if (prev != NULL) {
+        /* Move it to the head of the list. */
+        prev->set_prev_cu(cu->prev_cu());
+        cu->set_prev_cu(loaded_cu_);
+        loaded_cu_ = cu;
+      }
+      return cu;
+    }
+    prev = cu;
+  }
 
-      return true;
+  /* Parse the CU with an allocator of its own, so it can be released
+   * independently from other CUs. */
+  ElfAllocator* allocator = new ElfAllocator();
+  assert(allocator != NULL);
+  if (allocator == NULL) {
+    _set_errno(ENOMEM);
+    return NULL;
+  }
+  DwarfCU* cu = DwarfCU::create_instance(this, cu_header, allocator);
+  if (cu == NULL) {
+    delete allocator;
+    _set_errno(ENOMEM);
+    return NULL;
+  }
+  const void* next_cu;
+  if (!cu->parse(&parse_rt_context, &next_cu)) {
+    release_loaded_cu(cu);
+    return NULL;
+  }
+  cu->set_prev_cu(loaded_cu_);
+  loaded_cu_ = cu;
+  loaded_cu_bytes_ += allocator->allocated();
+
+  /* Release least recently used CUs, if loaded CUs take too much memory. The
+   * CU that has just been loaded is kept regardless of its size. */
+  while (loaded_cu_bytes_ > ELFF_CU_CACHE_BYTES && cu->prev_cu() != NULL) {
+    DwarfCU* lru_prev = cu;
+    DwarfCU* lru = cu->prev_cu();
+    while (lru->prev_cu() != NULL) {
+      lru_prev = lru;
+      lru = lru->prev_cu();
     }
-    cu = cu->prev_cu();
+    lru_prev->set_prev_cu(NULL);
+    loaded_cu_bytes_ -= lru->allocator()->allocated();
+    release_loaded_cu(lru);
   }
 
-  return false;
+  return cu;
+}
+
+void ElfFile::release_loaded_cu(DwarfCU* cu) {
+  /* CU object itself lives in its allocator, so it must be deleted first. */
+  ElfAllocator* allocator = cu->allocator();
+  delete cu;
+  delete allocator;
+}
+
+DIEObject* ElfFile::get_leaf_die_for_address(Elf_Xword address,
+                                             DwarfCU** cu) {
+  if (!cu_index_.is_finalized() && !build_cu_index()) {
+    cu_index_.reset();
+    return NULL;
+  }
+
+  const ElfAddressRange* range = cu_index_.find(address);
+  if (range == NULL && cu_index_from_aranges_) {
+    /* Not every CU has to be listed in .debug_aranges (e.g. objects compiled
+     * without it), so look the address up in the CU DIEs as well. */
+    if (!cu_die_index_.is_finalized()) {
+      if (!index_cu_dies(&cu_die_index_)) {
+        /* Don't rescan the DIEs on every miss. */
+        cu_die_index_.reset();
+      }
+      cu_die_index_.finalize();
+    }
+    range = cu_die_index_.find(address);
+  }
+  if (range == NULL) {
+    _set_errno(EINVAL);
+    return NULL;
+  }
+  *cu = get_loaded_cu(range->data);
+  if (*cu == NULL) {
+    return NULL;
+  }
+  return (*cu)->get_leaf_die_for_address(address);
 }
 
 void ElfFile::free_pc_address_info(Elf_AddressInfo* address_info) const {
@@ -418,7 +610,7 @@ int ElfFileImpl<Elf_Addr, Elf_Off>::parse_compilation_units(
    * file. */
   while (is_valid_cu(next_cu)) {
     /* Instatiate CU, depending on DWARF "bitness". */
-    DwarfCU* cu = DwarfCU::create_instance(this, next_cu);
+    DwarfCU* cu = DwarfCU::create_instance(this, next_cu, allocator_);
     if (cu == NULL) {
       _set_errno(ENOMEM);
       return -1;
@@ -437,6 +629,34 @@ int ElfFileImpl<Elf_Addr, Elf_Off>::parse_compilation_units(
   return cu_count_;
 }
 
+template <typename Elf_Addr, typename Elf_Off>
+bool ElfFileImpl<Elf_Addr, Elf_Off>::build_cu_index() {
+  /* Cache sections required for address lookups. Files that don't use
+   * DW_AT_ranges may not have .debug_ranges section. */
+  if (!map_section_by_name(".debug_abbrev", &debug_abbrev_) ||
+      !map_section_by_name(".debug_line", &debug_line_) ||
+      !map_section_by_name(".debug_str", &debug_str_)) {
+    _set_errno(EBADF);
+    return false;
+  }
+  map_section_by_name(".debug_ranges", &debug_ranges_);
+
+  /* .debug_aranges lists code ranges of each CU, and is much cheaper to
+   * process than CU DIEs, but it's optional. */
+  cu_index_from_aranges_ = true;
+  if (!map_section_by_name(".debug_aranges", &debug_aranges_) ||
+      !index_aranges() || cu_index_.count() == 0) {
+    cu_index_.reset();
+    cu_index_from_aranges_ = false;
+    if (!index_cu_dies(&cu_index_)) {
+      return false;
+    }
+  }
+
+  cu_index_.finalize();
+  return true;
+}
+
 template <typename Elf_Addr, typename Elf_Off>
 bool ElfFileImpl<Elf_Addr, Elf_Off>::get_section_info_by_name(const char* name,
                                                               Elf_Off* offset,
@@ -18,10 +18,15 @@
 #define ELFF_ELF_FILE_H_
 
 #include "dwarf_die.h"
+#include "elf_addr_index.h"
 #include "elf_mapped_section.h"
 #include "elff_api.h"
 #include "android/utils/mapfile.h"
 
+/* Number of bytes DWARF objects of compilation units parsed on demand may take,
+ * before least recently used ones get released. */
+#define ELFF_CU_CACHE_BYTES   (8 * 1024 * 1024)
+
 /* Encapsulates architecture-independent functionality of an ELF file.
  *
  * This class is a base class for templated ElfFileImpl. This class implements
@@ -348,6 +353,65 @@ class ElfFile {
    */
   virtual int parse_compilation_units(const DwarfParseContext* parse_context) = 0;
 
+  /* Builds the index of address ranges covered by compilation units of this
+   * file, without parsing any of their DIEs. Ranges are taken from the
+   * .debug_aranges section if the file has one, or from attributes of the CU
+   * DIEs otherwise. In the former case, addresses that .debug_aranges doesn't
+   * cover are looked up in cu_die_index_, built on the first miss.
+   * This is ELF format - dependent method.
+   * Return:
+   *  true on success, or false on failure.
+   */
+  virtual bool build_cu_index() = 0;
+
+  /* Fills in CU index from .debug_aranges section.
+   * Return:
+   *  true on success, or false if section is malformed, or memory allocation
+   *  has failed.
+   */
+  bool index_aranges();
+
+  /* Fills in a CU index from address ranges of the CU DIEs.
+   * Param:
+   *  index - CU index to fill in.
+   * Return:
+   *  true on success, or false on failure.
+   */
+  bool index_cu_dies(ElfAddressIndex* index);
+
+  /* Gets lookup priority of a CU in the CU index. When CU ranges overlap, CUs
+   * that come later in .debug_info section win, just like they did when all
+   * the CUs were looked up in the list built by parse_compilation_units().
+   */
+  int get_cu_order(const void* cu_header) const {
+    return -static_cast<int>(diff_ptr(debug_info_.data(), cu_header));
+  }
+
+  /* Gets a compilation unit parsed on demand, parsing it if it's not in the
+   * loaded CU list. Loaded CUs are kept in the most recently used order, and
+   * the least recently used ones are released when DWARF objects of the
+   * loaded CUs take more than ELFF_CU_CACHE_BYTES.
+   * Param:
+   *  cu_header - CU header in the mapped .debug_info section.
+   * Return:
+   *  Parsed compilation unit, or NULL on failure.
+   */
+  DwarfCU* get_loaded_cu(const void* cu_header);
+
+  /* Releases a compilation unit parsed on demand, along with its allocator. */
+  static void release_loaded_cu(DwarfCU* cu);
+
+  /* Gets the leaf DIE object containing given address.
+   * Param:
+   *  address - Address to get a DIE for.
+   *  cu - Upon successful return contains the compilation unit the returned
+   *    DIE belongs to.
+   * Return:
+   *  Leaf DIE containing given address, or NULL if no compilation unit
+   *  contains it. See DwarfCU::get_leaf_die_for_address().
+   */
+  DIEObject* get_leaf_die_for_address(Elf_Xword address, DwarfCU** cu);
+
  public:
   /* Gets PC address information.
    * Param:
@@ -506,6 +570,9 @@ class ElfFile {
   /* Mapped .debug_ranges section. */
   ElfMappedSection    debug_ranges_;
 
+  /* Mapped .debug_aranges section. */
+  ElfMappedSection    debug_aranges_;
+
   /* Base address of the loaded module (if fixed), or 0 if module doesn't get
    * loaded at fixed address. */
   Elf_Xword           fixed_base_address_;
@@ -534,6 +601,27 @@ class ElfFile {
   /* Number of compilation units in last_cu_ list. */
   int                 cu_count_;
 
+  /* Sorted index of address ranges covered by compilation units, mapping
+   * addresses to CU headers in the mapped .debug_info section. Built on the
+   * first address lookup. */
+  ElfAddressIndex     cu_index_;
+
+  /* CU index built from the CU DIEs when cu_index_ has been built from the
+   * .debug_aranges section, which may not list all CUs in the file. Built on
+   * the first address that cu_index_ doesn't cover. */
+  ElfAddressIndex     cu_die_index_;
+
+  /* Whether cu_index_ has been built from the .debug_aranges section. */
+  bool                cu_index_from_aranges_;
+
+  /* Most recently used compilation unit parsed on demand by address lookups.
+   * Loaded CUs are linked through their prev_cu() lists. Unlike CUs in the
+   * last_cu_ list, each loaded CU has an allocator of its own. */
+  class DwarfCU*      loaded_cu_;
+
+  /* Number of bytes allocated for DWARF objects of the loaded CUs. */
+  size_t              loaded_cu_bytes_;
+
   /* Flags ELF's CPU architecture: 64 (true), or 32 bits (false). */
   bool                is_ELF_64_;
 
@@ -595,6 +683,12 @@ friend class ElfFile;
    */
   virtual int parse_compilation_units(const DwarfParseContext* parse_context);
 
+  /* Builds the index of address ranges covered by compilation units.
+   * This is an implementation of the base class' abstract method.
+   * See ElfFile::build_cu_index().
+   */
+  virtual bool build_cu_index();
+
   /* Gets section information by section name.
    * Param:
    *  name - Name of the section to get information for.
@@ -15,10 +15,91 @@
  * an ELF file containing debugging information in DWARF format.
  */
 
+#include <string.h>
+#include <sys/stat.h>
 #include "elff_api.h"
 #include "elf_file.h"
 #include "dwarf_defs.h"
 
+/* Describes an ELF file opened with elff_open_cached(). */
+typedef struct ElfCacheEntry {
+  /* Next entry in the list of opened entries. */
+  ElfCacheEntry*  next;
+
+  /* Opened ELF file. */
+  ElfFile*        elf_file;
+
+  /* Path to the ELF file. */
+  char*           path;
+
+  /* Modification time of the file, when it was opened. */
+  time_t          mtime;
+
+  /* Size of the file, when it was opened. */
+  off_t           size;
+
+  /* Number of handles to this entry that have not been closed yet. */
+  int             ref_count;
+
+  /* Last time this entry has been looked up (in lookups count). Entries that
+   * have been evicted from the cache, but are still referenced have it set
+   * to zero. */
+  uint32_t        last_used;
+} ElfCacheEntry;
+
+/* List of ELF files opened with elff_open_cached(). The list contains both,
+ * cached entries, and entries that have been evicted from the cache (or
+ * superseded with a newer version of the file), but whose handles have not
+ * been closed yet. The cache is not thread-safe: like the rest of this API it
+ * is expected to be used from the emulator's main loop only. */
+static ElfCacheEntry* elf_cache = NULL;
+
+/* Number of cached entries in elf_cache list. */
+static int elf_cache_count = 0;
+
+/* Counts lookups in the cache, stamping the entries for LRU eviction. */
+static uint32_t elf_cache_clock = 0;
+
+/* Releases an entry, removing it from the elf_cache list. */
+static void
+elf_cache_free_entry(ElfCacheEntry* entry)
+{
+  ElfCacheEntry** link = &elf_cache;
+  while (*link != entry) {
+    link = &(*link)->next;
+  }
+  *link = entry->next;
+
+  delete entry->elf_file;
+  delete[] entry->path;
+  delete entry;
+}
+
+/* Evicts an entry from the cache. The entry gets freed as soon as all its
+ * handles are closed. */
+static void
+elf_cache_evict(ElfCacheEntry* entry)
+{
+  assert(entry->last_used != 0);
+  entry->last_used = 0;
+  elf_cache_count--;
+  if (entry->ref_count == 0) {
+    elf_cache_free_entry(entry);
+  }
+}
+
+/* Finds an entry for the given ELF file handle. */
+static ElfCacheEntry*
+elf_cache_find_handle(ELFF_HANDLE handle)
+{
+  for (ElfCacheEntry* entry = elf_cache; entry != NULL; entry = entry->next) {
+    if (reinterpret_cast<ELFF_HANDLE>(entry->elf_file) == handle) {
+      return entry;
+    }
+  }
+  return NULL;
+}
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -30,11 +111,113 @@ elff_init(const char* elf_file_path)
   return reinterpret_cast<ELFF_HANDLE>(elf_file);
 }
 
+ELFF_HANDLE
+elff_open_cached(const char* elf_file_path)
+{
+  struct stat st;
+
+  assert(elf_file_path != NULL);
+  if (elf_file_path == NULL) {
+    _set_errno(EINVAL);
+    return NULL;
+  }
+  if (stat(elf_file_path, &st) != 0) {
+    return NULL;
+  }
+
+  /* Lets see if the file is cached, and is still up to date. */
+  for (ElfCacheEntry* entry = elf_cache; entry != NULL; entry = entry->next) {
+    if (entry->last_used == 0) {
+      continue;
+    }
+    if (!strcmp(entry->path, elf_file_path)) {
+      if (entry->mtime == st.st_mtime && entry->size == st.st_size) {
+        entry->last_used = ++elf_cache_clock;
+        entry->ref_count++;
+        return reinterpret_cast<ELFF_HANDLE>(entry->elf_file);
+      }
+      /* File has changed since it's been cached. */
+      elf_cache_evict(entry);
+      break;
+    }
+  }
+
+  ElfFile* elf_file = ElfFile::Create(elf_file_path);
+  if (elf_file == NULL) {
+    return NULL;
+  }
+  const size_t path_len = strlen(elf_file_path) + 1;
+  ElfCacheEntry* entry = new ElfCacheEntry;
+  char* path = new char[path_len];
+  assert(entry != NULL && path != NULL);
+  if (entry == NULL || path == NULL) {
+    delete entry;
+    delete[] path;
+    delete elf_file;
+    _set_errno(ENOMEM);
+    return NULL;
+  }
+  memcpy(path, elf_file_path, path_len);
+
+  /* Make room in the cache, if it's full. */
+  if (elf_cache_count >= ELFF_CACHE_SIZE) {
+    ElfCacheEntry* lru = NULL;
+    for (ElfCacheEntry* iter = elf_cache; iter != NULL; iter = iter->next) {
+      if (iter->last_used != 0 &&
+          (lru == NULL || iter->last_used < lru->last_used)) {
+        lru = iter;
+      }
+    }
+    if (lru != NULL) {
+      elf_cache_evict(lru);
+    }
+  }
+
+  entry->elf_file = elf_file;
+  entry->path = path;
+  entry->mtime = st.st_mtime;
+  entry->size = st.st_size;
+  entry->ref_count = 1;
+  entry->last_used = ++elf_cache_clock;
+  entry->next = elf_cache;
+  elf_cache = entry;
+  elf_cache_count++;
+
+  return reinterpret_cast<ELFF_HANDLE>(elf_file);
+}
+
 void
 elff_close(ELFF_HANDLE handle)
 {
-  if (handle != NULL) {
+  if (handle == NULL) {
+    return;
+  }
+
+  ElfCacheEntry* entry = elf_cache_find_handle(handle);
+  if (entry == NULL) {
+    /* Handle has been obtained from elff_init(). */
     delete reinterpret_cast<ElfFile*>(handle);
+    return;
+  }
+
+  assert(entry->ref_count > 0);
+  entry->ref_count--;
+  if (entry->ref_count == 0 && entry->last_used == 0) {
+    /* Entry has been evicted while it was in use. */
+    elf_cache_free_entry(entry);
+  }
+}
+
+void
+elff_flush_cache(void)
+{
+  ElfCacheEntry* entry = elf_cache;
+  while (entry != NULL) {
+    ElfCacheEntry* next = entry->next;
+    if (entry->last_used != 0) {
+      elf_cache_evict(entry);
+    }
+    entry = next;
   }
 }
 
@@ -78,6 +261,47 @@ elff_free_pc_address_info(ELFF_HANDLE handle, Elf_AddressInfo* address_info)
   reinterpret_cast<ElfFile*>(handle)->free_pc_address_info(address_info);
 }
 
+int
+elff_get_pc_address_info_batch(ELFF_HANDLE handle,
+                               const uint64_t* addresses,
+                               int count,
+                               Elf_AddressInfo* address_infos)
+{
+  assert(handle != NULL && addresses != NULL && address_infos != NULL);
+  if (handle == NULL || addresses == NULL || address_infos == NULL) {
+    _set_errno(EINVAL);
+    return -1;
+  }
+
+  ElfFile* elf_file = reinterpret_cast<ElfFile*>(handle);
+  int found = 0;
+  for (int n = 0; n < count; n++) {
+    if (elf_file->get_pc_address_info(addresses[n], &address_infos[n])) {
+      found++;
+    } else {
+      memset(&address_infos[n], 0, sizeof(Elf_AddressInfo));
+    }
+  }
+  return found;
+}
+
+void
+elff_free_pc_address_info_batch(ELFF_HANDLE handle,
+                                Elf_AddressInfo* address_infos,
+                                int count)
+{
+  assert(handle != NULL && address_infos != NULL);
+  if (handle == NULL || address_infos == NULL) {
+    return;
+  }
+  ElfFile* elf_file = reinterpret_cast<ElfFile*>(handle);
+  for (int n = 0; n < count; n++) {
+    if (address_infos[n].routine_name != NULL) {
+      elf_file->free_pc_address_info(&address_infos[n]);
+    }
+  }
+}
+
 #ifdef __cplusplus
 }   /* end of extern "C" */
 #endif
@@ -28,6 +28,9 @@ extern "C" {
 /* Defines type for a handle used in ELFF API. */
 typedef void* ELFF_HANDLE;
 
+/* Maximum number of ELF files kept open by elff_open_cached(). */
+#define ELFF_CACHE_SIZE   16
+
 /* Defines an entry for 'inline_stack' array in Elf_AddressInfo structure.
  * Each entry in the array represents a routine, where routine represented
  * with the previous array entry has been inlined. First element in the array
@@ -119,13 +122,35 @@ typedef struct Elf_AddressInfo {
  */
 ELFF_HANDLE elff_init(const char* elf_file_path);
 
-/* Closes a handle obtained after successful call to elff_init routine.
+/* Initializes ELFF API for the given ELF file, reusing an ELF file that has
+ * been opened earlier by this routine, if possible. ELF files opened by this
+ * routine are kept open in a process-wide cache, keyed by file path, size and
+ * modification time, so DWARF info collected for a file is reused for all
+ * subsequent lookups in that file. Up to ELFF_CACHE_SIZE files are cached,
+ * and the least recently used one is closed when the cache is full.
+ * Param:
+ *  elf_file_path - Path to the ELF file to initialize API for.
+ * Return:
+ *  On success, this routine returns a handle that can be used in subsequent
+ *  calls to this API dealing with the given ELF file. On failure this routine
+ *  returns NULL, with errno providing extended error information.
+ *  NOTE: handle returned from this routine must be closed using elff_close().
+ */
+ELFF_HANDLE elff_open_cached(const char* elf_file_path);
+
+/* Closes a handle obtained after successful call to elff_init, or
+ * elff_open_cached routine. Cached ELF files are not closed here, but stay in
+ * the cache until they get evicted.
  * Param:
  *  handle - A handle to close. This handle must be a handle returned from
- *  a successful call to elff_init routine.
+ *  a successful call to elff_init, or elff_open_cached routine.
  */
 void elff_close(ELFF_HANDLE handle);
 
+/* Evicts all ELF files from the cache used by elff_open_cached routine. Files
+ * whose handles are still open are closed when their handles are closed. */
+void elff_flush_cache(void);
+
 /* Checks if ELF file represents an executable file, or a shared library.
  *  handle - A handle obtained from successful call to elff_init().
  * Return:
@@ -166,6 +191,39 @@ int elff_get_pc_address_info(ELFF_HANDLE handle,
 void elff_free_pc_address_info(ELFF_HANDLE handle,
                                Elf_AddressInfo* address_info);
 
+/* Gets PC address information for an array of addresses.
+ * Param:
+ *  handle - A handle obtained from successful call to elff_init().
+ *  addresses - Array of PC addresses to get information for. Addresses must be
+ *    relative to the beginning of ELF file represented by the handle parameter.
+ *  count - Number of entries in addresses array.
+ *  address_infos - Array of count entries, that upon return contains
+ *    information for each address in addresses array. Entries for addresses
+ *    that could not be resolved have all their fields set to zero.
+ * Return:
+ *  Number of addresses that have been resolved, or -1 if parameters are
+ *  invalid.
+ *  NOTE: Successful call to this routine must be complimented with a call
+ *  to elff_free_pc_address_info_batch, so ELFF API can release resources
+ *  aquired for address_infos.
+ */
+int elff_get_pc_address_info_batch(ELFF_HANDLE handle,
+                                   const uint64_t* addresses,
+                                   int count,
+                                   Elf_AddressInfo* address_infos);
+
+/* Frees resources acquired for address information in successful call to
+ * elff_get_pc_address_info_batch().
+ * Param:
+ *  handle - A handle obtained from successful call to elff_init().
+ *  address_infos - Array of address information structures, initialized in
+ *    successful call to elff_get_pc_address_info_batch() routine.
+ *  count - Number of entries in address_infos array.
+ */
+void elff_free_pc_address_info_batch(ELFF_HANDLE handle,
+                                     Elf_AddressInfo* address_infos,
+                                     int count);
+
 #ifdef __cplusplus
 }   /* end of extern "C" */
 #endif
@@ -62,14 +62,17 @@ enum {
 	AUDIO_INT_READ_BUFFER_FULL      = 1U << 2,
 };
 
+/* A guest buffer. The data is never copied to the emulator: the audio
+ * backend reads it from, or writes it to, guest RAM in place. 'offset'
+ * counts the bytes already played or recorded. */
 struct goldfish_audio_buff {
     uint32_t  address;
     uint32_t  length;
-    uint8*    data;
-    uint32_t  capacity;
     uint32_t  offset;
 };
 
+/* number of write buffers the guest driver cycles through */
+#define  AUDIO_OUT_BUFFERS  2
 
 struct goldfish_audio_state {
     struct goldfish_device dev;
@@ -97,9 +100,8 @@ struct goldfish_audio_state {
     // set to 1 or 2 to indicate which buffer we are writing from, or zero if both buffers are empty
     int current_buffer;
 
-    // current data to write
-    struct goldfish_audio_buff  out_buff1[1];
-    struct goldfish_audio_buff  out_buff2[1];
+    // ring of guest buffers to write, and the guest buffer to read into
+    struct goldfish_audio_buff  out_buff[AUDIO_OUT_BUFFERS];
     struct goldfish_audio_buff  in_buff[1];
 
     // for QEMU sound output
@@ -115,8 +117,6 @@ goldfish_audio_buff_init( struct goldfish_audio_buff*  b )
 {
     b->address  = 0;
     b->length   = 0;
-    b->data     = NULL;
-    b->capacity = 0;
     b->offset   = 0;
 }
 
@@ -127,21 +127,6 @@ goldfish_audio_buff_reset( struct goldfish_audio_buff*  b )
     b->length = 0;
 }
 
-static uint32_t
-goldfish_audio_buff_length( struct goldfish_audio_buff*  b )
-{
-    return b->length;
-}
-
-static void
-goldfish_audio_buff_ensure( struct goldfish_audio_buff*  b, uint32_t  size )
-{
-    if (b->capacity < size) {
-        b->data     = qemu_realloc(b->data, size);
-        b->capacity = size;
-    }
-}
-
 static void
 goldfish_audio_buff_set_address( struct goldfish_audio_buff*  b, uint32_t  addr )
 {
@@ -153,59 +138,78 @@ goldfish_audio_buff_set_length( struct goldfish_audio_buff*  b, uint32_t  len )
 {
     b->length = len;
     b->offset = 0;
-    goldfish_audio_buff_ensure(b, len);
-}
-
-static void
-goldfish_audio_buff_read( struct goldfish_audio_buff*  b )
-{
-    cpu_physical_memory_read(b->address, b->data, b->length);
 }
 
-static void
-goldfish_audio_buff_write( struct goldfish_audio_buff*  b )
+static int
+goldfish_audio_buff_available( struct goldfish_audio_buff*  b )
 {
-    cpu_physical_memory_write(b->address, b->data, b->length);
+    return b->length - b->offset;
 }
 
+/* Sends up to 'free' bytes of the buffer to the output voice, straight from
+ * guest memory. A buffer may map to several host ranges. */
 static int
 goldfish_audio_buff_send( struct goldfish_audio_buff*  b, int  free, struct goldfish_audio_state*  s )
 {
-    int  ret, write = b->length;
+    int  sent = 0;
 
-    if (write > free)
-        write = free;
+    while (free > 0 && goldfish_audio_buff_available(b) > 0) {
+        target_phys_addr_t  len = goldfish_audio_buff_available(b);
+        void*               data;
+        int                 ret;
 
-    ret = AUD_write(s->voice, b->data + b->offset, write);
-    b->offset += ret;
-    b->length -= ret;
-    return ret;
-}
+        if (len > (target_phys_addr_t)free)
+            len = free;
 
-static int
-goldfish_audio_buff_available( struct goldfish_audio_buff*  b )
-{
-    return b->length - b->offset;
+        data = cpu_physical_memory_map(b->address + b->offset, &len, 0);
+        if (data == NULL)
+            break;
+
+        ret = AUD_write(s->voice, data, len);
+        cpu_physical_memory_unmap(data, len, 0, ret);
+
+        b->offset += ret;
+        free      -= ret;
+        sent      += ret;
+        if (ret < (int)len)
+            break;
+    }
+    return sent;
 }
 
+/* Receives up to 'avail' bytes from the input voice, straight into guest
+ * memory. */
 static int
 goldfish_audio_buff_recv( struct goldfish_audio_buff*  b, int  avail, struct goldfish_audio_state*  s )
 {
-    int     missing = b->length - b->offset;
-    int     avail2 = (avail > missing) ? missing : avail;
-    int     read;
+    int  received = 0;
 
-    read = AUD_read(s->voicein, b->data + b->offset, avail2 );
-    if (read == 0)
-        return 0;
+    while (avail > 0 && goldfish_audio_buff_available(b) > 0) {
+        target_phys_addr_t  len = goldfish_audio_buff_available(b);
+        void*               data;
+        int                 read;
+
+        if (len > (target_phys_addr_t)avail)
+            len = avail;
+
+        data = cpu_physical_memory_map(b->address + b->offset, &len, 1);
+        if (data == NULL)
+            break;
 
-    if (avail2 > 0)
-        D("%s: AUD_read(%d) returned %d", __FUNCTION__, avail2, read);
+        read = AUD_read(s->voicein, data, len);
+        cpu_physical_memory_unmap(data, len, 1, read);
+        if (read == 0)
+            break;
 
-    cpu_physical_memory_write( b->address + b->offset, b->data, read );
-    b->offset += read;
+        D("%s: AUD_read(%d) returned %d", __FUNCTION__, (int)len, read);
 
-    return read;
+        b->offset += read;
+        avail     -= read;
+        received  += read;
+        if (read < (int)len)
+            break;
+    }
+    return received;
 }
 
 static void
@@ -214,21 +218,31 @@ goldfish_audio_buff_put( struct goldfish_audio_buff*  b, QEMUFile*  f )
     qemu_put_be32(f, b->address );
     qemu_put_be32(f, b->length );
     qemu_put_be32(f, b->offset );
-    qemu_put_buffer(f, b->data, b->length );
 }
 
 static void
-goldfish_audio_buff_get( struct goldfish_audio_buff*  b, QEMUFile*  f )
+goldfish_audio_buff_get( struct goldfish_audio_buff*  b, QEMUFile*  f, int  version_id )
 {
     b->address = qemu_get_be32(f);
     b->length  = qemu_get_be32(f);
     b->offset  = qemu_get_be32(f);
-    goldfish_audio_buff_ensure(b, b->length);
-    qemu_get_buffer(f, b->data, b->length);
+
+    if (version_id < 3) {
+        /* older snapshots also saved a copy of the data, which is still
+         * in guest memory */
+        uint8_t   skip[256];
+        uint32_t  left = b->length;
+
+        while (left > 0) {
+            int  n = left > sizeof(skip) ? (int)sizeof(skip) : (int)left;
+            qemu_get_buffer(f, skip, n);
+            left -= n;
+        }
+    }
 }
 
 /* update this whenever you change the goldfish_audio_state structure */
-#define  AUDIO_STATE_SAVE_VERSION  2
+#define  AUDIO_STATE_SAVE_VERSION  3
 
 #define  QFIELD_STRUCT   struct goldfish_audio_state
 QFIELD_BEGIN(audio_state_fields)
@@ -244,8 +258,8 @@ static void  audio_state_save( QEMUFile*  f, void* opaque )
 
     qemu_put_struct(f, audio_state_fields, s);
 
-    goldfish_audio_buff_put (s->out_buff1, f);
-    goldfish_audio_buff_put (s->out_buff2, f);
+    goldfish_audio_buff_put (&s->out_buff[0], f);
+    goldfish_audio_buff_put (&s->out_buff[1], f);
     goldfish_audio_buff_put (s->in_buff, f);
 }
 
@@ -254,14 +268,22 @@ static int   audio_state_load( QEMUFile*  f, void*  opaque, int  version_id )
     struct goldfish_audio_state*  s = opaque;
     int                           ret;
 
-    if (version_id != AUDIO_STATE_SAVE_VERSION)
+    if (version_id != AUDIO_STATE_SAVE_VERSION && version_id != 2)
         return -1;
 
     ret = qemu_get_struct(f, audio_state_fields, s);
     if (!ret) {
-        goldfish_audio_buff_get( s->out_buff1, f );
-        goldfish_audio_buff_get( s->out_buff2, f );
-        goldfish_audio_buff_get (s->in_buff, f);
+        int  nn;
+
+        for (nn = 0; nn < AUDIO_OUT_BUFFERS; nn++) {
+            struct goldfish_audio_buff*  b = &s->out_buff[nn];
+
+            goldfish_audio_buff_get( b, f, version_id );
+            /* version 2 saved the number of bytes left to play */
+            if (version_id < 3)
+                b->length += b->offset;
+        }
+        goldfish_audio_buff_get( s->in_buff, f, version_id );
     }
     return ret;
 }
@@ -271,8 +293,8 @@ static void enable_audio(struct goldfish_audio_state *s, int enable)
     // enable or disable the output voice
     if (s->voice != NULL) {
         AUD_set_active_out(s->voice,   (enable & (AUDIO_INT_WRITE_BUFFER_1_EMPTY | AUDIO_INT_WRITE_BUFFER_2_EMPTY)) != 0);
-        goldfish_audio_buff_reset( s->out_buff1 );
-        goldfish_audio_buff_reset( s->out_buff2 );
+        goldfish_audio_buff_reset( &s->out_buff[0] );
+        goldfish_audio_buff_reset( &s->out_buff[1] );
     }
 
     if (s->voicein) {
@@ -387,7 +409,6 @@ static uint32_t goldfish_audio_read(void *opaque, target_phys_addr_t offset)
 	case AUDIO_READ_BUFFER_AVAILABLE:
             D("%s: AUDIO_READ_BUFFER_AVAILABLE returns %d", __FUNCTION__,
                s->read_buffer_available);
-            goldfish_audio_buff_write( s->in_buff );
 	    return s->read_buffer_available;
 
         default:
@@ -412,28 +433,30 @@ static void goldfish_audio_write(void *opaque, target_phys_addr_t offset, uint32
         case AUDIO_SET_WRITE_BUFFER_1:
             /* save pointer to buffer 1 */
             D( "%s: AUDIO_SET_WRITE_BUFFER_1 %08x", __FUNCTION__, val);
-            goldfish_audio_buff_set_address( s->out_buff1, val );
+            goldfish_audio_buff_set_address( &s->out_buff[0], val );
             break;
         case AUDIO_SET_WRITE_BUFFER_2:
             /* save pointer to buffer 2 */
             D( "%s: AUDIO_SET_WRITE_BUFFER_2 %08x", __FUNCTION__, val);
-            goldfish_audio_buff_set_address( s->out_buff2, val );
+            goldfish_audio_buff_set_address( &s->out_buff[1], val );
             break;
         case AUDIO_WRITE_BUFFER_1:
             /* record that data in buffer 1 is ready to write */
             //D( "%s: AUDIO_WRITE_BUFFER_1 %08x", __FUNCTION__, val);
             if (s->current_buffer == 0) s->current_buffer = 1;
-            goldfish_audio_buff_set_length( s->out_buff1, val );
-            goldfish_audio_buff_read( s->out_buff1 );
+            goldfish_audio_buff_set_length( &s->out_buff[0], val );
             s->int_status &= ~AUDIO_INT_WRITE_BUFFER_1_EMPTY;
+            /* the audio timer may be idle, have the data played now */
+            AUD_kick_out( s->voice );
             break;
         case AUDIO_WRITE_BUFFER_2:
             /* record that data in buffer 2 is ready to write */
             //D( "%s: AUDIO_WRITE_BUFFER_2 %08x", __FUNCTION__, val);
             if (s->current_buffer == 0) s->current_buffer = 2;
-            goldfish_audio_buff_set_length( s->out_buff2, val );
-            goldfish_audio_buff_read( s->out_buff2 );
+            goldfish_audio_buff_set_length( &s->out_buff[1], val );
             s->int_status &= ~AUDIO_INT_WRITE_BUFFER_2_EMPTY;
+            /* the audio timer may be idle, have the data played now */
+            AUD_kick_out( s->voice );
             break;
 
         case AUDIO_SET_READ_BUFFER:
@@ -459,40 +482,29 @@ static void goldfish_audio_callback(void *opaque, int free)
     struct goldfish_audio_state *s = opaque;
     int new_status = 0;
 
-    /* loop until free is zero or both buffers are empty */
-    while (free && s->current_buffer) {
-
-        /* write data in buffer 1 */
-        while (free && s->current_buffer == 1) {
-            int  written = goldfish_audio_buff_send( s->out_buff1, free, s );
-            if (written) {
-                D("%s: sent %5d bytes to audio output (buffer 1)", __FUNCTION__, written);
-                free -= written;
-
-                if (goldfish_audio_buff_length( s->out_buff1 ) == 0) {
-                    new_status |= AUDIO_INT_WRITE_BUFFER_1_EMPTY;
-                    s->current_buffer = (goldfish_audio_buff_length( s->out_buff2 ) ? 2 : 0);
-                }
-            } else {
-                break;
-            }
-        }
+    /* play the ring of buffers until free is zero or they are all empty */
+    while (s->current_buffer) {
+        int  nn = s->current_buffer - 1;
+        struct goldfish_audio_buff*  b = &s->out_buff[nn];
+
+        if (goldfish_audio_buff_available(b) > 0) {
+            int  written;
 
-        /* write data in buffer 2 */
-        while (free && s->current_buffer == 2) {
-            int  written = goldfish_audio_buff_send( s->out_buff2, free, s );
-            if (written) {
-                D("%s: sent %5d bytes to audio output (buffer 2)", __FUNCTION__, written);
-                free -= written;
-
-                if (goldfish_audio_buff_length( s->out_buff2 ) == 0) {
-                    new_status |= AUDIO_INT_WRITE_BUFFER_2_EMPTY;
-                    s->current_buffer = (goldfish_audio_buff_length( s->out_buff1 ) ? 1 : 0);
-                }
-            } else {
+            if (!free)
                 break;
-            }
+            written = goldfish_audio_buff_send( b, free, s );
+            if (!written)
+                break;
+            D("%s: sent %5d bytes to audio output (buffer %d)", __FUNCTION__, written, nn + 1);
+            free -= written;
+            if (goldfish_audio_buff_available(b) > 0)
+                continue;
         }
+
+        /* buffer done, move to the next one if the guest filled it */
+        new_status |= AUDIO_INT_WRITE_BUFFER_1_EMPTY << nn;
+        nn = (nn + 1) % AUDIO_OUT_BUFFERS;
+        s->current_buffer = goldfish_audio_buff_available(&s->out_buff[nn]) ? nn + 1 : 0;
     }
 
     if (new_status && new_status != s->int_status) {
@@ -521,7 +533,7 @@ goldfish_audio_in_callback(void *opaque, int avail)
         if (goldfish_audio_buff_available( s->in_buff) == 0) {
             new_status |= AUDIO_INT_READ_BUFFER_FULL;
             D("%s: AUDIO_INT_READ_BUFFER_FULL available=%d",
-              __FUNCTION__, goldfish_audio_buff_length( s->in_buff ));
+              __FUNCTION__, s->in_buff->length);
             break;
         }
     }
@@ -615,8 +627,8 @@ void goldfish_audio_init(uint32_t base, int id, const char* input_source)
     }
 #endif
 
-    goldfish_audio_buff_init( s->out_buff1 );
-    goldfish_audio_buff_init( s->out_buff2 );
+    goldfish_audio_buff_init( &s->out_buff[0] );
+    goldfish_audio_buff_init( &s->out_buff[1] );
     goldfish_audio_buff_init( s->in_buff );
 
     goldfish_device_add(&s->dev, goldfish_audio_readfn, goldfish_audio_writefn, s);
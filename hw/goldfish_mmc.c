@@ -14,6 +14,7 @@
 #include "mmc.h"
 #include "sd.h"
 #include "block.h"
+#include "dma.h"
 
 enum {
     /* status register */
@@ -78,8 +79,12 @@ struct goldfish_mmc_state {
     uint32_t block_length;
     uint32_t block_count;
     int is_SDHC;
+};
 
-    uint8_t* buf;
+// A block transfer between the card and guest memory, done with bdrv_aio
+struct goldfish_mmc_request {
+    struct goldfish_mmc_state *s;
+    QEMUSGList sg;
 };
 
 #define  GOLDFISH_MMC_SAVE_VERSION  2
@@ -170,51 +175,65 @@ static const char* get_command_name(int command)
 }
 #endif
 
-static int  goldfish_mmc_bdrv_read(struct goldfish_mmc_state *s,
-                                   int64_t                    sector_number,
-                                   target_phys_addr_t         dst_address,
-                                   int                        num_sectors)
+static void goldfish_mmc_set_status(struct goldfish_mmc_state *s,
+                                    uint32_t new_status)
 {
-    int  ret;
-
-    while (num_sectors > 0) {
-        ret = bdrv_read(s->bs, sector_number, s->buf, 1);
-        if (ret < 0)
-            return ret;
+    s->int_status |= new_status;
 
-        cpu_physical_memory_write(dst_address, s->buf, 512);
-        dst_address   += 512;
-        num_sectors   -= 1;
-        sector_number += 1;
+    if ((s->int_status & s->int_enable)) {
+        goldfish_device_set_irq(&s->dev, 0, (s->int_status & s->int_enable));
     }
-    return 0;
 }
 
-static int  goldfish_mmc_bdrv_write(struct goldfish_mmc_state *s,
-                                    int64_t                    sector_number,
-                                    target_phys_addr_t         dst_address,
-                                    int                        num_sectors)
+static void goldfish_mmc_bdrv_done(void *opaque, int ret)
 {
-    int  ret;
+    struct goldfish_mmc_request *req = opaque;
+    struct goldfish_mmc_state *s = req->s;
 
-    while (num_sectors > 0) {
-        cpu_physical_memory_read(dst_address, s->buf, 512);
+    if (ret < 0)
+        fprintf(stderr, "goldfish_mmc: block transfer failed: %s\n",
+                strerror(-ret));
 
-        ret = bdrv_write(s->bs, sector_number, s->buf, 1);
-        if (ret < 0)
-            return ret;
+    qemu_sglist_destroy(&req->sg);
+    qemu_free(req);
 
-        dst_address   += 512;
-        num_sectors   -= 1;
-        sector_number += 1;
-    }
-    return 0;
+    goldfish_mmc_set_status(s, MMC_STAT_END_OF_CMD | MMC_STAT_END_OF_DATA);
+}
+
+/* Starts a transfer of all the blocks of a command between the card and
+ * guest memory. The blocks are read or written straight from guest RAM.
+ * MMC_STAT_END_OF_CMD and MMC_STAT_END_OF_DATA are raised together once
+ * the whole transfer is done: some guest drivers complete the data phase
+ * as soon as they see END_OF_CMD, so it must not arrive any earlier.
+ */
+static void goldfish_mmc_bdrv_transfer(struct goldfish_mmc_state *s,
+                                       int64_t             sector_number,
+                                       target_phys_addr_t  address,
+                                       int                 num_sectors,
+                                       int                 is_write)
+{
+    struct goldfish_mmc_request *req;
+    BlockDriverAIOCB *acb;
+
+    req = qemu_mallocz(sizeof(*req));
+    req->s = s;
+    qemu_sglist_init(&req->sg, 1);
+    qemu_sglist_add(&req->sg, address, (target_phys_addr_t)num_sectors * 512);
+
+    if (is_write)
+        acb = dma_bdrv_write(s->bs, &req->sg, sector_number,
+                             goldfish_mmc_bdrv_done, req);
+    else
+        acb = dma_bdrv_read(s->bs, &req->sg, sector_number,
+                            goldfish_mmc_bdrv_done, req);
+
+    if (acb == NULL)
+        goldfish_mmc_bdrv_done(req, -EIO);
 }
 
 
 static void goldfish_mmc_do_command(struct goldfish_mmc_state *s, uint32_t cmd, uint32_t arg)
 {
-    int result;
     int new_status = MMC_STAT_END_OF_CMD;
     int opcode = cmd & 63;
 
@@ -371,9 +390,10 @@ static void goldfish_mmc_do_command(struct goldfish_mmc_state *s, uint32_t cmd,
                 if (arg & 511) fprintf(stderr, "offset %d is not multiple of 512 when reading\n", arg);
                 arg /= s->block_length;
             }
-            result = goldfish_mmc_bdrv_read(s, arg, s->buffer_address, s->block_count);
-            new_status |= MMC_STAT_END_OF_DATA;
+            // completion is signalled by goldfish_mmc_bdrv_done()
+            new_status = 0;
             s->resp[0] = SET_R1_CURRENT_STATE(4) | R1_READY_FOR_DATA; // 2304
+            goldfish_mmc_bdrv_transfer(s, arg, s->buffer_address, s->block_count, 0);
             break;
         }
 
@@ -388,11 +408,10 @@ static void goldfish_mmc_do_command(struct goldfish_mmc_state *s, uint32_t cmd,
                 if (arg & 511) fprintf(stderr, "offset %d is not multiple of 512 when writing\n", arg);
                 arg /= s->block_length;
             }
-            // arg is byte offset
-            result = goldfish_mmc_bdrv_write(s, arg, s->buffer_address, s->block_count);
-//            bdrv_flush(s->bs);
-            new_status |= MMC_STAT_END_OF_DATA;
+            // completion is signalled by goldfish_mmc_bdrv_done()
+            new_status = 0;
             s->resp[0] = SET_R1_CURRENT_STATE(4) | R1_READY_FOR_DATA; // 2304
+            goldfish_mmc_bdrv_transfer(s, arg, s->buffer_address, s->block_count, 1);
             break;
         }
 
@@ -405,11 +424,8 @@ static void goldfish_mmc_do_command(struct goldfish_mmc_state *s, uint32_t cmd,
             break;
      }
 
-    s->int_status |= new_status;
-
-    if ((s->int_status & s->int_enable)) {
-        goldfish_device_set_irq(&s->dev, 0, (s->int_status & s->int_enable));
-    }
+    if (new_status)
+        goldfish_mmc_set_status(s, new_status);
 }
 
 static uint32_t goldfish_mmc_read(void *opaque, target_phys_addr_t offset)
@@ -510,7 +526,6 @@ void goldfish_mmc_init(uint32_t base, int id, BlockDriverState* bs)
     s->dev.size = 0x1000;
     s->dev.irq_count = 1;
     s->bs = bs;
-    s->buf = qemu_memalign(512,512);
 
     goldfish_device_add(&s->dev, goldfish_mmc_readfn, goldfish_mmc_writefn, s);
 
@@ -14,6 +14,10 @@
 #include "goldfish_nand.h"
 #include "android/utils/tempfile.h"
 #include "qemu_debug.h"
+#include "qemu-timer.h"
+#include "qemu-objects.h"
+#include "monitor.h"
+#include "block.h"
 #include "android/android.h"
 
 #ifdef TARGET_I386
@@ -53,6 +57,14 @@ xlog( const char*  format, ... )
     va_end(args);
 }
 
+/* Request types of the I/O statistics */
+enum {
+    NAND_ACCT_READ,
+    NAND_ACCT_WRITE,
+    NAND_ACCT_ERASE,
+    NAND_ACCT_MAX,
+};
+
 /* Information on a single device/nand image used by the emulator
  */
 typedef struct {
@@ -66,6 +78,10 @@ typedef struct {
     uint32_t   erase_size;   /* size of the data buffer mentioned above */
     uint64_t   max_size;     /* Capacity limit for the image. The actual underlying
                               * file may be smaller. */
+
+    /* I/O statistics (display with "info nandstats") */
+    uint64_t           bytes[NAND_ACCT_MAX];
+    BlockLatencyStats  latency[NAND_ACCT_MAX];
 } nand_dev;
 
 nand_threshold    android_nand_write_threshold;
@@ -442,6 +458,95 @@ static uint32_t nand_dev_erase_file(nand_dev *dev, uint64_t addr, uint32_t total
     return total_len - len;
 }
 
+/* Accounts a completed command in the I/O statistics of a device */
+static void nand_dev_acct_done(nand_dev *dev, int type, uint32_t len, int64_t start)
+{
+    dev->bytes[type] += len;
+    bdrv_latency_add(&dev->latency[type], get_clock() - start);
+}
+
+static QObject *nand_dev_info_stats_dev(nand_dev *dev)
+{
+    QDict *dict, *stats;
+
+    stats = qdict_new();
+    qdict_put(stats, "rd_bytes", qint_from_int(dev->bytes[NAND_ACCT_READ]));
+    qdict_put(stats, "wr_bytes", qint_from_int(dev->bytes[NAND_ACCT_WRITE]));
+    qdict_put(stats, "erase_bytes", qint_from_int(dev->bytes[NAND_ACCT_ERASE]));
+    qdict_put(stats, "rd_operations",
+              qint_from_int(dev->latency[NAND_ACCT_READ].count));
+    qdict_put(stats, "wr_operations",
+              qint_from_int(dev->latency[NAND_ACCT_WRITE].count));
+    qdict_put(stats, "erase_operations",
+              qint_from_int(dev->latency[NAND_ACCT_ERASE].count));
+    qdict_put_obj(stats, "rd_latency",
+                  bdrv_latency_to_qobject(&dev->latency[NAND_ACCT_READ]));
+    qdict_put_obj(stats, "wr_latency",
+                  bdrv_latency_to_qobject(&dev->latency[NAND_ACCT_WRITE]));
+    qdict_put_obj(stats, "erase_latency",
+                  bdrv_latency_to_qobject(&dev->latency[NAND_ACCT_ERASE]));
+
+    dict = qdict_new();
+    qdict_put(dict, "device",
+              qstring_from_substr(dev->devname, 0, dev->devname_len - 1));
+    qdict_put(dict, "stats", stats);
+    return QOBJECT(dict);
+}
+
+void nand_dev_info_stats(Monitor *mon, QObject **ret_data)
+{
+    QList *devices = qlist_new();
+    uint32_t i;
+
+    for (i = 0; i < nand_dev_count; i++)
+        qlist_append_obj(devices, nand_dev_info_stats_dev(&nand_devs[i]));
+
+    *ret_data = QOBJECT(devices);
+}
+
+static void nand_dev_stats_iter(QObject *data, void *opaque)
+{
+    Monitor *mon = opaque;
+    QDict *qdict = qobject_to_qdict(data);
+
+    monitor_printf(mon, "%s:", qdict_get_str(qdict, "device"));
+
+    qdict = qobject_to_qdict(qdict_get(qdict, "stats"));
+    monitor_printf(mon, " rd_bytes=%" PRId64
+                        " wr_bytes=%" PRId64
+                        " erase_bytes=%" PRId64
+                        " rd_operations=%" PRId64
+                        " wr_operations=%" PRId64
+                        " erase_operations=%" PRId64
+                        "\n",
+                        qdict_get_int(qdict, "rd_bytes"),
+                        qdict_get_int(qdict, "wr_bytes"),
+                        qdict_get_int(qdict, "erase_bytes"),
+                        qdict_get_int(qdict, "rd_operations"),
+                        qdict_get_int(qdict, "wr_operations"),
+                        qdict_get_int(qdict, "erase_operations"));
+
+    bdrv_latency_print(mon, "rd_latency", qdict_get(qdict, "rd_latency"));
+    bdrv_latency_print(mon, "wr_latency", qdict_get(qdict, "wr_latency"));
+    bdrv_latency_print(mon, "erase_latency",
+                       qdict_get(qdict, "erase_latency"));
+}
+
+void nand_dev_stats_print(Monitor *mon, const QObject *data)
+{
+    qlist_iter(qobject_to_qlist(data), nand_dev_stats_iter, mon);
+}
+
+void nand_dev_reset_stats(void)
+{
+    uint32_t i;
+
+    for (i = 0; i < nand_dev_count; i++) {
+        memset(nand_devs[i].bytes, 0, sizeof(nand_devs[i].bytes));
+        memset(nand_devs[i].latency, 0, sizeof(nand_devs[i].latency));
+    }
+}
+
 /* this is a huge hack required to make the PowerPC emulator binary usable
  * on Mac OS X. If you define this function as 'static', the emulated kernel
  * will panic when attempting to mount the /data partition.
@@ -459,6 +564,7 @@ uint32_t nand_dev_do_cmd(nand_dev_controller_state *s, uint32_t cmd)
 {
     uint32_t size;
     uint64_t addr;
+    int64_t start;
     nand_dev *dev;
 
     if (cmd == NAND_CMD_WRITE_BATCH || cmd == NAND_CMD_READ_BATCH ||
@@ -495,13 +601,17 @@ uint32_t nand_dev_do_cmd(nand_dev_controller_state *s, uint32_t cmd)
             return 0;
         if(size > dev->max_size - addr)
             size = dev->max_size - addr;
-        if(dev->fd >= 0)
-            return nand_dev_read_file(dev, s->data, addr, size);
+        start = get_clock();
+        if(dev->fd >= 0) {
+            size = nand_dev_read_file(dev, s->data, addr, size);
+        } else {
 #ifdef TARGET_I386
-        if (kvm_enabled())
-                cpu_synchronize_state(cpu_single_env, 0);
+            if (kvm_enabled())
+                    cpu_synchronize_state(cpu_single_env, 0);
 #endif
-        cpu_memory_rw_debug(cpu_single_env,s->data, &dev->data[addr], size, 1);
+            cpu_memory_rw_debug(cpu_single_env,s->data, &dev->data[addr], size, 1);
+        }
+        nand_dev_acct_done(dev, NAND_ACCT_READ, size, start);
         return size;
     case NAND_CMD_WRITE_BATCH:
     case NAND_CMD_WRITE:
@@ -511,13 +621,17 @@ uint32_t nand_dev_do_cmd(nand_dev_controller_state *s, uint32_t cmd)
             return 0;
         if(size > dev->max_size - addr)
             size = dev->max_size - addr;
-        if(dev->fd >= 0)
-            return nand_dev_write_file(dev, s->data, addr, size);
+        start = get_clock();
+        if(dev->fd >= 0) {
+            size = nand_dev_write_file(dev, s->data, addr, size);
+        } else {
 #ifdef TARGET_I386
-        if (kvm_enabled())
-                cpu_synchronize_state(cpu_single_env, 0);
+            if (kvm_enabled())
+                    cpu_synchronize_state(cpu_single_env, 0);
 #endif
-        cpu_memory_rw_debug(cpu_single_env,s->data, &dev->data[addr], size, 0);
+            cpu_memory_rw_debug(cpu_single_env,s->data, &dev->data[addr], size, 0);
+        }
+        nand_dev_acct_done(dev, NAND_ACCT_WRITE, size, start);
         return size;
     case NAND_CMD_ERASE_BATCH:
     case NAND_CMD_ERASE:
@@ -527,9 +641,12 @@ uint32_t nand_dev_do_cmd(nand_dev_controller_state *s, uint32_t cmd)
             return 0;
         if(size > dev->max_size - addr)
             size = dev->max_size - addr;
+        start = get_clock();
         if(dev->fd >= 0)
-            return nand_dev_erase_file(dev, addr, size);
-        memset(&dev->data[addr], 0xff, size);
+            size = nand_dev_erase_file(dev, addr, size);
+        else
+            memset(&dev->data[addr], 0xff, size);
+        nand_dev_acct_done(dev, NAND_ACCT_ERASE, size, start);
         return size;
     case NAND_CMD_BLOCK_BAD_GET: // no bad block support
         return 0;
@@ -849,6 +966,8 @@ void nand_add_dev(const char *arg)
     dev->devname = devname;
     dev->devname_len = devname_len;
     dev->max_size = dev_size;
+    memset(dev->bytes, 0, sizeof(dev->bytes));
+    memset(dev->latency, 0, sizeof(dev->latency));
     dev->data = malloc(dev->erase_size);
     if(dev->data == NULL)
         goto out_of_memory;
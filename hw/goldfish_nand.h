@@ -12,10 +12,17 @@
 #ifndef NAND_DEVICE_H
 #define NAND_DEVICE_H
 
+#include "qobject.h"
+
 void nand_dev_init(uint32_t base);
 void nand_add_dev(const char *arg);
 void parse_nand_limits(char*  limits);
 
+/* I/O statistics of the NAND partitions, see "info nandstats" */
+void nand_dev_info_stats(Monitor *mon, QObject **ret_data);
+void nand_dev_stats_print(Monitor *mon, const QObject *data);
+void nand_dev_reset_stats(void);
+
 typedef struct {
     uint64_t     limit;
     uint64_t     counter;
@@ -0,0 +1,344 @@
+/*
+ * Linux native AIO support.
+ *
+ * Copyright (C) 2009 IBM, Corp.
+ * Copyright (C) 2009 Red Hat, Inc.
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+#include "qemu-common.h"
+#include "qemu-aio.h"
+#include "block_int.h"
+#include "block/raw-posix-aio.h"
+
+#include <sys/syscall.h>
+#include <linux/aio_abi.h>
+
+/*
+ * The kernel AIO interface is used through raw system calls, so that the
+ * emulator doesn't depend on libaio being installed on the build host.
+ *
+ * laio_submit() hands each request to the kernel right away. It must not
+ * defer the submission to a bottom half: bottom halves only run in the
+ * async context that created them, and a synchronous request issued from a
+ * nested context (e.g. qcow2 metadata I/O during savevm) would never be
+ * submitted. Requests that don't fit in the ring are queued and submitted,
+ * in batches, as soon as earlier requests complete. Completions are
+ * signaled through an eventfd and reaped in batches with io_getevents() in
+ * the I/O thread, without any thread handoff.
+ */
+
+/*
+ * Size of the kernel completion ring (per-device). Requests beyond this
+ * many stay in pending_reqs until earlier ones complete.
+ */
+#define MAX_EVENTS 128
+
+struct qemu_laiocb {
+    BlockDriverAIOCB common;
+    struct qemu_laio_state *ctx;
+    struct iocb iocb;
+    ssize_t ret;
+    size_t nbytes;
+    int async_context_id;
+    int submitted;              /* handed to the kernel */
+    int cancelled;
+    QTAILQ_ENTRY(qemu_laiocb) node;
+};
+
+struct qemu_laio_state {
+    aio_context_t ctx;
+    int efd;
+    int count;                  /* queued and submitted requests */
+    int inflight;               /* requests submitted to the kernel */
+    QTAILQ_HEAD(, qemu_laiocb) pending_reqs;
+    QTAILQ_HEAD(, qemu_laiocb) completed_reqs;
+};
+
+static int io_setup(unsigned nr_events, aio_context_t *ctx)
+{
+    return syscall(__NR_io_setup, nr_events, ctx) < 0 ? -errno : 0;
+}
+
+static int io_submit(aio_context_t ctx, long nr, struct iocb **iocbs)
+{
+    int ret = syscall(__NR_io_submit, ctx, nr, iocbs);
+    return ret < 0 ? -errno : ret;
+}
+
+static int io_getevents(aio_context_t ctx, long min_nr, long nr,
+                        struct io_event *events, struct timespec *timeout)
+{
+    int ret = syscall(__NR_io_getevents, ctx, min_nr, nr, events, timeout);
+    return ret < 0 ? -errno : ret;
+}
+
+static int io_cancel(aio_context_t ctx, struct iocb *iocb,
+                     struct io_event *result)
+{
+    return syscall(__NR_io_cancel, ctx, iocb, result) < 0 ? -errno : 0;
+}
+
+static void qemu_laio_process_completion(struct qemu_laio_state *s,
+    struct qemu_laiocb *laiocb)
+{
+    int ret;
+
+    s->count--;
+
+    ret = laiocb->ret;
+    if (ret == laiocb->nbytes)
+        ret = 0;
+    else if (ret >= 0)
+        ret = -EINVAL;
+
+    laiocb->common.cb(laiocb->common.opaque, ret);
+    qemu_aio_release(laiocb);
+}
+
+/*
+ * All requests are completed in the async context they were submitted from,
+ * completions for other contexts are kept until qemu_aio_process_queue() is
+ * called from the right one.
+ */
+static int qemu_laio_process_requests(void *opaque)
+{
+    struct qemu_laio_state *s = opaque;
+    struct qemu_laiocb *laiocb, *next;
+    int res = 0;
+
+    QTAILQ_FOREACH_SAFE(laiocb, &s->completed_reqs, node, next) {
+        if (laiocb->async_context_id == get_async_context_id()) {
+            QTAILQ_REMOVE(&s->completed_reqs, laiocb, node);
+            qemu_laio_process_completion(s, laiocb);
+            res = 1;
+        }
+    }
+
+    return res;
+}
+
+static void qemu_laio_enqueue_completed(struct qemu_laio_state *s,
+    struct qemu_laiocb* laiocb)
+{
+    if (laiocb->cancelled) {
+        /* laio_cancel() is waiting for it and releases it */
+        return;
+    }
+
+    if (laiocb->async_context_id == get_async_context_id()) {
+        qemu_laio_process_completion(s, laiocb);
+    } else {
+        QTAILQ_INSERT_TAIL(&s->completed_reqs, laiocb, node);
+    }
+}
+
+/* Hands the queued requests to the kernel, as many as the ring can take */
+static void qemu_laio_submit_pending(struct qemu_laio_state *s)
+{
+    struct iocb *iocbs[MAX_EVENTS];
+    struct qemu_laiocb *laiocb;
+    int nr, ret, i;
+
+    while (!QTAILQ_EMPTY(&s->pending_reqs) && s->inflight < MAX_EVENTS) {
+        nr = 0;
+        QTAILQ_FOREACH(laiocb, &s->pending_reqs, node) {
+            if (s->inflight + nr == MAX_EVENTS)
+                break;
+            iocbs[nr++] = &laiocb->iocb;
+        }
+
+        ret = io_submit(s->ctx, nr, iocbs);
+        if (ret == -EAGAIN && s->inflight > 0) {
+            /* retried when the next request completes */
+            return;
+        }
+        if (ret < 0) {
+            /* the first request was rejected, fail it and go on */
+            laiocb = QTAILQ_FIRST(&s->pending_reqs);
+            QTAILQ_REMOVE(&s->pending_reqs, laiocb, node);
+            laiocb->ret = ret;
+            qemu_laio_enqueue_completed(s, laiocb);
+            continue;
+        }
+
+        for (i = 0; i < ret; i++) {
+            laiocb = QTAILQ_FIRST(&s->pending_reqs);
+            QTAILQ_REMOVE(&s->pending_reqs, laiocb, node);
+            laiocb->submitted = 1;
+        }
+        s->inflight += ret;
+    }
+}
+
+static void qemu_laio_completion_cb(void *opaque)
+{
+    struct qemu_laio_state *s = opaque;
+
+    while (1) {
+        struct io_event events[MAX_EVENTS];
+        uint64_t val;
+        ssize_t ret;
+        struct timespec ts = { 0 };
+        int nevents, i;
+
+        do {
+            ret = read(s->efd, &val, sizeof(val));
+        } while (ret == -1 && errno == EINTR);
+
+        if (ret == -1 && errno == EAGAIN)
+            break;
+
+        if (ret != 8)
+            break;
+
+        do {
+            nevents = io_getevents(s->ctx, val, MAX_EVENTS, events, &ts);
+        } while (nevents == -EINTR);
+
+        for (i = 0; i < nevents; i++) {
+            struct iocb *iocb = (struct iocb *)(uintptr_t)events[i].obj;
+            struct qemu_laiocb *laiocb =
+                    container_of(iocb, struct qemu_laiocb, iocb);
+
+            s->inflight--;
+            laiocb->ret = events[i].res;
+            qemu_laio_enqueue_completed(s, laiocb);
+        }
+    }
+
+    /* Room was made in the ring */
+    if (!QTAILQ_EMPTY(&s->pending_reqs)) {
+        qemu_laio_submit_pending(s);
+    }
+}
+
+static int qemu_laio_flush_cb(void *opaque)
+{
+    struct qemu_laio_state *s = opaque;
+
+    return (s->count > 0) ? 1 : 0;
+}
+
+static void laio_cancel(BlockDriverAIOCB *blockacb)
+{
+    struct qemu_laiocb *laiocb = (struct qemu_laiocb *)blockacb;
+    struct qemu_laio_state *s = laiocb->ctx;
+    struct io_event event;
+
+    if (laiocb->ret != -EINPROGRESS) {
+        /* completed, waiting for the right async context */
+        QTAILQ_REMOVE(&s->completed_reqs, laiocb, node);
+    } else if (!laiocb->submitted) {
+        QTAILQ_REMOVE(&s->pending_reqs, laiocb, node);
+    } else if (io_cancel(s->ctx, &laiocb->iocb, &event) == 0) {
+        s->inflight--;
+    } else {
+        /*
+         * The kernel doesn't cancel most requests. Wait for it to complete,
+         * the buffers must not be touched once we return.
+         */
+        laiocb->cancelled = 1;
+        while (laiocb->ret == -EINPROGRESS)
+            qemu_laio_completion_cb(s);
+    }
+
+    s->count--;
+    qemu_aio_release(laiocb);
+}
+
+static AIOPool laio_pool = {
+    .aiocb_size         = sizeof(struct qemu_laiocb),
+    .cancel             = laio_cancel,
+};
+
+BlockDriverAIOCB *laio_submit(BlockDriverState *bs, void *aio_ctx, int fd,
+        int64_t sector_num, QEMUIOVector *qiov, int nb_sectors,
+        BlockDriverCompletionFunc *cb, void *opaque, int type)
+{
+    struct qemu_laio_state *s = aio_ctx;
+    struct qemu_laiocb *laiocb;
+    struct iocb *iocbs;
+    off_t offset = sector_num * 512;
+
+    laiocb = qemu_aio_get(&laio_pool, bs, cb, opaque);
+    if (!laiocb)
+        return NULL;
+    laiocb->nbytes = nb_sectors * 512;
+    laiocb->ctx = s;
+    laiocb->ret = -EINPROGRESS;
+    laiocb->async_context_id = get_async_context_id();
+    laiocb->submitted = 0;
+    laiocb->cancelled = 0;
+
+    iocbs = &laiocb->iocb;
+    memset(iocbs, 0, sizeof(*iocbs));
+    iocbs->aio_fildes = fd;
+    iocbs->aio_buf = (uintptr_t)qiov->iov;
+    iocbs->aio_nbytes = qiov->niov;
+    iocbs->aio_offset = offset;
+    iocbs->aio_flags = IOCB_FLAG_RESFD;
+    iocbs->aio_resfd = s->efd;
+
+    switch (type) {
+    case QEMU_AIO_WRITE:
+        iocbs->aio_lio_opcode = IOCB_CMD_PWRITEV;
+        break;
+    case QEMU_AIO_READ:
+        iocbs->aio_lio_opcode = IOCB_CMD_PREADV;
+        break;
+    default:
+        fprintf(stderr, "%s: invalid AIO request type 0x%x.\n",
+                        __func__, type);
+        qemu_aio_release(laiocb);
+        return NULL;
+    }
+
+    if (s->inflight < MAX_EVENTS && QTAILQ_EMPTY(&s->pending_reqs)) {
+        int ret = io_submit(s->ctx, 1, &iocbs);
+        if (ret == 1) {
+            laiocb->submitted = 1;
+            s->inflight++;
+            s->count++;
+            return &laiocb->common;
+        }
+        if (ret != -EAGAIN || s->inflight == 0) {
+            qemu_aio_release(laiocb);
+            return NULL;
+        }
+    }
+
+    /* The ring is full, submitted when earlier requests complete */
+    s->count++;
+    QTAILQ_INSERT_TAIL(&s->pending_reqs, laiocb, node);
+    return &laiocb->common;
+}
+
+void *laio_init(void)
+{
+    struct qemu_laio_state *s;
+
+    s = qemu_mallocz(sizeof(*s));
+    QTAILQ_INIT(&s->pending_reqs);
+    QTAILQ_INIT(&s->completed_reqs);
+    s->efd = syscall(__NR_eventfd, 0);
+    if (s->efd == -1)
+        goto out_free_state;
+    fcntl(s->efd, F_SETFL, O_NONBLOCK);
+
+    if (io_setup(MAX_EVENTS, &s->ctx) != 0)
+        goto out_close_efd;
+
+    qemu_aio_set_fd_handler(s->efd, qemu_laio_completion_cb, NULL,
+        qemu_laio_flush_cb, qemu_laio_process_requests, s);
+
+    return s;
+
+out_close_efd:
+    close(s->efd);
+out_free_state:
+    qemu_free(s);
+    return NULL;
+}
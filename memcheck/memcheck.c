@@ -177,7 +177,8 @@ av_access_violation(ProcDesc* proc,
  *      been found.
  *  desc_ptr - Upon exit from this routine contains pointer to the allocation
  *      descriptor matching given address range, or NULL, if allocation
- *      descriptor for the validated memory range has not been found.
+ *      descriptor for the validated memory range has not been found, or
+ *      has not been needed to validate the access.
  * Return:
  *  0 if access to the given guest address range doesn't violate anything, or
  *  1 if given guest address range doesn't match any entry in the current
@@ -201,6 +202,20 @@ memcheck_common_access_validation(target_ulong addr,
         return 1;
     }
 
+    /* Most of the accesses are either far from any allocated block, or well
+     * inside the user part of one. Shadow map tells these apart without
+     * searching the allocation descriptors map. */
+    switch (memcheck_shadow_get(&proc->shadow, addr, data_size)) {
+        case MSHADOW_NONE:
+            *desc_ptr = NULL;
+            return 1;
+        case MSHADOW_USER:
+            *desc_ptr = NULL;
+            return 0;
+        default:
+            break;
+    }
+
     desc = procdesc_find_malloc_for_range(proc, addr, data_size);
     *desc_ptr = desc;
     if (desc == NULL) {
@@ -251,25 +266,21 @@ memcheck_common_access_validation(target_ulong addr,
     return -1;
 }
 
-/* Checks if process has allocation descriptors for pages defined by a buffer.
+/* Checks if process has guarding areas of allocated blocks in pages defined by
+ * a buffer. Pages that only contain user parts of allocated blocks (e.g. the
+ * middle of a large buffer), can't be accessed in violation, so there is no
+ * need to validate accesses to them.
  * Param:
  *  addr - Starting address of a buffer.
  *  buf_size - Buffer size.
  * Return:
- *  1 if process has allocations descriptors for pages defined by a buffer, or
- *  0 if pages containing given buffer don't have any memory allocations in
- *  them.
+ *  1 if pages defined by a buffer contain guarding areas, or block boundaries,
+ *  or 0 if accesses to pages containing given buffer don't need validation.
  */
 static inline int
-procdesc_contains_allocs(ProcDesc* proc, target_ulong addr, uint32_t buf_size) {
+procdesc_contains_guards(ProcDesc* proc, target_ulong addr, uint32_t buf_size) {
     if (proc != NULL) {
-        // Beginning of the page containing last byte in range.
-        const target_ulong end_page = (addr + buf_size - 1) & TARGET_PAGE_MASK;
-        // Adjust beginning of the range to the beginning of the page.
-        addr &= TARGET_PAGE_MASK;
-        // Total size of range to check for descriptors.
-        buf_size = end_page - addr + TARGET_PAGE_SIZE + 1;
-        return procdesc_find_malloc_for_range(proc, addr, buf_size) ? 1 : 0;
+        return memcheck_shadow_pages_checked(&proc->shadow, addr, buf_size);
     } else {
         return 0;
     }
@@ -444,13 +455,14 @@ memcheck_guest_alloc(target_ulong guest_address)
 
     // Save malloc descriptor in the map.
     insert_res = procdesc_add_malloc(proc, &desc, &replaced);
-    if (insert_res == RBT_MAP_RESULT_ENTRY_INSERTED) {
-        // Invalidate TLB cache for the allocated block.
-        if (memcheck_instrument_mmu) {
-            invalidate_tlb_cache(desc.malloc_desc.ptr,
-                                mallocdesc_get_alloc_end(&desc.malloc_desc));
-        }
-    } else if (insert_res == RBT_MAP_RESULT_ENTRY_REPLACED) {
+    if ((insert_res == RBT_MAP_RESULT_ENTRY_INSERTED ||
+         insert_res == RBT_MAP_RESULT_ENTRY_REPLACED) && memcheck_instrument_mmu) {
+        /* Invalidate TLB cache for the allocated block, as its pages may have
+         * been cached while they didn't contain any guarding areas. */
+        invalidate_tlb_cache(desc.malloc_desc.ptr,
+                             mallocdesc_get_alloc_end(&desc.malloc_desc));
+    }
+    if (insert_res == RBT_MAP_RESULT_ENTRY_REPLACED) {
         /* We don't expect to have another entry in the map that matches
          * inserting entry. This is an error condition for us, indicating
          * that we somehow lost track of memory allocations. */
@@ -464,7 +476,7 @@ memcheck_guest_alloc(target_ulong guest_address)
         if (replaced.call_stack != NULL) {
             qemu_free(replaced.call_stack);
         }
-    } else {
+    } else if (insert_res != RBT_MAP_RESULT_ENTRY_INSERTED) {
         ME("memcheck: Unable to insert an entry to the allocation map:");
         if (VERBOSE_CHECK(memcheck)) {
             memcheck_dump_malloc_desc(&desc, 1, 1);
@@ -587,8 +599,8 @@ memcheck_validate_ld(target_ulong addr,
 
     /* Even though descriptor for the given address range has not been found,
      * we need to make sure that pages containing the given address range
-     * don't contain other descriptors. */
-    return res ? procdesc_contains_allocs(proc, addr, data_size) : 0;
+     * don't contain guarding areas of other descriptors. */
+    return res ? procdesc_contains_guards(proc, addr, data_size) : 0;
 }
 
 /* Validates write operations, detected in __stx_mmu routine.
@@ -623,8 +635,8 @@ memcheck_validate_st(target_ulong addr,
 
     /* Even though descriptor for the given address range has not been found,
      * we need to make sure that pages containing the given address range
-     * don't contain other descriptors. */
-    return res ? procdesc_contains_allocs(proc, addr, data_size) : 0;
+     * don't contain guarding areas of other descriptors. */
+    return res ? procdesc_contains_guards(proc, addr, data_size) : 0;
 }
 
 /* Checks if given address range in the context of the current process is under
@@ -638,5 +650,5 @@ memcheck_validate_st(target_ulong addr,
  */
 int
 memcheck_is_checked(target_ulong addr, uint32_t size) {
-    return procdesc_contains_allocs(get_current_process(), addr, size) ? 1 : 0;
+    return procdesc_contains_guards(get_current_process(), addr, size);
 }
@@ -105,6 +105,7 @@ create_new_process(uint32_t pid, uint32_t parent_pid)
     }
     QLIST_INIT(&new_proc->threads);
     allocmap_init(&new_proc->alloc_map);
+    memcheck_shadow_init(&new_proc->shadow);
     mmrangemap_init(&new_proc->mmrange_map);
     new_proc->pid = pid;
     new_proc->parent_pid = parent_pid;
@@ -138,12 +139,24 @@ create_new_process(uint32_t pid, uint32_t parent_pid)
             return NULL;
         }
 
+        // The copied map describes the same blocks, so does parent's shadow.
+        failed = memcheck_shadow_copy(&new_proc->shadow, &parent->shadow);
+        if (failed) {
+            ME("memcheck: Unable to copy process' %s[pid=%u] shadow map to new process pid=%u",
+               parent->image_path, parent_pid, pid);
+            memcheck_shadow_empty(&new_proc->shadow);
+            allocmap_empty(&new_proc->alloc_map);
+            qemu_free(new_proc);
+            return NULL;
+        }
+
         // Copy parent's memory mappings map.
         failed = mmrangemap_copy(&new_proc->mmrange_map, &parent->mmrange_map);
         if (failed) {
             ME("memcheck: Unable to copy process' %s[pid=%u] mmrange map to new process pid=%u",
                parent->image_path, parent_pid, pid);
             mmrangemap_empty(&new_proc->mmrange_map);
+            memcheck_shadow_empty(&new_proc->shadow);
             allocmap_empty(&new_proc->alloc_map);
             qemu_free(new_proc);
             return NULL;
@@ -153,6 +166,7 @@ create_new_process(uint32_t pid, uint32_t parent_pid)
     // Create and register main thread descriptor for new process.
     if(create_new_thread(new_proc, pid) == NULL) {
         mmrangemap_empty(&new_proc->mmrange_map);
+        memcheck_shadow_empty(&new_proc->shadow);
         allocmap_empty(&new_proc->alloc_map);
         qemu_free(new_proc);
         return NULL;
@@ -683,8 +697,9 @@ memcheck_exit(uint32_t exit_code)
     current_process = NULL;
     QLIST_REMOVE(proc, global_entry);
 
-    // Empty process' mmapings map.
+    // Empty process' mmapings and shadow maps.
     mmrangemap_empty(&proc->mmrange_map);
+    memcheck_shadow_empty(&proc->shadow);
     if (proc->image_path != NULL) {
         qemu_free(proc->image_path);
     }
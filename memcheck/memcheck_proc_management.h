@@ -22,6 +22,7 @@
 #include "memcheck_common.h"
 #include "memcheck_malloc_map.h"
 #include "memcheck_mmrange_map.h"
+#include "memcheck_shadow.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -36,6 +37,10 @@ typedef struct ProcDesc {
     /* Map of memory blocks allocated in context of this process. */
     AllocMap                                    alloc_map;
 
+    /* Shadow of the allocation descriptors map, used to validate memory
+     * access without searching the map. */
+    MemcheckShadow                              shadow;
+
     /* Map of memory mapped modules loaded in context of this process. */
     MMRangeMap                                  mmrange_map;
 
@@ -203,7 +208,7 @@ ProcDesc* get_current_process(void);
 ProcDesc* get_process_from_pid(uint32_t pid);
 
 /* Inserts new (or replaces existing) entry in the allocation descriptors map
- * for the given process.
+ * for the given process, updating process' shadow map accordingly.
  * See allocmap_insert for more information on this routine, its parameters
  * and returning value.
  * Param:
@@ -214,7 +219,16 @@ procdesc_add_malloc(ProcDesc* proc,
                     const MallocDescEx* desc,
                     MallocDescEx* replaced)
 {
-    return allocmap_insert(&proc->alloc_map, desc, replaced);
+    RBTMapResult ret = allocmap_insert(&proc->alloc_map, desc, replaced);
+    if (ret == RBT_MAP_RESULT_ENTRY_REPLACED) {
+        memcheck_shadow_unmark(&proc->shadow, &replaced->malloc_desc,
+                               &proc->alloc_map);
+    }
+    if (ret == RBT_MAP_RESULT_ENTRY_INSERTED ||
+        ret == RBT_MAP_RESULT_ENTRY_REPLACED) {
+        memcheck_shadow_mark(&proc->shadow, &desc->malloc_desc);
+    }
+    return ret;
 }
 
 /* Finds an entry in the allocation descriptors map for the given process,
@@ -255,7 +269,12 @@ procdesc_find_malloc(ProcDesc* proc, target_ulong address)
 static inline int
 procdesc_pull_malloc(ProcDesc* proc, target_ulong address, MallocDescEx* pulled)
 {
-    return allocmap_pull(&proc->alloc_map, address, pulled);
+    int ret = allocmap_pull(&proc->alloc_map, address, pulled);
+    if (ret == 0) {
+        memcheck_shadow_unmark(&proc->shadow, &pulled->malloc_desc,
+                               &proc->alloc_map);
+    }
+    return ret;
 }
 
 /* Empties allocation descriptors map for the process.
@@ -267,6 +286,7 @@ procdesc_pull_malloc(ProcDesc* proc, target_ulong address, MallocDescEx* pulled)
 static inline int
 procdesc_empty_alloc_map(ProcDesc* proc)
 {
+    memcheck_shadow_empty(&proc->shadow);
     return allocmap_empty(&proc->alloc_map);
 }
 
@@ -0,0 +1,193 @@
+/* Copyright (C) 2012 The Android Open Source Project
+**
+** This software is licensed under the terms of the GNU General Public
+** License version 2, as published by the Free Software Foundation, and
+** may be copied, distributed, and modified under those terms.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+*/
+
+/*
+ * Contains implementation of the shadow map of memory blocks allocated by the
+ * guest system.
+ */
+
+#include "memcheck_shadow.h"
+#include "memcheck_logging.h"
+
+// =============================================================================
+// Static routines
+// =============================================================================
+
+/* Sets the shadow state of a range of granules.
+ * Param:
+ *  shadow - Shadow map to update.
+ *  first - Index of the first granule in the range.
+ *  last - Index of the last granule in the range (inclusive).
+ *  state - One of the MSHADOW_XXX values to set.
+ */
+static void
+mshadow_fill(MemcheckShadow* shadow,
+             uint32_t first,
+             uint32_t last,
+             int state)
+{
+    const uint32_t granules_per_chunk = MSHADOW_CHUNK_SIZE;
+    const uint32_t page_shift = TARGET_PAGE_BITS - MSHADOW_GRANULE_BITS;
+
+    while (first <= last) {
+        const uint32_t chunk_index = first / granules_per_chunk;
+        const uint32_t offset = first % granules_per_chunk;
+        uint32_t count = granules_per_chunk - offset;
+        MemcheckShadowChunk* chunk = shadow->chunks[chunk_index];
+        uint32_t n;
+
+        if (count > last - first + 1) {
+            count = last - first + 1;
+        }
+
+        if (chunk == NULL) {
+            if (state == MSHADOW_NONE) {
+                // Missing chunks are already "empty".
+                first += count;
+                continue;
+            }
+            chunk = qemu_mallocz(sizeof(MemcheckShadowChunk));
+            if (chunk == NULL) {
+                ME("memcheck: Unable to allocate %u bytes for a shadow chunk",
+                   (uint32_t)sizeof(MemcheckShadowChunk));
+                return;
+            }
+            shadow->chunks[chunk_index] = chunk;
+        }
+
+        // Keep per-page counts of granules that need checking up to date.
+        for (n = offset; n < offset + count; n++) {
+            const int old = chunk->granules[n];
+            if (old != state) {
+                if (old == MSHADOW_CHECK) {
+                    chunk->check_count[n >> page_shift]--;
+                } else if (state == MSHADOW_CHECK) {
+                    chunk->check_count[n >> page_shift]++;
+                }
+                chunk->granules[n] = state;
+            }
+        }
+        first += count;
+    }
+}
+
+/* Gets index of the last granule covered by an allocated block.
+ * Param:
+ *  desc - Allocated block descriptor.
+ * Return:
+ *  Index of the granule containing the last byte of the block. The allocation
+ *  descriptors map matches empty blocks with ranges containing their address,
+ *  so for those this is the granule containing that address.
+ */
+static inline uint32_t
+mshadow_last_granule(const MallocDesc* desc)
+{
+    const target_ulong alloc_end = mallocdesc_get_alloc_end(desc);
+    if (alloc_end <= desc->ptr) {
+        return desc->ptr >> MSHADOW_GRANULE_BITS;
+    }
+    return (alloc_end - 1) >> MSHADOW_GRANULE_BITS;
+}
+
+// =============================================================================
+// Shadow map API
+// =============================================================================
+
+void
+memcheck_shadow_init(MemcheckShadow* shadow)
+{
+    memset(shadow->chunks, 0, sizeof(shadow->chunks));
+}
+
+void
+memcheck_shadow_empty(MemcheckShadow* shadow)
+{
+    int n;
+    for (n = 0; n < MSHADOW_CHUNK_COUNT; n++) {
+        if (shadow->chunks[n] != NULL) {
+            qemu_free(shadow->chunks[n]);
+            shadow->chunks[n] = NULL;
+        }
+    }
+}
+
+int
+memcheck_shadow_copy(MemcheckShadow* to, const MemcheckShadow* from)
+{
+    int n;
+    for (n = 0; n < MSHADOW_CHUNK_COUNT; n++) {
+        if (from->chunks[n] != NULL) {
+            to->chunks[n] = qemu_malloc(sizeof(MemcheckShadowChunk));
+            if (to->chunks[n] == NULL) {
+                ME("memcheck: Unable to allocate %u bytes for a shadow chunk",
+                   (uint32_t)sizeof(MemcheckShadowChunk));
+                return -1;
+            }
+            memcpy(to->chunks[n], from->chunks[n], sizeof(MemcheckShadowChunk));
+        }
+    }
+    return 0;
+}
+
+void
+memcheck_shadow_mark(MemcheckShadow* shadow, const MallocDesc* desc)
+{
+    const target_ulong user_ptr = mallocdesc_get_user_ptr(desc);
+    const target_ulong user_end = mallocdesc_get_user_alloc_end(desc);
+    const uint32_t first = desc->ptr >> MSHADOW_GRANULE_BITS;
+    const uint32_t last = mshadow_last_granule(desc);
+    uint32_t user_first, user_last;
+
+    /* The whole block needs checking, except for the granules that are fully
+     * inside its user part. Granules that contain the first, or the last byte
+     * of the block may be shared with a neighbour, so they always need
+     * checking. */
+    mshadow_fill(shadow, first, last, MSHADOW_CHECK);
+
+    user_first = (user_ptr + MSHADOW_GRANULE_SIZE - 1) >> MSHADOW_GRANULE_BITS;
+    user_last = user_end >> MSHADOW_GRANULE_BITS;
+    if (user_first <= first) {
+        user_first = first + 1;
+    }
+    if (user_last == 0) {
+        return;
+    }
+    user_last--;
+    if (user_last >= last) {
+        user_last = last - 1;
+    }
+    if (last > first + 1 && user_first <= user_last) {
+        mshadow_fill(shadow, user_first, user_last, MSHADOW_USER);
+    }
+}
+
+void
+memcheck_shadow_unmark(MemcheckShadow* shadow,
+                       const MallocDesc* desc,
+                       const AllocMap* map)
+{
+    const uint32_t first = desc->ptr >> MSHADOW_GRANULE_BITS;
+    const uint32_t last = mshadow_last_granule(desc);
+
+    mshadow_fill(shadow, first, last, MSHADOW_NONE);
+
+    // Boundary granules may still hold bytes of neighbouring blocks.
+    if (allocmap_find(map, first << MSHADOW_GRANULE_BITS,
+                      MSHADOW_GRANULE_SIZE) != NULL) {
+        mshadow_fill(shadow, first, first, MSHADOW_CHECK);
+    }
+    if (last != first &&
+        allocmap_find(map, last << MSHADOW_GRANULE_BITS,
+                      MSHADOW_GRANULE_SIZE) != NULL) {
+        mshadow_fill(shadow, last, last, MSHADOW_CHECK);
+    }
+}
@@ -0,0 +1,218 @@
+/* Copyright (C) 2012 The Android Open Source Project
+**
+** This software is licensed under the terms of the GNU General Public
+** License version 2, as published by the Free Software Foundation, and
+** may be copied, distributed, and modified under those terms.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+*/
+
+/*
+ * Contains declarations of structures and routines that implement a shadow
+ * map of the memory blocks allocated by the guest system. The shadow map keeps
+ * one byte per 8 bytes (a "granule") of the guest's address space, telling
+ * whether the granule is outside of any allocated block, entirely inside the
+ * user part of a block, or anything else (guarding areas, block boundaries).
+ * This lets memory access validation dismiss the vast majority of accesses in
+ * constant time, without searching the allocation descriptors map. The shadow
+ * map also counts, for each guest page, the granules that need checking, so
+ * pages that can't hold an access violation can be left in the TLB. Shadow maps
+ * are instantiated one per each process running on the guest system, next to
+ * its allocation descriptors map, and must be kept in sync with it.
+ */
+
+#ifndef QEMU_MEMCHECK_MEMCHECK_SHADOW_H
+#define QEMU_MEMCHECK_MEMCHECK_SHADOW_H
+
+#include "memcheck_common.h"
+#include "memcheck_malloc_map.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if TARGET_LONG_BITS != 32
+#error The shadow map only covers 32-bit guest address spaces.
+#endif
+
+/* Number of guest bytes described by a shadow byte (log2). */
+#define MSHADOW_GRANULE_BITS    3
+#define MSHADOW_GRANULE_SIZE    (1 << MSHADOW_GRANULE_BITS)
+
+/* Shadow is allocated in chunks covering 1MB of the guest space each (log2). */
+#define MSHADOW_CHUNK_BITS      20
+#define MSHADOW_CHUNK_SIZE      (1 << (MSHADOW_CHUNK_BITS - MSHADOW_GRANULE_BITS))
+#define MSHADOW_CHUNK_PAGES     (1 << (MSHADOW_CHUNK_BITS - TARGET_PAGE_BITS))
+#define MSHADOW_CHUNK_COUNT     (1 << (32 - MSHADOW_CHUNK_BITS))
+#define MSHADOW_CHUNK_MASK      ((1 << MSHADOW_CHUNK_BITS) - 1)
+
+/* Granule doesn't intersect with any allocated block. */
+#define MSHADOW_NONE            0
+/* Granule is entirely contained in the user part of an allocated block, and
+ * doesn't contain the first, or the last byte of that block. */
+#define MSHADOW_USER            1
+/* Granule must be checked against the allocation descriptors map: it contains
+ * guarding area bytes, or a block boundary. */
+#define MSHADOW_CHECK           2
+
+/* Chunk of a shadow map. */
+typedef struct MemcheckShadowChunk {
+    /* Shadow state (MSHADOW_XXX) of each granule in the chunk. */
+    uint8_t     granules[MSHADOW_CHUNK_SIZE];
+
+    /* Number of MSHADOW_CHECK granules in each page of the chunk. */
+    uint16_t    check_count[MSHADOW_CHUNK_PAGES];
+} MemcheckShadowChunk;
+
+/* Shadow map of a process. */
+typedef struct MemcheckShadow {
+    /* Chunks of the shadow map, indexed by the upper bits of the guest address.
+     * A NULL chunk describes a 1MB range without any allocated block. */
+    MemcheckShadowChunk*    chunks[MSHADOW_CHUNK_COUNT];
+} MemcheckShadow;
+
+// =============================================================================
+// Shadow map API
+// =============================================================================
+
+/* Initializes a shadow map.
+ * Param:
+ *  shadow - Shadow map to initialize.
+ */
+void memcheck_shadow_init(MemcheckShadow* shadow);
+
+/* Empties a shadow map, releasing all memory used by its chunks.
+ * Param:
+ *  shadow - Shadow map to empty.
+ */
+void memcheck_shadow_empty(MemcheckShadow* shadow);
+
+/* Copies content of one shadow map to another, empty, shadow map.
+ * Param:
+ *  to - Shadow map where to copy the content to.
+ *  from - Shadow map where to copy the content from.
+ * Return:
+ *  Zero on success, or -1 on error.
+ */
+int memcheck_shadow_copy(MemcheckShadow* to, const MemcheckShadow* from);
+
+/* Updates the shadow map for a block that has been added to the allocation
+ * descriptors map.
+ * Param:
+ *  shadow - Shadow map to update.
+ *  desc - Descriptor of the allocated block.
+ */
+void memcheck_shadow_mark(MemcheckShadow* shadow, const MallocDesc* desc);
+
+/* Updates the shadow map for a block that has been removed from the allocation
+ * descriptors map.
+ * Param:
+ *  shadow - Shadow map to update.
+ *  desc - Descriptor of the removed block.
+ *  map - Allocation descriptors map the block has been removed from. It is
+ *      used to find out if granules at the boundaries of the removed block are
+ *      shared with other blocks.
+ */
+void memcheck_shadow_unmark(MemcheckShadow* shadow,
+                            const MallocDesc* desc,
+                            const AllocMap* map);
+
+// =============================================================================
+// Inlines
+// =============================================================================
+
+/* Gets the shadow state of a granule.
+ * Param:
+ *  shadow - Shadow map to look into.
+ *  addr - Any address inside the granule.
+ * Return:
+ *  One of the MSHADOW_XXX values.
+ */
+static inline int
+memcheck_shadow_state(const MemcheckShadow* shadow, target_ulong addr)
+{
+    const MemcheckShadowChunk* chunk =
+        shadow->chunks[(uint32_t)addr >> MSHADOW_CHUNK_BITS];
+    if (chunk == NULL) {
+        return MSHADOW_NONE;
+    }
+    return chunk->granules[(addr & MSHADOW_CHUNK_MASK) >> MSHADOW_GRANULE_BITS];
+}
+
+/* Gets the shadow state of a guest address range.
+ * Param:
+ *  shadow - Shadow map to look into.
+ *  addr - Starting address of the range.
+ *  size - Range size.
+ * Return:
+ *  MSHADOW_NONE if the range doesn't intersect with any allocated block,
+ *  MSHADOW_USER if the range is entirely contained in the user part of a
+ *  single allocated block, or MSHADOW_CHECK if the range must be checked
+ *  against the allocation descriptors map.
+ */
+static inline int
+memcheck_shadow_get(const MemcheckShadow* shadow,
+                    target_ulong addr,
+                    uint32_t size)
+{
+    const target_ulong last = addr + size - 1;
+    const int state = memcheck_shadow_state(shadow, addr);
+    target_ulong granule;
+
+    if (last < addr) {
+        // The range wraps around the address space.
+        return MSHADOW_CHECK;
+    }
+
+    /* Granules at the boundaries of a block are never MSHADOW_USER, so a run
+     * of MSHADOW_USER granules always belongs to the same block. */
+    for (granule = (addr >> MSHADOW_GRANULE_BITS) + 1;
+         granule <= (last >> MSHADOW_GRANULE_BITS); granule++) {
+        if (memcheck_shadow_state(shadow, granule << MSHADOW_GRANULE_BITS) !=
+            state) {
+            return MSHADOW_CHECK;
+        }
+    }
+    return state;
+}
+
+/* Checks if any of the pages spanned by a guest address range contains
+ * granules that need checking. An access to a page that doesn't contain such
+ * granules can't violate anything, so the page can stay cached in the TLB.
+ * Param:
+ *  shadow - Shadow map to look into.
+ *  addr - Starting address of the range.
+ *  size - Range size.
+ * Return:
+ *  Boolean: 1 if accesses to the pages must be validated, or 0 if they don't.
+ */
+static inline int
+memcheck_shadow_pages_checked(const MemcheckShadow* shadow,
+                              target_ulong addr,
+                              uint32_t size)
+{
+    const target_ulong last = (addr + size - 1) & TARGET_PAGE_MASK;
+    target_ulong page = addr & TARGET_PAGE_MASK;
+
+    for (;;) {
+        const MemcheckShadowChunk* chunk =
+            shadow->chunks[(uint32_t)page >> MSHADOW_CHUNK_BITS];
+        if (chunk != NULL &&
+            chunk->check_count[(page & MSHADOW_CHUNK_MASK) >> TARGET_PAGE_BITS]) {
+            return 1;
+        }
+        if (page == last) {
+            return 0;
+        }
+        page += TARGET_PAGE_SIZE;
+    }
+}
+
+#ifdef __cplusplus
+};  /* end of extern "C" */
+#endif
+
+#endif  // QEMU_MEMCHECK_MEMCHECK_SHADOW_H
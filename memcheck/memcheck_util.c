@@ -239,7 +239,7 @@ memcheck_get_address_info(target_ulong abs_pc,
         return 1;
     }
 
-    handle = elff_init(sym_path);
+    handle = elff_open_cached(sym_path);
     if (handle == NULL) {
         return -1;
     }
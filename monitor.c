@@ -37,6 +37,7 @@
 #include "readline.h"
 #include "console.h"
 #include "blockdev.h"
+#include "hw/goldfish_nand.h"
 #include "audio/audio.h"
 #include "disas.h"
 #include "balloon.h"
@@ -330,6 +331,33 @@ static void do_info_version(Monitor *mon)
     monitor_printf(mon, "%s\n", QEMU_VERSION QEMU_PKGVERSION);
 }
 
+static void do_info_block(Monitor *mon)
+{
+    QObject *data;
+
+    bdrv_info(mon, &data);
+    bdrv_info_print(mon, data);
+    qobject_decref(data);
+}
+
+static void do_info_blockstats(Monitor *mon)
+{
+    QObject *data;
+
+    bdrv_info_stats(mon, &data);
+    bdrv_stats_print(mon, data);
+    qobject_decref(data);
+}
+
+static void do_info_nandstats(Monitor *mon)
+{
+    QObject *data;
+
+    nand_dev_info_stats(mon, &data);
+    nand_dev_stats_print(mon, data);
+    qobject_decref(data);
+}
+
 static void do_info_name(Monitor *mon)
 {
     if (qemu_name)
@@ -1673,10 +1701,12 @@ static const mon_cmd_t info_cmds[] = {
       "", "show the network state" },
     { "chardev", "", qemu_chr_info,
       "", "show the character devices" },
-    { "block", "", bdrv_info,
+    { "block", "", do_info_block,
       "", "show the block devices" },
-    { "blockstats", "", bdrv_info_stats,
+    { "blockstats", "", do_info_blockstats,
       "", "show block device statistics" },
+    { "nandstats", "", do_info_nandstats,
+      "", "show NAND partition statistics" },
     { "registers", "", do_info_registers,
       "", "show the cpu registers" },
     { "cpus", "", do_info_cpus,
@@ -30,6 +30,7 @@
 #include <zlib.h>
 
 #include "tcpdump.h"
+#include "netstats.h"
 
 /* Needed early for HOST_BSD etc. */
 #include "config-host.h"
@@ -736,13 +737,23 @@ NetShaper  slirp_shaper_in;
 NetShaper  slirp_shaper_out;
 NetDelay   slirp_delay_in;
 
+/* the time at which a packet enters the shapers travels with it as the
+ * opaque pointer, so the final callbacks can report its queueing delay */
+#define  SLIRP_STAMP()  ((void*)(uintptr_t)qemu_get_clock_ms(rt_clock))
+
+static int
+slirp_stamp_delay( void*  opaque )
+{
+    return (int)((uintptr_t)qemu_get_clock_ms(rt_clock) - (uintptr_t)opaque);
+}
+
 static void
 slirp_delay_in_cb( void*   data,
                    size_t  size,
                    void*   opaque )
 {
+    netstats_delay( data, (int)size, NETSTATS_TX, slirp_stamp_delay(opaque) );
     slirp_input( (const uint8_t*)data, (int)size );
-    opaque = opaque;
 }
 
 static void
@@ -758,6 +769,7 @@ slirp_shaper_out_cb( void*   data,
                      size_t  size,
                      void*   opaque )
 {
+    netstats_delay( data, (int)size, NETSTATS_RX, slirp_stamp_delay(opaque) );
     qemu_send_packet( slirp_vc, (const uint8_t*)data, (int)size );
 }
 
@@ -799,8 +811,10 @@ void slirp_output(const uint8_t *pkt, int pkt_len)
     if (!slirp_vc)
         return;
 
+    netstats_packet(pkt, pkt_len, NETSTATS_RX);
+
 #ifdef CONFIG_ANDROID
-    netshaper_send(slirp_shaper_out, (void*)pkt, pkt_len);
+    netshaper_send_aux(slirp_shaper_out, (void*)pkt, pkt_len, SLIRP_STAMP());
 #else
     qemu_send_packet(slirp_vc, pkt, pkt_len);
 #endif
@@ -820,8 +834,10 @@ static ssize_t slirp_receive(VLANClientState *vc, const uint8_t *buf, size_t siz
     if (qemu_tcpdump_active)
         qemu_tcpdump_packet(buf, size);
 
+    netstats_packet(buf, size, NETSTATS_TX);
+
 #ifdef CONFIG_ANDROID
-    netshaper_send(slirp_shaper_in, (char*)buf, size);
+    netshaper_send_aux(slirp_shaper_in, (char*)buf, size, SLIRP_STAMP());
 #else
     slirp_input(buf, size);
 #endif
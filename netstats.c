@@ -0,0 +1,438 @@
+/* Copyright (C) 2012 The Android Open Source Project
+**
+** This software is licensed under the terms of the GNU General Public
+** License version 2, as published by the Free Software Foundation, and
+** may be copied, distributed, and modified under those terms.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+*/
+#include "netstats.h"
+#include "qemu-timer.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define  NETSTATS_CLOCK        rt_clock
+#define  NETSTATS_HASH_SIZE    256   /* must be a power of 2 */
+
+typedef struct NetFlowRec_   NetFlowRec, *NetFlow;
+
+struct NetFlowRec_ {
+    NetFlowStats  stats;
+    uint32_t      hash;
+    NetFlow       hash_next;
+    NetFlow       lru_prev;     /* most recently used first */
+    NetFlow       lru_next;
+    int           seq_valid[2];
+    uint32_t      seq_next[2];  /* next expected TCP sequence number */
+};
+
+static NetFlowRec      flow_table[NETSTATS_MAX_FLOWS];
+static NetFlow         flow_hash[NETSTATS_HASH_SIZE];
+static NetFlowRec      flow_lru[1];    /* sentinel of the LRU list */
+static NetFlow         flow_free;      /* linked through hash_next */
+static int             flow_count;
+static NetStatsTotals  flow_totals;
+static int             flow_init;
+
+/* decoded header fields of a packet */
+typedef struct {
+    int       proto;
+    uint32_t  guest_ip;
+    uint32_t  remote_ip;
+    int       guest_port;
+    int       remote_port;
+    int       has_seq;
+    uint32_t  seq;
+    uint32_t  seq_len;    /* payload length, plus one for SYN and FIN */
+} NetFlowKey;
+
+static void
+netstats_init( void )
+{
+    int  nn;
+
+    memset(flow_hash, 0, sizeof(flow_hash));
+    flow_lru->lru_prev = flow_lru->lru_next = flow_lru;
+    flow_free  = NULL;
+    flow_count = 0;
+    for (nn = NETSTATS_MAX_FLOWS-1; nn >= 0; nn--) {
+        flow_table[nn].hash_next = flow_free;
+        flow_free = &flow_table[nn];
+    }
+    flow_init = 1;
+}
+
+/* extract the flow key of an Ethernet frame, returns 0 if this is not
+ * an IPv4 packet */
+static int
+netstats_parse( const uint8_t*  p, int  len, int  dir, NetFlowKey*  key )
+{
+    int       hlen, total, frag;
+    uint32_t  src, dst;
+    int       sport = 0, dport = 0;
+
+    if (len < 14 + 20 || p[12] != 0x08 || p[13] != 0x00)
+        return 0;
+
+    p   += 14;
+    len -= 14;
+    hlen = (p[0] & 15) * 4;
+    if ((p[0] >> 4) != 4 || hlen < 20 || hlen > len)
+        return 0;
+
+    total = (p[2] << 8) | p[3];
+    if (total > len || total < hlen)
+        total = len;
+
+    frag = ((p[6] & 0x1f) << 8) | p[7];
+    src  = (p[12] << 24) | (p[13] << 16) | (p[14] << 8) | p[15];
+    dst  = (p[16] << 24) | (p[17] << 16) | (p[18] << 8) | p[19];
+
+    key->proto   = p[9];
+    key->has_seq = 0;
+
+    if (frag == 0 && (key->proto == 6 || key->proto == 17) && total >= hlen + 4) {
+        const uint8_t*  th = p + hlen;
+
+        sport = (th[0] << 8) | th[1];
+        dport = (th[2] << 8) | th[3];
+
+        if (key->proto == 6 && total >= hlen + 20) {
+            int  thlen = (th[12] >> 4) * 4;
+            int  flags = th[13];
+
+            if (thlen >= 20 && hlen + thlen <= total) {
+                key->has_seq = 1;
+                key->seq     = ((uint32_t)th[4] << 24) | (th[5] << 16) | (th[6] << 8) | th[7];
+                key->seq_len = total - hlen - thlen;
+                if (flags & 0x02)  /* SYN */
+                    key->seq_len += 1;
+                if (flags & 0x01)  /* FIN */
+                    key->seq_len += 1;
+            }
+        }
+    }
+
+    if (dir == NETSTATS_TX) {
+        key->guest_ip    = src;
+        key->guest_port  = sport;
+        key->remote_ip   = dst;
+        key->remote_port = dport;
+    } else {
+        key->guest_ip    = dst;
+        key->guest_port  = dport;
+        key->remote_ip   = src;
+        key->remote_port = sport;
+    }
+    return 1;
+}
+
+static uint32_t
+netstats_hash( const NetFlowKey*  key )
+{
+    uint32_t  h = key->guest_ip * 2654435761U;
+
+    h ^= key->remote_ip + 0x9e3779b9 + (h << 6) + (h >> 2);
+    h ^= ((uint32_t)key->guest_port << 16 | key->remote_port) + (h << 6) + (h >> 2);
+    h ^= key->proto;
+    return h;
+}
+
+static void
+netstats_lru_remove( NetFlow  flow )
+{
+    flow->lru_prev->lru_next = flow->lru_next;
+    flow->lru_next->lru_prev = flow->lru_prev;
+}
+
+static void
+netstats_lru_insert( NetFlow  flow )
+{
+    flow->lru_prev = flow_lru;
+    flow->lru_next = flow_lru->lru_next;
+    flow_lru->lru_next->lru_prev = flow;
+    flow_lru->lru_next = flow;
+}
+
+static void
+netstats_hash_remove( NetFlow  flow )
+{
+    NetFlow*  pnode = &flow_hash[flow->hash & (NETSTATS_HASH_SIZE-1)];
+
+    while (*pnode != flow)
+        pnode = &(*pnode)->hash_next;
+
+    *pnode = flow->hash_next;
+}
+
+/* find the flow of a given key, creating it if needed */
+static NetFlow
+netstats_lookup( const NetFlowKey*  key, int64_t  now )
+{
+    uint32_t  hash = netstats_hash(key);
+    NetFlow*  pnode = &flow_hash[hash & (NETSTATS_HASH_SIZE-1)];
+    NetFlow   flow;
+
+    for (flow = *pnode; flow != NULL; flow = flow->hash_next) {
+        if (flow->hash              == hash             &&
+            flow->stats.proto       == key->proto       &&
+            flow->stats.guest_ip    == key->guest_ip    &&
+            flow->stats.remote_ip   == key->remote_ip   &&
+            flow->stats.guest_port  == key->guest_port  &&
+            flow->stats.remote_port == key->remote_port)
+        {
+            if (flow_lru->lru_next != flow) {
+                netstats_lru_remove(flow);
+                netstats_lru_insert(flow);
+            }
+            return flow;
+        }
+    }
+
+    if (flow_free != NULL) {
+        flow      = flow_free;
+        flow_free = flow->hash_next;
+        flow_count++;
+    } else {
+        /* recycle the least recently used flow */
+        flow = flow_lru->lru_prev;
+        netstats_lru_remove(flow);
+        netstats_hash_remove(flow);
+        flow_totals.evicted_flows++;
+    }
+
+    memset(flow, 0, sizeof(*flow));
+    flow->hash              = hash;
+    flow->stats.proto       = key->proto;
+    flow->stats.guest_ip    = key->guest_ip;
+    flow->stats.remote_ip   = key->remote_ip;
+    flow->stats.guest_port  = key->guest_port;
+    flow->stats.remote_port = key->remote_port;
+    flow->stats.first_ms    = now;
+
+    flow->hash_next = *pnode;
+    *pnode          = flow;
+    netstats_lru_insert(flow);
+    return flow;
+}
+
+void
+netstats_packet( const void*  base, int  len, int  dir )
+{
+    NetFlowKey         key;
+    NetFlow            flow;
+    NetStatsCounters*  c;
+    int64_t            now;
+
+    if (!netstats_parse(base, len, dir, &key))
+        return;
+
+    if (!flow_init)
+        netstats_init();
+
+    now  = qemu_get_clock_ms(NETSTATS_CLOCK);
+    flow = netstats_lookup(&key, now);
+    flow->stats.last_ms = now;
+
+    c = &flow->stats.dir[dir];
+    c->packets += 1;
+    c->bytes   += len;
+    flow_totals.dir[dir].packets += 1;
+    flow_totals.dir[dir].bytes   += len;
+
+    /* a segment that carries nothing beyond what was already sent in
+     * this direction is a retransmission */
+    if (key.has_seq && key.seq_len > 0) {
+        uint32_t  end = key.seq + key.seq_len;
+
+        if (!flow->seq_valid[dir]) {
+            flow->seq_valid[dir] = 1;
+            flow->seq_next[dir]  = end;
+        } else if ((int32_t)(end - flow->seq_next[dir]) <= 0) {
+            c->retransmits += 1;
+            flow_totals.dir[dir].retransmits += 1;
+        } else {
+            flow->seq_next[dir] = end;
+        }
+    }
+}
+
+static int
+netstats_bucket( int  delay_ms )
+{
+    int  bucket = 0;
+
+    while (delay_ms > 0 && bucket < NETSTATS_DELAY_BUCKETS-1) {
+        delay_ms >>= 1;
+        bucket++;
+    }
+    return bucket;
+}
+
+int
+netstats_bucket_min_ms( int  bucket )
+{
+    return (bucket == 0) ? 0 : (1 << (bucket-1));
+}
+
+static void
+netstats_counters_delay( NetStatsCounters*  c, int  delay_ms )
+{
+    c->delay_count    += 1;
+    c->delay_total_ms += delay_ms;
+    if ((uint32_t)delay_ms > c->delay_max_ms)
+        c->delay_max_ms = delay_ms;
+    c->delay_hist[netstats_bucket(delay_ms)] += 1;
+}
+
+void
+netstats_delay( const void*  base, int  len, int  dir, int  delay_ms )
+{
+    NetFlowKey  key;
+
+    if (delay_ms < 0)
+        delay_ms = 0;
+
+    if (!netstats_parse(base, len, dir, &key))
+        return;
+
+    if (!flow_init)
+        netstats_init();
+
+    netstats_counters_delay(&netstats_lookup(&key, qemu_get_clock_ms(NETSTATS_CLOCK))->stats.dir[dir],
+                            delay_ms);
+    netstats_counters_delay(&flow_totals.dir[dir], delay_ms);
+}
+
+static int
+netstats_compare_bytes( const void*  a, const void*  b )
+{
+    const NetFlowStats*  fa = a;
+    const NetFlowStats*  fb = b;
+    uint64_t  ba = fa->dir[0].bytes + fa->dir[1].bytes;
+    uint64_t  bb = fb->dir[0].bytes + fb->dir[1].bytes;
+
+    return (ba > bb) ? -1 : (ba < bb) ? 1 : 0;
+}
+
+int
+netstats_get_flows( NetFlowStats*  flows, int  max_flows )
+{
+    NetFlowStats*  all;
+    NetFlow        flow;
+    int            count = 0;
+
+    if (!flow_init || flow_count == 0 || max_flows <= 0)
+        return 0;
+
+    all = malloc(flow_count * sizeof(NetFlowStats));
+    if (all == NULL)
+        return 0;
+
+    for (flow = flow_lru->lru_next; flow != flow_lru; flow = flow->lru_next)
+        all[count++] = flow->stats;
+
+    qsort(all, count, sizeof(NetFlowStats), netstats_compare_bytes);
+
+    if (count > max_flows)
+        count = max_flows;
+    memcpy(flows, all, count * sizeof(NetFlowStats));
+    free(all);
+    return count;
+}
+
+void
+netstats_get_totals( NetStatsTotals*  totals )
+{
+    *totals = flow_totals;
+    totals->active_flows = flow_count;
+}
+
+void
+netstats_reset( void )
+{
+    memset(&flow_totals, 0, sizeof(flow_totals));
+    netstats_init();
+}
+
+/***********************************************************************/
+/***********************************************************************/
+/*****                                                             *****/
+/*****          J S O N   O U T P U T                              *****/
+/*****                                                             *****/
+/***********************************************************************/
+/***********************************************************************/
+
+static void
+netstats_json_counters( stralloc_t*  out, const NetStatsCounters*  c )
+{
+    int  nn;
+
+    stralloc_add_format(out, "{\"packets\":%llu,\"bytes\":%llu,\"retransmits\":%u,",
+                        (unsigned long long)c->packets,
+                        (unsigned long long)c->bytes,
+                        c->retransmits);
+    stralloc_add_format(out, "\"delay\":{\"count\":%u,\"total_ms\":%llu,\"max_ms\":%u,\"histogram\":[",
+                        c->delay_count,
+                        (unsigned long long)c->delay_total_ms,
+                        c->delay_max_ms);
+    for (nn = 0; nn < NETSTATS_DELAY_BUCKETS; nn++)
+        stralloc_add_format(out, "%s%u", nn ? "," : "", c->delay_hist[nn]);
+    stralloc_add_str(out, "]}}");
+}
+
+static void
+netstats_json_addr( stralloc_t*  out, const char*  name, uint32_t  ip, int  port )
+{
+    stralloc_add_format(out, "\"%s\":\"%u.%u.%u.%u:%d\"", name,
+                        (ip >> 24) & 255, (ip >> 16) & 255, (ip >> 8) & 255, ip & 255,
+                        port);
+}
+
+void
+netstats_dump_json( stralloc_t*  out )
+{
+    NetFlowStats*   flows = malloc(NETSTATS_MAX_FLOWS * sizeof(NetFlowStats));
+    NetStatsTotals  totals;
+    int64_t         now   = qemu_get_clock_ms(NETSTATS_CLOCK);
+    int             count = 0, nn;
+
+    if (flows != NULL)
+        count = netstats_get_flows(flows, NETSTATS_MAX_FLOWS);
+
+    netstats_get_totals(&totals);
+
+    stralloc_add_str(out, "{\"delay_buckets_ms\":[");
+    for (nn = 0; nn < NETSTATS_DELAY_BUCKETS; nn++)
+        stralloc_add_format(out, "%s%d", nn ? "," : "", netstats_bucket_min_ms(nn));
+    stralloc_add_str(out, "],");
+
+    stralloc_add_format(out, "\"active_flows\":%u,\"evicted_flows\":%u,",
+                        totals.active_flows, totals.evicted_flows);
+    stralloc_add_str(out, "\"totals\":{\"tx\":");
+    netstats_json_counters(out, &totals.dir[NETSTATS_TX]);
+    stralloc_add_str(out, ",\"rx\":");
+    netstats_json_counters(out, &totals.dir[NETSTATS_RX]);
+    stralloc_add_str(out, "},\"flows\":[");
+
+    for (nn = 0; nn < count; nn++) {
+        const NetFlowStats*  f = &flows[nn];
+
+        stralloc_add_format(out, "%s{\"proto\":%d,", nn ? "," : "", f->proto);
+        netstats_json_addr(out, "guest", f->guest_ip, f->guest_port);
+        stralloc_add_c(out, ',');
+        netstats_json_addr(out, "remote", f->remote_ip, f->remote_port);
+        stralloc_add_format(out, ",\"age_ms\":%lld,\"idle_ms\":%lld,\"tx\":",
+                            (long long)(now - f->first_ms),
+                            (long long)(now - f->last_ms));
+        netstats_json_counters(out, &f->dir[NETSTATS_TX]);
+        stralloc_add_str(out, ",\"rx\":");
+        netstats_json_counters(out, &f->dir[NETSTATS_RX]);
+        stralloc_add_c(out, '}');
+    }
+    stralloc_add_str(out, "]}\n");
+    free(flows);
+}
@@ -0,0 +1,84 @@
+/* Copyright (C) 2012 The Android Open Source Project
+**
+** This software is licensed under the terms of the GNU General Public
+** License version 2, as published by the Free Software Foundation, and
+** may be copied, distributed, and modified under those terms.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+*/
+#ifndef _QEMU_NETSTATS_H
+#define _QEMU_NETSTATS_H
+
+#include <stdint.h>
+#include "android/utils/stralloc.h"
+
+/* Per-flow network statistics. Every Ethernet frame exchanged between
+ * the emulated device and the user-mode network stack is accounted to
+ * its (protocol, guest address/port, remote address/port) flow, kept
+ * in a fixed-size table where the least recently used flow is evicted
+ * when a new one appears.
+ */
+
+/* direction of a packet, relative to the emulated device */
+#define  NETSTATS_TX   0   /* sent by the guest */
+#define  NETSTATS_RX   1   /* received by the guest */
+
+#define  NETSTATS_MAX_FLOWS      256
+
+/* queueing delays are recorded in a log2 histogram of milliseconds:
+ * bucket 0 is < 1ms, bucket n is [2^(n-1) .. 2^n - 1] ms, and the last
+ * bucket is everything above. */
+#define  NETSTATS_DELAY_BUCKETS  12
+
+typedef struct {
+    uint64_t  packets;
+    uint64_t  bytes;
+    uint32_t  retransmits;     /* TCP segments whose data was already seen */
+    uint32_t  delay_count;     /* packets which went through the shapers */
+    uint64_t  delay_total_ms;
+    uint32_t  delay_max_ms;
+    uint32_t  delay_hist[NETSTATS_DELAY_BUCKETS];
+} NetStatsCounters;
+
+typedef struct {
+    int               proto;        /* IP protocol number */
+    uint32_t          guest_ip;     /* host byte order */
+    uint32_t          remote_ip;
+    int               guest_port;   /* 0 for protocols without ports */
+    int               remote_port;
+    int64_t           first_ms;
+    int64_t           last_ms;
+    NetStatsCounters  dir[2];       /* indexed by NETSTATS_TX/RX */
+} NetFlowStats;
+
+typedef struct {
+    uint32_t          active_flows;
+    uint32_t          evicted_flows;
+    NetStatsCounters  dir[2];       /* all IPv4 traffic, including evicted flows */
+} NetStatsTotals;
+
+/* account an Ethernet frame to its flow */
+extern void  netstats_packet( const void*  base, int  len, int  dir );
+
+/* record the time spent by an Ethernet frame in the network shapers */
+extern void  netstats_delay( const void*  base, int  len, int  dir, int  delay_ms );
+
+/* copy up to 'max_flows' flows into 'flows', busiest first.
+ * returns the number of flows copied */
+extern int   netstats_get_flows( NetFlowStats*  flows, int  max_flows );
+
+extern void  netstats_get_totals( NetStatsTotals*  totals );
+
+/* return the lower bound, in ms, of a given delay histogram bucket */
+extern int   netstats_bucket_min_ms( int  bucket );
+
+/* append a JSON description of all flows and totals to 'out' */
+extern void  netstats_dump_json( stralloc_t*  out );
+
+/* forget all flows and clear the totals */
+extern void  netstats_reset( void );
+
+#endif /* _QEMU_NETSTATS_H */
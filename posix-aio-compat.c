@@ -37,7 +37,9 @@ struct qemu_paiocb {
     union {
         struct iovec *aio_iov;
         void *aio_ioctl_buf;
+        void *aio_call_arg;
     };
+    int (*aio_call_func)(void *arg);
     int aio_niov;
     size_t aio_nbytes;
 #define aio_ioctl_cmd   aio_nbytes /* for QEMU_AIO_IOCTL */
@@ -147,6 +149,12 @@ static ssize_t handle_aiocb_flush(struct qemu_paiocb *aiocb)
     return 0;
 }
 
+static ssize_t handle_aiocb_call(struct qemu_paiocb *aiocb)
+{
+    /* aio_nbytes is 0, so a return value of 0 means success */
+    return aiocb->aio_call_func(aiocb->aio_call_arg);
+}
+
 #ifdef CONFIG_PREADV
 
 static ssize_t
@@ -344,6 +352,9 @@ static void *aio_thread(void *unused)
         case QEMU_AIO_IOCTL:
             ret = handle_aiocb_ioctl(aiocb);
             break;
+        case QEMU_AIO_CALL:
+            ret = handle_aiocb_call(aiocb);
+            break;
         default:
             fprintf(stderr, "invalid aio request (0x%x)\n", aiocb->aio_type);
             ret = -EINVAL;
@@ -618,6 +629,36 @@ BlockDriverAIOCB *paio_ioctl(BlockDriverState *bs, int fd,
     return &acb->common;
 }
 
+/*
+ * Runs func(arg) on one of the worker threads, and calls cb with its return
+ * value (0 or -errno) once it has returned. func must not touch any state
+ * that the I/O thread may use concurrently.
+ */
+BlockDriverAIOCB *paio_call(BlockDriverState *bs,
+        int (*func)(void *arg), void *arg,
+        BlockDriverCompletionFunc *cb, void *opaque)
+{
+    struct qemu_paiocb *acb;
+
+    acb = qemu_aio_get(&raw_aio_pool, bs, cb, opaque);
+    if (!acb)
+        return NULL;
+    acb->aio_type = QEMU_AIO_CALL;
+    acb->aio_fildes = -1;
+    acb->ev_signo = SIGUSR2;
+    acb->async_context_id = get_async_context_id();
+    acb->aio_offset = 0;
+    acb->aio_nbytes = 0;
+    acb->aio_call_func = func;
+    acb->aio_call_arg = arg;
+
+    acb->next = posix_aio_state->first_aio;
+    posix_aio_state->first_aio = acb;
+
+    qemu_paio_submit(acb);
+    return &acb->common;
+}
+
 int paio_init(void)
 {
     struct sigaction act;
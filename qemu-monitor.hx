@@ -37,8 +37,12 @@ show the various VLANs and the associated devices
 show the character devices
 @item info block
 show the block devices
-@item info block
-show block device statistics
+@item info blockstats
+show block device statistics, including the latency histograms of the
+read, write and flush requests
+@item info nandstats
+show the read, write and erase statistics and latency histograms of the
+NAND partitions
 @item info registers
 show the cpu registers
 @item info cpus
@@ -92,6 +92,7 @@ DEF("drive", HAS_ARG, QEMU_OPTION_drive,
     "-drive [file=file][,if=type][,bus=n][,unit=m][,media=d][,index=i]\n"
     "       [,cyls=c,heads=h,secs=s[,trans=t]][,snapshot=on|off]\n"
     "       [,cache=writethrough|writeback|none][,format=f][,serial=s]\n"
+    "       [,aio=threads|native]\n"
     "                use 'file' as a drive image\n")
 STEXI
 @item -drive @var{option}[,@var{option}[,@var{option}[,...]]]
@@ -126,6 +127,10 @@ the format.  Can be used to specifiy format=raw to avoid interpreting
 an untrusted format header.
 @item serial=@var{serial}
 This option specifies the serial number to assign to the device.
+@item aio=@var{aio}
+@var{aio} is "threads", or "native" and selects between pthread based disk I/O
+and native Linux AIO. Native AIO is only used together with
+@option{cache=none}, and falls back to threads if the host doesn't support it.
 @end table
 
 By default, writethrough caching is used for all block device.  This means that
@@ -234,6 +239,18 @@ the raw disk image you use is not written back. You can however force
 the write back by pressing @key{C-a s} (@pxref{disk_images}).
 ETEXI
 
+DEF("qcow2-cache", HAS_ARG, QEMU_OPTION_qcow2_cache,
+    "-qcow2-cache [l2=n][,refcount=n][,writethrough=on|off]\n"
+    "                set the number of cached qcow2 L2 tables and refcount\n"
+    "                blocks, and write refcount updates through to the disk\n")
+STEXI
+@item -qcow2-cache [l2=@var{n}][,refcount=@var{n}][,writethrough=on|off]
+Set the number of L2 tables (default 64) and refcount blocks (default 16)
+cached for each qcow2 image. Refcount updates are written back when a
+block is evicted or before metadata that depends on them is written,
+unless @option{writethrough=on} is given.
+ETEXI
+
 DEF("m", HAS_ARG, QEMU_OPTION_m,
     "-m megs         set virtual RAM size to megs MB [default=%d]\n")
 STEXI
@@ -1695,6 +1712,10 @@ DEF("trace", HAS_ARG, QEMU_OPTION_trace, \
     "-trace name\n" \
     "                set trace directory\n")
 
+DEF("trace-compress", HAS_ARG, QEMU_OPTION_trace_compress, \
+    "-trace-compress none|zlib\n" \
+    "                compress the trace files (default: none)\n")
+
 DEF("nand", HAS_ARG, QEMU_OPTION_nand, \
     "-nand <params>  enable NAND Flash partition\n")
 
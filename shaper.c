@@ -50,6 +50,11 @@ _packet_is_internal( const uint8_t*  data, size_t  size )
  *
  * there are different (queue/timer/rate) values for the input and output
  * direction of the user vlan.
+ *
+ * since each queued packet expires exactly when the previous one has been
+ * fully "sent", expiration dates only grow and the queue is a simple FIFO.
+ * the timer is only reprogrammed when the head of the queue changes, and
+ * all packets due at a given time are released in a single timer callback.
  */
 typedef struct QueuedPacketRec_ {
     int64_t                    expiration;
@@ -97,6 +102,7 @@ queued_packet_free( QueuedPacket  packet )
 
 typedef struct NetShaperRec_ {
     QueuedPacket   packets;   /* list of queued packets, ordered by expiration date */
+    QueuedPacket   last;      /* tail of 'packets', valid if 'packets' is not NULL */
     int            num_packets;
     int            active;    /* is this shaper active ? */
     int64_t        block_until;
@@ -135,10 +141,9 @@ static void
 netshaper_expires( NetShaper  shaper )
 {
     QueuedPacket  packet;
+    int64_t       now = qemu_get_clock_ms( SHAPER_CLOCK );
 
     while ((packet = shaper->packets) != NULL) {
-        int64_t   now = qemu_get_clock_ms( SHAPER_CLOCK );
-
        if (packet->expiration > now)
            break;
 
@@ -148,10 +153,10 @@ netshaper_expires( NetShaper  shaper )
        shaper->num_packets--;
    }
 
-   /* reprogram timer if needed */
+   /* reprogram timer if needed. block_until is left alone while packets
+    * are queued: it already accounts for all of them. */
    if (shaper->packets) {
-       shaper->block_until = shaper->packets->expiration;
-       qemu_mod_timer( shaper->timer, shaper->block_until );
+       qemu_mod_timer( shaper->timer, shaper->packets->expiration );
    } else {
        shaper->block_until = -1;
    }
@@ -166,10 +171,12 @@ netshaper_create( int                do_copy,
 
     shaper->active = 0;
     shaper->packets = NULL;
+    shaper->last    = NULL;
     shaper->num_packets = 0;
     shaper->timer   = qemu_new_timer_ms( SHAPER_CLOCK,
                                          (QEMUTimerCB*) netshaper_expires,
                                          shaper );
+    shaper->do_copy   = do_copy;
     shaper->send_func = send_func;
     shaper->max_rate  = 1e6;
     shaper->inv_rate  = 0.;
@@ -189,8 +196,8 @@ netshaper_set_rate( NetShaper  shaper,
         shaper->packets = packet->next;
         shaper->send_func(packet->data, packet->size, packet->opaque);
         qemu_free(packet);
-        shaper->num_packets = 0;
     }
+    shaper->num_packets = 0;
 
     shaper->max_rate = rate;
     if (rate > 1.) {
@@ -216,8 +223,9 @@ netshaper_send_aux( NetShaper  shaper,
         return;
     }
 
+    /* never overtake queued packets, even if the timer is late */
     now = qemu_get_clock_ms( SHAPER_CLOCK );
-    if (now >= shaper->block_until) {
+    if (shaper->packets == NULL && now >= shaper->block_until) {
         shaper->send_func( data, size, opaque );
         shaper->block_until = now + size*shaper->inv_rate;
         //fprintf(stderr, "NETSHAPER: block for %.2fms\n", (shaper->block_until - now)*1.0 );
@@ -232,22 +240,13 @@ netshaper_send_aux( NetShaper  shaper,
 
         packet->expiration = shaper->block_until;
 
-        {
-            QueuedPacket  *pnode, node;
-
-            pnode = &shaper->packets;
-            for (;;) {
-                node = *pnode;
-                if (node == NULL || node->expiration > packet->expiration )
-                    break;
-                pnode = &node->next;
-            }
-            packet->next = *pnode;
-            *pnode       = packet;
-
-            if (packet == shaper->packets)
-                qemu_mod_timer( shaper->timer, packet->expiration );
+        if (shaper->packets == NULL) {
+            shaper->packets = packet;
+            qemu_mod_timer( shaper->timer, packet->expiration );
+        } else {
+            shaper->last->next = packet;
         }
+        shaper->last = packet;
         shaper->num_packets += 1;
     }
     shaper->block_until += size*shaper->inv_rate;
@@ -288,7 +287,9 @@ netshaper_can_send( NetShaper  shaper )
  */
 typedef struct SessionRec_ {
     int64_t               expiration;
-    struct SessionRec_*   next;
+    struct SessionRec_*   next;         /* next in hash bucket */
+    struct SessionRec_*   wheel_next;   /* next in timer wheel slot */
+    struct SessionRec_**  wheel_pprev;  /* NULL if not in the wheel */
     unsigned              src_ip;
     unsigned              dst_ip;
     unsigned short        src_port;
@@ -380,24 +381,64 @@ _packet_SYN_flags( const void*  _data, size_t   size, Session  info )
 }
 
 
+/* sessions are kept in a small hash table, keyed by their addresses and
+ * ports. sessions whose SYN packet is being delayed are also placed in a
+ * two-level timer wheel, indexed by expiration time in milliseconds:
+ *
+ *   - level 0 has one slot per millisecond for the next 256 ms.
+ *   - level 1 has one slot per 256 ms block, for the next 64 blocks.
+ *     a level 1 slot is moved down to level 0 ("cascaded") when the
+ *     wheel enters the corresponding block. sessions further away than
+ *     that are parked in the farthest slot and re-inserted on cascade.
+ *
+ * insertion and removal are O(1), and a single timer callback releases
+ * all packets that are due, whatever their number.
+ */
+#define  NETDELAY_HASH_SIZE    256
+
+#define  WHEEL_BITS0   8
+#define  WHEEL_SIZE0   (1 << WHEEL_BITS0)
+#define  WHEEL_MASK0   (WHEEL_SIZE0-1)
+#define  WHEEL_BITS1   6
+#define  WHEEL_SIZE1   (1 << WHEEL_BITS1)
+#define  WHEEL_MASK1   (WHEEL_SIZE1-1)
+
 typedef struct NetDelayRec_
 {
-    Session     sessions;
+    Session     sessions[NETDELAY_HASH_SIZE];
     int         num_sessions;
     QEMUTimer*  timer;
+    int64_t     timer_expires;  /* -1 if the timer is not armed */
     int         active;
     int         min_ms;
     int         max_ms;
 
+    int64_t     wheel_now;      /* next tick to be processed */
+    int         wheel_count;    /* number of sessions in the wheel */
+    Session     wheel0[WHEEL_SIZE0];
+    Session     wheel1[WHEEL_SIZE1];
+
     NetShaperSendFunc  send_func;
 
 } NetDelayRec;
 
 
+static unsigned
+netdelay_hash( Session  info )
+{
+    unsigned  h = info->src_ip * 31 + info->dst_ip;
+
+    h = h * 31 + (((unsigned)info->src_port << 16) | info->dst_port);
+    h = h * 31 + info->protocol;
+    h ^= h >> 16;
+    h ^= h >> 8;
+    return h & (NETDELAY_HASH_SIZE-1);
+}
+
 static Session*
 netdelay_lookup_session( NetDelay  delay, Session  info )
 {
-    Session*  pnode = &delay->sessions;
+    Session*  pnode = &delay->sessions[netdelay_hash(info)];
     Session   node;
 
     for (;;) {
@@ -418,41 +459,121 @@ netdelay_lookup_session( NetDelay  delay, Session  info )
 }
 
 
+static void
+netdelay_wheel_add( NetDelay  delay, Session  session )
+{
+    int64_t   expiration = session->expiration;
+    int64_t   blocks;
+    Session*  slot;
+
+    if (expiration < delay->wheel_now)
+        expiration = delay->wheel_now;
+
+    blocks = (expiration >> WHEEL_BITS0) - (delay->wheel_now >> WHEEL_BITS0);
+
+    if (expiration - delay->wheel_now < WHEEL_SIZE0)
+        slot = &delay->wheel0[expiration & WHEEL_MASK0];
+    else if (blocks <= WHEEL_SIZE1)
+        slot = &delay->wheel1[(expiration >> WHEEL_BITS0) & WHEEL_MASK1];
+    else  /* too far away, park it and re-insert on cascade */
+        slot = &delay->wheel1[(delay->wheel_now >> WHEEL_BITS0) & WHEEL_MASK1];
+
+    session->wheel_next  = *slot;
+    session->wheel_pprev = slot;
+    if (*slot)
+        (*slot)->wheel_pprev = &session->wheel_next;
+    *slot = session;
+    delay->wheel_count += 1;
+}
+
+static void
+netdelay_wheel_remove( NetDelay  delay, Session  session )
+{
+    if (session->wheel_pprev == NULL)
+        return;
+
+    *session->wheel_pprev = session->wheel_next;
+    if (session->wheel_next)
+        session->wheel_next->wheel_pprev = session->wheel_pprev;
+
+    session->wheel_next  = NULL;
+    session->wheel_pprev = NULL;
+    delay->wheel_count  -= 1;
+}
+
+/* return the time at which the timer should fire next, or -1 */
+static int64_t
+netdelay_wheel_next( NetDelay  delay )
+{
+    int64_t  tick = delay->wheel_now;
+    int64_t  block_end;
+
+    if (delay->wheel_count == 0)
+        return -1;
+
+    /* earliest level 0 slot within the current block, otherwise wake up
+     * at the start of the next block to cascade it */
+    block_end = (tick | WHEEL_MASK0) + 1;
+    for ( ; tick < block_end; tick++ ) {
+        if (delay->wheel0[tick & WHEEL_MASK0] != NULL)
+            return tick;
+    }
+    return block_end;
+}
+
+static void
+netdelay_rearm( NetDelay  delay )
+{
+    int64_t  expires = netdelay_wheel_next(delay);
+
+    if (expires < 0) {
+        if (delay->timer_expires >= 0)
+            qemu_del_timer( delay->timer );
+    } else if (expires != delay->timer_expires) {
+        qemu_mod_timer( delay->timer, expires );
+    }
+    delay->timer_expires = expires;
+}
+
 
 /* called by the delay's timer on expiration */
 static void
 netdelay_expires( NetDelay  delay )
 {
-    Session  session;
     int64_t  now = qemu_get_clock_ms( SHAPER_CLOCK );
-    int      rearm = 0;
-    int64_t  rearm_time = 0;
 
-    for (session = delay->sessions; session != NULL; session = session->next)
+    delay->timer_expires = -1;
+
+    while (delay->wheel_count > 0 && delay->wheel_now <= now)
     {
-        QueuedPacket  packet = session->packet;
+        int64_t  tick = delay->wheel_now;
+        Session  session;
 
-        if (packet == NULL)
-            continue;
+        if ((tick & WHEEL_MASK0) == 0) {
+            /* entering a new block, move its sessions down to level 0 */
+            Session*  slot = &delay->wheel1[(tick >> WHEEL_BITS0) & WHEEL_MASK1];
+
+            while ((session = *slot) != NULL) {
+                netdelay_wheel_remove(delay, session);
+                netdelay_wheel_add(delay, session);
+            }
+        }
+
+        while ((session = delay->wheel0[tick & WHEEL_MASK0]) != NULL) {
+            QueuedPacket  packet = session->packet;
+
+            netdelay_wheel_remove(delay, session);
+            session->packet = NULL;
 
-        if (session->expiration <= now) {
             /* send the SYN packet now */
-                    //fprintf(stderr, "NetDelay:RST: sending creation for %s\n", session_to_string(session) );
+            //fprintf(stderr, "NetDelay:RST: sending creation for %s\n", session_to_string(session) );
             delay->send_func( packet->data, packet->size, packet->opaque );
-            session->packet = NULL;
             queued_packet_free( packet );
-        } else {
-            if (!rearm) {
-                rearm      = 1;
-                rearm_time = session->expiration;
-            }
-            else if ( session->expiration < rearm_time )
-                rearm_time = session->expiration;
         }
+        delay->wheel_now = tick + 1;
     }
 
-    if (rearm)
-        qemu_mod_timer( delay->timer, rearm_time );
+    netdelay_rearm(delay);
 }
 
 
@@ -461,11 +582,18 @@ netdelay_create( NetShaperSendFunc  send_func )
 {
     NetDelay  delay = qemu_malloc(sizeof(*delay));
 
-    delay->sessions     = NULL;
+    memset(delay->sessions, 0, sizeof(delay->sessions));
     delay->num_sessions = 0;
     delay->timer        = qemu_new_timer_ms( SHAPER_CLOCK,
                                              (QEMUTimerCB*) netdelay_expires,
                                              delay );
+    delay->timer_expires = -1;
+
+    delay->wheel_now   = 0;
+    delay->wheel_count = 0;
+    memset(delay->wheel0, 0, sizeof(delay->wheel0));
+    memset(delay->wheel1, 0, sizeof(delay->wheel1));
+
     delay->active = 0;
     delay->min_ms = 0;
     delay->max_ms = 0;
@@ -479,18 +607,24 @@ netdelay_create( NetShaperSendFunc  send_func )
 void
 netdelay_set_latency( NetDelay  delay, int  min_ms, int  max_ms )
 {
+    int  nn;
+
     /* when changing the latency, accept all sessions */
-    while (delay->sessions) {
-        Session  session = delay->sessions;
-        delay->sessions = session->next;
-        session->next = NULL;
-        if (session->packet) {
-            QueuedPacket  packet = session->packet;
-            delay->send_func( packet->data, packet->size, packet->opaque );
+    for (nn = 0; nn < NETDELAY_HASH_SIZE; nn++) {
+        while (delay->sessions[nn]) {
+            Session  session = delay->sessions[nn];
+            delay->sessions[nn] = session->next;
+            session->next = NULL;
+            netdelay_wheel_remove(delay, session);
+            if (session->packet) {
+                QueuedPacket  packet = session->packet;
+                delay->send_func( packet->data, packet->size, packet->opaque );
+            }
+            session_free(session);
+            delay->num_sessions--;
         }
-        session_free(session);
-        delay->num_sessions--;
     }
+    netdelay_rearm(delay);
 
     delay->min_ms = min_ms;
     delay->max_ms = max_ms;
@@ -510,6 +644,7 @@ netdelay_send_aux( NetDelay  delay, const void*  data, size_t  size, void* opaqu
     if (delay->active && !_packet_is_internal(data, size)) {
         SessionRec  info[1];
         int         flags;
+        int64_t     now;
 
         flags = _packet_SYN_flags( data, size, info );
         if ((flags & 0x05) != 0)
@@ -520,6 +655,7 @@ netdelay_send_aux( NetDelay  delay, const void*  data, size_t  size, void* opaqu
                 //fprintf(stderr, "NetDelay:RST: dropping %s\n", session_to_string(info) );
 
                 *lookup = session->next;
+                netdelay_wheel_remove( delay, session );
                 session_free( session );
                 delay->num_sessions -= 1;
             }
@@ -549,11 +685,12 @@ netdelay_send_aux( NetDelay  delay, const void*  data, size_t  size, void* opaqu
                     //fprintf(stderr, "NetDelay:RST: delay creation for %s\n", session_to_string(info) );
                 session = qemu_malloc( sizeof(*session) );
 
-                session->next        = delay->sessions;
-                delay->sessions      = session;
+                session->next        = NULL;
+                *lookup              = session;
                 delay->num_sessions += 1;
 
-                session->expiration = qemu_get_clock_ms( SHAPER_CLOCK ) + latency;
+                now = qemu_get_clock_ms( SHAPER_CLOCK );
+                session->expiration = now + latency;
 
                 session->src_ip   = info->src_ip;
                 session->dst_ip   = info->dst_ip;
@@ -563,7 +700,12 @@ netdelay_send_aux( NetDelay  delay, const void*  data, size_t  size, void* opaqu
 
                 session->packet = queued_packet_create( data, size, opaque, 1 );
 
-                netdelay_expires(delay);
+                if (delay->wheel_count == 0) {
+                    /* don't replay the ticks that went by while idle */
+                    delay->wheel_now = now;
+                }
+                netdelay_wheel_add(delay, session);
+                netdelay_rearm(delay);
                 return;
             }
         }
@@ -577,13 +719,20 @@ void
 netdelay_destroy( NetDelay  delay )
 {
     if (delay) {
-        while (delay->sessions) {
-            Session  session = delay->sessions;
-            delay->sessions = session->next;
-            session_free(session);
-            delay->num_sessions -= 1;
+        int  nn;
+
+        for (nn = 0; nn < NETDELAY_HASH_SIZE; nn++) {
+            while (delay->sessions[nn]) {
+                Session  session = delay->sessions[nn];
+                delay->sessions[nn] = session->next;
+                session_free(session);
+                delay->num_sessions -= 1;
+            }
         }
         delay->active = 0;
+        qemu_del_timer(delay->timer);
+        qemu_free_timer(delay->timer);
+        delay->timer = NULL;
         qemu_free( delay );
     }
 }
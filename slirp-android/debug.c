@@ -230,6 +230,8 @@ tcpstats(void)
 	lprint("  %6d correct ACK header predictions\r\n", tcpstat.tcps_predack);
 	lprint("  %6d correct data packet header predictions\n", tcpstat.tcps_preddat);
 	lprint("  %6d TCP cache misses\r\n", tcpstat.tcps_socachemiss);
+	lprint("  %6d segments queued for large receive (%d merged)\r\n",
+			tcpstat.tcps_lroqueued, tcpstat.tcps_lromerged);
 
 
 /*	lprint("    Packets received too short:		%d\r\n", tcpstat.tcps_rcvshort); */
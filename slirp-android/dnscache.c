@@ -0,0 +1,563 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* This file implements a small caching DNS forwarder for the guest.
+ *
+ * Every guest query sent to one of the virtual DNS addresses (10.0.2.3
+ * and up) goes through dns_cache_input() before being forwarded to the
+ * corresponding host resolver. Queries are keyed by the virtual server
+ * address, their RD and CD flags and their (lowercased) question, and:
+ *
+ *  - if a fresh answer is cached, a copy of it is sent back right away,
+ *    with the transaction ID of the new query and every record TTL
+ *    reduced by the time spent in the cache.
+ *
+ *  - if an identical query was already forwarded and is still waiting
+ *    for its answer, the new one is queued on it instead of hitting the
+ *    host resolver again. All waiters get a copy of the answer when it
+ *    arrives in dns_cache_response().
+ *
+ *  - otherwise the query is forwarded as usual.
+ *
+ * Positive answers are cached for the smallest TTL of their answer
+ * section. NXDOMAIN and NODATA answers are cached as described by
+ * RFC 2308, i.e. for the TTL of the SOA record in the authority
+ * section, bounded by its MINIMUM field. Truncated answers, server
+ * failures and zero TTLs are never cached.
+ *
+ * Only plain queries are handled: queries carrying an EDNS OPT record
+ * (or any other extra record) are always forwarded, and answers that
+ * carry one, or that don't fit in a plain 512-byte UDP message, are
+ * neither cached nor handed to coalesced queries.
+ */
+#include <slirp.h>
+
+#define DNS_HEADER_SIZE     12
+#define DNS_MAX_UDP_SIZE    512
+#define DNS_KEY_PREFIX      6               /* server address + flags */
+#define DNS_KEY_MAX         (DNS_KEY_PREFIX + 255 + 1 + 4)  /* + qname + qtype + qclass */
+
+#define DNS_FLAG_QR         0x8000
+#define DNS_FLAG_TC         0x0200
+#define DNS_FLAG_RD         0x0100
+#define DNS_FLAG_CD         0x0010
+#define DNS_OPCODE_MASK     0x7800
+#define DNS_RCODE_MASK      0x000f
+
+#define DNS_RCODE_NOERROR   0
+#define DNS_RCODE_NXDOMAIN  3
+
+#define DNS_TYPE_SOA        6
+#define DNS_TYPE_OPT        41
+
+#define DNS_CACHE_BUCKETS   256
+
+typedef struct {
+    uint32_t  client_ip;
+    uint16_t  client_port;
+    uint16_t  id;           /* network order, as sent by the guest */
+    uint32_t  server_ip;    /* virtual DNS address that was queried */
+} DnsWaiter;
+
+typedef struct DnsEntry {
+    struct DnsEntry*  hnext;        /* hash bucket chain */
+    struct DnsEntry*  lru_prev;
+    struct DnsEntry*  lru_next;
+    unsigned          hash;
+    int               pending;      /* query forwarded, no answer yet */
+    int               negative;     /* cached answer is NXDOMAIN/NODATA */
+    u_int             stamp;        /* when forwarded, or answered */
+    u_int             expires;      /* when the cached answer goes stale */
+    uint8_t*          answer;
+    int               answer_len;
+    int               num_waiters;
+    DnsWaiter         waiters[DNS_CACHE_MAX_WAITERS];
+    int               key_len;
+    uint8_t           key[DNS_KEY_MAX];
+} DnsEntry;
+
+static DnsEntry*           dns_buckets[DNS_CACHE_BUCKETS];
+static DnsEntry            dns_lru = { .lru_prev = &dns_lru, .lru_next = &dns_lru };
+static SlirpDnsCacheStats  dns_stats;
+
+static unsigned
+dns_get16( const uint8_t*  p )
+{
+    return (p[0] << 8) | p[1];
+}
+
+static uint32_t
+dns_get32( const uint8_t*  p )
+{
+    return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static void
+dns_put32( uint8_t*  p, uint32_t  val )
+{
+    p[0] = (uint8_t)(val >> 24);
+    p[1] = (uint8_t)(val >> 16);
+    p[2] = (uint8_t)(val >> 8);
+    p[3] = (uint8_t)val;
+}
+
+/* Parse the question of a DNS message into a lookup key made of the
+ * virtual server address and the RD/CD flags, followed by the lowercased
+ * wire-format name, the type and the class. Returns the offset of the
+ * first byte after the question, or -1.
+ */
+static int
+dns_parse_question( const uint8_t*  msg, int  len, uint32_t  server_ip,
+                    uint8_t*  key, int*  key_len )
+{
+    unsigned  flags = dns_get16(msg + 2) & (DNS_FLAG_RD | DNS_FLAG_CD);
+    int       pos   = DNS_HEADER_SIZE;
+    int       n     = DNS_KEY_PREFIX;
+
+    dns_put32(key, server_ip);
+    key[4] = (uint8_t)(flags >> 8);
+    key[5] = (uint8_t)flags;
+
+    for (;;) {
+        int  label;
+
+        if (pos >= len)
+            return -1;
+        label = msg[pos++];
+        if (label == 0)
+            break;
+        /* compression pointers are not expected in questions */
+        if ((label & 0xc0) != 0 || pos + label > len || n + 1 + label >= DNS_KEY_MAX - 4)
+            return -1;
+        key[n++] = (uint8_t)label;
+        for ( ; label > 0; label-- ) {
+            int  c = msg[pos++];
+            if (c >= 'A' && c <= 'Z')
+                c += 'a' - 'A';
+            key[n++] = (uint8_t)c;
+        }
+    }
+    key[n++] = 0;
+    if (pos + 4 > len)
+        return -1;
+    memcpy(key + n, msg + pos, 4);
+    *key_len = n + 4;
+    return pos + 4;
+}
+
+static int
+dns_skip_name( const uint8_t*  msg, int  len, int  pos )
+{
+    while (pos < len) {
+        int  label = msg[pos];
+
+        if (label == 0)
+            return pos + 1;
+        if ((label & 0xc0) == 0xc0)
+            return (pos + 2 <= len) ? pos + 2 : -1;
+        if (label & 0xc0)
+            return -1;
+        pos += 1 + label;
+    }
+    return -1;
+}
+
+/* Parse the resource record at 'pos'. Returns the offset of the next
+ * one, or -1 if the message is malformed.
+ */
+static int
+dns_parse_record( const uint8_t*  msg, int  len, int  pos,
+                  int*  type, int*  ttl_pos, int*  rdata_pos, int*  rdlen )
+{
+    pos = dns_skip_name(msg, len, pos);
+    if (pos < 0 || pos + 10 > len)
+        return -1;
+
+    *type      = dns_get16(msg + pos);
+    *ttl_pos   = pos + 4;
+    *rdlen     = dns_get16(msg + pos + 8);
+    *rdata_pos = pos + 10;
+    pos += 10 + *rdlen;
+    return (pos <= len) ? pos : -1;
+}
+
+/* Return 1 if 'msg', whose question ends at 'pos', carries an EDNS OPT
+ * record or is malformed.
+ */
+static int
+dns_has_opt( const uint8_t*  msg, int  len, int  pos )
+{
+    int  count = dns_get16(msg + 6) + dns_get16(msg + 8) + dns_get16(msg + 10);
+    int  nn;
+
+    for (nn = 0; nn < count; nn++) {
+        int  type, ttl_pos, rdata_pos, rdlen;
+
+        pos = dns_parse_record(msg, len, pos, &type, &ttl_pos, &rdata_pos, &rdlen);
+        if (pos < 0 || type == DNS_TYPE_OPT)
+            return 1;
+    }
+    return 0;
+}
+
+/* Return the number of seconds the answer in 'msg' can be cached for,
+ * or -1 if it must not be cached at all.
+ */
+static int
+dns_answer_ttl( const uint8_t*  msg, int  len, int  pos, int*  negative )
+{
+    unsigned  flags   = dns_get16(msg + 2);
+    int       ancount = dns_get16(msg + 6);
+    int       nscount = dns_get16(msg + 8);
+    int       rcode   = flags & DNS_RCODE_MASK;
+    int       ttl     = -1;
+    int       nn;
+
+    if (flags & DNS_FLAG_TC)
+        return -1;
+
+    if (rcode == DNS_RCODE_NOERROR && ancount > 0) {
+        *negative = 0;
+        for (nn = 0; nn < ancount; nn++) {
+            int  type, ttl_pos, rdata_pos, rdlen, rr_ttl;
+
+            pos = dns_parse_record(msg, len, pos, &type, &ttl_pos, &rdata_pos, &rdlen);
+            if (pos < 0)
+                return -1;
+            rr_ttl = (int)(dns_get32(msg + ttl_pos) & 0x7fffffff);
+            if (ttl < 0 || rr_ttl < ttl)
+                ttl = rr_ttl;
+        }
+        if (ttl > DNS_CACHE_MAX_TTL)
+            ttl = DNS_CACHE_MAX_TTL;
+        return (ttl > 0) ? ttl : -1;
+    }
+
+    if (rcode != DNS_RCODE_NOERROR && rcode != DNS_RCODE_NXDOMAIN)
+        return -1;
+
+    /* negative answer, look for the SOA in the authority section */
+    *negative = 1;
+    for (nn = 0; nn < ancount + nscount; nn++) {
+        int  type, ttl_pos, rdata_pos, rdlen;
+
+        pos = dns_parse_record(msg, len, pos, &type, &ttl_pos, &rdata_pos, &rdlen);
+        if (pos < 0)
+            return -1;
+        if (nn >= ancount && type == DNS_TYPE_SOA && rdlen >= 20) {
+            int  soa_ttl = (int)(dns_get32(msg + ttl_pos) & 0x7fffffff);
+            int  minimum = (int)(dns_get32(msg + rdata_pos + rdlen - 4) & 0x7fffffff);
+
+            ttl = (soa_ttl < minimum) ? soa_ttl : minimum;
+            break;
+        }
+    }
+    if (ttl < 0)
+        ttl = DNS_CACHE_DEF_NEG_TTL;
+    if (ttl > DNS_CACHE_MAX_NEG_TTL)
+        ttl = DNS_CACHE_MAX_NEG_TTL;
+    return (ttl > 0) ? ttl : -1;
+}
+
+/* Reduce the TTL of every record of a cached answer by 'elapsed' seconds */
+static void
+dns_age_records( uint8_t*  msg, int  len, u_int  elapsed )
+{
+    int  count = dns_get16(msg + 6) + dns_get16(msg + 8) + dns_get16(msg + 10);
+    int  pos   = dns_skip_name(msg, len, DNS_HEADER_SIZE);
+    int  nn;
+
+    if (pos < 0)
+        return;
+    pos += 4;
+
+    for (nn = 0; nn < count; nn++) {
+        int       type, ttl_pos, rdata_pos, rdlen;
+        uint32_t  ttl;
+
+        pos = dns_parse_record(msg, len, pos, &type, &ttl_pos, &rdata_pos, &rdlen);
+        if (pos < 0)
+            return;
+        if (type == DNS_TYPE_OPT)
+            continue;
+        ttl = dns_get32(msg + ttl_pos);
+        dns_put32(msg + ttl_pos, (ttl > elapsed) ? ttl - elapsed : 0);
+    }
+}
+
+static void
+dns_cache_send( const uint8_t*  msg, int  len, uint16_t  id, u_int  elapsed,
+                uint32_t  server_ip, uint32_t  client_ip, uint16_t  client_port )
+{
+    SockAddress   saddr, daddr;
+    struct mbuf*  m;
+
+    m = m_get();
+    if (!m)
+        return;
+
+    m->m_data += IF_MAXLINKHDR + sizeof(struct udpiphdr);
+    if (M_FREEROOM(m) < len)
+        m_inc(m, (m->m_data - m->m_dat) + len + 1);
+
+    memcpy(m->m_data, msg, len);
+    memcpy(m->m_data, &id, sizeof(id));
+    m->m_len = len;
+    if (elapsed > 0)
+        dns_age_records((uint8_t*)m->m_data, len, elapsed);
+
+    sock_address_init_inet( &saddr, server_ip, DNS_PORT );
+    sock_address_init_inet( &daddr, client_ip, client_port );
+    udp_output2_(NULL, m, &saddr, &daddr, IPTOS_LOWDELAY);
+}
+
+static unsigned
+dns_hash( const uint8_t*  key, int  key_len )
+{
+    unsigned  hash = 2166136261U;
+    int       nn;
+
+    for (nn = 0; nn < key_len; nn++)
+        hash = (hash ^ key[nn]) * 16777619U;
+    return hash;
+}
+
+static void
+dns_lru_unlink( DnsEntry*  e )
+{
+    e->lru_prev->lru_next = e->lru_next;
+    e->lru_next->lru_prev = e->lru_prev;
+}
+
+static void
+dns_lru_push( DnsEntry*  e )
+{
+    e->lru_next = dns_lru.lru_next;
+    e->lru_prev = &dns_lru;
+    dns_lru.lru_next->lru_prev = e;
+    dns_lru.lru_next = e;
+}
+
+static DnsEntry*
+dns_cache_lookup( const uint8_t*  key, int  key_len )
+{
+    unsigned   hash = dns_hash(key, key_len);
+    DnsEntry*  e    = dns_buckets[hash % DNS_CACHE_BUCKETS];
+
+    for ( ; e != NULL; e = e->hnext ) {
+        if (e->hash == hash && e->key_len == key_len &&
+            !memcmp(e->key, key, key_len)) {
+            dns_lru_unlink(e);
+            dns_lru_push(e);
+            return e;
+        }
+    }
+    return NULL;
+}
+
+static void
+dns_entry_free( DnsEntry*  e )
+{
+    DnsEntry**  pnode = &dns_buckets[e->hash % DNS_CACHE_BUCKETS];
+
+    while (*pnode != e)
+        pnode = &(*pnode)->hnext;
+    *pnode = e->hnext;
+
+    dns_lru_unlink(e);
+    free(e->answer);
+    free(e);
+    dns_stats.entries--;
+}
+
+static DnsEntry*
+dns_cache_insert( const uint8_t*  key, int  key_len )
+{
+    DnsEntry*  e;
+
+    if (dns_stats.entries >= DNS_CACHE_MAX_ENTRIES) {
+        /* evict the least recently used entry, but not one whose query is
+         * still in flight: its waiters would never get their answer. */
+        for (e = dns_lru.lru_prev; e != &dns_lru; e = e->lru_prev) {
+            if (!e->pending ||
+                (int)(curtime - e->stamp) >= DNS_CACHE_PENDING_MS)
+                break;
+        }
+        if (e == &dns_lru)
+            return NULL;
+
+        dns_entry_free(e);
+        dns_stats.evicted++;
+    }
+
+    e = calloc(1, sizeof(*e));
+    if (e == NULL)
+        return NULL;
+
+    memcpy(e->key, key, key_len);
+    e->key_len = key_len;
+    e->hash    = dns_hash(key, key_len);
+    e->hnext   = dns_buckets[e->hash % DNS_CACHE_BUCKETS];
+    dns_buckets[e->hash % DNS_CACHE_BUCKETS] = e;
+    dns_lru_push(e);
+    dns_stats.entries++;
+    return e;
+}
+
+int
+dns_cache_input( struct mbuf*  m, int  iphlen )
+{
+    struct ip*      ip  = mtod(m, struct ip *);
+    struct udphdr*  uh  = (struct udphdr *)((caddr_t)ip + iphlen);
+    const uint8_t*  msg = (const uint8_t *)(uh + 1);
+    int             len = ntohs(uh->uh_ulen) - sizeof(struct udphdr);
+    uint8_t         key[DNS_KEY_MAX];
+    int             key_len;
+    uint16_t        id;
+    DnsEntry*       e;
+
+    /* only plain queries: no EDNS OPT or other extra records */
+    if (len < DNS_HEADER_SIZE ||
+        (dns_get16(msg + 2) & (DNS_FLAG_QR | DNS_OPCODE_MASK)) != 0 ||
+        dns_get16(msg + 4) != 1 ||
+        dns_get16(msg + 6) != 0 || dns_get16(msg + 8) != 0 ||
+        dns_get16(msg + 10) != 0)
+        return 0;
+
+    if (dns_parse_question(msg, len, ip_geth(ip->ip_dst), key, &key_len) < 0)
+        return 0;
+
+    memcpy(&id, msg, sizeof(id));
+
+    e = dns_cache_lookup(key, key_len);
+    if (e != NULL) {
+        if (e->answer != NULL && (int)(curtime - e->expires) < 0) {
+            if (e->negative)
+                dns_stats.negative_hits++;
+            else
+                dns_stats.hits++;
+            dns_cache_send(e->answer, e->answer_len, id,
+                           (curtime - e->stamp) / 1000,
+                           ip_geth(ip->ip_dst),
+                           ip_geth(ip->ip_src),
+                           port_geth(uh->uh_sport));
+            return 1;
+        }
+        if (e->pending && (int)(curtime - e->stamp) < DNS_CACHE_PENDING_MS) {
+            DnsWaiter*  w;
+
+            if (e->num_waiters == DNS_CACHE_MAX_WAITERS)
+                return 0;
+
+            w = &e->waiters[e->num_waiters++];
+            w->client_ip   = ip_geth(ip->ip_src);
+            w->client_port = port_geth(uh->uh_sport);
+            w->id          = id;
+            w->server_ip   = ip_geth(ip->ip_dst);
+            dns_stats.coalesced++;
+            return 1;
+        }
+        if (e->answer != NULL) {
+            free(e->answer);
+            e->answer = NULL;
+            dns_stats.expired++;
+        }
+    } else {
+        e = dns_cache_insert(key, key_len);
+        if (e == NULL)
+            return 0;
+    }
+
+    /* forward this one, and make it the query others wait for */
+    e->pending     = 1;
+    e->stamp       = curtime;
+    e->num_waiters = 0;
+    dns_stats.misses++;
+    return 0;
+}
+
+void
+dns_cache_response( struct socket*  so, struct mbuf*  m )
+{
+    const uint8_t*  msg = (const uint8_t *)m->m_data;
+    int             len = m->m_len;
+    uint8_t         key[DNS_KEY_MAX];
+    int             key_len, pos, ttl, negative = 0, nn;
+    DnsEntry*       e;
+
+    if (len < DNS_HEADER_SIZE || len > DNS_MAX_UDP_SIZE ||
+        (dns_get16(msg + 2) & DNS_FLAG_QR) == 0 ||
+        dns_get16(msg + 4) != 1)
+        return;
+
+    pos = dns_parse_question(msg, len, so->so_faddr_ip, key, &key_len);
+    if (pos < 0)
+        return;
+
+    /* answer to an EDNS query, not something a plain query may get */
+    if (dns_has_opt(msg, len, pos))
+        return;
+
+    ttl = dns_answer_ttl(msg, len, pos, &negative);
+
+    e = dns_cache_lookup(key, key_len);
+    if (e == NULL) {
+        if (ttl < 0)
+            return;
+        e = dns_cache_insert(key, key_len);
+        if (e == NULL)
+            return;
+    }
+
+    if (ttl >= 0) {
+        uint8_t*  answer = malloc(len);
+
+        if (answer != NULL) {
+            memcpy(answer, msg, len);
+            free(e->answer);
+            e->answer     = answer;
+            e->answer_len = len;
+            e->negative   = negative;
+            e->stamp      = curtime;
+            e->expires    = curtime + (u_int)ttl * 1000;
+        }
+    }
+    e->pending = 0;
+
+    for (nn = 0; nn < e->num_waiters; nn++) {
+        DnsWaiter*  w = &e->waiters[nn];
+
+        dns_cache_send(msg, len, w->id, 0,
+                       w->server_ip, w->client_ip, w->client_port);
+    }
+    e->num_waiters = 0;
+
+    if (e->answer == NULL)
+        dns_entry_free(e);
+}
+
+void
+slirp_dns_cache_stats( SlirpDnsCacheStats*  stats )
+{
+    *stats = dns_stats;
+}
+
+void
+slirp_dns_cache_flush( void )
+{
+    while (dns_lru.lru_next != &dns_lru)
+        dns_entry_free(dns_lru.lru_next);
+}
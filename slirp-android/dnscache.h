@@ -0,0 +1,47 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef _SLIRP_DNSCACHE_H_
+#define _SLIRP_DNSCACHE_H_
+
+/* A small caching DNS forwarder sitting in front of the host resolvers
+ * listed in dns_addr[]. Guest queries sent to the virtual DNS addresses
+ * are answered from the cache when possible, and identical queries that
+ * are already in flight are coalesced onto the first one.
+ */
+
+#define DNS_PORT            53
+
+#define DNS_CACHE_MAX_ENTRIES   512
+#define DNS_CACHE_MAX_TTL       3600    /* seconds, positive answers */
+#define DNS_CACHE_MAX_NEG_TTL   300     /* seconds, NXDOMAIN / NODATA */
+#define DNS_CACHE_DEF_NEG_TTL   30      /* when the reply has no SOA */
+#define DNS_CACHE_PENDING_MS    5000    /* how long we wait for an answer */
+#define DNS_CACHE_MAX_WAITERS   8
+
+/* Called from udp_input() for a query sent to a virtual DNS address.
+ * m points to the IP header. Returns 1 if the query was consumed (it
+ * was answered from the cache, or is waiting for an identical query
+ * already sent to the host resolver), or 0 if it must be forwarded.
+ */
+int  dns_cache_input(struct mbuf *m, int iphlen);
+
+/* Called from sorecvfrom() for a reply from a host resolver, before it
+ * is sent back to the guest. m points to the DNS message. Caches the
+ * answer and replies to any coalesced queries waiting for it.
+ */
+void dns_cache_response(struct socket *so, struct mbuf *m);
+
+#endif /* _SLIRP_DNSCACHE_H_ */
@@ -238,7 +238,7 @@ ip_input(struct mbuf *m)
 	STAT(ipstat.ips_delivered++);
 	switch (ip->ip_p) {
 	 case IPPROTO_TCP:
-		tcp_input(m, hlen, (struct socket *)NULL);
+		tcp_lro_input(m, hlen);
 		break;
 	 case IPPROTO_UDP:
 		udp_input(m, hlen);
@@ -80,6 +80,21 @@ void slirp_set_max_dns_conns(int max_dns_conns);
 /* Returns the max number of allowed DNS requests.*/
 int slirp_get_max_dns_conns();
 
+/* Statistics of the DNS cache in front of the host resolvers */
+typedef struct {
+    unsigned  entries;        /* cached or in-flight questions */
+    unsigned  hits;           /* answered from a positive entry */
+    unsigned  negative_hits;  /* answered from a NXDOMAIN/NODATA entry */
+    unsigned  misses;         /* forwarded to a host resolver */
+    unsigned  coalesced;      /* merged with an identical in-flight query */
+    unsigned  expired;        /* entries found stale and refreshed */
+    unsigned  evicted;        /* entries dropped because the cache was full */
+} SlirpDnsCacheStats;
+
+void slirp_dns_cache_stats(SlirpDnsCacheStats* stats);
+/* Drops all cached answers */
+void slirp_dns_cache_flush(void);
+
 /**
  * Modifications for implementing "-net-forward-tcp2sink' option.
  */
@@ -211,6 +211,14 @@ int slirp_get_system_dns_servers(void)
 static void slirp_state_save(QEMUFile *f, void *opaque);
 static int slirp_state_load(QEMUFile *f, void *opaque, int version_id);
 
+/* pushes segments held by tcp_lro_input() through tcp_input() */
+static QEMUBH *slirp_lro_bh;
+
+static void slirp_lro_flush(void *opaque)
+{
+    tcp_lro_flush();
+}
+
 void slirp_init(int restricted, const char *special_ip)
 {
 #if DEBUG
@@ -265,6 +273,7 @@ void slirp_init(int restricted, const char *special_ip)
     alias_addr_ip = special_addr_ip | CTL_ALIAS;
     getouraddr();
     register_savevm("slirp", 0, 1, slirp_state_save, slirp_state_load, NULL);
+    slirp_lro_bh = qemu_bh_new(slirp_lro_flush, NULL);
 
     slirp_net_forward_init();
 }
@@ -770,6 +779,8 @@ void slirp_input(const uint8_t *pkt, int pkt_len)
         m->m_len -= 2 + ETH_HLEN;
 
         ip_input(m);
+        if (tcp_lro_pending)
+            qemu_bh_schedule(slirp_lro_bh);
         break;
     default:
         break;
@@ -1346,6 +1357,8 @@ static void slirp_state_save(QEMUFile *f, void *opaque)
 {
     struct ex_list *ex_ptr;
 
+    tcp_lro_flush();
+
     for (ex_ptr = exec_list; ex_ptr; ex_ptr = ex_ptr->ex_next)
         if (ex_ptr->ex_pty == 3) {
             struct socket *so;
@@ -175,6 +175,7 @@ void free _P((void *ptr));
 
 #include "bootp.h"
 #include "tftp.h"
+#include "dnscache.h"
 #include "libslirp.h"
 
 extern struct ttys *ttys_unit[MAX_INTERFACES];
@@ -242,6 +243,9 @@ int ip_output _P((struct socket *, struct mbuf *));
 /* tcp_input.c */
 void tcp_input _P((register struct mbuf *, int, struct socket *));
 int tcp_mss _P((register struct tcpcb *, u_int));
+void tcp_lro_input _P((struct mbuf *, int));
+void tcp_lro_flush _P((void));
+extern int tcp_lro_pending;
 
 /* tcp_output.c */
 int tcp_output _P((register struct tcpcb *));
@@ -527,6 +527,12 @@ sorecvfrom(struct socket *so)
 		so->so_expire = curtime + SO_EXPIRE;
 	    }
 
+	    /* cache answers to queries sent to the virtual DNS servers */
+	    if (so->so_faddr_port == DNS_PORT &&
+	        (so->so_faddr_ip & 0xffffff00) == special_addr_ip &&
+	        CTL_IS_DNS(so->so_faddr_ip & 0xff))
+	      dns_cache_response(so, m);
+
 	    /*		if (m->m_len == len) {
 	     *			m_inc(m, MINCSIZE);
 	     *			m->m_len = 0;
@@ -225,6 +225,182 @@ present:
 	return (flags);
 }
 
+/*
+ * Large receive offload.
+ *
+ * The guest NIC hands us one MTU-sized frame at a time, so a bulk
+ * transfer from the guest would otherwise go through socket lookup,
+ * sequence checks, sbappend() and a host send() once per segment.
+ * tcp_lro_input() holds on to in-order data segments of the same
+ * connection and appends their payloads to the first one, so that
+ * tcp_input() sees a single large segment per burst.
+ *
+ * Only segments carrying data with ACK (and possibly PSH) set and no
+ * IP options are merged.  Anything else flushes its connection's
+ * pending aggregate first, so the order seen by tcp_input() is never
+ * changed.  A PSH segment ends the aggregate immediately; the rest is
+ * pushed out by tcp_lro_flush(), which slirp.c runs from a bottom half
+ * scheduled as soon as something was queued.
+ */
+#define TCP_LRO_FLOWS	8
+#define TCP_LRO_MAXLEN	32768	/* max. payload of a merged segment */
+
+struct tcp_lro_flow {
+	struct mbuf	*lro_m;		/* head segment, NULL if slot is free */
+	uint32_t	lro_src;	/* host order */
+	uint32_t	lro_dst;
+	uint16_t	lro_sport;
+	uint16_t	lro_dport;
+	tcp_seq		lro_next;	/* seq of the next segment to merge */
+	int		lro_len;	/* payload length of the aggregate */
+};
+
+static struct tcp_lro_flow tcp_lro_flows[TCP_LRO_FLOWS];
+static int tcp_lro_evict;
+int tcp_lro_pending;
+
+/*
+ * Return the TCP checksum of the segment in m, which is left
+ * untouched.  ip_len must already be in host order, without the
+ * IP header.
+ */
+static int
+tcp_lro_cksum(struct mbuf *m)
+{
+	struct tcpiphdr *ti = mtod(m, struct tcpiphdr *);
+	struct ip save_ip = *mtod(m, struct ip *);
+	int sum;
+
+	memset(&ti->ti_i.ih_mbuf, 0, sizeof(struct mbuf_ptr));
+	ti->ti_x1 = 0;
+	ti->ti_len = htons((u_int16_t)save_ip.ip_len);
+	sum = cksum(m, sizeof(struct ip) + save_ip.ip_len);
+	*mtod(m, struct ip *) = save_ip;
+	return sum;
+}
+
+static void
+tcp_lro_flush_flow(struct tcp_lro_flow *fl)
+{
+	struct mbuf *m = fl->lro_m;
+
+	if (m == NULL)
+		return;
+	fl->lro_m = NULL;
+	tcp_lro_pending--;
+	tcp_input(m, sizeof(struct ip), (struct socket *)NULL);
+}
+
+void
+tcp_lro_flush(void)
+{
+	int i;
+
+	for (i = 0; i < TCP_LRO_FLOWS && tcp_lro_pending > 0; i++)
+		tcp_lro_flush_flow(&tcp_lro_flows[i]);
+}
+
+void
+tcp_lro_input(struct mbuf *m, int iphlen)
+{
+	struct ip *ip = mtod(m, struct ip *);
+	struct tcphdr *th;
+	struct tcp_lro_flow *fl = NULL, *slot = NULL;
+	uint32_t src, dst;
+	uint16_t sport, dport;
+	int i, off, dlen, mergeable;
+
+	DEBUG_CALL("tcp_lro_input");
+	DEBUG_ARG("m = %lx", (long)m);
+
+	if (m->m_len < iphlen + sizeof(struct tcphdr)) {
+		tcp_input(m, iphlen, (struct socket *)NULL);
+		return;
+	}
+	th = (struct tcphdr *)(mtod(m, caddr_t) + iphlen);
+	src = ip_geth(ip->ip_src);
+	dst = ip_geth(ip->ip_dst);
+	sport = port_geth(th->th_sport);
+	dport = port_geth(th->th_dport);
+
+	for (i = 0; i < TCP_LRO_FLOWS; i++) {
+		struct tcp_lro_flow *f = &tcp_lro_flows[i];
+
+		if (f->lro_m == NULL) {
+			if (slot == NULL)
+				slot = f;
+			continue;
+		}
+		if (f->lro_src == src && f->lro_dst == dst &&
+		    f->lro_sport == sport && f->lro_dport == dport) {
+			fl = f;
+			break;
+		}
+	}
+
+	off = th->th_off << 2;
+	dlen = ip->ip_len - off;
+	mergeable = iphlen == sizeof(struct ip) &&
+		    (th->th_flags & ~TH_PUSH) == TH_ACK &&
+		    off >= sizeof(struct tcphdr) && dlen > 0 &&
+		    tcp_lro_cksum(m) == 0;
+
+	if (fl != NULL) {
+		struct mbuf *head = fl->lro_m;
+		struct tcphdr *hth = (struct tcphdr *)(mtod(head, caddr_t) +
+						       sizeof(struct ip));
+
+		if (mergeable && ntohl(th->th_seq) == fl->lro_next &&
+		    fl->lro_len + dlen <= TCP_LRO_MAXLEN &&
+		    SEQ_GEQ(ntohl(th->th_ack), ntohl(hth->th_ack))) {
+			int push = th->th_flags & TH_PUSH;
+
+			hth->th_ack = th->th_ack;
+			hth->th_win = th->th_win;
+			hth->th_flags |= push;
+			mtod(head, struct ip *)->ip_len += dlen;
+			fl->lro_next += dlen;
+			fl->lro_len += dlen;
+
+			/* m_inc() may move the data, hth is stale after this */
+			m_adj(m, sizeof(struct ip) + off);
+			if (M_FREEROOM(head) < m->m_len)
+				m_inc(head, head->m_size + TCP_LRO_MAXLEN);
+			m_cat(head, m);
+			STAT(tcpstat.tcps_lromerged++);
+
+			if (push)
+				tcp_lro_flush_flow(fl);
+			return;
+		}
+		tcp_lro_flush_flow(fl);
+		slot = fl;
+	}
+
+	if (mergeable)
+		m->m_flags |= M_CSUM_VALID;
+
+	if (!mergeable || (th->th_flags & TH_PUSH)) {
+		tcp_input(m, iphlen, (struct socket *)NULL);
+		return;
+	}
+
+	if (slot == NULL) {
+		slot = &tcp_lro_flows[tcp_lro_evict];
+		tcp_lro_evict = (tcp_lro_evict + 1) % TCP_LRO_FLOWS;
+		tcp_lro_flush_flow(slot);
+	}
+	slot->lro_m = m;
+	slot->lro_src = src;
+	slot->lro_dst = dst;
+	slot->lro_sport = sport;
+	slot->lro_dport = dport;
+	slot->lro_next = ntohl(th->th_seq) + dlen;
+	slot->lro_len = dlen;
+	tcp_lro_pending++;
+	STAT(tcpstat.tcps_lroqueued++);
+}
+
 /*
  * TCP input routine, follows pages 65-76 of the
  * protocol specification dated September, 1981 very closely.
@@ -303,7 +479,7 @@ tcp_input(struct mbuf *m, int iphlen, struct socket *inso)
 	/* keep checksum for ICMP reply
 	 * ti->ti_sum = cksum(m, len);
 	 * if (ti->ti_sum) { */
-	if(cksum(m, len)) {
+	if (!(m->m_flags & M_CSUM_VALID) && cksum(m, len)) {
 	  STAT(tcpstat.tcps_rcvbadsum++);
 	  goto drop;
 	}
@@ -224,6 +224,8 @@ struct tcpstat {
 	u_long	tcps_preddat;		/* times hdr predict ok for data pkts */
 	u_long	tcps_socachemiss;	/* tcp_last_so misses */
 	u_long	tcps_didnuttin;		/* Times tcp_output didn't do anything XXX */
+	u_long	tcps_lroqueued;		/* segments held for large receive */
+	u_long	tcps_lromerged;		/* segments merged into a previous one */
 };
 
 extern struct	tcpstat tcpstat;	/* tcp statistics */
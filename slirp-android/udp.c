@@ -209,6 +209,11 @@ udp_input(register struct mbuf *m, int iphlen)
             if (slirp_get_max_dns_conns() != -1 &&
                 dns_num_conns > slirp_get_max_dns_conns())
                 goto bad;
+
+            if ((ip_geth(ip->ip_dst) & 0xffffff00) == special_addr_ip &&
+                CTL_IS_DNS(ip_geth(ip->ip_dst) & 0xff) &&
+                dns_cache_input(m, iphlen))
+                goto bad;
         }
 
 
@@ -12,20 +12,37 @@
 #include "tcpdump.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <errno.h>
 #include <sys/time.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
 
 int  qemu_tcpdump_active;
 
-static FILE*     capture_file;
 static uint64_t  capture_count;
 static uint64_t  capture_size;
 static int       capture_init;
 
+/* capture parameters, parsed from the capture specification */
+static char*     capture_path;
+static int       capture_snaplen;
+static uint64_t  capture_rotate;     /* 0 means never rotate */
+static int       capture_files;      /* number of rotated files to keep */
+static int       capture_index;      /* number of the current rotated file */
+static uint64_t  capture_file_size;  /* bytes written to the current file */
+
+static int   capture_open( void );
+static void  capture_close( void );
+
 static void
 capture_atexit(void)
 {
     if (qemu_tcpdump_active) {
-        fclose(capture_file);
+        capture_close();
         qemu_tcpdump_active = 0;
     }
 }
@@ -40,19 +57,186 @@ capture_atexit(void)
 #define  PCAP_SNAPLEN   65535
 #define  PCAP_ETHERNET  1
 
+typedef struct {
+    uint32_t   magic;
+    uint16_t   version_major;
+    uint16_t   version_minor;
+    int32_t    this_zone;
+    uint32_t   sigfigs;
+    uint32_t   snaplen;
+    uint32_t   network;
+} PcapHeader;
+
+typedef struct {
+    uint32_t  ts_sec;
+    uint32_t  ts_usec;
+    uint32_t  incl_len;
+    uint32_t  orig_len;
+} PacketHeader;
+
+/***********************************************************************/
+/***********************************************************************/
+/*****                                                             *****/
+/*****          C A P T U R E   F I L E   O U T P U T              *****/
+/*****                                                             *****/
+/***********************************************************************/
+/***********************************************************************/
+
+/* On Linux, the capture file is written through a memory-mapped window
+ * that slides along the file: capturing a packet is only a pair of
+ * memcpy() into the window, and the kernel writes dirty pages back on
+ * its own. The disk blocks of each window are reserved with
+ * posix_fallocate() before it is mapped, so that a full disk stops the
+ * capture instead of raising SIGBUS in the middle of a memcpy(). The
+ * file is truncated to its real size when closed.
+ *
+ * Elsewhere, we simply use a large stdio buffer.
+ */
+#ifdef __linux__
+#  define  CAPTURE_MMAP  1
+#else
+#  define  CAPTURE_MMAP  0
+#endif
+
+#if !CAPTURE_MMAP
+
+#define  CAPTURE_BUFFER   (1024*1024)
+
+static FILE*  capture_file;
+
+static int
+capture_file_open( const char*  path )
+{
+    capture_file = fopen(path, "wb");
+    if (capture_file == NULL)
+        return -1;
+
+    setvbuf(capture_file, NULL, _IOFBF, CAPTURE_BUFFER);
+    return 0;
+}
+
+static int
+capture_write( const void*  data, size_t  size )
+{
+    if (fwrite(data, 1, size, capture_file) != size)
+        return -1;
+    capture_file_size += size;
+    return 0;
+}
+
+static void
+capture_file_close( void )
+{
+    if (capture_file) {
+        fclose(capture_file);
+        capture_file = NULL;
+    }
+}
+
+#else /* CAPTURE_MMAP */
+
+#define  CAPTURE_WINDOW   (4*1024*1024)
+
+static int       capture_fd = -1;
+static uint8_t*  capture_map;         /* current window, or NULL */
+static uint64_t  capture_map_offset;  /* file offset of current window */
+static size_t    capture_map_pos;     /* write position in current window */
+
+static void
+capture_unmap( void )
+{
+    if (capture_map != NULL) {
+        munmap(capture_map, CAPTURE_WINDOW);
+        capture_map = NULL;
+    }
+}
+
+static int
+capture_map_window( uint64_t  offset )
+{
+    void*  map;
+    int    err;
+
+    capture_unmap();
+
+    err = posix_fallocate(capture_fd, (off_t)offset, CAPTURE_WINDOW);
+    if (err != 0) {
+        errno = err;
+        return -1;
+    }
+
+    map = mmap(NULL, CAPTURE_WINDOW, PROT_READ|PROT_WRITE, MAP_SHARED,
+               capture_fd, (off_t)offset);
+    if (map == MAP_FAILED)
+        return -1;
+
+    capture_map        = map;
+    capture_map_offset = offset;
+    capture_map_pos    = 0;
+    return 0;
+}
+
 static int
-pcap_write_header( FILE*  out )
+capture_file_open( const char*  path )
 {
-    typedef struct {
-        uint32_t   magic;
-        uint16_t   version_major;
-        uint16_t   version_minor;
-        int32_t    this_zone;
-        uint32_t   sigfigs;
-        uint32_t   snaplen;
-        uint32_t   network;
-    } PcapHeader;
+    capture_fd = open(path, O_RDWR|O_CREAT|O_TRUNC, 0644);
+    if (capture_fd < 0)
+        return -1;
+
+    if (capture_map_window(0) < 0) {
+        int  err = errno;
+        close(capture_fd);
+        capture_fd = -1;
+        errno = err;
+        return -1;
+    }
+    return 0;
+}
+
+static int
+capture_write( const void*  data, size_t  size )
+{
+    const uint8_t*  p = data;
+
+    while (size > 0) {
+        size_t  avail = CAPTURE_WINDOW - capture_map_pos;
+
+        if (avail == 0) {
+            if (capture_map_window(capture_map_offset + CAPTURE_WINDOW) < 0)
+                return -1;
+            avail = CAPTURE_WINDOW;
+        }
+        if (avail > size)
+            avail = size;
+
+        memcpy(capture_map + capture_map_pos, p, avail);
+        capture_map_pos   += avail;
+        capture_file_size += avail;
+        p    += avail;
+        size -= avail;
+    }
+    return 0;
+}
 
+static void
+capture_file_close( void )
+{
+    if (capture_fd < 0)
+        return;
+
+    capture_unmap();
+    if (ftruncate(capture_fd, (off_t)capture_file_size) < 0) {
+        /* nothing we can do here, readers will see zero padding */
+    }
+    close(capture_fd);
+    capture_fd = -1;
+}
+
+#endif /* CAPTURE_MMAP */
+
+static int
+pcap_write_header( void )
+{
     PcapHeader  h;
 
     h.magic         = PCAP_MAGIC;
@@ -60,15 +244,407 @@ pcap_write_header( FILE*  out )
     h.version_minor = PCAP_MINOR;
     h.this_zone     = 0;
     h.sigfigs       = 0;  /* all tools set it to 0 in practice */
-    h.snaplen       = PCAP_SNAPLEN;
+    h.snaplen       = capture_snaplen;
     h.network       = PCAP_ETHERNET;
 
-    if (fwrite(&h, sizeof(h), 1, out) != 1) {
+    return capture_write(&h, sizeof(h));
+}
+
+/* open the current capture file, i.e. 'capture_path' for the first one,
+ * then '<capture_path>.<index>' after each rotation. once 'capture_files'
+ * files exist, the index wraps around and the oldest file is reused */
+static int
+capture_open( void )
+{
+    char   temp[1024];
+    const char*  path = capture_path;
+
+    if (capture_index > 0) {
+        snprintf(temp, sizeof(temp), "%s.%d", capture_path, capture_index);
+        path = temp;
+    }
+
+    capture_file_size = 0;
+    if (capture_file_open(path) < 0)
+        return -1;
+
+    if (pcap_write_header() < 0) {
+        int  err = errno;
+        capture_file_close();
+        errno = err;
         return -1;
     }
     return 0;
 }
 
+static void
+capture_close( void )
+{
+    capture_file_close();
+}
+
+/***********************************************************************/
+/***********************************************************************/
+/*****                                                             *****/
+/*****          P A C K E T   F I L T E R                          *****/
+/*****                                                             *****/
+/***********************************************************************/
+/***********************************************************************/
+
+/* A small subset of the tcpdump/BPF filter syntax is supported:
+ *
+ *   <expr>      := <term> [ ('or'|'||') <term> ]*
+ *   <term>      := <factor> [ ('and'|'&&') <factor> ]*
+ *   <factor>    := ('not'|'!') <factor> | '(' <expr> ')' | <primitive>
+ *   <primitive> := 'ip' | 'arp' | 'tcp' | 'udp' | 'icmp'
+ *                | ['src'|'dst'] 'host' <a.b.c.d>
+ *                | ['src'|'dst'] 'port' <number>
+ *
+ * The expression is compiled into a small tree once, then evaluated on
+ * the raw Ethernet frame before anything is copied to the capture file.
+ */
+
+typedef enum {
+    FILTER_AND,
+    FILTER_OR,
+    FILTER_NOT,
+    FILTER_ETHERTYPE,
+    FILTER_IPPROTO,
+    FILTER_HOST,
+    FILTER_PORT,
+} FilterType;
+
+#define  FILTER_DIR_SRC   1
+#define  FILTER_DIR_DST   2
+#define  FILTER_DIR_ANY   (FILTER_DIR_SRC|FILTER_DIR_DST)
+
+#define  FILTER_MAX_NODES   64
+
+typedef struct {
+    FilterType  type;
+    int         dir;
+    uint32_t    value;
+    int         left;
+    int         right;
+} FilterNode;
+
+static FilterNode  filter_nodes[FILTER_MAX_NODES];
+static int         filter_count;
+static int         filter_root = -1;
+
+/* decoded header fields of the packet being filtered */
+typedef struct {
+    int       ethertype;
+    int       ipproto;     /* -1 if not IPv4 */
+    uint32_t  src_ip;
+    uint32_t  dst_ip;
+    int       src_port;    /* -1 if not TCP/UDP, or not first fragment */
+    int       dst_port;
+} FilterPacket;
+
+typedef struct {
+    const char*  pos;
+    char         token[64];
+} FilterParser;
+
+static int  filter_parse_expr( FilterParser*  fp );
+
+static void
+filter_next_token( FilterParser*  fp )
+{
+    const char*  p = fp->pos;
+    int          n = 0;
+
+    while (*p == ' ' || *p == '\t')
+        p++;
+
+    if (*p == '(' || *p == ')' || *p == '!') {
+        fp->token[n++] = *p++;
+    } else if ((p[0] == '&' && p[1] == '&') || (p[0] == '|' && p[1] == '|')) {
+        fp->token[n++] = *p++;
+        fp->token[n++] = *p++;
+    } else {
+        while (*p && *p != ' ' && *p != '\t' && *p != '(' && *p != ')' &&
+               n < (int)sizeof(fp->token)-1)
+            fp->token[n++] = *p++;
+    }
+    fp->token[n] = 0;
+    fp->pos      = p;
+}
+
+static int
+filter_new_node( FilterType  type, int  dir, uint32_t  value, int  left, int  right )
+{
+    FilterNode*  node;
+
+    if (filter_count >= FILTER_MAX_NODES || left == -2 || right == -2)
+        return -2;
+
+    node = &filter_nodes[filter_count];
+    node->type  = type;
+    node->dir   = dir;
+    node->value = value;
+    node->left  = left;
+    node->right = right;
+    return filter_count++;
+}
+
+static int
+filter_parse_primitive( FilterParser*  fp )
+{
+    int   dir = FILTER_DIR_ANY;
+    char* end;
+
+    if (!strcmp(fp->token, "ip"))
+        return filter_new_node(FILTER_ETHERTYPE, 0, 0x0800, -1, -1);
+    if (!strcmp(fp->token, "arp"))
+        return filter_new_node(FILTER_ETHERTYPE, 0, 0x0806, -1, -1);
+    if (!strcmp(fp->token, "icmp"))
+        return filter_new_node(FILTER_IPPROTO, 0, 1, -1, -1);
+    if (!strcmp(fp->token, "tcp"))
+        return filter_new_node(FILTER_IPPROTO, 0, 6, -1, -1);
+    if (!strcmp(fp->token, "udp"))
+        return filter_new_node(FILTER_IPPROTO, 0, 17, -1, -1);
+
+    if (!strcmp(fp->token, "src") || !strcmp(fp->token, "dst")) {
+        dir = (fp->token[0] == 's') ? FILTER_DIR_SRC : FILTER_DIR_DST;
+        filter_next_token(fp);
+    }
+
+    if (!strcmp(fp->token, "host")) {
+        unsigned  a, b, c, d;
+        filter_next_token(fp);
+        if (sscanf(fp->token, "%u.%u.%u.%u", &a, &b, &c, &d) != 4 ||
+            a > 255 || b > 255 || c > 255 || d > 255)
+            return -2;
+        return filter_new_node(FILTER_HOST, dir, (a << 24) | (b << 16) | (c << 8) | d, -1, -1);
+    }
+    if (!strcmp(fp->token, "port")) {
+        unsigned long  port;
+        filter_next_token(fp);
+        port = strtoul(fp->token, &end, 10);
+        if (end == fp->token || *end != 0 || port > 65535)
+            return -2;
+        return filter_new_node(FILTER_PORT, dir, (uint32_t)port, -1, -1);
+    }
+    return -2;
+}
+
+static int
+filter_parse_factor( FilterParser*  fp )
+{
+    int  node;
+
+    if (!strcmp(fp->token, "not") || !strcmp(fp->token, "!")) {
+        filter_next_token(fp);
+        node = filter_parse_factor(fp);
+        return filter_new_node(FILTER_NOT, 0, 0, node, -1);
+    }
+    if (!strcmp(fp->token, "(")) {
+        filter_next_token(fp);
+        node = filter_parse_expr(fp);
+        if (strcmp(fp->token, ")"))
+            return -2;
+        filter_next_token(fp);
+        return node;
+    }
+    node = filter_parse_primitive(fp);
+    filter_next_token(fp);
+    return node;
+}
+
+static int
+filter_parse_term( FilterParser*  fp )
+{
+    int  node = filter_parse_factor(fp);
+
+    while (!strcmp(fp->token, "and") || !strcmp(fp->token, "&&")) {
+        filter_next_token(fp);
+        node = filter_new_node(FILTER_AND, 0, 0, node, filter_parse_factor(fp));
+    }
+    return node;
+}
+
+static int
+filter_parse_expr( FilterParser*  fp )
+{
+    int  node = filter_parse_term(fp);
+
+    while (!strcmp(fp->token, "or") || !strcmp(fp->token, "||")) {
+        filter_next_token(fp);
+        node = filter_new_node(FILTER_OR, 0, 0, node, filter_parse_term(fp));
+    }
+    return node;
+}
+
+/* compile a filter expression, returns -1 on syntax error */
+static int
+filter_compile( const char*  expr )
+{
+    FilterParser  fp[1];
+
+    filter_count = 0;
+    filter_root  = -1;
+
+    fp->pos = expr;
+    filter_next_token(fp);
+    if (fp->token[0] == 0)
+        return 0;
+
+    filter_root = filter_parse_expr(fp);
+    if (filter_root < 0 || fp->token[0] != 0) {
+        filter_root = -1;
+        return -1;
+    }
+    return 0;
+}
+
+static int
+filter_match_dir( int  dir, uint32_t  value, uint32_t  src, uint32_t  dst )
+{
+    return ((dir & FILTER_DIR_SRC) && src == value) ||
+           ((dir & FILTER_DIR_DST) && dst == value);
+}
+
+static int
+filter_eval( int  index, const FilterPacket*  pkt )
+{
+    const FilterNode*  node = &filter_nodes[index];
+
+    switch (node->type) {
+    case FILTER_AND:
+        return filter_eval(node->left, pkt) && filter_eval(node->right, pkt);
+    case FILTER_OR:
+        return filter_eval(node->left, pkt) || filter_eval(node->right, pkt);
+    case FILTER_NOT:
+        return !filter_eval(node->left, pkt);
+    case FILTER_ETHERTYPE:
+        return pkt->ethertype == (int)node->value;
+    case FILTER_IPPROTO:
+        return pkt->ipproto == (int)node->value;
+    case FILTER_HOST:
+        return pkt->ipproto >= 0 &&
+               filter_match_dir(node->dir, node->value, pkt->src_ip, pkt->dst_ip);
+    case FILTER_PORT:
+        return pkt->src_port >= 0 &&
+               filter_match_dir(node->dir, node->value, pkt->src_port, pkt->dst_port);
+    }
+    return 0;
+}
+
+static int
+filter_packet( const uint8_t*  data, int  len )
+{
+    FilterPacket  pkt;
+
+    if (filter_root < 0)
+        return 1;
+
+    pkt.ethertype = -1;
+    pkt.ipproto   = -1;
+    pkt.src_port  = -1;
+    pkt.dst_port  = -1;
+
+    if (len >= 14) {
+        pkt.ethertype = (data[12] << 8) | data[13];
+        data += 14;
+        len  -= 14;
+    }
+    if (pkt.ethertype == 0x0800 && len >= 20 && (data[0] >> 4) == 4) {
+        int  hlen = (data[0] & 15) * 4;
+        int  frag = ((data[6] & 0x1f) << 8) | data[7];
+
+        pkt.ipproto = data[9];
+        pkt.src_ip  = (data[12] << 24) | (data[13] << 16) | (data[14] << 8) | data[15];
+        pkt.dst_ip  = (data[16] << 24) | (data[17] << 16) | (data[18] << 8) | data[19];
+
+        if ((pkt.ipproto == 6 || pkt.ipproto == 17) && frag == 0 && len >= hlen + 4) {
+            pkt.src_port = (data[hlen] << 8)   | data[hlen+1];
+            pkt.dst_port = (data[hlen+2] << 8) | data[hlen+3];
+        }
+    }
+    return filter_eval(filter_root, &pkt);
+}
+
+/***********************************************************************/
+/***********************************************************************/
+/*****                                                             *****/
+/*****          P U B L I C   I N T E R F A C E                    *****/
+/*****                                                             *****/
+/***********************************************************************/
+/***********************************************************************/
+
+/* default maximum number of files kept when rotating */
+#define  CAPTURE_DEFAULT_FILES  10
+
+/* parse a "<size>[k|m|g]" value, returns 0 on error */
+static uint64_t
+capture_parse_size( const char*  str )
+{
+    char*     end;
+    uint64_t  size = strtoull(str, &end, 10);
+
+    switch (*end) {
+        case 'k': case 'K': size <<= 10; end++; break;
+        case 'm': case 'M': size <<= 20; end++; break;
+        case 'g': case 'G': size <<= 30; end++; break;
+    }
+    return (*end == 0) ? size : 0;
+}
+
+/* parse "<file>[,snaplen=<bytes>][,rotate=<size>][,files=<count>][,filter=<expr>]" */
+static int
+capture_parse_spec( const char*  spec )
+{
+    char*  copy = strdup(spec);
+    char*  opts = strchr(copy, ',');
+
+    capture_snaplen = PCAP_SNAPLEN;
+    capture_rotate  = 0;
+    capture_files   = CAPTURE_DEFAULT_FILES;
+    filter_compile("");
+
+    if (opts != NULL) {
+        *opts++ = 0;
+        while (opts != NULL) {
+            char*  next = strchr(opts, ',');
+            if (next != NULL)
+                *next++ = 0;
+
+            if (!strncmp(opts, "snaplen=", 8)) {
+                capture_snaplen = atoi(opts + 8);
+                if (capture_snaplen <= 0 || capture_snaplen > PCAP_SNAPLEN)
+                    goto Fail;
+            } else if (!strncmp(opts, "rotate=", 7)) {
+                capture_rotate = capture_parse_size(opts + 7);
+                if (capture_rotate == 0)
+                    goto Fail;
+            } else if (!strncmp(opts, "files=", 6)) {
+                capture_files = atoi(opts + 6);
+                if (capture_files <= 0)
+                    goto Fail;
+            } else if (!strncmp(opts, "filter=", 7)) {
+                if (filter_compile(opts + 7) < 0)
+                    goto Fail;
+            } else {
+                goto Fail;
+            }
+            opts = next;
+        }
+    }
+    if (copy[0] == 0)
+        goto Fail;
+
+    capture_path = copy;
+    return 0;
+
+Fail:
+    free(copy);
+    filter_compile("");
+    errno = EINVAL;
+    return -1;
+}
+
 int
 qemu_tcpdump_start( const char*  filepath )
 {
@@ -82,12 +658,15 @@ qemu_tcpdump_start( const char*  filepath )
     if (filepath == NULL)
         return -1;
 
-    capture_file = fopen(filepath, "wb");
-    if (capture_file == NULL)
+    if (capture_parse_spec(filepath) < 0)
         return -1;
 
-    if (pcap_write_header(capture_file) < 0)
+    capture_index = 0;
+    if (capture_open() < 0) {
+        free(capture_path);
+        capture_path = NULL;
         return -1;
+    }
 
     qemu_tcpdump_active = 1;
     return 0;
@@ -104,26 +683,33 @@ qemu_tcpdump_stop( void )
     capture_count = 0;
     capture_size  = 0;
 
-    fclose(capture_file);
-    capture_file = NULL;
+    capture_close();
+    free(capture_path);
+    capture_path = NULL;
 }
 
 void
 qemu_tcpdump_packet( const void*  base, int  len )
 {
-    typedef struct {
-        uint32_t  ts_sec;
-        uint32_t  ts_usec;
-        uint32_t  incl_len;
-        uint32_t  orig_len;
-    } PacketHeader;
-
     PacketHeader    h;
     struct timeval  now;
+    uint64_t        start;
     int             len2 = len;
 
-    if (len2 > PCAP_SNAPLEN)
-        len2 = PCAP_SNAPLEN;
+    if (!filter_packet(base, len))
+        return;
+
+    if (len2 > capture_snaplen)
+        len2 = capture_snaplen;
+
+    if (capture_rotate > 0 &&
+        capture_file_size + sizeof(h) + len2 > capture_rotate &&
+        capture_file_size > sizeof(PcapHeader)) {
+        capture_close();
+        capture_index = (capture_index + 1) % capture_files;
+        if (capture_open() < 0)
+            goto Fail;
+    }
 
     gettimeofday(&now, NULL);
     h.ts_sec   = (uint32_t) now.tv_sec;
@@ -131,11 +717,21 @@ qemu_tcpdump_packet( const void*  base, int  len )
     h.incl_len = (uint32_t) len2;
     h.orig_len = (uint32_t) len;
 
-    fwrite( &h, sizeof(h), 1, capture_file );
-    fwrite( base, 1, len2, capture_file );
+    start = capture_file_size;
+    if (capture_write( &h, sizeof(h) ) < 0 ||
+        capture_write( base, len2 ) < 0) {
+        /* don't leave a truncated record at the end of the file */
+        capture_file_size = start;
+        goto Fail;
+    }
 
     capture_count += 1;
     capture_size  += len2;
+    return;
+
+Fail:
+    /* disk full, or could not map the next window: stop capturing */
+    qemu_tcpdump_stop();
 }
 
 void
@@ -144,4 +740,3 @@ qemu_tcpdump_stats( uint64_t  *pcount, uint64_t*  psize )
     *pcount = capture_count;
     *psize  = capture_size;
 }
-
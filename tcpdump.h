@@ -18,6 +18,13 @@
 extern int  qemu_tcpdump_active;
 
 /* start a new packet capture, close the current one if any.
+ * 'filepath' is a capture specification of the form:
+ *
+ *    <file>[,snaplen=<bytes>][,rotate=<size>[k|m|g]][,files=<count>][,filter=<expr>]
+ *
+ * where <expr> uses a small subset of the tcpdump filter syntax. when
+ * rotating, at most <count> files (10 by default) are kept, the oldest
+ * one being overwritten.
  * returns 0 on success, and -1 on failure (see errno then) */
 extern int  qemu_tcpdump_start( const char*  filepath );
 
@@ -0,0 +1,381 @@
+/* Copyright (C) 2012 The Android Open Source Project
+**
+** This software is licensed under the terms of the GNU General Public
+** License version 2, as published by the Free Software Foundation, and
+** may be copied, distributed, and modified under those terms.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/time.h>
+#include <zlib.h>
+#include "trace-writer.h"
+
+#ifdef __linux__
+#include "qemu-thread.h"
+#define TRACE_WRITER_THREAD  1
+#else
+#define TRACE_WRITER_THREAD  0
+#endif
+
+struct TraceWriter {
+    char        *path;
+    FILE        *fstream;
+    const TraceCompressor *compressor;
+    void        *state;         // compressor state
+    char        *buffers[2];
+    int         error;          // errno of the first failed write, or 0
+    int         failed;         // set once the error has been reported
+
+    // Statistics, reported when the writer is closed.
+    uint64_t    bytes_in;       // bytes submitted by the simulator
+    uint64_t    bytes_out;      // bytes written to the file
+    uint64_t    num_buffers;    // number of buffers submitted
+    uint64_t    write_usecs;    // time spent compressing and writing
+    uint64_t    num_stalls;     // times the simulator waited for a buffer
+    uint64_t    stall_usecs;    // time the simulator spent waiting
+
+#if TRACE_WRITER_THREAD
+    char        *pending;       // buffer queued or being written, or NULL
+    uint32_t    pending_size;
+    TraceWriter *next_pending;  // next writer in the queue
+    QemuCond    written;        // signaled when 'pending' is cleared
+#endif
+};
+
+static uint64_t now_usecs(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+// The "none" compressor writes the data as is.
+
+static char none_state;
+
+static void *none_open(void)
+{
+    return &none_state;
+}
+
+static int64_t none_write(void *state, FILE *fstream, const char *data,
+                          uint32_t size)
+{
+    if (fwrite(data, sizeof(char), size, fstream) != size)
+        return -1;
+    return size;
+}
+
+static int64_t none_close(void *state, FILE *fstream)
+{
+    return 0;
+}
+
+// The "zlib" compressor deflates the data at the fastest level, in the gzip
+// format, so that the trace files can be read back through zcat.
+
+#define kZlibOutputSize  (64 * 1024)
+
+typedef struct ZlibState {
+    z_stream    stream;
+    char        output[kZlibOutputSize];
+} ZlibState;
+
+static void *zlib_open(void)
+{
+    ZlibState *zs = calloc(1, sizeof(ZlibState));
+    if (zs == NULL)
+        return NULL;
+    // Window bits above 15 select the gzip format.
+    if (deflateInit2(&zs->stream, Z_BEST_SPEED, Z_DEFLATED, 15 + 16, 8,
+                     Z_DEFAULT_STRATEGY) != Z_OK) {
+        free(zs);
+        return NULL;
+    }
+    return zs;
+}
+
+static int64_t zlib_deflate(ZlibState *zs, FILE *fstream, int flush)
+{
+    int64_t written = 0;
+    do {
+        zs->stream.next_out = (Bytef *)zs->output;
+        zs->stream.avail_out = kZlibOutputSize;
+        if (deflate(&zs->stream, flush) == Z_STREAM_ERROR)
+            return -1;
+        uint32_t size = kZlibOutputSize - zs->stream.avail_out;
+        if (size && fwrite(zs->output, sizeof(char), size, fstream) != size)
+            return -1;
+        written += size;
+    } while (zs->stream.avail_out == 0);
+    return written;
+}
+
+static int64_t zlib_write(void *state, FILE *fstream, const char *data,
+                          uint32_t size)
+{
+    ZlibState *zs = state;
+    zs->stream.next_in = (Bytef *)data;
+    zs->stream.avail_in = size;
+    return zlib_deflate(zs, fstream, Z_NO_FLUSH);
+}
+
+static int64_t zlib_close(void *state, FILE *fstream)
+{
+    ZlibState *zs = state;
+    zs->stream.next_in = NULL;
+    zs->stream.avail_in = 0;
+    int64_t written = zlib_deflate(zs, fstream, Z_FINISH);
+    deflateEnd(&zs->stream);
+    free(zs);
+    return written;
+}
+
+static const TraceCompressor trace_compressors[] = {
+    { "none", "",    none_open, none_write, none_close },
+    { "zlib", ".gz", zlib_open, zlib_write, zlib_close },
+};
+
+static const TraceCompressor *trace_compressor = &trace_compressors[0];
+
+int trace_writer_set_compressor(const char *name)
+{
+    unsigned int ii;
+    for (ii = 0; ii < sizeof(trace_compressors) / sizeof(trace_compressors[0]);
+         ++ii) {
+        if (strcmp(trace_compressors[ii].name, name) == 0) {
+            trace_compressor = &trace_compressors[ii];
+            return 0;
+        }
+    }
+    return -1;
+}
+
+// Compresses and writes a block of data to the file of a writer.
+static void trace_writer_output(TraceWriter *writer, const char *data,
+                                uint32_t size)
+{
+    uint64_t start = now_usecs();
+    errno = 0;
+    int64_t written = writer->compressor->write(writer->state,
+                                                writer->fstream, data, size);
+    if (written < 0) {
+        if (writer->error == 0)
+            writer->error = errno ? errno : EIO;
+    } else {
+        writer->bytes_out += written;
+    }
+    writer->write_usecs += now_usecs() - start;
+}
+
+#if TRACE_WRITER_THREAD
+// A single thread writes the buffers of all the streams, in the order in
+// which they were submitted.
+static QemuMutex    writer_lock;
+static QemuCond     writer_work;
+static QemuThread   writer_thread;
+static int          writer_lock_ready;
+static int          writer_quit;
+static int          num_writers;    // the thread runs while this is > 0
+static TraceWriter  *pending_first;
+static TraceWriter  *pending_last;
+
+static void *trace_writer_thread(void *arg)
+{
+    qemu_mutex_lock(&writer_lock);
+    for (;;) {
+        TraceWriter *writer = pending_first;
+        if (writer == NULL) {
+            if (writer_quit)
+                break;
+            qemu_cond_wait(&writer_work, &writer_lock);
+            continue;
+        }
+        pending_first = writer->next_pending;
+        if (pending_first == NULL)
+            pending_last = NULL;
+        qemu_mutex_unlock(&writer_lock);
+
+        trace_writer_output(writer, writer->pending, writer->pending_size);
+
+        qemu_mutex_lock(&writer_lock);
+        writer->pending = NULL;
+        qemu_cond_signal(&writer->written);
+    }
+    qemu_mutex_unlock(&writer_lock);
+    return NULL;
+}
+#endif
+
+static void trace_writer_free(TraceWriter *writer)
+{
+    free(writer->buffers[0]);
+    free(writer->buffers[1]);
+    free(writer->path);
+    free(writer);
+}
+
+TraceWriter *trace_writer_open(const char *path, char **buffer)
+{
+    const TraceCompressor *compressor = trace_compressor;
+    TraceWriter *writer = calloc(1, sizeof(TraceWriter));
+    if (writer == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    writer->compressor = compressor;
+    writer->path = malloc(strlen(path) + strlen(compressor->suffix) + 1);
+    writer->buffers[0] = malloc(TRACE_WRITER_BUFFER_SIZE);
+#if TRACE_WRITER_THREAD
+    writer->buffers[1] = malloc(TRACE_WRITER_BUFFER_SIZE);
+    if (writer->buffers[1] == NULL) {
+        trace_writer_free(writer);
+        errno = ENOMEM;
+        return NULL;
+    }
+#endif
+    if (writer->path == NULL || writer->buffers[0] == NULL) {
+        trace_writer_free(writer);
+        errno = ENOMEM;
+        return NULL;
+    }
+    strcpy(writer->path, path);
+    strcat(writer->path, compressor->suffix);
+
+    writer->fstream = fopen(writer->path, "wb");
+    if (writer->fstream == NULL) {
+        int error = errno;
+        trace_writer_free(writer);
+        errno = error;
+        return NULL;
+    }
+    writer->state = compressor->open();
+    if (writer->state == NULL) {
+        fclose(writer->fstream);
+        trace_writer_free(writer);
+        errno = ENOMEM;
+        return NULL;
+    }
+
+#if TRACE_WRITER_THREAD
+    if (!writer_lock_ready) {
+        qemu_mutex_init(&writer_lock);
+        qemu_cond_init(&writer_work);
+        writer_lock_ready = 1;
+    }
+    qemu_cond_init(&writer->written);
+    qemu_mutex_lock(&writer_lock);
+    if (num_writers++ == 0) {
+        writer_quit = 0;
+        qemu_thread_create(&writer_thread, trace_writer_thread, NULL);
+    }
+    qemu_mutex_unlock(&writer_lock);
+#endif
+
+    *buffer = writer->buffers[0];
+    return writer;
+}
+
+char *trace_writer_submit(TraceWriter *writer, char *buffer, uint32_t size)
+{
+    char *next = buffer;
+    int error;
+
+    writer->bytes_in += size;
+    writer->num_buffers += 1;
+#if TRACE_WRITER_THREAD
+    if (buffer == writer->buffers[0])
+        next = writer->buffers[1];
+    else
+        next = writer->buffers[0];
+
+    qemu_mutex_lock(&writer_lock);
+    if (writer->pending != NULL) {
+        // The previous buffer is still being written.
+        uint64_t start = now_usecs();
+        while (writer->pending != NULL)
+            qemu_cond_wait(&writer->written, &writer_lock);
+        writer->num_stalls += 1;
+        writer->stall_usecs += now_usecs() - start;
+    }
+    error = writer->error;
+    if (error == 0) {
+        writer->pending = buffer;
+        writer->pending_size = size;
+        writer->next_pending = NULL;
+        if (pending_last)
+            pending_last->next_pending = writer;
+        else
+            pending_first = writer;
+        pending_last = writer;
+        qemu_cond_signal(&writer_work);
+    }
+    qemu_mutex_unlock(&writer_lock);
+#else
+    trace_writer_output(writer, buffer, size);
+    error = writer->error;
+#endif
+
+    // Exiting runs trace_cleanup(), which submits the remaining records of
+    // all the streams again, so only report the failure once.
+    if (error && !writer->failed) {
+        writer->failed = 1;
+        fprintf(stderr, "fwrite() failed\n");
+        errno = error;
+        perror(writer->path);
+        exit(1);
+    }
+    return next;
+}
+
+void trace_writer_close(TraceWriter *writer, const void *tail, uint32_t size)
+{
+#if TRACE_WRITER_THREAD
+    qemu_mutex_lock(&writer_lock);
+    while (writer->pending != NULL)
+        qemu_cond_wait(&writer->written, &writer_lock);
+    int stop = (--num_writers == 0);
+    if (stop) {
+        writer_quit = 1;
+        qemu_cond_signal(&writer_work);
+    }
+    qemu_mutex_unlock(&writer_lock);
+    if (stop)
+        qemu_thread_join(&writer_thread);
+    qemu_cond_destroy(&writer->written);
+#endif
+
+    if (size) {
+        writer->bytes_in += size;
+        trace_writer_output(writer, tail, size);
+    }
+    int64_t written = writer->compressor->close(writer->state,
+                                                writer->fstream);
+    if (written >= 0)
+        writer->bytes_out += written;
+    else if (writer->error == 0)
+        writer->error = EIO;
+    if (fclose(writer->fstream) != 0 && writer->error == 0)
+        writer->error = errno;
+
+    double mbytes_per_sec = 0;
+    if (writer->write_usecs != 0)
+        mbytes_per_sec = (double)writer->bytes_in / writer->write_usecs;
+    printf("%s: %" PRIu64 " bytes, %" PRIu64 " written, %.1f MB/s,"
+           " %" PRIu64 " buffers, %" PRIu64 " stalls (%.3f secs)\n",
+           writer->path, writer->bytes_in, writer->bytes_out, mbytes_per_sec,
+           writer->num_buffers, writer->num_stalls,
+           writer->stall_usecs / 1000000.0);
+    if (writer->error)
+        fprintf(stderr, "%s: %s\n", writer->path, strerror(writer->error));
+
+    trace_writer_free(writer);
+}
@@ -0,0 +1,70 @@
+/* Copyright (C) 2012 The Android Open Source Project
+**
+** This software is licensed under the terms of the GNU General Public
+** License version 2, as published by the Free Software Foundation, and
+** may be copied, distributed, and modified under those terms.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+*/
+
+#ifndef TRACE_WRITER_H
+#define TRACE_WRITER_H
+
+#include <stdio.h>
+#include <inttypes.h>
+
+// A trace writer takes the encoded records of one trace stream (.bb,
+// .insn, .load, ...) off the simulator's hands. Each stream owns two
+// buffers: the simulator fills one of them while the other one is being
+// compressed and written to disk by a background thread. The simulator
+// only has to wait when it fills a buffer before the previous one has
+// been written out, which is counted as a stall.
+//
+// On hosts without qemu-thread, the buffers are written synchronously.
+
+// Size of each of the two buffers of a stream.
+#define TRACE_WRITER_BUFFER_SIZE  (256 * 1024)
+
+typedef struct TraceWriter TraceWriter;
+
+// Compresses the data of a trace stream on its way to the disk.
+typedef struct TraceCompressor {
+    const char  *name;
+    // Appended to the names of the trace files.
+    const char  *suffix;
+    // Returns the compressor state for a new stream, or NULL on error.
+    void        *(*open)(void);
+    // Compresses and writes a block of data, returning the number of bytes
+    // written to the file, or -1 on error.
+    int64_t     (*write)(void *state, FILE *fstream, const char *data,
+                         uint32_t size);
+    // Writes out any pending output and releases the state, returning the
+    // number of bytes written to the file, or -1 on error.
+    int64_t     (*close)(void *state, FILE *fstream);
+} TraceCompressor;
+
+// Selects the compressor used for the trace files created after this call.
+// Returns 0 on success, or -1 if there is no compressor with that name.
+extern int trace_writer_set_compressor(const char *name);
+
+// Creates the file 'path' (plus the suffix of the current compressor) and
+// returns a writer for it, or NULL with errno set on error. '*buffer' is
+// set to the first buffer to fill.
+extern TraceWriter *trace_writer_open(const char *path, char **buffer);
+
+// Hands the first 'size' bytes of the filled 'buffer' over to the writer,
+// and returns the buffer to fill next. Exits the emulator if writing a
+// previous buffer failed.
+extern char *trace_writer_submit(TraceWriter *writer, char *buffer,
+                                 uint32_t size);
+
+// Waits until all the submitted buffers are written, appends 'size' bytes
+// of 'tail' to the file, closes it, prints the stream statistics to stdout
+// and frees the writer.
+extern void trace_writer_close(TraceWriter *writer, const void *tail,
+                               uint32_t size);
+
+#endif /* TRACE_WRITER_H */
@@ -24,16 +24,17 @@
 #include "exec-all.h"
 #include "android-trace.h"
 #include "varint.h"
+#include "trace-writer.h"
 #include "android/utils/path.h"
 
 // For tracing dynamic execution of basic blocks
 typedef struct TraceBB {
     char        *filename;
-    FILE        *fstream;
+    TraceWriter *writer;
     BBRec       buffer[kMaxNumBasicBlocks];
     BBRec       *next;          // points to next record in buffer
     uint64_t    flush_time;     // time of last buffer flush
-    char        compressed[kCompressedSize];
+    char        *compressed;
     char        *compressed_ptr;
     char        *high_water_ptr;
     int64_t     prev_bb_num;
@@ -48,12 +49,12 @@ typedef struct TraceBB {
 // For tracing simuation start times of instructions
 typedef struct TraceInsn {
     char        *filename;
-    FILE        *fstream;
+    TraceWriter *writer;
     InsnRec     dummy;          // this is here so we can use buffer[-1]
     InsnRec     buffer[kInsnBufferSize];
     InsnRec     *current;
     uint64_t    prev_time;      // time of last instruction start
-    char        compressed[kCompressedSize];
+    char        *compressed;
     char        *compressed_ptr;
     char        *high_water_ptr;
 } TraceInsn;
@@ -72,10 +73,10 @@ typedef struct TraceStatic {
 // For tracing load and store addresses
 typedef struct TraceAddr {
     char        *filename;
-    FILE        *fstream;
+    TraceWriter *writer;
     AddrRec     buffer[kMaxNumAddrs];
     AddrRec     *next;
-    char        compressed[kCompressedSize];
+    char        *compressed;
     char        *compressed_ptr;
     char        *high_water_ptr;
     uint32_t    prev_addr;
@@ -85,8 +86,8 @@ typedef struct TraceAddr {
 // For tracing exceptions
 typedef struct TraceExc {
     char        *filename;
-    FILE        *fstream;
-    char        compressed[kCompressedSize];
+    TraceWriter *writer;
+    char        *compressed;
     char        *compressed_ptr;
     char        *high_water_ptr;
     uint64_t    prev_time;
@@ -96,8 +97,8 @@ typedef struct TraceExc {
 // For tracing process id changes
 typedef struct TracePid {
     char        *filename;
-    FILE        *fstream;
-    char        compressed[kCompressedSize];
+    TraceWriter *writer;
+    char        *compressed;
     char        *compressed_ptr;
     uint64_t    prev_time;
 } TracePid;
@@ -105,8 +106,8 @@ typedef struct TracePid {
 // For tracing Dalvik VM method enter and exit
 typedef struct TraceMethod {
     char        *filename;
-    FILE        *fstream;
-    char        compressed[kCompressedSize];
+    TraceWriter *writer;
+    char        *compressed;
     char        *compressed_ptr;
     uint64_t    prev_time;
     uint32_t    prev_addr;
@@ -340,16 +341,15 @@ void create_trace_bb(const char *filename)
     char *fname = create_trace_path(filename, ".bb");
     trace_bb.filename = fname;
 
-    FILE *fstream = fopen(fname, "wb");
-    if (fstream == NULL) {
+    trace_bb.writer = trace_writer_open(fname, &trace_bb.compressed);
+    if (trace_bb.writer == NULL) {
         perror(fname);
         exit(1);
     }
-    trace_bb.fstream = fstream;
     trace_bb.next = &trace_bb.buffer[0];
     trace_bb.flush_time = 0;
     trace_bb.compressed_ptr = trace_bb.compressed;
-    trace_bb.high_water_ptr = &trace_bb.compressed[kCompressedSize] - kMaxBBCompressed;
+    trace_bb.high_water_ptr = &trace_bb.compressed[TRACE_WRITER_BUFFER_SIZE] - kMaxBBCompressed;
     trace_bb.prev_bb_num = 0;
     trace_bb.prev_bb_time = 0;
     trace_bb.num_insns = 0;
@@ -362,18 +362,17 @@ void create_trace_insn(const char *filename)
     char *fname = create_trace_path(filename, ".insn");
     trace_insn.filename = fname;
 
-    FILE *fstream = fopen(fname, "wb");
-    if (fstream == NULL) {
+    trace_insn.writer = trace_writer_open(fname, &trace_insn.compressed);
+    if (trace_insn.writer == NULL) {
         perror(fname);
         exit(1);
     }
-    trace_insn.fstream = fstream;
     trace_insn.current = &trace_insn.dummy;
     trace_insn.dummy.time_diff = 0;
     trace_insn.dummy.repeat = 0;
     trace_insn.prev_time = 0;
     trace_insn.compressed_ptr = trace_insn.compressed;
-    trace_insn.high_water_ptr = &trace_insn.compressed[kCompressedSize] - kMaxInsnCompressed;
+    trace_insn.high_water_ptr = &trace_insn.compressed[TRACE_WRITER_BUFFER_SIZE] - kMaxInsnCompressed;
 }
 
 void create_trace_static(const char *filename)
@@ -420,22 +419,21 @@ void create_trace_static(const char *filename)
 void create_trace_addr(const char *filename)
 {
     // The "qtrace.load" and "qtrace.store" files are optional
-    trace_load.fstream = NULL;
-    trace_store.fstream = NULL;
+    trace_load.writer = NULL;
+    trace_store.writer = NULL;
     if (trace_all_addr || trace_cache_miss) {
         // Create the "qtrace.load" file
         char *fname = create_trace_path(filename, ".load");
         trace_load.filename = fname;
 
-        FILE *fstream = fopen(fname, "wb");
-        if (fstream == NULL) {
+        trace_load.writer = trace_writer_open(fname, &trace_load.compressed);
+        if (trace_load.writer == NULL) {
             perror(fname);
             exit(1);
         }
-        trace_load.fstream = fstream;
         trace_load.next = &trace_load.buffer[0];
         trace_load.compressed_ptr = trace_load.compressed;
-        trace_load.high_water_ptr = &trace_load.compressed[kCompressedSize] - kMaxAddrCompressed;
+        trace_load.high_water_ptr = &trace_load.compressed[TRACE_WRITER_BUFFER_SIZE] - kMaxAddrCompressed;
         trace_load.prev_addr = 0;
         trace_load.prev_time = 0;
 
@@ -443,15 +441,14 @@ void create_trace_addr(const char *filename)
         fname = create_trace_path(filename, ".store");
         trace_store.filename = fname;
 
-        fstream = fopen(fname, "wb");
-        if (fstream == NULL) {
+        trace_store.writer = trace_writer_open(fname, &trace_store.compressed);
+        if (trace_store.writer == NULL) {
             perror(fname);
             exit(1);
         }
-        trace_store.fstream = fstream;
         trace_store.next = &trace_store.buffer[0];
         trace_store.compressed_ptr = trace_store.compressed;
-        trace_store.high_water_ptr = &trace_store.compressed[kCompressedSize] - kMaxAddrCompressed;
+        trace_store.high_water_ptr = &trace_store.compressed[TRACE_WRITER_BUFFER_SIZE] - kMaxAddrCompressed;
         trace_store.prev_addr = 0;
         trace_store.prev_time = 0;
     }
@@ -463,14 +460,13 @@ void create_trace_exc(const char *filename)
     char *fname = create_trace_path(filename, ".exc");
     trace_exc.filename = fname;
 
-    FILE *fstream = fopen(fname, "wb");
-    if (fstream == NULL) {
+    trace_exc.writer = trace_writer_open(fname, &trace_exc.compressed);
+    if (trace_exc.writer == NULL) {
         perror(fname);
         exit(1);
     }
-    trace_exc.fstream = fstream;
     trace_exc.compressed_ptr = trace_exc.compressed;
-    trace_exc.high_water_ptr = &trace_exc.compressed[kCompressedSize] - kMaxExcCompressed;
+    trace_exc.high_water_ptr = &trace_exc.compressed[TRACE_WRITER_BUFFER_SIZE] - kMaxExcCompressed;
     trace_exc.prev_time = 0;
     trace_exc.prev_bb_recnum = 0;
 }
@@ -481,12 +477,11 @@ void create_trace_pid(const char *filename)
     char *fname = create_trace_path(filename, ".pid");
     trace_pid.filename = fname;
 
-    FILE *fstream = fopen(fname, "wb");
-    if (fstream == NULL) {
+    trace_pid.writer = trace_writer_open(fname, &trace_pid.compressed);
+    if (trace_pid.writer == NULL) {
         perror(fname);
         exit(1);
     }
-    trace_pid.fstream = fstream;
     trace_pid.compressed_ptr = trace_pid.compressed;
     trace_pid.prev_time = 0;
 }
@@ -497,12 +492,11 @@ void create_trace_method(const char *filename)
     char *fname = create_trace_path(filename, ".method");
     trace_method.filename = fname;
 
-    FILE *fstream = fopen(fname, "wb");
-    if (fstream == NULL) {
+    trace_method.writer = trace_writer_open(fname, &trace_method.compressed);
+    if (trace_method.writer == NULL) {
         perror(fname);
         exit(1);
     }
-    trace_method.fstream = fstream;
     trace_method.compressed_ptr = trace_method.compressed;
     trace_method.prev_time = 0;
     trace_method.prev_addr = 0;
@@ -639,7 +633,7 @@ void trace_cleanup()
     }
     printf("Elapsed seconds: %.2f, simulated cycles/sec: %.1f%s\n",
            elapsed_secs, cycles_per_sec, suffix);
-    if (trace_bb.fstream) {
+    if (trace_bb.writer) {
         BBRec *ptr;
         BBRec *next = trace_bb.next;
         char *comp_ptr = trace_bb.compressed_ptr;
@@ -648,8 +642,10 @@ void trace_cleanup()
         for (ptr = trace_bb.buffer; ptr != next; ++ptr) {
             if (comp_ptr >= trace_bb.high_water_ptr) {
                 uint32_t size = comp_ptr - trace_bb.compressed;
-                fwrite(trace_bb.compressed, sizeof(char), size,
-                       trace_bb.fstream);
+                trace_bb.compressed = trace_writer_submit(trace_bb.writer,
+                                                          trace_bb.compressed, size);
+                trace_bb.high_water_ptr =
+                    &trace_bb.compressed[TRACE_WRITER_BUFFER_SIZE] - kMaxBBCompressed;
                 comp_ptr = trace_bb.compressed;
             }
             int64_t bb_diff = ptr->bb_num - prev_bb_num;
@@ -675,29 +671,25 @@ void trace_cleanup()
 
         uint32_t size = comp_ptr - trace_bb.compressed;
         if (size)
-            fwrite(trace_bb.compressed, sizeof(char), size, trace_bb.fstream);
+            trace_writer_submit(trace_bb.writer, trace_bb.compressed, size);
 
         // Terminate the file with three zeros so that we can detect
         // the end of file quickly.
         uint32_t zeros = 0;
-        fwrite(&zeros, 3, 1, trace_bb.fstream);
-        fclose(trace_bb.fstream);
+        trace_writer_close(trace_bb.writer, &zeros, 3);
     }
 
-    if (trace_insn.fstream) {
+    if (trace_insn.writer) {
         InsnRec *ptr;
         InsnRec *current = trace_insn.current + 1;
         char *comp_ptr = trace_insn.compressed_ptr;
         for (ptr = trace_insn.buffer; ptr != current; ++ptr) {
             if (comp_ptr >= trace_insn.high_water_ptr) {
                 uint32_t size = comp_ptr - trace_insn.compressed;
-                uint32_t rval = fwrite(trace_insn.compressed, sizeof(char),
-                                       size, trace_insn.fstream);
-                if (rval != size) {
-                    fprintf(stderr, "fwrite() failed\n");
-                    perror(trace_insn.filename);
-                    exit(1);
-                }
+                trace_insn.compressed = trace_writer_submit(trace_insn.writer,
+                                                            trace_insn.compressed, size);
+                trace_insn.high_water_ptr =
+                    &trace_insn.compressed[TRACE_WRITER_BUFFER_SIZE] - kMaxInsnCompressed;
                 comp_ptr = trace_insn.compressed;
             }
             comp_ptr = varint_encode(ptr->time_diff, comp_ptr);
@@ -705,16 +697,9 @@ void trace_cleanup()
         }
 
         uint32_t size = comp_ptr - trace_insn.compressed;
-        if (size) {
-            uint32_t rval = fwrite(trace_insn.compressed, sizeof(char), size,
-                                   trace_insn.fstream);
-            if (rval != size) {
-                fprintf(stderr, "fwrite() failed\n");
-                perror(trace_insn.filename);
-                exit(1);
-            }
-        }
-        fclose(trace_insn.fstream);
+        if (size)
+            trace_writer_submit(trace_insn.writer, trace_insn.compressed, size);
+        trace_writer_close(trace_insn.writer, NULL, 0);
     }
 
     if (trace_static.fstream) {
@@ -723,7 +708,7 @@ void trace_cleanup()
         fclose(trace_static.fstream);
     }
 
-    if (trace_load.fstream) {
+    if (trace_load.writer) {
         AddrRec *ptr;
         char *comp_ptr = trace_load.compressed_ptr;
         AddrRec *next = trace_load.next;
@@ -732,8 +717,10 @@ void trace_cleanup()
         for (ptr = trace_load.buffer; ptr != next; ++ptr) {
             if (comp_ptr >= trace_load.high_water_ptr) {
                 uint32_t size = comp_ptr - trace_load.compressed;
-                fwrite(trace_load.compressed, sizeof(char), size,
-                       trace_load.fstream);
+                trace_load.compressed = trace_writer_submit(trace_load.writer,
+                                                            trace_load.compressed, size);
+                trace_load.high_water_ptr =
+                    &trace_load.compressed[TRACE_WRITER_BUFFER_SIZE] - kMaxAddrCompressed;
                 comp_ptr = trace_load.compressed;
             }
 
@@ -747,19 +734,16 @@ void trace_cleanup()
         }
 
         uint32_t size = comp_ptr - trace_load.compressed;
-        if (size) {
-            fwrite(trace_load.compressed, sizeof(char), size,
-                   trace_load.fstream);
-        }
+        if (size)
+            trace_writer_submit(trace_load.writer, trace_load.compressed, size);
 
         // Terminate the file with two zeros so that we can detect
         // the end of file quickly.
         uint32_t zeros = 0;
-        fwrite(&zeros, 2, 1, trace_load.fstream);
-        fclose(trace_load.fstream);
+        trace_writer_close(trace_load.writer, &zeros, 2);
     }
 
-    if (trace_store.fstream) {
+    if (trace_store.writer) {
         AddrRec *ptr;
         char *comp_ptr = trace_store.compressed_ptr;
         AddrRec *next = trace_store.next;
@@ -768,8 +752,10 @@ void trace_cleanup()
         for (ptr = trace_store.buffer; ptr != next; ++ptr) {
             if (comp_ptr >= trace_store.high_water_ptr) {
                 uint32_t size = comp_ptr - trace_store.compressed;
-                fwrite(trace_store.compressed, sizeof(char), size,
-                       trace_store.fstream);
+                trace_store.compressed = trace_writer_submit(trace_store.writer,
+                                                             trace_store.compressed, size);
+                trace_store.high_water_ptr =
+                    &trace_store.compressed[TRACE_WRITER_BUFFER_SIZE] - kMaxAddrCompressed;
                 comp_ptr = trace_store.compressed;
             }
 
@@ -783,56 +769,44 @@ void trace_cleanup()
         }
 
         uint32_t size = comp_ptr - trace_store.compressed;
-        if (size) {
-            fwrite(trace_store.compressed, sizeof(char), size,
-                   trace_store.fstream);
-        }
+        if (size)
+            trace_writer_submit(trace_store.writer, trace_store.compressed, size);
 
         // Terminate the file with two zeros so that we can detect
         // the end of file quickly.
         uint32_t zeros = 0;
-        fwrite(&zeros, 2, 1, trace_store.fstream);
-        fclose(trace_store.fstream);
+        trace_writer_close(trace_store.writer, &zeros, 2);
     }
 
-    if (trace_exc.fstream) {
+    if (trace_exc.writer) {
         uint32_t size = trace_exc.compressed_ptr - trace_exc.compressed;
-        if (size) {
-            fwrite(trace_exc.compressed, sizeof(char), size,
-                   trace_exc.fstream);
-        }
+        if (size)
+            trace_writer_submit(trace_exc.writer, trace_exc.compressed, size);
 
         // Terminate the file with 7 zeros so that we can detect
         // the end of file quickly.
         uint64_t zeros = 0;
-        fwrite(&zeros, 7, 1, trace_exc.fstream);
-        fclose(trace_exc.fstream);
+        trace_writer_close(trace_exc.writer, &zeros, 7);
     }
-    if (trace_pid.fstream) {
+    if (trace_pid.writer) {
         uint32_t size = trace_pid.compressed_ptr - trace_pid.compressed;
-        if (size) {
-            fwrite(trace_pid.compressed, sizeof(char), size,
-                   trace_pid.fstream);
-        }
+        if (size)
+            trace_writer_submit(trace_pid.writer, trace_pid.compressed, size);
 
         // Terminate the file with 2 zeros so that we can detect
         // the end of file quickly.
         uint64_t zeros = 0;
-        fwrite(&zeros, 2, 1, trace_pid.fstream);
-        fclose(trace_pid.fstream);
+        trace_writer_close(trace_pid.writer, &zeros, 2);
     }
-    if (trace_method.fstream) {
+    if (trace_method.writer) {
         uint32_t size = trace_method.compressed_ptr - trace_method.compressed;
-        if (size) {
-            fwrite(trace_method.compressed, sizeof(char), size,
-                   trace_method.fstream);
-        }
+        if (size)
+            trace_writer_submit(trace_method.writer, trace_method.compressed, size);
 
         // Terminate the file with 2 zeros so that we can detect
         // the end of file quickly.
         uint64_t zeros = 0;
-        fwrite(&zeros, 2, 1, trace_method.fstream);
-        fclose(trace_method.fstream);
+        trace_writer_close(trace_method.writer, &zeros, 2);
     }
     if (ftrace_debug)
         fclose(ftrace_debug);
@@ -1476,7 +1450,7 @@ int  get_insn_ticks_thumb(uint32_t  insn)
 // Adds an exception trace record.
 void trace_exception(uint32 target_pc)
 {
-    if (trace_exc.fstream == NULL)
+    if (trace_exc.writer == NULL)
         return;
 
     // Sometimes we get an unexpected exception as the first record.  If the
@@ -1496,7 +1470,10 @@ void trace_exception(uint32 target_pc)
     char *comp_ptr = trace_exc.compressed_ptr;
     if (comp_ptr >= trace_exc.high_water_ptr) {
         uint32_t size = comp_ptr - trace_exc.compressed;
-        fwrite(trace_exc.compressed, sizeof(char), size, trace_exc.fstream);
+        trace_exc.compressed = trace_writer_submit(trace_exc.writer,
+                                                   trace_exc.compressed, size);
+        trace_exc.high_water_ptr =
+            &trace_exc.compressed[TRACE_WRITER_BUFFER_SIZE] - kMaxExcCompressed;
         comp_ptr = trace_exc.compressed;
     }
     uint64_t time_diff = sim_time - trace_exc.prev_time;
@@ -1515,13 +1492,14 @@ void trace_exception(uint32 target_pc)
 
 void trace_pid_1arg(int pid, int rec_type)
 {
-    if (trace_pid.fstream == NULL)
+    if (trace_pid.writer == NULL)
         return;
     char *comp_ptr = trace_pid.compressed_ptr;
     char *max_end_ptr = comp_ptr + kMaxPidCompressed;
-    if (max_end_ptr >= &trace_pid.compressed[kCompressedSize]) {
+    if (max_end_ptr >= &trace_pid.compressed[TRACE_WRITER_BUFFER_SIZE]) {
         uint32_t size = comp_ptr - trace_pid.compressed;
-        fwrite(trace_pid.compressed, sizeof(char), size, trace_pid.fstream);
+        trace_pid.compressed = trace_writer_submit(trace_pid.writer,
+                                                   trace_pid.compressed, size);
         comp_ptr = trace_pid.compressed;
     }
     uint64_t time_diff = sim_time - trace_pid.prev_time;
@@ -1534,13 +1512,14 @@ void trace_pid_1arg(int pid, int rec_type)
 
 void trace_pid_2arg(int tgid, int pid, int rec_type)
 {
-    if (trace_pid.fstream == NULL)
+    if (trace_pid.writer == NULL)
         return;
     char *comp_ptr = trace_pid.compressed_ptr;
     char *max_end_ptr = comp_ptr + kMaxPid2Compressed;
-    if (max_end_ptr >= &trace_pid.compressed[kCompressedSize]) {
+    if (max_end_ptr >= &trace_pid.compressed[TRACE_WRITER_BUFFER_SIZE]) {
         uint32_t size = comp_ptr - trace_pid.compressed;
-        fwrite(trace_pid.compressed, sizeof(char), size, trace_pid.fstream);
+        trace_pid.compressed = trace_writer_submit(trace_pid.writer,
+                                                   trace_pid.compressed, size);
         comp_ptr = trace_pid.compressed;
     }
     uint64_t time_diff = sim_time - trace_pid.prev_time;
@@ -1555,7 +1534,7 @@ void trace_pid_2arg(int tgid, int pid, int rec_type)
 void trace_switch(int pid)
 {
 #if 0
-    if (ftrace_debug && trace_pid.fstream)
+    if (ftrace_debug && trace_pid.writer)
         fprintf(ftrace_debug, "t%lld switch %d\n", sim_time, pid);
 #endif
     trace_pid_1arg(pid, kPidSwitch);
@@ -1565,7 +1544,7 @@ void trace_switch(int pid)
 void trace_fork(int tgid, int pid)
 {
 #if 0
-    if (ftrace_debug && trace_pid.fstream)
+    if (ftrace_debug && trace_pid.writer)
         fprintf(ftrace_debug, "t%lld fork %d\n", sim_time, pid);
 #endif
     trace_pid_2arg(tgid, pid, kPidFork);
@@ -1574,7 +1553,7 @@ void trace_fork(int tgid, int pid)
 void trace_clone(int tgid, int pid)
 {
 #if 0
-    if (ftrace_debug && trace_pid.fstream)
+    if (ftrace_debug && trace_pid.writer)
         fprintf(ftrace_debug, "t%lld clone %d\n", sim_time, pid);
 #endif
     trace_pid_2arg(tgid, pid, kPidClone);
@@ -1583,7 +1562,7 @@ void trace_clone(int tgid, int pid)
 void trace_exit(int exitcode)
 {
 #if 0
-    if (ftrace_debug && trace_pid.fstream)
+    if (ftrace_debug && trace_pid.writer)
         fprintf(ftrace_debug, "t%lld exit %d\n", sim_time, exitcode);
 #endif
     trace_pid_1arg(exitcode, kPidExit);
@@ -1592,19 +1571,20 @@ void trace_exit(int exitcode)
 void trace_name(char *name)
 {
 #if 0
-    if (ftrace_debug && trace_pid.fstream) {
+    if (ftrace_debug && trace_pid.writer) {
         fprintf(ftrace_debug, "t%lld pid %d name %s\n",
                 sim_time, current_pid, name);
     }
 #endif
-    if (trace_pid.fstream == NULL)
+    if (trace_pid.writer == NULL)
         return;
     int len = strlen(name);
     char *comp_ptr = trace_pid.compressed_ptr;
     char *max_end_ptr = comp_ptr + len + kMaxNameCompressed;
-    if (max_end_ptr >= &trace_pid.compressed[kCompressedSize]) {
+    if (max_end_ptr >= &trace_pid.compressed[TRACE_WRITER_BUFFER_SIZE]) {
         uint32_t size = comp_ptr - trace_pid.compressed;
-        fwrite(trace_pid.compressed, sizeof(char), size, trace_pid.fstream);
+        trace_pid.compressed = trace_writer_submit(trace_pid.writer,
+                                                   trace_pid.compressed, size);
         comp_ptr = trace_pid.compressed;
     }
     uint64_t time_diff = sim_time - trace_pid.prev_time;
@@ -1623,7 +1603,7 @@ void trace_execve(const char *argv, int len)
 {
     int ii;
 
-    if (trace_pid.fstream == NULL)
+    if (trace_pid.writer == NULL)
         return;
     // Count the number of args
     int alen = 0;
@@ -1652,9 +1632,10 @@ void trace_execve(const char *argv, int len)
 
     char *comp_ptr = trace_pid.compressed_ptr;
     char *max_end_ptr = comp_ptr + len + 5 * argc + kMaxExecArgsCompressed;
-    if (max_end_ptr >= &trace_pid.compressed[kCompressedSize]) {
+    if (max_end_ptr >= &trace_pid.compressed[TRACE_WRITER_BUFFER_SIZE]) {
         uint32_t size = comp_ptr - trace_pid.compressed;
-        fwrite(trace_pid.compressed, sizeof(char), size, trace_pid.fstream);
+        trace_pid.compressed = trace_writer_submit(trace_pid.writer,
+                                                   trace_pid.compressed, size);
         comp_ptr = trace_pid.compressed;
     }
     uint64_t time_diff = sim_time - trace_pid.prev_time;
@@ -1678,7 +1659,7 @@ void trace_execve(const char *argv, int len)
 void trace_mmap(unsigned long vstart, unsigned long vend,
                 unsigned long offset, const char *path)
 {
-    if (trace_pid.fstream == NULL)
+    if (trace_pid.writer == NULL)
         return;
 #if 0
     if (ftrace_debug)
@@ -1688,9 +1669,10 @@ void trace_mmap(unsigned long vstart, unsigned long vend,
     int len = strlen(path);
     char *comp_ptr = trace_pid.compressed_ptr;
     char *max_end_ptr = comp_ptr + len + kMaxMmapCompressed;
-    if (max_end_ptr >= &trace_pid.compressed[kCompressedSize]) {
+    if (max_end_ptr >= &trace_pid.compressed[TRACE_WRITER_BUFFER_SIZE]) {
         uint32_t size = comp_ptr - trace_pid.compressed;
-        fwrite(trace_pid.compressed, sizeof(char), size, trace_pid.fstream);
+        trace_pid.compressed = trace_writer_submit(trace_pid.writer,
+                                                   trace_pid.compressed, size);
         comp_ptr = trace_pid.compressed;
     }
     uint64_t time_diff = sim_time - trace_pid.prev_time;
@@ -1708,7 +1690,7 @@ void trace_mmap(unsigned long vstart, unsigned long vend,
 
 void trace_munmap(unsigned long vstart, unsigned long vend)
 {
-    if (trace_pid.fstream == NULL)
+    if (trace_pid.writer == NULL)
         return;
 #if 0
     if (ftrace_debug)
@@ -1717,9 +1699,10 @@ void trace_munmap(unsigned long vstart, unsigned long vend)
 #endif
     char *comp_ptr = trace_pid.compressed_ptr;
     char *max_end_ptr = comp_ptr + kMaxMunmapCompressed;
-    if (max_end_ptr >= &trace_pid.compressed[kCompressedSize]) {
+    if (max_end_ptr >= &trace_pid.compressed[TRACE_WRITER_BUFFER_SIZE]) {
         uint32_t size = comp_ptr - trace_pid.compressed;
-        fwrite(trace_pid.compressed, sizeof(char), size, trace_pid.fstream);
+        trace_pid.compressed = trace_writer_submit(trace_pid.writer,
+                                                   trace_pid.compressed, size);
         comp_ptr = trace_pid.compressed;
     }
     uint64_t time_diff = sim_time - trace_pid.prev_time;
@@ -1734,7 +1717,7 @@ void trace_munmap(unsigned long vstart, unsigned long vend)
 
 void trace_dynamic_symbol_add(unsigned long vaddr, const char *name)
 {
-    if (trace_pid.fstream == NULL)
+    if (trace_pid.writer == NULL)
         return;
 #if 0
     if (ftrace_debug)
@@ -1743,9 +1726,10 @@ void trace_dynamic_symbol_add(unsigned long vaddr, const char *name)
     int len = strlen(name);
     char *comp_ptr = trace_pid.compressed_ptr;
     char *max_end_ptr = comp_ptr + len + kMaxSymbolCompressed;
-    if (max_end_ptr >= &trace_pid.compressed[kCompressedSize]) {
+    if (max_end_ptr >= &trace_pid.compressed[TRACE_WRITER_BUFFER_SIZE]) {
         uint32_t size = comp_ptr - trace_pid.compressed;
-        fwrite(trace_pid.compressed, sizeof(char), size, trace_pid.fstream);
+        trace_pid.compressed = trace_writer_submit(trace_pid.writer,
+                                                   trace_pid.compressed, size);
         comp_ptr = trace_pid.compressed;
     }
     uint64_t time_diff = sim_time - trace_pid.prev_time;
@@ -1761,7 +1745,7 @@ void trace_dynamic_symbol_add(unsigned long vaddr, const char *name)
 
 void trace_dynamic_symbol_remove(unsigned long vaddr)
 {
-    if (trace_pid.fstream == NULL)
+    if (trace_pid.writer == NULL)
         return;
 #if 0
     if (ftrace_debug)
@@ -1769,9 +1753,10 @@ void trace_dynamic_symbol_remove(unsigned long vaddr)
 #endif
     char *comp_ptr = trace_pid.compressed_ptr;
     char *max_end_ptr = comp_ptr + kMaxSymbolCompressed;
-    if (max_end_ptr >= &trace_pid.compressed[kCompressedSize]) {
+    if (max_end_ptr >= &trace_pid.compressed[TRACE_WRITER_BUFFER_SIZE]) {
         uint32_t size = comp_ptr - trace_pid.compressed;
-        fwrite(trace_pid.compressed, sizeof(char), size, trace_pid.fstream);
+        trace_pid.compressed = trace_writer_submit(trace_pid.writer,
+                                                   trace_pid.compressed, size);
         comp_ptr = trace_pid.compressed;
     }
     uint64_t time_diff = sim_time - trace_pid.prev_time;
@@ -1785,7 +1770,7 @@ void trace_dynamic_symbol_remove(unsigned long vaddr)
 
 void trace_init_name(int tgid, int pid, const char *name)
 {
-    if (trace_pid.fstream == NULL)
+    if (trace_pid.writer == NULL)
         return;
 #if 0
     if (ftrace_debug)
@@ -1794,9 +1779,10 @@ void trace_init_name(int tgid, int pid, const char *name)
     int len = strlen(name);
     char *comp_ptr = trace_pid.compressed_ptr;
     char *max_end_ptr = comp_ptr + len + kMaxKthreadNameCompressed;
-    if (max_end_ptr >= &trace_pid.compressed[kCompressedSize]) {
+    if (max_end_ptr >= &trace_pid.compressed[TRACE_WRITER_BUFFER_SIZE]) {
         uint32_t size = comp_ptr - trace_pid.compressed;
-        fwrite(trace_pid.compressed, sizeof(char), size, trace_pid.fstream);
+        trace_pid.compressed = trace_writer_submit(trace_pid.writer,
+                                                   trace_pid.compressed, size);
         comp_ptr = trace_pid.compressed;
     }
     uint64_t time_diff = sim_time - trace_pid.prev_time;
@@ -1855,7 +1841,10 @@ void trace_bb_helper(uint64_t bb_num, TranslationBlock *tb)
         for (ptr = trace_bb.buffer; ptr != next; ++ptr) {
             if (comp_ptr >= trace_bb.high_water_ptr) {
                 uint32_t size = comp_ptr - trace_bb.compressed;
-                fwrite(trace_bb.compressed, sizeof(char), size, trace_bb.fstream);
+                trace_bb.compressed = trace_writer_submit(trace_bb.writer,
+                                                          trace_bb.compressed, size);
+                trace_bb.high_water_ptr =
+                    &trace_bb.compressed[TRACE_WRITER_BUFFER_SIZE] - kMaxBBCompressed;
                 comp_ptr = trace_bb.compressed;
             }
             int64_t bb_diff = ptr->bb_num - prev_bb_num;
@@ -1920,13 +1909,10 @@ void trace_insn_helper()
         for (ptr = trace_insn.buffer; ptr != current; ++ptr) {
             if (comp_ptr >= trace_insn.high_water_ptr) {
                 uint32_t size = comp_ptr - trace_insn.compressed;
-                uint32_t rval = fwrite(trace_insn.compressed, sizeof(char),
-                                       size, trace_insn.fstream);
-                if (rval != size) {
-                    fprintf(stderr, "fwrite() failed\n");
-                    perror(trace_insn.filename);
-                    exit(1);
-                }
+                trace_insn.compressed = trace_writer_submit(trace_insn.writer,
+                                                            trace_insn.compressed, size);
+                trace_insn.high_water_ptr =
+                    &trace_insn.compressed[TRACE_WRITER_BUFFER_SIZE] - kMaxInsnCompressed;
                 comp_ptr = trace_insn.compressed;
             }
             comp_ptr = varint_encode(ptr->time_diff, comp_ptr);
@@ -1946,7 +1932,7 @@ void trace_insn_helper()
 // of the core virtual machine interpreter.
 void trace_interpreted_method(uint32_t addr, int call_type)
 {
-    if (trace_method.fstream == NULL)
+    if (trace_method.writer == NULL)
         return;
 #if 0
     fprintf(stderr, "trace_method time: %llu p%d 0x%x %d\n",
@@ -1954,9 +1940,10 @@ void trace_interpreted_method(uint32_t addr, int call_type)
 #endif
     char *comp_ptr = trace_method.compressed_ptr;
     char *max_end_ptr = comp_ptr + kMaxMethodCompressed;
-    if (max_end_ptr >= &trace_method.compressed[kCompressedSize]) {
+    if (max_end_ptr >= &trace_method.compressed[TRACE_WRITER_BUFFER_SIZE]) {
         uint32_t size = comp_ptr - trace_method.compressed;
-        fwrite(trace_method.compressed, sizeof(char), size, trace_method.fstream);
+        trace_method.compressed = trace_writer_submit(trace_method.writer,
+                                                      trace_method.compressed, size);
         comp_ptr = trace_method.compressed;
     }
     uint64_t time_diff = sim_time - trace_method.prev_time;
@@ -232,6 +232,7 @@ extern void  android_emulator_set_base_port(int  port);
 
 #ifdef CONFIG_TRACE
 #include "android-trace.h"
+#include "trace-writer.h"
 #endif
 
 #include "qemu_socket.h"
@@ -2741,6 +2742,25 @@ int main(int argc, char **argv, char **envp)
             case QEMU_OPTION_snapshot:
                 snapshot = 1;
                 break;
+            case QEMU_OPTION_qcow2_cache:
+                {
+                    char buf[16];
+                    int l2 = 0, refcount = 0;
+                    int writethrough = 0;
+
+                    if (get_param_value(buf, sizeof(buf), "l2", optarg)) {
+                        l2 = strtol(buf, NULL, 0);
+                    }
+                    if (get_param_value(buf, sizeof(buf), "refcount", optarg)) {
+                        refcount = strtol(buf, NULL, 0);
+                    }
+                    if (get_param_value(buf, sizeof(buf), "writethrough",
+                                        optarg)) {
+                        writethrough = !strcmp(buf, "on");
+                    }
+                    qcow2_set_cache_options(l2, refcount, writethrough);
+                }
+                break;
             case QEMU_OPTION_hdachs:
                 {
                     const char *p;
@@ -3335,6 +3355,12 @@ int main(int argc, char **argv, char **envp)
                 trace_filename = optarg;
                 tracing = 1;
                 break;
+            case QEMU_OPTION_trace_compress:
+                if (trace_writer_set_compressor(optarg) < 0) {
+                    PANIC("Unexpected option to -trace-compress ('%s')",
+                            optarg);
+                }
+                break;
 #if 0
             case QEMU_OPTION_trace_miss:
                 trace_cache_miss = 1;